@@ -0,0 +1,260 @@
+#include "asset_watcher.h"
+#include "assimp_model_loading.h"
+#include <algorithm>
+#include <chrono>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+//"" for the files in the working directory
+static std::string DirectoryOf(const std::string& filepath)
+{
+	size_t slash = filepath.find_last_of("/\\");
+	return slash == std::string::npos ? std::string() : filepath.substr(0, slash);
+}
+
+static void QueueAssetChange(AssetWatcher& watcher, const std::string& filepath)
+{
+	std::lock_guard<std::mutex> lock(watcher.mutex);
+	watcher.changes.push_back(AssetChange{ filepath, GetPlatformTime() });
+}
+
+//false while the list is the one the thread already has
+static bool CopyWatchedFiles(AssetWatcher& watcher, std::vector<std::string>& files, u32& version)
+{
+	std::lock_guard<std::mutex> lock(watcher.mutex);
+	if (watcher.watchedVersion == version)
+		return false;
+
+	files = watcher.watchedFiles;
+	version = watcher.watchedVersion;
+	return true;
+}
+
+static void WatchFilesPolling(AssetWatcher* watcher)
+{
+	std::vector<std::string> files;
+	std::unordered_map<std::string, u64> timestamps;
+	u32 version = UINT32_MAX;
+
+	while (watcher->running)
+	{
+		CopyWatchedFiles(*watcher, files, version);
+
+		for (u32 i = 0; i < files.size(); ++i)
+		{
+			//0 while an editor has the file replaced halfway, it is seen on the next pass
+			u64 timestamp = GetFileLastWriteTimestamp(files[i].c_str());
+			auto known = timestamps.find(files[i]);
+			if (known == timestamps.end())
+			{
+				timestamps[files[i]] = timestamp;
+			}
+			else if (timestamp != known->second && timestamp != 0)
+			{
+				known->second = timestamp;
+				QueueAssetChange(*watcher, files[i]);
+			}
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(ASSET_WATCHER_POLL_MS));
+	}
+}
+
+#ifdef __linux__
+static void WatchFilesInotify(AssetWatcher* watcher, int fd)
+{
+	std::unordered_map<int, std::string> directories; // watch descriptor -> directory of the files
+	std::vector<std::string> files;
+	u32 version = UINT32_MAX;
+	alignas(inotify_event) char events[4096];
+
+	while (watcher->running)
+	{
+		if (CopyWatchedFiles(*watcher, files, version))
+		{
+			//the directories are watched, editors that save through a rename only show up as a move into them.
+			//Adding one again returns the same descriptor
+			for (u32 i = 0; i < files.size(); ++i)
+			{
+				std::string directory = DirectoryOf(files[i]);
+				int wd = inotify_add_watch(fd, directory.empty() ? "." : directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+				if (wd >= 0)
+					directories[wd] = directory;
+			}
+		}
+
+		//waits with a timeout so a stop request is seen
+		pollfd descriptor = { fd, POLLIN, 0 };
+		if (poll(&descriptor, 1, ASSET_WATCHER_POLL_MS) <= 0)
+			continue;
+
+		ssize_t length = read(fd, events, sizeof(events));
+		for (ssize_t offset = 0; offset < length; )
+		{
+			const inotify_event* event = (const inotify_event*)(events + offset);
+			offset += sizeof(inotify_event) + event->len;
+
+			auto directory = directories.find(event->wd);
+			if (event->len == 0 || directory == directories.end())
+				continue;
+
+			std::string filepath = directory->second.empty() ? std::string(event->name) : directory->second + "/" + event->name;
+			if (std::find(files.begin(), files.end(), filepath) != files.end())
+				QueueAssetChange(*watcher, filepath);
+		}
+	}
+
+	close(fd);
+}
+#endif
+
+//the files of every loaded program, texture and mesh, built again when any of those arrays grows
+static void UpdateWatchedFiles(App* app)
+{
+	AssetWatcher& watcher = app->assetWatcher;
+	if (watcher.watchedPrograms == app->programs.size() && watcher.watchedTextures == app->textures.size() &&
+	    watcher.watchedMeshes == app->meshes.size() && watcher.watchedVersion != 0)
+		return;
+
+	std::vector<std::string> files;
+	for (u32 i = 0; i < app->programs.size(); ++i)
+		files.push_back(app->programs[i].filepath);
+	for (u32 i = 0; i < app->textures.size(); ++i)
+		files.push_back(app->textures[i].filepath);
+	for (u32 i = 0; i < app->meshes.size(); ++i)
+		files.push_back(app->meshes[i].filepath);
+
+	//the permutations of a shader all share its file
+	std::sort(files.begin(), files.end());
+	files.erase(std::unique(files.begin(), files.end()), files.end());
+	files.erase(std::remove(files.begin(), files.end(), std::string()), files.end());
+
+	watcher.watchedPrograms = app->programs.size();
+	watcher.watchedTextures = app->textures.size();
+	watcher.watchedMeshes = app->meshes.size();
+
+	std::lock_guard<std::mutex> lock(watcher.mutex);
+	watcher.watchedFiles.swap(files);
+	watcher.watchedVersion++;
+}
+
+void StartAssetWatcher(App* app)
+{
+	AssetWatcher& watcher = app->assetWatcher;
+	UpdateWatchedFiles(app);
+	watcher.running = true;
+
+#ifdef __linux__
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd >= 0)
+	{
+		watcher.backend = "inotify";
+		watcher.thread = std::thread(WatchFilesInotify, &watcher, fd);
+		return;
+	}
+	ELOG("StartAssetWatcher() - inotify_init1() failed, the files are polled instead\n");
+#endif
+
+	watcher.backend = "polling";
+	watcher.thread = std::thread(WatchFilesPolling, &watcher);
+}
+
+void StopAssetWatcher(App* app)
+{
+	AssetWatcher& watcher = app->assetWatcher;
+	watcher.running = false;
+	if (watcher.thread.joinable())
+		watcher.thread.join();
+}
+
+//reloads whatever was loaded from the file and changed since, a write that left the same timestamp
+//(or a second event of the same save) finds nothing to do
+static void ReloadAsset(App* app, const AssetChange& change)
+{
+	AssetWatcher& watcher = app->assetWatcher;
+	u64 timestamp = GetFileLastWriteTimestamp(change.filepath.c_str());
+	f64 start = GetPlatformTime();
+	u32 reloaded = 0;
+	u32 failed = 0;
+
+	//a program that fails keeps its old timestamp, the next save tries again
+	for (u32 i = 0; i < app->programs.size(); ++i)
+	{
+		if (app->programs[i].filepath != change.filepath || app->programs[i].lastWriteTimestamp == timestamp)
+			continue;
+		if (ReloadProgram(app, i))
+		{
+			app->lightClusters.boundsDirty = true;
+			reloaded++;
+		}
+		else
+		{
+			failed++;
+		}
+	}
+
+	for (u32 i = 0; i < app->textures.size(); ++i)
+	{
+		//one still streaming reads the new file anyway
+		if (app->textures[i].filepath != change.filepath || app->textures[i].lastWriteTimestamp == timestamp || !app->textures[i].resident)
+			continue;
+		if (ReloadTexture2D(app, i))
+			reloaded++;
+		else
+			failed++;
+	}
+
+	for (u32 i = 0; i < app->meshes.size(); ++i)
+	{
+		//one still importing reads the new file anyway
+		if (app->meshes[i].filepath != change.filepath || app->meshes[i].lastWriteTimestamp == timestamp || app->meshes[i].loading)
+			continue;
+		if (ReimportMesh(app, i))
+			reloaded++;
+		else
+			failed++;
+	}
+
+	if (reloaded == 0 && failed == 0)
+		return;
+
+	f64 end = GetPlatformTime();
+	watcher.reloadCount += reloaded;
+	watcher.failedCount += failed;
+	watcher.lastAsset = change.filepath;
+	watcher.lastReloadTime = end - start;
+	watcher.lastLatency = end - change.detectTime;
+	watcher.maxLatency = glm::max(watcher.maxLatency, watcher.lastLatency);
+
+	ILOG("Hot reload of %s: %u reloaded, %u failed, %.1f ms (%.1f ms after the change)\n",
+		change.filepath.c_str(), reloaded, failed, watcher.lastReloadTime * 1000.0, watcher.lastLatency * 1000.0);
+}
+
+void ProcessAssetChanges(App* app)
+{
+	AssetWatcher& watcher = app->assetWatcher;
+	if (!watcher.running)
+		return;
+
+	UpdateWatchedFiles(app);
+
+	std::vector<AssetChange> changes;
+	{
+		std::lock_guard<std::mutex> lock(watcher.mutex);
+		changes.swap(watcher.changes);
+	}
+
+	//a save can write a file more than once, it is reloaded once and timed from the first event
+	for (u32 i = 0; i < changes.size(); ++i)
+	{
+		bool repeated = false;
+		for (u32 j = 0; j < i; ++j)
+			repeated |= changes[j].filepath == changes[i].filepath;
+		if (!repeated)
+			ReloadAsset(app, changes[i]);
+	}
+}
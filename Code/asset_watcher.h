@@ -0,0 +1,16 @@
+//
+// asset_watcher.h: Hot reload of the files the engine loaded. A background thread watches them
+// (inotify on Linux, polling the write timestamps elsewhere) and queues what changed; the main
+// thread rebuilds only the programs, textures and meshes of those files, keeping their indices.
+//
+#pragma once
+
+#include "engine.h"
+
+#define ASSET_WATCHER_POLL_MS 250 // polling interval, and how long the inotify thread waits for events
+
+void StartAssetWatcher(App* app);
+void StopAssetWatcher(App* app);
+
+// once per frame on the main thread, reloads what the watcher queued
+void ProcessAssetChanges(App* app);
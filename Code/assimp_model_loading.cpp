@@ -4,6 +4,12 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include "buffer_management.h"
+#include "geometry_arena.h"
+#include "frustum_culling.h"
+#include "material_table.h"
+#include "program_permutations.h"
+#include "worker_pool.h"
+#include "texture_streaming.h"
 #include "engine.h"
 
 void ProcessAssimpMesh(const aiScene* scene, aiMesh *mesh, Mesh *myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
@@ -91,6 +97,7 @@ void ProcessAssimpMesh(const aiScene* scene, aiMesh *mesh, Mesh *myMesh, u32 bas
     submesh.vertices.swap(vertices);
     submesh.indices.swap(indices);
 	submesh.name = mesh->mName.C_Str();
+	ComputeSubmeshBounds(submesh);
     myMesh->submeshes.push_back( submesh );
 }
 
@@ -120,7 +127,7 @@ void ProcessAssimpMaterial(App* app, aiMaterial *material, Material& myMaterial,
         material->GetTexture(aiTextureType_DIFFUSE, 0, &aiFilename);
         String filename = MakeString(aiFilename.C_Str());
         String filepath = MakePath(directory, filename);
-        myMaterial.albedoTextureIdx = LoadTexture2D(app, filepath.str);
+        myMaterial.albedoTextureIdx = LoadTexture2DAsync(app, filepath.str, TextureCompression_Color);
 		myMaterial.hasalbedo = true;
     }
     if (material->GetTextureCount(aiTextureType_EMISSIVE) > 0)
@@ -128,7 +135,7 @@ void ProcessAssimpMaterial(App* app, aiMaterial *material, Material& myMaterial,
         material->GetTexture(aiTextureType_EMISSIVE, 0, &aiFilename);
         String filename = MakeString(aiFilename.C_Str());
         String filepath = MakePath(directory, filename);
-        myMaterial.emissiveTextureIdx = LoadTexture2D(app, filepath.str);
+        myMaterial.emissiveTextureIdx = LoadTexture2DAsync(app, filepath.str, TextureCompression_Color);
 		myMaterial.hasemissive = true;
 
     }
@@ -137,7 +144,7 @@ void ProcessAssimpMaterial(App* app, aiMaterial *material, Material& myMaterial,
         material->GetTexture(aiTextureType_SPECULAR, 0, &aiFilename);
         String filename = MakeString(aiFilename.C_Str());
         String filepath = MakePath(directory, filename);
-        myMaterial.specularTextureIdx = LoadTexture2D(app, filepath.str);
+        myMaterial.specularTextureIdx = LoadTexture2DAsync(app, filepath.str, TextureCompression_Single);
 		myMaterial.hasspecular = true;
     }
     if (material->GetTextureCount(aiTextureType_NORMALS) > 0)
@@ -145,7 +152,7 @@ void ProcessAssimpMaterial(App* app, aiMaterial *material, Material& myMaterial,
         material->GetTexture(aiTextureType_NORMALS, 0, &aiFilename);
         String filename = MakeString(aiFilename.C_Str());
         String filepath = MakePath(directory, filename);
-        myMaterial.normalsTextureIdx = LoadTexture2D(app, filepath.str);
+        myMaterial.normalsTextureIdx = LoadTexture2DAsync(app, filepath.str, TextureCompression_Normal);
 		myMaterial.hasnormals = true;
     }
     if (material->GetTextureCount(aiTextureType_HEIGHT) > 0)
@@ -153,7 +160,7 @@ void ProcessAssimpMaterial(App* app, aiMaterial *material, Material& myMaterial,
         material->GetTexture(aiTextureType_HEIGHT, 0, &aiFilename);
         String filename = MakeString(aiFilename.C_Str());
         String filepath = MakePath(directory, filename);
-        myMaterial.bumpTextureIdx = LoadTexture2D(app, filepath.str);
+        myMaterial.bumpTextureIdx = LoadTexture2DAsync(app, filepath.str, TextureCompression_Single);
 		myMaterial.hasbump = true;
     }
 
@@ -176,7 +183,7 @@ void ProcessAssimpNode(const aiScene* scene, aiNode *node, Mesh *myMesh, u32 bas
     }
 }
 
-u32 LoadModel(App* app, const char* filename)
+static const aiScene* ImportModelScene(const char* filename)
 {
     const aiScene* scene = aiImportFile(filename,
                                         aiProcess_Triangulate           |
@@ -189,77 +196,249 @@ u32 LoadModel(App* app, const char* filename)
                                         aiProcess_SortByPType);
 
     if (!scene)
-    {
         ELOG("Error loading mesh %s: %s", filename, aiGetErrorString());
-        return UINT32_MAX;
-    }
-
-    app->meshes.push_back(Mesh{});
-    Mesh& mesh = app->meshes.back();
-    u32 meshIdx = (u32)app->meshes.size() - 1u;
+    return scene;
+}
 
+static u32 AddModel(App* app, u32 meshIdx, const char* filename)
+{
     app->models.push_back(Model{});
     Model& model = app->models.back();
     model.meshIdx = meshIdx;
-    u32 modelIdx = (u32)app->models.size() - 1u;
+    model.materialIdx = app->meshes[meshIdx].materialIdx;
+    model.name = filename;
+    return (u32)app->models.size() - 1u;
+}
+
+static u32 FindMesh(App* app, const char* filename)
+{
+    for (u32 meshIdx = 0; meshIdx < app->meshes.size(); ++meshIdx)
+        if (app->meshes[meshIdx].filepath == filename)
+            return meshIdx;
+    return UINT32_MAX;
+}
+
+static ModelImport* AddMeshImport(App* app, const char* filename)
+{
+    app->meshes.push_back(Mesh{});
+    Mesh& mesh = app->meshes.back();
+    mesh.name = filename;
+    mesh.filepath = filename;
+    mesh.loading = true;
+
+    ModelImport* import = new ModelImport();
+    import->meshIdx = (u32)app->meshes.size() - 1u;
+    import->filepath = filename;
+    return import;
+}
+
+// the part that doesn't need GL, safe on a worker thread
+static void ImportModel(ModelImport* import)
+{
+    f64 start = GetPlatformTime();
+    import->scene = ImportModelScene(import->filepath.c_str());
+    if (import->scene)
+        ProcessAssimpNode(import->scene, import->scene->mRootNode, &import->imported, 0, import->imported.materialIdx);
+    import->importTime = GetPlatformTime() - start;
+}
+
+// on the GL thread: the materials (their textures are GL objects) and the geometry upload
+static bool FinishModelImport(App* app, ModelImport* import)
+{
+    const aiScene* scene = import->scene;
+    Mesh& mesh = app->meshes[import->meshIdx];
+    mesh.loading = false;
+    if (!scene)
+        return false;
 
 	//model.localBuffer = CreateBuffer(sizeof(glm::mat4)*2, GL_UNIFORM_BUFFER, GL_STREAM_DRAW);
 
-    String directory = GetDirectoryPart(MakeString(filename));
+    String directory = GetDirectoryPart(MakeString(mesh.filepath.c_str()));
 
     // Create a list of materials
-    u32 baseMeshMaterialIndex = (u32)app->materials.size();
+    mesh.firstMaterialIdx = (u32)app->materials.size();
+    mesh.materialCount = scene->mNumMaterials;
     for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
     {
         app->materials.push_back(Material{});
         Material& material = app->materials.back();
         ProcessAssimpMaterial(app, scene->mMaterials[i], material, directory);
     }
-	model.name = filename;
-    ProcessAssimpNode(scene, scene->mRootNode, &mesh, baseMeshMaterialIndex, model.materialIdx);
 
     aiReleaseImport(scene);
+    import->scene = nullptr;
+
+    for (u32 i = 0; i < import->imported.submeshes.size(); ++i)
+    {
+        import->imported.materialIdx[i] += mesh.firstMaterialIdx;
+        UploadSubmeshGeometry(app, import->imported.submeshes[i]);
+    }
+
+    mesh.submeshes.swap(import->imported.submeshes);
+    mesh.materialIdx.swap(import->imported.materialIdx);
+    mesh.lastWriteTimestamp = GetFileLastWriteTimestamp(mesh.filepath.c_str());
+
+    // the models added while it was loading got no materials, and no bounds
+    for (u32 i = 0; i < app->models.size(); ++i)
+    {
+        Model& model = app->models[i];
+        if (model.meshIdx != import->meshIdx)
+            continue;
+        model.materialIdx = mesh.materialIdx;
+        model.boundsDirty = true;
+    }
+    app->worldBounds.firstBound.clear();
 
-    u32 vertexBufferSize = 0;
-    u32 indexBufferSize = 0;
+    return true;
+}
 
-    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+u32 LoadModel(App* app, const char* filename)
+{
+    // the same file is imported only once, later loads are new models sharing its mesh and materials
+    u32 meshIdx = FindMesh(app, filename);
+    if (meshIdx != UINT32_MAX)
+        return AddModel(app, meshIdx, filename);
+
+    ModelImport* import = AddMeshImport(app, filename);
+    ImportModel(import);
+    bool imported = FinishModelImport(app, import);
+    meshIdx = import->meshIdx;
+    delete import;
+
+    if (!imported)
     {
-        vertexBufferSize += mesh.submeshes[i].vertices.size() * sizeof(float);
-        indexBufferSize  += mesh.submeshes[i].indices.size()  * sizeof(u32);
+        app->meshes.pop_back();
+        return UINT32_MAX;
     }
 
-    glGenBuffers(1, &mesh.vertexBufferHandle);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-    glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, NULL, GL_STATIC_DRAW);
+    return AddModel(app, meshIdx, filename);
+}
+
+u32 LoadModelAsync(App* app, const char* filename)
+{
+    u32 meshIdx = FindMesh(app, filename);
+    if (meshIdx != UINT32_MAX)
+        return AddModel(app, meshIdx, filename);
 
-    glGenBuffers(1, &mesh.indexBufferHandle);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, NULL, GL_STATIC_DRAW);
+    ModelImports& imports = app->modelImports;
+    if (imports.pending == 0)
+        imports.requestTime = GetPlatformTime();
+    imports.pending++;
 
-    u32 indicesOffset = 0;
-    u32 verticesOffset = 0;
+    ModelImport* import = AddMeshImport(app, filename);
+    meshIdx = import->meshIdx;
 
-    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    PushWorkerJob(app->workers, [import, &imports]()
     {
-        const void* verticesData = mesh.submeshes[i].vertices.data();
-        const u32   verticesSize = mesh.submeshes[i].vertices.size() * sizeof(float);
-        glBufferSubData(GL_ARRAY_BUFFER, verticesOffset, verticesSize, verticesData);
-        mesh.submeshes[i].vertexOffset = verticesOffset;
-        verticesOffset += verticesSize;
-
-        const void* indicesData = mesh.submeshes[i].indices.data();
-        const u32   indicesSize = mesh.submeshes[i].indices.size() * sizeof(u32);
-        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesOffset, indicesSize, indicesData);
-        mesh.submeshes[i].indexOffset = indicesOffset;
-        indicesOffset += indicesSize;
+        ImportModel(import);
+
+        std::lock_guard<std::mutex> lock(imports.mutex);
+        imports.finished.push_back(import);
+    });
+
+    return AddModel(app, meshIdx, filename);
+}
+
+void FinishModelImports(App* app)
+{
+    ModelImports& imports = app->modelImports;
+
+    std::vector<ModelImport*> finished;
+    {
+        std::lock_guard<std::mutex> lock(imports.mutex);
+        finished.swap(imports.finished);
     }
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    for (u32 i = 0; i < finished.size(); ++i)
+    {
+        ModelImport* import = finished[i];
+        u32 firstMaterialIdx = (u32)app->materials.size();
+
+        // a failed import leaves an empty mesh, its models draw nothing
+        if (FinishModelImport(app, import))
+        {
+            imports.completed++;
+            PrewarmScenePermutations(app, firstMaterialIdx);
+        }
+        else
+        {
+            imports.failed++;
+        }
+
+        imports.workerTime += import->importTime;
+        imports.pending--;
+        if (imports.pending == 0)
+            imports.readyTime = GetPlatformTime() - imports.requestTime;
+        delete import;
+    }
+}
 
+// the workers finish what is queued first, nothing is uploaded anymore
+void ReleaseModelImports(App* app)
+{
+    ModelImports& imports = app->modelImports;
+    for (u32 i = 0; i < imports.finished.size(); ++i)
+    {
+        if (imports.finished[i]->scene)
+            aiReleaseImport(imports.finished[i]->scene);
+        delete imports.finished[i];
+    }
+    imports.finished.clear();
+}
 
+bool ReimportMesh(App* app, u32 meshIdx)
+{
+    const aiScene* scene = ImportModelScene(app->meshes[meshIdx].filepath.c_str());
+    if (!scene)
+        return false;
 
+    Mesh& mesh = app->meshes[meshIdx];
+    String directory = GetDirectoryPart(MakeString(mesh.filepath.c_str()));
 
-    return modelIdx;
-}
\ No newline at end of file
+    // while the file keeps as many materials they are replaced in place, so the material indices
+    // stay the same. Otherwise the new ones are appended and the old ones are left unused
+    if (scene->mNumMaterials != mesh.materialCount)
+    {
+        mesh.firstMaterialIdx = (u32)app->materials.size();
+        mesh.materialCount = scene->mNumMaterials;
+        app->materials.resize(app->materials.size() + scene->mNumMaterials);
+    }
+    for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
+    {
+        Material material = {};
+        ProcessAssimpMaterial(app, scene->mMaterials[i], material, directory);
+        app->materials[mesh.firstMaterialIdx + i] = material;
+        MarkMaterialDirty(app, mesh.firstMaterialIdx + i);
+    }
+
+    Mesh imported = {};
+    ProcessAssimpNode(scene, scene->mRootNode, &imported, mesh.firstMaterialIdx, imported.materialIdx);
+
+    aiReleaseImport(scene);
+
+    // the arenas only grow, the old ranges stay unused until the next start
+    for (u32 i = 0; i < imported.submeshes.size(); ++i)
+    {
+        UploadSubmeshGeometry(app, imported.submeshes[i]);
+    }
+
+    bool sameSubmeshCount = imported.submeshes.size() == mesh.submeshes.size();
+    mesh.submeshes.swap(imported.submeshes);
+    mesh.materialIdx.swap(imported.materialIdx);
+    mesh.lastWriteTimestamp = GetFileLastWriteTimestamp(mesh.filepath.c_str());
+
+    for (u32 i = 0; i < app->models.size(); ++i)
+    {
+        Model& model = app->models[i];
+        if (model.meshIdx != meshIdx)
+            continue;
+        model.materialIdx = mesh.materialIdx;
+        model.boundsDirty = true;
+    }
+
+    // a different submesh count moves the bounds of every later model, lay them out again
+    if (!sameSubmeshCount)
+        app->worldBounds.firstBound.clear();
+
+    return true;
+}
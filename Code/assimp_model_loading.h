@@ -12,6 +12,15 @@ void ProcessAssimpMaterial(App* app, aiMaterial *material, Material& myMaterial,
 
 void ProcessAssimpNode(const aiScene* scene, aiNode *node, Mesh *myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
 u32 LoadModel(App* app, const char* filename);
+// returns the model right away, the file is imported on the worker pool and the model draws nothing
+// until FinishModelImports uploads it
+u32 LoadModelAsync(App* app, const char* filename);
+// once per frame on the GL thread
+void FinishModelImports(App* app);
+// after the worker pool stopped
+void ReleaseModelImports(App* app);
+// imports the file of the mesh again, the mesh, its materials and the models using it keep their indices
+bool ReimportMesh(App* app, u32 meshIdx);
 
 
 
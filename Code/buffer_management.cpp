@@ -57,3 +57,166 @@ void PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment)
     memcpy((u8*)buffer.data + buffer.head, data, size);
     buffer.head += size;
 }
+
+// glad is generated for GL 4.3, so the GL 4.4 / ARB_buffer_storage bits are declared here
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC_RING)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+static PFNGLBUFFERSTORAGEPROC_RING LoadBufferStorage()
+{
+    static bool loaded = false;
+    static PFNGLBUFFERSTORAGEPROC_RING bufferStorage = NULL;
+
+    if (!loaded)
+    {
+        loaded = true;
+        bufferStorage = (PFNGLBUFFERSTORAGEPROC_RING)GetOpenGLProcAddress("glBufferStorage");
+    }
+    return bufferStorage;
+}
+
+RingBuffer CreateRingBuffer(u32 regionSize, GLenum type, u32 regionCount)
+{
+    ASSERT(regionCount > 0 && regionCount <= MAX_RING_REGIONS, "Invalid number of ring buffer regions");
+
+    // Every region start is bound as a range, so it follows the offset alignment of its binding
+    GLint alignment = 1;
+    if (type == GL_UNIFORM_BUFFER)
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    else if (type == GL_SHADER_STORAGE_BUFFER)
+        glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+
+    RingBuffer ring = {};
+    ring.regionCount = regionCount;
+    ring.fences.assign(regionCount, NULL);
+    ring.regionSize = Align(regionSize, alignment);
+    ring.regionIdx = regionCount - 1;
+    ring.buffer.size = ring.regionSize * regionCount;
+    ring.buffer.type = type;
+
+    glGenBuffers(1, &ring.buffer.handle);
+    glBindBuffer(type, ring.buffer.handle);
+
+    PFNGLBUFFERSTORAGEPROC_RING bufferStorage = LoadBufferStorage();
+    if (bufferStorage)
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        bufferStorage(type, ring.buffer.size, NULL, flags);
+        ring.buffer.data = glMapBufferRange(type, 0, ring.buffer.size, flags);
+        ring.persistent = ring.buffer.data != NULL;
+    }
+
+    if (!ring.persistent)
+    {
+        // No immutable storage available: every region gets mapped unsynchronized
+        // instead, the fences still keep us from overwriting data in flight.
+        ILOG("CreateRingBuffer() - persistent mapping not available, falling back to unsynchronized mapping\n");
+        glBufferData(type, ring.buffer.size, NULL, GL_STREAM_DRAW);
+        ring.buffer.data = NULL;
+    }
+
+    glBindBuffer(type, 0);
+
+    return ring;
+}
+
+// Between regions only, the contents are not kept
+void ResizeRingBuffer(RingBuffer& ring, u32 regionSize)
+{
+    // The commands already submitted keep the old storage alive until the GPU is done with it
+    for (u32 i = 0; i < ring.regionCount; ++i)
+    {
+        if (ring.fences[i])
+            glDeleteSync(ring.fences[i]);
+    }
+    glDeleteBuffers(1, &ring.buffer.handle);
+
+    RingBuffer resized = CreateRingBuffer(regionSize, ring.buffer.type, ring.regionCount);
+    resized.waitCount = ring.waitCount;
+    resized.lastWaitTime = ring.lastWaitTime;
+    resized.totalWaitTime = ring.totalWaitTime;
+    ring = resized;
+}
+
+void BeginRingRegion(RingBuffer& ring)
+{
+    ring.regionIdx = (ring.regionIdx + 1) % ring.regionCount;
+    ring.regionStart = ring.regionIdx * ring.regionSize;
+
+    GLsync& fence = ring.fences[ring.regionIdx];
+    if (fence)
+    {
+        f64 start = GetPlatformTime();
+        GLenum result = glClientWaitSync(fence, 0, 0);
+        if (result == GL_TIMEOUT_EXPIRED)
+        {
+            ring.waitCount++;
+            do
+            {
+                result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            } while (result == GL_TIMEOUT_EXPIRED);
+        }
+        ring.lastWaitTime = GetPlatformTime() - start;
+        ring.totalWaitTime += ring.lastWaitTime;
+
+        glDeleteSync(fence);
+        fence = NULL;
+    }
+
+    if (ring.persistent)
+    {
+        ring.regionData = (u8*)ring.buffer.data + ring.regionStart;
+    }
+    else
+    {
+        glBindBuffer(ring.buffer.type, ring.buffer.handle);
+        ring.regionData = (u8*)glMapBufferRange(ring.buffer.type, ring.regionStart, ring.regionSize,
+                                                GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+    }
+
+    ring.buffer.head = ring.regionStart;
+}
+
+void EndRingRegion(RingBuffer& ring)
+{
+    if (!ring.persistent)
+    {
+        glBindBuffer(ring.buffer.type, ring.buffer.handle);
+        glUnmapBuffer(ring.buffer.type);
+        glBindBuffer(ring.buffer.type, 0);
+    }
+}
+
+void FenceRingRegion(RingBuffer& ring)
+{
+    GLsync& fence = ring.fences[ring.regionIdx];
+    if (fence)
+        glDeleteSync(fence);
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void AlignHead(RingBuffer& ring, u32 alignment)
+{
+    AlignHead(ring.buffer, alignment);
+}
+
+void PushAlignedData(RingBuffer& ring, const void* data, u32 size, u32 alignment)
+{
+    ASSERT(ring.regionData != NULL, "The ring region must be started first");
+    AlignHead(ring.buffer, alignment);
+    ASSERT(ring.buffer.head + size <= ring.regionStart + ring.regionSize, "Ring buffer region overflow");
+    memcpy(ring.regionData + (ring.buffer.head - ring.regionStart), data, size);
+    ring.buffer.head += size;
+}
+
+u32 RingRangeSize(const RingBuffer& ring, u32 offset)
+{
+    // from the offset up to the end of the current region, so fixed size blocks never read out of it
+    return ring.regionStart + ring.regionSize - offset;
+}
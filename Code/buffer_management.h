@@ -1,9 +1,13 @@
 #ifndef BUFFER_MANAGEMENT
 #define BUFFER_MANAGEMENT
 
+#define RING_BUFFER_FRAMES 3
+#define MAX_RING_REGIONS 16
+
 #define CreateConstantBuffer(size) CreateBuffer(size, GL_UNIFORM_BUFFER, GL_STREAM_DRAW)
 #define CreateStaticVertexBuffer(size) CreateBuffer(size, GL_ARRAY_BUFFER, GL_STATIC_DRAW)
 #define CreateStaticIndexBuffer(size) CreateBuffer(size, GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW)
+#define CreateConstantRingBuffer(size) CreateRingBuffer(size, GL_UNIFORM_BUFFER, RING_BUFFER_FRAMES)
 
 #define PushData(buffer, data, size) PushAlignedData(buffer, data, size, 1)
 #define PushUInt(buffer, value) { u32 v = value; PushAlignedData(buffer, &v, sizeof(v), 4); }
@@ -23,4 +27,13 @@ void UnmapBuffer(Buffer& buffer);
 void AlignHead(Buffer& buffer, u32 alignment);
 void PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment);
 
+RingBuffer CreateRingBuffer(u32 regionSize, GLenum type, u32 regionCount);
+void ResizeRingBuffer(RingBuffer& ring, u32 regionSize);
+void BeginRingRegion(RingBuffer& ring);
+void EndRingRegion(RingBuffer& ring);
+void FenceRingRegion(RingBuffer& ring);
+void AlignHead(RingBuffer& ring, u32 alignment);
+void PushAlignedData(RingBuffer& ring, const void* data, u32 size, u32 alignment);
+u32 RingRangeSize(const RingBuffer& ring, u32 offset);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,529 @@
+#include "bvh.h"
+#include <cfloat>
+#include <cstdlib>
+
+static vec3 ItemCenter(const WorldBounds& bounds, u32 b)
+{
+	return vec3(bounds.centerX[b], bounds.centerY[b], bounds.centerZ[b]);
+}
+
+static vec3 ItemExtent(const WorldBounds& bounds, u32 b)
+{
+	return vec3(bounds.extentX[b], bounds.extentY[b], bounds.extentZ[b]);
+}
+
+static f32 HalfSurfaceArea(vec3 size)
+{
+	return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+static void UpdateNodeBounds(BVH& bvh, const WorldBounds& bounds, u32 nodeIdx)
+{
+	BVHNode& node = bvh.nodes[nodeIdx];
+	node.aabbMin = vec3(FLT_MAX);
+	node.aabbMax = vec3(-FLT_MAX);
+
+	for (u32 i = 0; i < node.count; ++i)
+	{
+		u32 b = bvh.items[node.leftFirst + i];
+		vec3 center = ItemCenter(bounds, b);
+		vec3 extent = ItemExtent(bounds, b);
+		node.aabbMin = glm::min(node.aabbMin, center - extent);
+		node.aabbMax = glm::max(node.aabbMax, center + extent);
+	}
+}
+
+static void UnionChildren(BVH& bvh, u32 nodeIdx)
+{
+	BVHNode& node = bvh.nodes[nodeIdx];
+	const BVHNode& left = bvh.nodes[node.leftFirst];
+	const BVHNode& right = bvh.nodes[node.leftFirst + 1];
+	node.aabbMin = glm::min(left.aabbMin, right.aabbMin);
+	node.aabbMax = glm::max(left.aabbMax, right.aabbMax);
+}
+
+//binned SAH over the item centers, returns the cost of the best split found
+static f32 FindBestSplit(const BVH& bvh, const WorldBounds& bounds, const BVHNode& node, u32& bestAxis, f32& bestPosition)
+{
+	struct Bin
+	{
+		vec3 aabbMin = vec3(FLT_MAX);
+		vec3 aabbMax = vec3(-FLT_MAX);
+		u32 count = 0;
+	};
+
+	vec3 centroidMin(FLT_MAX);
+	vec3 centroidMax(-FLT_MAX);
+	for (u32 i = 0; i < node.count; ++i)
+	{
+		vec3 center = ItemCenter(bounds, bvh.items[node.leftFirst + i]);
+		centroidMin = glm::min(centroidMin, center);
+		centroidMax = glm::max(centroidMax, center);
+	}
+
+	f32 bestCost = FLT_MAX;
+	for (u32 axis = 0; axis < 3; ++axis)
+	{
+		f32 lo = centroidMin[axis];
+		f32 hi = centroidMax[axis];
+		if (lo == hi)
+			continue;
+
+		Bin bins[BVH_BINS];
+		f32 scale = BVH_BINS / (hi - lo);
+		for (u32 i = 0; i < node.count; ++i)
+		{
+			u32 b = bvh.items[node.leftFirst + i];
+			vec3 center = ItemCenter(bounds, b);
+			vec3 extent = ItemExtent(bounds, b);
+			u32 binIdx = glm::min((u32)BVH_BINS - 1, (u32)((center[axis] - lo) * scale));
+			bins[binIdx].count++;
+			bins[binIdx].aabbMin = glm::min(bins[binIdx].aabbMin, center - extent);
+			bins[binIdx].aabbMax = glm::max(bins[binIdx].aabbMax, center + extent);
+		}
+
+		//sweep from both sides so every plane between two bins is evaluated in O(bins)
+		f32 leftArea[BVH_BINS - 1], rightArea[BVH_BINS - 1];
+		u32 leftCount[BVH_BINS - 1], rightCount[BVH_BINS - 1];
+		vec3 leftMin(FLT_MAX), leftMax(-FLT_MAX), rightMin(FLT_MAX), rightMax(-FLT_MAX);
+		u32 leftSum = 0, rightSum = 0;
+		for (u32 i = 0; i < BVH_BINS - 1; ++i)
+		{
+			leftSum += bins[i].count;
+			leftCount[i] = leftSum;
+			leftMin = glm::min(leftMin, bins[i].aabbMin);
+			leftMax = glm::max(leftMax, bins[i].aabbMax);
+			leftArea[i] = leftSum ? HalfSurfaceArea(leftMax - leftMin) : 0.0f;
+
+			rightSum += bins[BVH_BINS - 1 - i].count;
+			rightCount[BVH_BINS - 2 - i] = rightSum;
+			rightMin = glm::min(rightMin, bins[BVH_BINS - 1 - i].aabbMin);
+			rightMax = glm::max(rightMax, bins[BVH_BINS - 1 - i].aabbMax);
+			rightArea[BVH_BINS - 2 - i] = rightSum ? HalfSurfaceArea(rightMax - rightMin) : 0.0f;
+		}
+
+		for (u32 i = 0; i < BVH_BINS - 1; ++i)
+		{
+			f32 cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestPosition = lo + (i + 1) / scale;
+			}
+		}
+	}
+
+	return bestCost;
+}
+
+void BuildBVH(BVH& bvh, const WorldBounds& bounds)
+{
+	f64 start = GetPlatformTime();
+
+	const u32 count = bounds.count;
+	bvh.nodes.resize(glm::max(2 * count, 1u));
+	bvh.parents.resize(bvh.nodes.size());
+	bvh.items.resize(count);
+	bvh.itemLeaf.resize(count);
+	bvh.dirtyItems.clear();
+
+	for (u32 i = 0; i < count; ++i)
+		bvh.items[i] = i;
+
+	BVHNode& root = bvh.nodes[0];
+	root.leftFirst = 0;
+	root.count = count;
+	bvh.parents[0] = UINT32_MAX;
+	bvh.nodeCount = 1;
+	UpdateNodeBounds(bvh, bounds, 0);
+
+	//no recursion, degenerate scenes can get deep
+	std::vector<u32> stack;
+	stack.push_back(0);
+	while (!stack.empty())
+	{
+		u32 nodeIdx = stack.back();
+		stack.pop_back();
+
+		BVHNode& node = bvh.nodes[nodeIdx];
+		if (node.count <= 2)
+			continue;
+
+		u32 axis = 0;
+		f32 position = 0.0f;
+		f32 splitCost = FindBestSplit(bvh, bounds, node, axis, position);
+		f32 leafCost = node.count * HalfSurfaceArea(node.aabbMax - node.aabbMin);
+		if (splitCost >= leafCost)
+			continue;
+
+		u32 i = node.leftFirst;
+		u32 j = node.leftFirst + node.count;
+		while (i < j)
+		{
+			if (ItemCenter(bounds, bvh.items[i])[axis] < position)
+				i++;
+			else
+				std::swap(bvh.items[i], bvh.items[--j]);
+		}
+
+		u32 leftCount = i - node.leftFirst;
+		if (leftCount == 0 || leftCount == node.count)
+			continue;
+
+		u32 leftIdx = bvh.nodeCount++;
+		u32 rightIdx = bvh.nodeCount++;
+
+		bvh.nodes[leftIdx].leftFirst = node.leftFirst;
+		bvh.nodes[leftIdx].count = leftCount;
+		bvh.nodes[rightIdx].leftFirst = i;
+		bvh.nodes[rightIdx].count = node.count - leftCount;
+		bvh.parents[leftIdx] = nodeIdx;
+		bvh.parents[rightIdx] = nodeIdx;
+
+		node.leftFirst = leftIdx;
+		node.count = 0;
+
+		UpdateNodeBounds(bvh, bounds, leftIdx);
+		UpdateNodeBounds(bvh, bounds, rightIdx);
+		stack.push_back(rightIdx);
+		stack.push_back(leftIdx);
+	}
+
+	for (u32 n = 0; n < bvh.nodeCount; ++n)
+	{
+		const BVHNode& node = bvh.nodes[n];
+		for (u32 i = 0; i < node.count; ++i)
+			bvh.itemLeaf[bvh.items[node.leftFirst + i]] = n;
+	}
+
+	bvh.lastBuildTime = GetPlatformTime() - start;
+}
+
+void RefitBVH(BVH& bvh, const WorldBounds& bounds)
+{
+	f64 start = GetPlatformTime();
+
+	if (bvh.dirtyItems.size() * 8 > bvh.nodeCount)
+	{
+		//children always come after their parent, one backwards sweep refits everything
+		for (u32 n = bvh.nodeCount; n-- > 0;)
+		{
+			if (bvh.nodes[n].count > 0)
+				UpdateNodeBounds(bvh, bounds, n);
+			else
+				UnionChildren(bvh, n);
+		}
+	}
+	else
+	{
+		for (u32 i = 0; i < bvh.dirtyItems.size(); ++i)
+		{
+			u32 n = bvh.itemLeaf[bvh.dirtyItems[i]];
+			UpdateNodeBounds(bvh, bounds, n);
+
+			for (n = bvh.parents[n]; n != UINT32_MAX; n = bvh.parents[n])
+				UnionChildren(bvh, n);
+		}
+	}
+
+	bvh.dirtyItems.clear();
+	bvh.lastRefitTime = GetPlatformTime() - start;
+}
+
+//clears the bits of the planes the box is fully inside of, returns false when it is fully outside one
+static bool ClassifyBox(const Frustum& frustum, vec3 center, vec3 extent, u32& planeMask)
+{
+	for (u32 p = 0; p < frustum.planeCount; ++p)
+	{
+		if (!(planeMask & (1u << p)))
+			continue;
+
+		const vec4& plane = frustum.planes[p];
+		f32 distance = glm::dot(vec3(plane), center) + plane.w;
+		f32 radius = glm::dot(glm::abs(vec3(plane)), extent);
+
+		if (distance + radius < 0.0f)
+			return false;
+		if (distance - radius >= 0.0f)
+			planeMask &= ~(1u << p);
+	}
+	return true;
+}
+
+u32 CullBVH(const BVH& bvh, WorldBounds& bounds, const Frustum& frustum)
+{
+	std::fill(bounds.visible.begin(), bounds.visible.end(), 0);
+	if (bounds.count == 0)
+		return 0;
+
+	struct Entry
+	{
+		u32 nodeIdx;
+		u32 planeMask;
+	};
+
+	u32 visibleCount = 0;
+	std::vector<Entry> stack;
+	stack.push_back({ 0, (1u << frustum.planeCount) - 1 });
+
+	while (!stack.empty())
+	{
+		Entry entry = stack.back();
+		stack.pop_back();
+		const BVHNode& node = bvh.nodes[entry.nodeIdx];
+
+		u32 planeMask = entry.planeMask;
+		if (planeMask && !ClassifyBox(frustum, (node.aabbMin + node.aabbMax) * 0.5f, (node.aabbMax - node.aabbMin) * 0.5f, planeMask))
+			continue;
+
+		if (node.count > 0)
+		{
+			for (u32 i = 0; i < node.count; ++i)
+			{
+				u32 b = bvh.items[node.leftFirst + i];
+				u32 itemMask = planeMask;
+				if (itemMask == 0 || ClassifyBox(frustum, ItemCenter(bounds, b), ItemExtent(bounds, b), itemMask))
+				{
+					bounds.visible[b] = 1;
+					visibleCount++;
+				}
+			}
+		}
+		else
+		{
+			stack.push_back({ node.leftFirst + 1, planeMask });
+			stack.push_back({ node.leftFirst, planeMask });
+		}
+	}
+
+	return visibleCount;
+}
+
+//slab test, returns the entry distance or FLT_MAX when the ray misses the box before maxDistance
+static f32 IntersectAABB(vec3 origin, vec3 invDirection, vec3 aabbMin, vec3 aabbMax, f32 maxDistance)
+{
+	vec3 t1 = (aabbMin - origin) * invDirection;
+	vec3 t2 = (aabbMax - origin) * invDirection;
+	vec3 tNear = glm::min(t1, t2);
+	vec3 tFar = glm::max(t1, t2);
+	f32 tEnter = glm::max(glm::max(tNear.x, tNear.y), tNear.z);
+	f32 tExit = glm::min(glm::min(tFar.x, tFar.y), tFar.z);
+
+	if (tExit >= tEnter && tExit > 0.0f && tEnter < maxDistance)
+		return glm::max(tEnter, 0.0f);
+	return FLT_MAX;
+}
+
+//Moller-Trumbore against the triangles of one submesh, in its model space
+static f32 IntersectSubmesh(const Submesh& submesh, vec3 origin, vec3 direction, f32 maxDistance)
+{
+	const u32 floatStride = submesh.vertexBufferLayout.stride / sizeof(float);
+	f32 closest = maxDistance;
+
+	for (u32 i = 0; i + 2 < submesh.indices.size(); i += 3)
+	{
+		vec3 v0 = glm::make_vec3(&submesh.vertices[submesh.indices[i + 0] * floatStride]);
+		vec3 v1 = glm::make_vec3(&submesh.vertices[submesh.indices[i + 1] * floatStride]);
+		vec3 v2 = glm::make_vec3(&submesh.vertices[submesh.indices[i + 2] * floatStride]);
+
+		vec3 edge1 = v1 - v0;
+		vec3 edge2 = v2 - v0;
+		vec3 h = glm::cross(direction, edge2);
+		f32 a = glm::dot(edge1, h);
+		if (glm::abs(a) < 1e-8f)
+			continue;
+
+		f32 f = 1.0f / a;
+		vec3 s = origin - v0;
+		f32 u = f * glm::dot(s, h);
+		if (u < 0.0f || u > 1.0f)
+			continue;
+
+		vec3 q = glm::cross(s, edge1);
+		f32 v = f * glm::dot(direction, q);
+		if (v < 0.0f || u + v > 1.0f)
+			continue;
+
+		f32 t = f * glm::dot(edge2, q);
+		if (t > 0.0f && t < closest)
+			closest = t;
+	}
+
+	return closest;
+}
+
+RayHit RaycastBVH(App* app, vec3 origin, vec3 direction, f32 maxDistance)
+{
+	const BVH& bvh = app->sceneBVH;
+	const WorldBounds& bounds = app->worldBounds;
+
+	RayHit hit = {};
+	hit.t = maxDistance;
+	if (bounds.count == 0)
+		return hit;
+
+	vec3 invDirection = 1.0f / direction;
+
+	struct Entry
+	{
+		u32 nodeIdx;
+		f32 t;
+	};
+
+	std::vector<Entry> stack;
+	f32 rootT = IntersectAABB(origin, invDirection, bvh.nodes[0].aabbMin, bvh.nodes[0].aabbMax, hit.t);
+	if (rootT != FLT_MAX)
+		stack.push_back({ 0, rootT });
+
+	while (!stack.empty())
+	{
+		Entry entry = stack.back();
+		stack.pop_back();
+		if (entry.t >= hit.t)
+			continue;
+
+		const BVHNode& node = bvh.nodes[entry.nodeIdx];
+		if (node.count > 0)
+		{
+			for (u32 i = 0; i < node.count; ++i)
+			{
+				u32 b = bvh.items[node.leftFirst + i];
+				vec3 center = ItemCenter(bounds, b);
+				vec3 extent = ItemExtent(bounds, b);
+				if (IntersectAABB(origin, invDirection, center - extent, center + extent, hit.t) == FLT_MAX)
+					continue;
+
+				//same t in both spaces since the direction is not renormalized
+				u32 modelIdx = bounds.boundModel[b];
+				const Model& model = app->models[modelIdx];
+				u32 submeshIdx = b - bounds.firstBound[modelIdx];
+				glm::mat4 invWorld = glm::inverse(model.world);
+				vec3 localOrigin = vec3(invWorld * vec4(origin, 1.0f));
+				vec3 localDirection = vec3(invWorld * vec4(direction, 0.0f));
+
+				const Submesh& submesh = app->meshes[model.meshIdx].submeshes[submeshIdx];
+				f32 t = IntersectSubmesh(submesh, localOrigin, localDirection, hit.t);
+				if (t < hit.t)
+				{
+					hit.hit = true;
+					hit.t = t;
+					hit.modelIdx = modelIdx;
+					hit.submeshIdx = submeshIdx;
+				}
+			}
+			continue;
+		}
+
+		//nearest child on top of the stack
+		const BVHNode& left = bvh.nodes[node.leftFirst];
+		const BVHNode& right = bvh.nodes[node.leftFirst + 1];
+		f32 tLeft = IntersectAABB(origin, invDirection, left.aabbMin, left.aabbMax, hit.t);
+		f32 tRight = IntersectAABB(origin, invDirection, right.aabbMin, right.aabbMax, hit.t);
+		Entry nearEntry = { node.leftFirst, tLeft };
+		Entry farEntry = { node.leftFirst + 1, tRight };
+		if (tRight < tLeft)
+			std::swap(nearEntry, farEntry);
+
+		if (farEntry.t != FLT_MAX)
+			stack.push_back(farEntry);
+		if (nearEntry.t != FLT_MAX)
+			stack.push_back(nearEntry);
+	}
+
+	return hit;
+}
+
+void OverlapSphereBVH(const BVH& bvh, const WorldBounds& bounds, vec3 center, f32 radius, std::vector<u32>& results)
+{
+	results.clear();
+	if (bounds.count == 0)
+		return;
+
+	const f32 radiusSq = radius * radius;
+	std::vector<u32> stack;
+	stack.push_back(0);
+
+	while (!stack.empty())
+	{
+		const BVHNode& node = bvh.nodes[stack.back()];
+		stack.pop_back();
+
+		vec3 closest = glm::clamp(center, node.aabbMin, node.aabbMax);
+		if (glm::dot(closest - center, closest - center) > radiusSq)
+			continue;
+
+		if (node.count == 0)
+		{
+			stack.push_back(node.leftFirst);
+			stack.push_back(node.leftFirst + 1);
+			continue;
+		}
+
+		for (u32 i = 0; i < node.count; ++i)
+		{
+			u32 b = bvh.items[node.leftFirst + i];
+			vec3 itemCenter = ItemCenter(bounds, b);
+			vec3 itemExtent = ItemExtent(bounds, b);
+			vec3 point = glm::clamp(center, itemCenter - itemExtent, itemCenter + itemExtent);
+			if (glm::dot(point - center, point - center) <= radiusSq)
+				results.push_back(b);
+		}
+	}
+}
+
+static f32 RandomRange(f32 lo, f32 hi)
+{
+	return lo + (hi - lo) * ((f32)rand() / (f32)RAND_MAX);
+}
+
+void RunBVHBenchmark(BVHBenchmark& benchmark, u32 itemCount)
+{
+	//synthetic scene: props of a few meters scattered over a square kilometer
+	srand(1234);
+
+	WorldBounds bounds = {};
+	const u32 paddedCount = (itemCount + 3) & ~3u;
+	bounds.centerX.resize(paddedCount);
+	bounds.centerY.resize(paddedCount);
+	bounds.centerZ.resize(paddedCount);
+	bounds.extentX.resize(paddedCount);
+	bounds.extentY.resize(paddedCount);
+	bounds.extentZ.resize(paddedCount);
+	bounds.visible.resize(paddedCount);
+	bounds.count = itemCount;
+
+	for (u32 i = 0; i < itemCount; ++i)
+	{
+		bounds.centerX[i] = RandomRange(-500.0f, 500.0f);
+		bounds.centerY[i] = RandomRange(0.0f, 20.0f);
+		bounds.centerZ[i] = RandomRange(-500.0f, 500.0f);
+		bounds.extentX[i] = RandomRange(0.5f, 3.0f);
+		bounds.extentY[i] = RandomRange(0.5f, 3.0f);
+		bounds.extentZ[i] = RandomRange(0.5f, 3.0f);
+	}
+
+	BVH bvh = {};
+	BuildBVH(bvh, bounds);
+	benchmark.buildTime = bvh.lastBuildTime;
+	benchmark.nodeCount = bvh.nodeCount;
+
+	for (u32 i = 0; i < itemCount; ++i)
+	{
+		bounds.centerX[i] += RandomRange(-1.0f, 1.0f);
+		bvh.dirtyItems.push_back(i);
+	}
+	RefitBVH(bvh, bounds);
+	benchmark.fullRefitTime = bvh.lastRefitTime;
+
+	for (u32 i = 0; i < itemCount / 100; ++i)
+	{
+		u32 b = (((u32)rand() << 15) | (u32)rand()) % itemCount; // RAND_MAX can be as low as 32767
+		bounds.centerY[b] += RandomRange(-1.0f, 1.0f);
+		bvh.dirtyItems.push_back(b);
+	}
+	RefitBVH(bvh, bounds);
+	benchmark.partialRefitTime = bvh.lastRefitTime;
+
+	benchmark.itemCount = itemCount;
+}
@@ -0,0 +1,19 @@
+//
+// bvh.h: Bounding volume hierarchy over the world bounds of every submesh. Built with binned
+// SAH when models are added and refit in place when they move, it serves frustum culling,
+// ray casts (mouse picking) and sphere overlap queries.
+//
+#pragma once
+
+#include "engine.h"
+
+#define BVH_BINS 8
+
+void BuildBVH(BVH& bvh, const WorldBounds& bounds);
+void RefitBVH(BVH& bvh, const WorldBounds& bounds);
+
+u32 CullBVH(const BVH& bvh, WorldBounds& bounds, const Frustum& frustum);
+RayHit RaycastBVH(App* app, vec3 origin, vec3 direction, f32 maxDistance);
+void OverlapSphereBVH(const BVH& bvh, const WorldBounds& bounds, vec3 center, f32 radius, std::vector<u32>& results);
+
+void RunBVHBenchmark(BVHBenchmark& benchmark, u32 itemCount);
@@ -0,0 +1,77 @@
+#include "depth_pyramid.h"
+
+void InitDepthPyramid(App* app)
+{
+	//the texture follows the depth target, it is created by the first BuildDepthPyramid
+	DepthPyramid& pyramid = app->depthPyramid;
+	pyramid.copyProgramIdx = LoadComputeProgram(app, "depth_pyramid.glsl", "DEPTH_PYRAMID_COPY");
+	pyramid.reduceProgramIdx = LoadComputeProgram(app, "depth_pyramid.glsl", "DEPTH_PYRAMID_REDUCE");
+}
+
+static void ResizeDepthPyramid(DepthPyramid& pyramid, ivec2 size)
+{
+	pyramid.size = size;
+
+	//only levels that halve the one above exactly, a texel then covers 2x2 texels of it
+	ivec2 levelSize = size;
+	pyramid.levels = 1;
+	while (pyramid.levels < DEPTH_PYRAMID_LEVELS && levelSize.x % 2 == 0 && levelSize.y % 2 == 0)
+	{
+		levelSize /= 2;
+		pyramid.levels++;
+	}
+
+	if (pyramid.handle)
+		glDeleteTextures(1, &pyramid.handle);
+
+	glGenTextures(1, &pyramid.handle);
+	glBindTexture(GL_TEXTURE_2D, pyramid.handle);
+	glTexStorage2D(GL_TEXTURE_2D, pyramid.levels, GL_R32F, size.x, size.y);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+static ivec2 DepthPyramidGroups(ivec2 size)
+{
+	return (size + ivec2(DEPTH_PYRAMID_GROUP_SIZE - 1)) / DEPTH_PYRAMID_GROUP_SIZE;
+}
+
+void BuildDepthPyramid(App* app, GLuint depthHandle, ivec2 size)
+{
+	DepthPyramid& pyramid = app->depthPyramid;
+	if (size != pyramid.size)
+		ResizeDepthPyramid(pyramid, size);
+
+	//the depth target can't be bound as an image, level 0 is copied out of it
+	Program& copyProgram = app->programs[pyramid.copyProgramIdx];
+	glUseProgram(copyProgram.handle);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, depthHandle);
+	glUniform1i(copyProgram.uniformLocations[Uniform_uDepth], 0);
+	glBindImageTexture(DEPTH_PYRAMID_DEST_IMAGE, pyramid.handle, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+	ivec2 groups = DepthPyramidGroups(size);
+	glDispatchCompute(groups.x, groups.y, 1);
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+	//every level reads the one written just before it
+	Program& reduceProgram = app->programs[pyramid.reduceProgramIdx];
+	glUseProgram(reduceProgram.handle);
+
+	for (u32 level = 1; level < pyramid.levels; ++level)
+	{
+		ivec2 levelSize = size / (1 << level);
+		glBindImageTexture(DEPTH_PYRAMID_SOURCE_IMAGE, pyramid.handle, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+		glBindImageTexture(DEPTH_PYRAMID_DEST_IMAGE, pyramid.handle, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+		groups = DepthPyramidGroups(levelSize);
+		glDispatchCompute(groups.x, groups.y, 1);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
@@ -0,0 +1,18 @@
+//
+// depth_pyramid.h: Hi-Z pyramid of the main pass depth. Every level keeps the closest depth of the
+// 2x2 texels under it, so screen-space rays can skip the empty space in steps of whole cells.
+//
+#pragma once
+
+#include "engine.h"
+
+// image units, see depth_pyramid.glsl
+#define DEPTH_PYRAMID_SOURCE_IMAGE  0
+#define DEPTH_PYRAMID_DEST_IMAGE    1
+
+#define DEPTH_PYRAMID_GROUP_SIZE    8
+
+void InitDepthPyramid(App* app);
+
+// size is the one of the depth texture, every level halves it
+void BuildDepthPyramid(App* app, GLuint depthHandle, ivec2 size);
@@ -11,9 +11,27 @@
 #include <stb_image_write.h>
 #include "assimp_model_loading.h"
 #include "buffer_management.h"
-
-
-GLuint CreateProgramFromSource(String programSource, const char* shaderName)
+#include "render_queue.h"
+#include "material_table.h"
+#include "geometry_arena.h"
+#include "frustum_culling.h"
+#include "bvh.h"
+#include "light_clustering.h"
+#include "render_target_pool.h"
+#include "render_graph.h"
+#include "depth_pyramid.h"
+#include "program_permutations.h"
+#include "program_cache.h"
+#include "asset_watcher.h"
+#include "worker_pool.h"
+#include "texture_streaming.h"
+#include "texture_registry.h"
+#include "texture_cooking.h"
+
+
+//defines is an extra preamble after the program name, a permutation. With deferStatus nothing
+//waits for the compiler, the status is read by FinishProgram
+GLuint CreateProgramFromSource(String programSource, const char* shaderName, bool geometry, const char* defines, bool deferStatus)
 {
     GLchar  infoLogBuffer[1024] = {};
     GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
@@ -25,84 +43,298 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
     sprintf(shaderNameDefine, "#define %s\n", shaderName);
     char vertexShaderDefine[] = "#define VERTEX\n";
     char fragmentShaderDefine[] = "#define FRAGMENT\n";
+    char geometryShaderDefine[] = "#define GEOMETRY\n";
 
     const GLchar* vertexShaderSource[] = {
         versionString,
         shaderNameDefine,
+        defines,
         vertexShaderDefine,
         programSource.str
     };
     const GLint vertexShaderLengths[] = {
         (GLint) strlen(versionString),
         (GLint) strlen(shaderNameDefine),
+        (GLint) strlen(defines),
         (GLint) strlen(vertexShaderDefine),
         (GLint) programSource.len
     };
     const GLchar* fragmentShaderSource[] = {
         versionString,
         shaderNameDefine,
+        defines,
         fragmentShaderDefine,
         programSource.str
     };
     const GLint fragmentShaderLengths[] = {
         (GLint) strlen(versionString),
         (GLint) strlen(shaderNameDefine),
+        (GLint) strlen(defines),
         (GLint) strlen(fragmentShaderDefine),
         (GLint) programSource.len
     };
+    const GLchar* geometryShaderSource[] = {
+        versionString,
+        shaderNameDefine,
+        defines,
+        geometryShaderDefine,
+        programSource.str
+    };
+    const GLint geometryShaderLengths[] = {
+        (GLint) strlen(versionString),
+        (GLint) strlen(shaderNameDefine),
+        (GLint) strlen(defines),
+        (GLint) strlen(geometryShaderDefine),
+        (GLint) programSource.len
+    };
 
     GLuint vshader = glCreateShader(GL_VERTEX_SHADER);
     glShaderSource(vshader, ARRAY_COUNT(vertexShaderSource), vertexShaderSource, vertexShaderLengths);
     glCompileShader(vshader);
-    glGetShaderiv(vshader, GL_COMPILE_STATUS, &success);
-    if (!success)
+    if (!deferStatus)
     {
-        glGetShaderInfoLog(vshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
-        ELOG("glCompileShader() failed with vertex shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+        glGetShaderiv(vshader, GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            glGetShaderInfoLog(vshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+            ELOG("glCompileShader() failed with vertex shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+        }
     }
 
     GLuint fshader = glCreateShader(GL_FRAGMENT_SHADER);
     glShaderSource(fshader, ARRAY_COUNT(fragmentShaderSource), fragmentShaderSource, fragmentShaderLengths);
     glCompileShader(fshader);
-    glGetShaderiv(fshader, GL_COMPILE_STATUS, &success);
-    if (!success)
+    if (!deferStatus)
     {
-        glGetShaderInfoLog(fshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
-        ELOG("glCompileShader() failed with fragment shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+        glGetShaderiv(fshader, GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            glGetShaderInfoLog(fshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+            ELOG("glCompileShader() failed with fragment shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+        }
+    }
+
+    GLuint gshader = 0;
+    if (geometry)
+    {
+        gshader = glCreateShader(GL_GEOMETRY_SHADER);
+        glShaderSource(gshader, ARRAY_COUNT(geometryShaderSource), geometryShaderSource, geometryShaderLengths);
+        glCompileShader(gshader);
+        if (!deferStatus)
+        {
+            glGetShaderiv(gshader, GL_COMPILE_STATUS, &success);
+            if (!success)
+            {
+                glGetShaderInfoLog(gshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+                ELOG("glCompileShader() failed with geometry shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+            }
+        }
     }
 
     GLuint programHandle = glCreateProgram();
     glAttachShader(programHandle, vshader);
     glAttachShader(programHandle, fshader);
+    if (gshader)
+        glAttachShader(programHandle, gshader);
+    glProgramParameteri(programHandle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(programHandle);
-    glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
-    if (!success)
+    if (!deferStatus)
     {
-        glGetProgramInfoLog(programHandle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
-        ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+        glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            glGetProgramInfoLog(programHandle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+            ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+        }
     }
 
     glUseProgram(0);
 
+    //the link has its own copy, the shaders can go while it is still in flight
     glDetachShader(programHandle, vshader);
     glDetachShader(programHandle, fshader);
     glDeleteShader(vshader);
     glDeleteShader(fshader);
+    if (gshader)
+    {
+        glDetachShader(programHandle, gshader);
+        glDeleteShader(gshader);
+    }
 
     return programHandle;
 }
 
-u32 LoadProgram(App* app, const char* filepath, const char* programName)
+GLuint CreateComputeProgramFromSource(String programSource, const char* shaderName)
 {
-    String programSource = ReadTextFile(filepath);
+    GLchar  infoLogBuffer[1024] = {};
+    GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
+    GLsizei infoLogSize;
+    GLint   success;
 
-    Program program = {};
-    program.handle = CreateProgramFromSource(programSource, programName);
-    program.filepath = filepath;
-    program.programName = programName;
-    program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
-    
-	int attributeCount;
+    char versionString[] = "#version 430\n";
+    char shaderNameDefine[128];
+    sprintf(shaderNameDefine, "#define %s\n", shaderName);
+    char computeShaderDefine[] = "#define COMPUTE\n";
+
+    const GLchar* computeShaderSource[] = {
+        versionString,
+        shaderNameDefine,
+        computeShaderDefine,
+        programSource.str
+    };
+    const GLint computeShaderLengths[] = {
+        (GLint) strlen(versionString),
+        (GLint) strlen(shaderNameDefine),
+        (GLint) strlen(computeShaderDefine),
+        (GLint) programSource.len
+    };
+
+    GLuint cshader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(cshader, ARRAY_COUNT(computeShaderSource), computeShaderSource, computeShaderLengths);
+    glCompileShader(cshader);
+    glGetShaderiv(cshader, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderInfoLog(cshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+        ELOG("glCompileShader() failed with compute shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+    }
+
+    GLuint programHandle = glCreateProgram();
+    glAttachShader(programHandle, cshader);
+    glProgramParameteri(programHandle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(programHandle);
+    glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glGetProgramInfoLog(programHandle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+        ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+    }
+
+    glUseProgram(0);
+
+    glDetachShader(programHandle, cshader);
+    glDeleteShader(cshader);
+
+    return programHandle;
+}
+
+static const char* UniformNames[Uniform_Count] =
+{
+	"uTextureBuckets",
+	"cameraProj",
+
+	"uAlbedo",
+	"uNormal",
+	"uPosition",
+	"uSpecular",
+	"current_light",
+
+	"clippingPlane",
+
+	"uProjectionMatrix",
+	"uWorldViewMatrix",
+	"viewportSize",
+	"modelViewMatrix",
+	"viewMatrixInv",
+	"projectionMatrixInv",
+	"waterMap",
+	"waterDepth",
+	"normalMap",
+	"dudvMap",
+	"currdepthMap",
+	"isDeferred",
+
+	"uViewMatrix",
+	"uInverseProjection",
+	"uScreenSize",
+	"uClusterDepthRange",
+	"uLightCount",
+	"uDepth",
+	"uCompactGBuffer",
+	"uDebugView",
+	"uRenderTargetScale",
+	"uReflectionScale",
+	"uRefractionScale",
+	"uLayerViewProjection",
+	"uLayerMask",
+	"uSceneRefraction",
+	"uSceneDepth",
+	"uDepthPyramid",
+	"uDepthPyramidLevels",
+	"uSceneColor",
+	"uScreenSpaceReflection",
+	"uPlanarFallback",
+	"uSkyColor",
+};
+
+void BuildProgramReflection(Program& program)
+{
+	program.uniforms.clear();
+	program.uniformBlocks.clear();
+
+	GLchar name[256];
+	GLsizei nameLength;
+
+	//loose uniforms (the ones inside blocks have no location)
+	GLint uniformCount = 0;
+	glGetProgramiv(program.handle, GL_ACTIVE_UNIFORMS, &uniformCount);
+
+	for (GLint i = 0; i < uniformCount; ++i)
+	{
+		ProgramUniform uniform = {};
+		glGetActiveUniform(program.handle, i, ARRAY_COUNT(name), &nameLength, &uniform.size, &uniform.type, name);
+
+		uniform.location = glGetUniformLocation(program.handle, name);
+		if (uniform.location == -1)
+			continue;
+
+		//arrays are reported as "name[0]"
+		char* bracket = strchr(name, '[');
+		if (bracket)
+			*bracket = '\0';
+
+		uniform.name = name;
+		program.uniforms.push_back(uniform);
+	}
+
+	GLint blockCount = 0;
+	glGetProgramiv(program.handle, GL_ACTIVE_UNIFORM_BLOCKS, &blockCount);
+
+	for (GLint i = 0; i < blockCount; ++i)
+	{
+		ProgramUniformBlock block = {};
+		glGetActiveUniformBlockName(program.handle, i, ARRAY_COUNT(name), &nameLength, name);
+		glGetActiveUniformBlockiv(program.handle, i, GL_UNIFORM_BLOCK_BINDING, &block.binding);
+		glGetActiveUniformBlockiv(program.handle, i, GL_UNIFORM_BLOCK_DATA_SIZE, &block.dataSize);
+
+		block.index = i;
+		block.name = name;
+		program.uniformBlocks.push_back(block);
+	}
+
+	//resolve the engine handles, -1 is silently ignored by glUniform* if the program doesn't use it
+	for (u32 i = 0; i < Uniform_Count; ++i)
+	{
+		program.uniformLocations[i] = -1;
+
+		for (u32 j = 0; j < program.uniforms.size(); ++j)
+		{
+			if (program.uniforms[j].name == UniformNames[i])
+			{
+				program.uniformLocations[i] = program.uniforms[j].location;
+				break;
+			}
+		}
+	}
+}
+
+//the attributes the vertex shader reads, FindVAO checks the arena has each of them. The draw id
+//comes from the instanced buffer of the arena instead of the vertex format
+static void BuildVertexInputLayout(Program& program)
+{
+	program.vertexInputLayout.attributes.clear();
+
+	GLint attributeCount = 0;
 	glGetProgramiv(program.handle, GL_ACTIVE_ATTRIBUTES, &attributeCount);
 
 	GLchar attName[256];
@@ -110,25 +342,159 @@ u32 LoadProgram(App* app, const char* filepath, const char* programName)
 	GLint attSize;
 	GLenum attType;
 
-	for (size_t i = 0; i < attributeCount; i++)
+	for (GLint i = 0; i < attributeCount; i++)
 	{
-		VertexShaderAttribute v = {};
-		glGetActiveAttrib(program.handle, i, 256, &attNameLength, &attSize, &attType, attName);
-	
-		u8 attribute_location = glGetAttribLocation(program.handle, attName);
+		glGetActiveAttrib(program.handle, i, ARRAY_COUNT(attName), &attNameLength, &attSize, &attType, attName);
+
+		GLint location = glGetAttribLocation(program.handle, attName);
+		if (location == -1 || location == DRAW_ID_LOCATION)
+			continue;
 
+		VertexShaderAttribute v = {};
+		v.location = location;
+		switch (attType)
+		{
+			case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_UNSIGNED_INT_VEC2: v.componentCount = 2; break;
+			case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_UNSIGNED_INT_VEC3: v.componentCount = 3; break;
+			case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_UNSIGNED_INT_VEC4: v.componentCount = 4; break;
+			default: v.componentCount = 1; break;
+		}
 		program.vertexInputLayout.attributes.push_back(v);
 	}
+}
+
+bool ReloadProgram(App* app, u32 programIdx)
+{
+	//a variant still compiling is settled first, it stays in use if the new source fails
+	FinishProgram(app, programIdx);
+	Program& program = app->programs[programIdx];
+
+	String programSource = ReadTextFile(program.filepath.c_str());
+	if (!programSource.str)
+		return false;
+
+	//compiled on a copy, the cache key and state of the program must keep matching the handle in use
+	Program compiled = program;
+	GLuint handle = CompileProgram(app, compiled, programSource);
+
+	GLint success;
+	glGetProgramiv(handle, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		//keep using the old program until the shader is fixed
+		glDeleteProgram(handle);
+		return false;
+	}
+
+	glDeleteProgram(program.handle);
+	program.handle = handle;
+	program.cacheKey = compiled.cacheKey;
+	program.pending = compiled.pending;
+	program.lastWriteTimestamp = GetFileLastWriteTimestamp(program.filepath.c_str());
+
+	BuildVertexInputLayout(program);
+	BuildProgramReflection(program);
+	return true;
+}
+
+//the binary from the program cache when it has a usable one, otherwise the source is compiled and
+//the result stored. With deferStatus the store waits for FinishProgram
+GLuint CompileProgram(App* app, Program& program, String programSource, bool deferStatus)
+{
+	ProgramCache& cache = app->programCache;
+	f64 start = GetPlatformTime();
+
+	program.cacheKey = ProgramCacheKey(app, program, programSource);
+	program.pending = false;
+
+	GLuint handle = LoadCachedProgram(app, program.cacheKey);
+	if (!handle)
+	{
+		if (program.compute)
+			handle = CreateComputeProgramFromSource(programSource, program.programName.c_str());
+		else
+			handle = CreateProgramFromSource(programSource, program.programName.c_str(), program.geometry, program.defines.c_str(), deferStatus);
+
+		program.pending = deferStatus;
+		if (!deferStatus)
+			StoreCachedProgram(app, program.cacheKey, handle);
+	}
+
+	cache.programTime += GetPlatformTime() - start;
+	return handle;
+}
+
+//variants are linked without waiting for the compiler, their status and reflection are read here
+//the first time they are used
+void FinishProgram(App* app, u32 programIdx)
+{
+	Program& program = app->programs[programIdx];
+	if (!program.pending)
+		return;
+	program.pending = false;
+
+	f64 start = GetPlatformTime();
+
+	GLint success;
+	glGetProgramiv(program.handle, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		GLchar infoLogBuffer[1024] = {};
+		glGetProgramInfoLog(program.handle, sizeof(infoLogBuffer), NULL, infoLogBuffer);
+		ELOG("glLinkProgram() failed with program %s\n%sReported message:\n%s\n", program.programName.c_str(), program.defines.c_str(), infoLogBuffer);
+	}
+	else
+	{
+		StoreCachedProgram(app, program.cacheKey, program.handle);
+	}
+
+	app->programCache.programTime += GetPlatformTime() - start;
+
+	BuildProgramReflection(program);
+}
+
+u32 LoadProgram(App* app, const char* filepath, const char* programName, bool geometry)
+{
+    String programSource = ReadTextFile(filepath);
+
+    Program program = {};
+    program.filepath = filepath;
+    program.programName = programName;
+    program.geometry = geometry;
+    program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+    program.handle = CompileProgram(app, program, programSource);
+
+	BuildVertexInputLayout(program);
+	BuildProgramReflection(program);
 
 	app->programs.push_back(program);
 
     return app->programs.size() - 1;
 }
 
+u32 LoadComputeProgram(App* app, const char* filepath, const char* programName)
+{
+	String programSource = ReadTextFile(filepath);
+
+	Program program = {};
+	program.filepath = filepath;
+	program.programName = programName;
+	program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+	program.compute = true;
+	program.handle = CompileProgram(app, program, programSource);
+
+	BuildProgramReflection(program);
+
+	app->programs.push_back(program);
+
+	return app->programs.size() - 1;
+}
+
 Image LoadImage(const char* filename)
 {
     Image img = {};
-    stbi_set_flip_vertically_on_load(true);
+    //per thread, the workers decode side by side
+    stbi_set_flip_vertically_on_load_thread(true);
     img.pixels = stbi_load(filename, &img.size.x, &img.size.y, &img.nchannels, 0);
     if (img.pixels)
     {
@@ -157,51 +523,79 @@ void FreeImage(Image image)
     stbi_image_free(image.pixels);
 }
 
-GLuint CreateTexture2DFromImage(Image image)
+GLenum TextureInternalFormat(const Image& image)
 {
-    GLenum internalFormat = GL_RGB8;
-    GLenum dataFormat     = GL_RGB;
-    GLenum dataType       = GL_UNSIGNED_BYTE;
-
     switch (image.nchannels)
     {
-        case 3: dataFormat = GL_RGB; internalFormat = GL_RGB8; break;
-        case 4: dataFormat = GL_RGBA; internalFormat = GL_RGBA8; break;
+        case 3: return GL_RGB8;
+        case 4: return GL_RGBA8;
         default: ELOG("LoadTexture2D() - Unsupported number of channels");
     }
+    return GL_RGB8;
+}
+
+//(re)defines the whole mip chain of the texture from the image
+static void UploadTexture2DImage(GLuint texHandle, const Image& image)
+{
+    GLenum internalFormat = TextureInternalFormat(image);
+    GLenum dataFormat     = internalFormat == GL_RGBA8 ? GL_RGBA : GL_RGB;
+    GLenum dataType       = GL_UNSIGNED_BYTE;
 
+    glBindTexture(GL_TEXTURE_2D, texHandle);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.size.x, image.size.y, 0, dataFormat, dataType, image.pixels);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+GLuint CreateTexture2DFromImage(Image image)
+{
     GLuint texHandle;
     glGenTextures(1, &texHandle);
     glBindTexture(GL_TEXTURE_2D, texHandle);
-    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.size.x, image.size.y, 0, dataFormat, dataType, image.pixels);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	//I made it so that GL_REPEAT is the default result instead of clamping to edge
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glGenerateMipmap(GL_TEXTURE_2D);
     glBindTexture(GL_TEXTURE_2D, 0);
 
+    UploadTexture2DImage(texHandle, image);
     return texHandle;
 }
 
 u32 LoadTexture2D(App* app, const char* filepath)
 {
-    for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
-        if (app->textures[texIdx].filepath == filepath)
-            return texIdx;
+    u32 loadedIdx = FindTexturePath(app, filepath, TextureCompression_None);
+    if (loadedIdx != UINT32_MAX)
+        return loadedIdx;
 
     Image image = LoadImage(filepath);
 
     if (image.pixels)
     {
+        u32 texIdx = app->textures.size();
+
         Texture tex = {};
-        tex.handle = CreateTexture2DFromImage(image);
         tex.filepath = filepath;
+        tex.size = image.size;
+        tex.internalFormat = TextureInternalFormat(image);
+        tex.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+        tex.resident = true;
+        tex.contentHash = HashTextureContent(image, TextureCompression_None, tex.internalFormat);
+        tex.contentOwner = texIdx;
+
+        //the same pixels under another path share the texture already uploaded
+        u32 ownerIdx = FindTextureContent(app, tex.contentHash);
+        if (ownerIdx == UINT32_MAX)
+            tex.handle = CreateTexture2DFromImage(image);
 
-        u32 texIdx = app->textures.size();
         app->textures.push_back(tex);
+        RegisterTexturePath(app, texIdx);
+        if (ownerIdx == UINT32_MAX)
+            RegisterTextureContent(app, texIdx);
+        else
+            ShareTextureContent(app, texIdx, ownerIdx);
 
         FreeImage(image);
         return texIdx;
@@ -212,6 +606,70 @@ u32 LoadTexture2D(App* app, const char* filepath)
     }
 }
 
+//cooked again, the cache file is older than the source now
+static bool ReloadCookedTexture2D(App* app, u32 texIdx)
+{
+    CookedTexture cooked;
+    bool cacheHit;
+    if (!CookTexture(app->textures[texIdx].filepath.c_str(), app->textures[texIdx].compression, cooked, cacheHit))
+        return false;
+
+    bool detached = DetachTextureContent(app, texIdx);
+
+    Texture& tex = app->textures[texIdx];
+    if (tex.handle)
+        UploadCookedTexture2D(tex.handle, cooked, cooked.data.data());
+    else
+        tex.handle = CreateTexture2DFromCooked(cooked, cooked.data.data());
+    tex.size = cooked.size;
+    tex.internalFormat = cooked.internalFormat;
+    tex.lastWriteTimestamp = GetFileLastWriteTimestamp(tex.filepath.c_str());
+    tex.contentHash = cooked.contentHash;
+    if (FindTextureContent(app, tex.contentHash) == UINT32_MAX)
+        RegisterTextureContent(app, texIdx);
+
+    if (detached)
+        app->materialTable.layoutDirty = true;
+    else
+        UpdateMaterialTexture(app, texIdx);
+    return true;
+}
+
+//the file is read again into the same handle, so the index and whoever holds the handle stay valid.
+//An image that can't be read keeps the old contents. A texture sharing its pixels with others is
+//split from them first, into a handle and a layer of its own
+bool ReloadTexture2D(App* app, u32 texIdx)
+{
+    if (app->textures[texIdx].compression != TextureCompression_None)
+        return ReloadCookedTexture2D(app, texIdx);
+
+    Image image = LoadImage(app->textures[texIdx].filepath.c_str());
+    if (!image.pixels)
+        return false;
+
+    bool detached = DetachTextureContent(app, texIdx);
+
+    Texture& tex = app->textures[texIdx];
+    if (tex.handle)
+        UploadTexture2DImage(tex.handle, image);
+    else
+        tex.handle = CreateTexture2DFromImage(image);
+    tex.size = image.size;
+    tex.internalFormat = TextureInternalFormat(image);
+    tex.lastWriteTimestamp = GetFileLastWriteTimestamp(tex.filepath.c_str());
+    tex.contentHash = HashTextureContent(image, TextureCompression_None, tex.internalFormat);
+    if (FindTextureContent(app, tex.contentHash) == UINT32_MAX)
+        RegisterTextureContent(app, texIdx);
+    FreeImage(image);
+
+    //its old layer is still the shared one
+    if (detached)
+        app->materialTable.layoutDirty = true;
+    else
+        UpdateMaterialTexture(app, texIdx);
+    return true;
+}
+
 void Init(App* app)
 {
 
@@ -239,6 +697,9 @@ void Init(App* app)
 	{
 		app->OpenGLinfo->OpenGLextensions.push_back((char*)glGetStringi(GL_EXTENSIONS, GLuint(i)));
 	}
+
+	//keyed by the driver strings, they have to be read first
+	InitProgramCache(app);
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
 
@@ -284,25 +745,32 @@ void Init(App* app)
 
 	glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &app->maxUniformBufferSize);
 	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &app->uniformBlockAlignment);
-	
-	int pat1 = LoadModel(app, "Patrick/Patrick.obj");
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &app->storageBlockAlignment);
+
+	InitGeometryArenas(app);
+	StartWorkerPool(app->workers);
+	InitTextureStreaming(app);
+	InitTextureCooking(app);
+
+	//imported on the workers side by side, each model shows up the frame its upload is done
+	int pat1 = LoadModelAsync(app, "Patrick/Patrick.obj");
 	ChangePos(&app->models[pat1], 2, 1.5, -1);
 	ChangeScl(&app->models[pat1], 0.45, 0.45, 0.45);
 	ChangeRot(&app->models[pat1], 0, -90, 0);
 	RecalculateMatrix(&app->models[pat1]);
 	
-	int pat2 = LoadModel(app, "Patrick/Patrick.obj");
+	int pat2 = LoadModelAsync(app, "Patrick/Patrick.obj");
 	ChangePos(&app->models[pat2], -1, 2, 2);
 	ChangeScl(&app->models[pat2], 0.45, 0.45, 0.45);
 	ChangeRot(&app->models[pat2], 0, 0, 0);
 	RecalculateMatrix(&app->models[pat2]);
 
-	int floor = LoadModel(app, "StoneFloor/StoneFloor.obj");
+	int floor = LoadModelAsync(app, "StoneFloor/StoneFloor.obj");
 	ChangeScl(&app->models[floor],0.5, 0.5, 0.5);
 	ChangePos(&app->models[floor], 0, -0.5, 0);
 	RecalculateMatrix(&app->models[floor]);
 
-	int toy = LoadModel(app, "TOYBOX/ToyBox.obj");
+	int toy = LoadModelAsync(app, "TOYBOX/ToyBox.obj");
 	ChangePos(&app->models[toy], 0, 1, 0);
 	ChangeScl(&app->models[toy], 0.2, 0.2, 0.2);
 	RecalculateMatrix(&app->models[toy]);	
@@ -312,10 +780,11 @@ void Init(App* app)
 	glBufferData(GL_UNIFORM_BUFFER, app->maxUniformBufferSize, NULL, GL_STREAM_DRAW);
 	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
-	app->cbuffer = CreateBuffer(app->maxUniformBufferSize,GL_UNIFORM_BUFFER,GL_STREAM_DRAW);
-	app->LocalAttBuffer = CreateBuffer(app->maxUniformBufferSize, GL_UNIFORM_BUFFER, GL_STREAM_DRAW);
-	app->LightTransformBuffer = CreateBuffer(sizeof(glm::mat4), GL_UNIFORM_BUFFER, GL_STREAM_DRAW);
-	app->LightParamsBuffer = CreateBuffer(app->maxUniformBufferSize, GL_UNIFORM_BUFFER, GL_STREAM_DRAW);
+	app->cbuffer = CreateConstantRingBuffer(app->maxUniformBufferSize);
+	//one region per queue submission, so a frame can submit every pass without waiting on itself
+	app->DrawParamsBuffer = CreateRingBuffer(DrawParamsRegionSize(app, INITIAL_SCENE_DRAWS), GL_SHADER_STORAGE_BUFFER, RING_BUFFER_FRAMES * RenderPass_Count);
+	app->sceneDrawCapacity = INITIAL_SCENE_DRAWS;
+	app->LightTransformBuffer = CreateConstantRingBuffer(app->maxUniformBufferSize);
 
 
 	app->diceTexIdx = LoadTexture2D(app, "dice.png");
@@ -342,39 +811,50 @@ void Init(App* app)
 
 	glBindTexture(GL_TEXTURE_2D, 0);
 
-	app->forwardRenderProgramIdx = LoadProgram(app, "forward_shading.glsl", "FORWARD_SHADING_RENDER");
-	Program& forwardRenderProgramIdx = app->programs[app->forwardRenderProgramIdx];
-	forwardRenderProgramIdx.vertexInputLayout.attributes.push_back({ 0,3 });
-	forwardRenderProgramIdx.vertexInputLayout.attributes.push_back({ 2,2 });
-	forwardRenderProgramIdx.vertexInputLayout.attributes.push_back({ 1,3 });
-	forwardRenderProgramIdx.vertexInputLayout.attributes.push_back({ 3,3 });
-	forwardRenderProgramIdx.vertexInputLayout.attributes.push_back({ 4,3 });
-
-	app->mapCalculationProgramIdx = LoadProgram(app, "map_calculation.glsl", "MAP_CALCULATION_SHADER");
-	Program& mapCalculationProgramIdx = app->programs[app->mapCalculationProgramIdx];
-	mapCalculationProgramIdx.vertexInputLayout.attributes.push_back({ 0,3 });
-	mapCalculationProgramIdx.vertexInputLayout.attributes.push_back({ 2,2 });
-	mapCalculationProgramIdx.vertexInputLayout.attributes.push_back({ 1,3 });
-	mapCalculationProgramIdx.vertexInputLayout.attributes.push_back({ 3,3 });
-	mapCalculationProgramIdx.vertexInputLayout.attributes.push_back({ 4,3 });
+	//the materials of the models still importing are added when they finish, UpdateMaterialTable
+	//builds the table again then
+	BuildMaterialTable(app);
 
+	//the vertex input layouts are read from the linked programs
 	app->deferredRenderProgramIdx = LoadProgram(app, "deferred.glsl", "DEFERRED_SHADING_RENDER");
-	Program& deferredRenderProgramIdx = app->programs[app->deferredRenderProgramIdx];
-	deferredRenderProgramIdx.vertexInputLayout.attributes.push_back({ 0,3 });
-	deferredRenderProgramIdx.vertexInputLayout.attributes.push_back({ 1,2 });
-
-
-	app->waterRenderProgramIdx = LoadProgram(app, "water_render.glsl", "WATER_REFL_REFR_RENDER_SHADER");
-	Program& waterRenderProgramIdx = app->programs[app->waterRenderProgramIdx];
-	waterRenderProgramIdx.vertexInputLayout.attributes.push_back({ 0,3 });
-	waterRenderProgramIdx.vertexInputLayout.attributes.push_back({ 2,2 });
-	waterRenderProgramIdx.vertexInputLayout.attributes.push_back({ 1,3 });
-
-
+	app->waterRenderProgramIdx = LoadProgram(app, "water_render.glsl", "WATER_REFL_REFR_RENDER_SHADER", true);
 	app->waterPlaneProgramIdx = LoadProgram(app, "water_plane.glsl", "WATER_PLANE_RENDER_SHADER");
-	Program& waterPlaneProgramIdx = app->programs[app->waterPlaneProgramIdx];
-	waterPlaneProgramIdx.vertexInputLayout.attributes.push_back({ 0,3 });
-	waterPlaneProgramIdx.vertexInputLayout.attributes.push_back({ 1,3 });
+	app->depthPrepassProgramIdx = LoadProgram(app, "depth_prepass.glsl", "DEPTH_PREPASS");
+
+	//the scene shaders compile a variant per combination of the maps the materials have. Forward+
+	//only loops over the lights of its screen tile. The depth variants draw the height mapped
+	//materials into the pre-pass with the same parallax code as the pass that shades them, the
+	//rest of the materials use the plain depth program
+	VertexShaderLayout sceneLayout = {};
+	sceneLayout.attributes.push_back({ 0,3 });
+	sceneLayout.attributes.push_back({ 2,2 });
+	sceneLayout.attributes.push_back({ 1,3 });
+	sceneLayout.attributes.push_back({ 3,3 });
+	sceneLayout.attributes.push_back({ 4,3 });
+
+	const u32 allFeatures = MaterialFeature_NormalMap | MaterialFeature_HeightMap | MaterialFeature_SpecularMap;
+	InitParallelShaderCompile(app);
+	InitProgramPermutations(app->forwardPrograms, "forward_shading.glsl", "FORWARD_SHADING_RENDER", allFeatures, sceneLayout);
+	InitProgramPermutations(app->forwardPlusPrograms, "forward_shading.glsl", "FORWARD_PLUS_RENDER", allFeatures, sceneLayout);
+	InitProgramPermutations(app->forwardDepthPrograms, "forward_shading.glsl", "FORWARD_SHADING_DEPTH", MaterialFeature_HeightMap, sceneLayout, app->depthPrepassProgramIdx);
+	InitProgramPermutations(app->gbufferPrograms, "map_calculation.glsl", "MAP_CALCULATION_SHADER", allFeatures, sceneLayout);
+	InitProgramPermutations(app->gbufferDepthPrograms, "map_calculation.glsl", "MAP_CALCULATION_DEPTH", MaterialFeature_HeightMap, sceneLayout, app->depthPrepassProgramIdx);
+
+	//started all at once so the driver can compile them side by side, nothing waits until a pass draws.
+	//The models still importing prewarm theirs when they finish
+	PrewarmScenePermutations(app, 0);
+
+	app->gbufferDebugProgramIdx = LoadProgram(app, "deferred.glsl", "GBUFFER_DEBUG_VIEW");
+
+	InitLightCulling(app);
+	InitDepthPyramid(app);
+
+	//a cold start compiles every program, a warm one loads their binaries. The variants still
+	//compiling are waited for in the first frames, the total keeps adding those
+	ProgramCache& programCache = app->programCache;
+	programCache.startupTime = programCache.programTime;
+	ILOG("Programs ready in %.1f ms, %u from the program cache and %u compiled\n",
+		programCache.startupTime * 1000.0, programCache.hits, programCache.misses);
 
 	AddLight(LightType_Ambient, { 1,1,1 }, { 0,1,0 }, { 0,0,0 }, app);
 	AddLight(LightType_Directional, { 1,1,1 }, { 0,1,0 }, { 0,0,-7 }, app);
@@ -390,6 +870,16 @@ void Init(App* app)
 
 	app->mode = Mode_FinalRender;
 	app->rendermode = RenderMode_Forward;
+
+	StartAssetWatcher(app);
+}
+
+void Shutdown(App* app)
+{
+	StopAssetWatcher(app);
+	StopWorkerPool(app->workers);
+	ReleaseModelImports(app);
+	ReleaseTextureStreaming(app);
 }
 
 void Gui(App* app)
@@ -397,6 +887,79 @@ void Gui(App* app)
 
     ImGui::Begin("Info");
     ImGui::Text("FPS: %f", 1.0f/app->deltaTime);
+	ImGui::Text("Scene pass: %u instances in %u draws, %u multi-draws, %u vao binds, %u texture binds, %u programs",
+		app->sceneQueue.instanceCount, app->sceneQueue.drawCount, app->sceneQueue.multiDrawCount, app->sceneQueue.vaoBinds, app->sceneQueue.textureBinds, app->sceneQueue.programBinds);
+	ImGui::Text("Culling: scene %u visible / %u culled, water %u / %u",
+		app->sceneQueue.visibleCount, app->sceneQueue.culledCount,
+		app->waterQueue.visibleCount, app->waterQueue.culledCount);
+	ImGui::Text("Water pass: %u instances in %u draws, %u multi-draws, %u vao binds",
+		app->waterQueue.instanceCount, app->waterQueue.drawCount, app->waterQueue.multiDrawCount, app->waterQueue.vaoBinds);
+	ImGui::Text("Shader permutations: %u compiled, %u shared, %u compiling, parallel compile %s",
+		app->permutationCount, app->sharedPermutationCount, PendingProgramPermutations(app), app->parallelShaderCompile ? "on" : "off");
+	const ProgramCache& programCache = app->programCache;
+	ImGui::Text("Programs: %.1f ms at startup, %.1f ms in total, %u from the cache, %u compiled, %u stale entries%s",
+		programCache.startupTime * 1000.0, programCache.programTime * 1000.0, programCache.hits, programCache.misses,
+		programCache.staleEntries, programCache.enabled ? "" : " (no binary formats, cache off)");
+	const AssetWatcher& assetWatcher = app->assetWatcher;
+	ImGui::Text("Hot reload (%s): %u reloads, %u failed, last %s in %.1f ms, %.1f ms after the change (worst %.1f ms)",
+		assetWatcher.backend ? assetWatcher.backend : "off", assetWatcher.reloadCount, assetWatcher.failedCount,
+		assetWatcher.lastAsset.empty() ? "-" : assetWatcher.lastAsset.c_str(), assetWatcher.lastReloadTime * 1000.0,
+		assetWatcher.lastLatency * 1000.0, assetWatcher.maxLatency * 1000.0);
+	const ModelImports& modelImports = app->modelImports;
+	ImGui::Text("Model import: %u workers, %u pending, %u done, %u failed, %.1f ms on the workers, ready %.1f ms after the first request",
+		(u32)app->workers.threads.size(), modelImports.pending, modelImports.completed, modelImports.failed,
+		modelImports.workerTime * 1000.0, modelImports.readyTime * 1000.0);
+	TextureStreaming& textureStreaming = app->textureStreaming;
+	ImGui::Text("Texture streaming: %u pending, %u resident, %u failed, %.2f MB this frame, %.1f MB in total, %u frames out of upload buffers",
+		textureStreaming.pending, textureStreaming.residentCount, textureStreaming.failedCount,
+		textureStreaming.frameBytes / (1024.0 * 1024.0), textureStreaming.totalBytes / (1024.0 * 1024.0), textureStreaming.bufferWaits);
+	int uploadBudgetKB = textureStreaming.frameBudget / 1024;
+	if (ImGui::SliderInt("Texture upload budget (KB per frame)", &uploadBudgetKB, 256, 64 * 1024))
+		textureStreaming.frameBudget = uploadBudgetKB * 1024;
+	const TextureCooking& textureCooking = app->textureCooking;
+	ImGui::Text("Texture cooking: %s, %u encoded in %.1f ms on the workers, %u from the cache, %.1f MB on the GPU instead of %.1f MB",
+		textureCooking.s3tc ? "BC1/BC3/BC4/BC5" : "BC4/BC5 (no s3tc)", textureCooking.encoded, textureCooking.encodeTime * 1000.0,
+		textureCooking.cacheHits, textureCooking.cookedBytes / (1024.0 * 1024.0), textureCooking.uncompressedBytes / (1024.0 * 1024.0));
+	const TextureRegistry& textureRegistry = app->textureRegistry;
+	ImGui::Text("Texture registry: %u textures, %.2f probes per lookup, %u sharing another's pixels, %.1f MB saved",
+		(u32)app->textures.size(), textureRegistry.lookups ? (f32)textureRegistry.probes / textureRegistry.lookups : 0.0f,
+		textureRegistry.duplicates, textureRegistry.savedBytes / (1024.0 * 1024.0));
+	ImGui::Text("Geometry: %u meshes for %u models, %u vertex arenas, %u indices",
+		(u32)app->meshes.size(), (u32)app->models.size(), (u32)app->geometryArenas.size(), app->indexArenaCount);
+	ImGui::Text("Material table: %u materials, %u texture buckets, %u uploads",
+		app->materialTable.builtMaterialCount, (u32)app->materialTable.buckets.size(), app->materialTable.uploadCount);
+
+	if (ImGui::CollapsingHeader("Uniform ring buffers"))
+	{
+		RingBuffer* rings[] = { &app->DrawParamsBuffer, &app->cbuffer, &app->LightTransformBuffer };
+		const char* ringNames[] = { "Draw params", "Global params", "Light transforms" };
+		for (u32 i = 0; i < ARRAY_COUNT(rings); ++i)
+		{
+			ImGui::Text("%s (%s): %u stalls, last wait %.3f ms, total %.3f ms", ringNames[i],
+				rings[i]->persistent ? "persistent" : "unsynchronized",
+				rings[i]->waitCount, rings[i]->lastWaitTime * 1000.0, rings[i]->totalWaitTime * 1000.0);
+		}
+	}
+
+	if (ImGui::CollapsingHeader("BVH"))
+	{
+		const BVH& bvh = app->sceneBVH;
+		ImGui::Checkbox("Hierarchical culling", &app->bvhCulling);
+		ImGui::Text("%u nodes over %u bounds, last build %.3f ms, last refit %.3f ms",
+			bvh.nodeCount, app->worldBounds.count, bvh.lastBuildTime * 1000.0, bvh.lastRefitTime * 1000.0);
+		ImGui::Text("Picked: %s", app->pickedModel >= 0 ? app->models[app->pickedModel].name.c_str() : "nothing (click the render view)");
+
+		static int benchmarkItems = 50000;
+		ImGui::InputInt("Benchmark bounds", &benchmarkItems);
+		if (ImGui::Button("Run benchmark") && benchmarkItems > 0)
+			RunBVHBenchmark(app->bvhBenchmark, benchmarkItems);
+		if (app->bvhBenchmark.itemCount)
+		{
+			ImGui::Text("%u bounds, %u nodes: build %.3f ms, full refit %.3f ms, 1%% refit %.3f ms",
+				app->bvhBenchmark.itemCount, app->bvhBenchmark.nodeCount, app->bvhBenchmark.buildTime * 1000.0,
+				app->bvhBenchmark.fullRefitTime * 1000.0, app->bvhBenchmark.partialRefitTime * 1000.0);
+		}
+	}
 
     ImGui::End();
 
@@ -425,6 +988,9 @@ void Gui(App* app)
 	case Mode_FinalRender:
 		curr_mode += "Final";
 		break;
+	case Mode_LightTiles:
+		curr_mode += "Light tiles";
+		break;
 	default:
 		curr_mode += "unknown";
 		break;
@@ -432,12 +998,49 @@ void Gui(App* app)
 
 	ImGui::Text(curr_mode.c_str());
 
+	if (ImGui::Button("Reload shaders"))
+	{
+		for (u32 i = 0; i < app->programs.size(); ++i)
+			ReloadProgram(app, i);
+		app->lightClusters.boundsDirty = true;
+	}
+	ImGui::SameLine();
+	if (ImGui::Button("Clear program cache"))
+	{
+		//the next start is a cold one again
+		for (u32 i = 0; i < app->programs.size(); ++i)
+			DeleteCachedProgram(app->programs[i].cacheKey);
+	}
+
 
 	if (ImGui::Button("Final"))
 	{
 		app->mode = Mode_FinalRender;
 		app->rendermode = RenderMode_Forward;
 	}
+	if (app->rendermode == RenderMode_Forward)
+	{
+		ImGui::Checkbox("Forward+", &app->forwardPlus);
+		if (!app->forwardPlus)
+			ImGui::Checkbox("Depth pre-pass", &app->depthPrepass);
+		if (app->forwardPlus)
+		{
+			const LightTiles& tiles = app->lightTiles;
+			ImGui::Text("%ux%u tiles, %u / %u tile light indices, list grown %u times",
+				tiles.tileCount.x, tiles.tileCount.y, tiles.indices.lastCount, tiles.indices.capacity, tiles.indices.overflowCount);
+			ImGui::Text("%u tiles over the per tile light limit, %u frames with lights dropped",
+				tiles.indices.lastTruncated, tiles.indices.truncatedFrames);
+
+			if (ImGui::Button("Light tiles"))
+			{
+				app->mode = Mode_LightTiles;
+			}
+		}
+		else if (app->mode == Mode_LightTiles)
+		{
+			app->mode = Mode_FinalRender;
+		}
+	}
 
 	if (ImGui::Button("Deferred"))
 	{
@@ -446,6 +1049,20 @@ void Gui(App* app)
 	}
 	if (app->rendermode == RenderMode_Deferred)
 	{
+		ImGui::Checkbox("Depth pre-pass", &app->depthPrepass);
+		ImGui::Checkbox("Clustered lighting", &app->clusteredLighting);
+		if (app->clusteredLighting)
+		{
+			const LightIndexList& indices = app->lightClusters.indices;
+			ImGui::Text("%u lights (%u global), %u / %u cluster light indices, list grown %u times",
+				app->gpuLights.lightCount, app->gpuLights.globalLightCount, indices.lastCount, indices.capacity, indices.overflowCount);
+		}
+
+		if (ImGui::Checkbox("Compact G-buffer", &app->compactGBuffer))
+			GenerateBuffers(app);
+		ImGui::Text("%u bytes per pixel, %.1f MB at %dx%d", app->gbufferBytesPerPixel,
+			app->gbufferBytesPerPixel * app->displaySize.x * app->displaySize.y / (1024.0f * 1024.0f), app->displaySize.x, app->displaySize.y);
+
 		if (ImGui::CollapsingHeader("gBuffer"))
 		{
 			if (ImGui::Button("Albedo"))
@@ -473,11 +1090,58 @@ void Gui(App* app)
 
 	ImGui::Checkbox("active", &app->render_water);
 
+	if (app->render_water)
+	{
+		WaterFX& water = app->waterFX;
+		RenderGraph& graph = app->renderGraph;
+		const char* scales[] = { "full", "1/2", "1/4" };
+		const i32 divisors[] = { 1, 2, 4 };
+
+		//the targets follow the new size the next frame
+		i32 reflectionScale = water.reflectionDivisor == 4 ? 2 : water.reflectionDivisor - 1;
+		if (ImGui::Combo("reflection scale", &reflectionScale, scales, ARRAY_COUNT(scales)))
+			water.reflectionDivisor = divisors[reflectionScale];
+		i32 refractionScale = water.refractionDivisor == 4 ? 2 : water.refractionDivisor - 1;
+		if (ImGui::Combo("refraction scale", &refractionScale, scales, ARRAY_COUNT(scales)))
+			water.refractionDivisor = divisors[refractionScale];
+
+		ImGui::SliderInt("update interval", &water.updateInterval, 1, 8);
+		ImGui::Checkbox("temporal reuse", &water.temporalReuse);
+		if (water.temporalReuse)
+		{
+			ImGui::DragFloat("reuse distance", &water.reuseDistance, 0.005, 0.0, 1.0);
+			ImGui::DragFloat("reuse angle", &water.reuseAngle, 0.05, 0.0, 10.0);
+			ImGui::SliderInt("max reuse frames", &water.maxReuseFrames, 1, 120);
+		}
+
+		//screen space reflections are only used by the deferred render mode
+		const char* reflections[] = { "planar", "screen space (deferred)" };
+		i32 reflection = water.reflection;
+		if (ImGui::Combo("reflection", &reflection, reflections, ARRAY_COUNT(reflections)))
+			water.reflection = (WaterReflection)reflection;
+		if (water.reflection == WaterReflection_ScreenSpace)
+		{
+			ImGui::Checkbox("planar fallback", &water.planarFallback);
+			if (!water.planarFallback)
+				ImGui::ColorEdit3("sky color", &water.skyColor[0]);
+			ImGui::Text("depth pyramid %.3f ms", graph.passStates["Depth pyramid"].gpuTime);
+		}
+
+		ImGui::Text("reflection %dx%d, refraction %dx%d", water.reflectionSize.x, water.reflectionSize.y, water.refractionSize.x, water.refractionSize.y);
+		//one scene traversal less, the water plane is drawn last over the main pass anyway
+		ImGui::Checkbox("refraction from scene copy", &water.sceneRefraction);
+		if (water.reflection == WaterReflection_ScreenSpace || water.sceneRefraction)
+			ImGui::Text("scene copy %.3f ms", graph.passStates["Scene copy"].gpuTime + graph.passStates["Scene copy (deferred)"].gpuTime);
+
+		const char* layers[] = { "none", "reflection", "refraction", "reflection and refraction" };
+		ImGui::Text("update: %.3f ms, %s", graph.passStates["Water"].gpuTime, layers[water.renderedLayers]);
+		ImGui::Text("per frame: %.3f ms, %u updates", water.frameCost, water.updateCount);
+	}
+
 	ImGui::End();
 
 	
 	ImGui::Begin("RENDER");
-	glBindFramebuffer(GL_FRAMEBUFFER, app->frameBufferHandle);
 
 	static ImVec2 cach;
 	static ImVec2 reg_max;
@@ -488,20 +1152,15 @@ void Gui(App* app)
 
 	app->isrenderonfocus = ImGui::IsWindowFocused();
 
-	GLuint buffer_to_render= app->colorAttachmentHandle;
+	//the G buffer itself doesn't outlive the frame, its views are decoded into a target of their own
+	GLuint buffer_to_render= app->finalAttachmentHandle;
 	switch (app->mode)
 	{
 	case Mode_AlbedoModel:
-		buffer_to_render = app->colorAttachmentHandle;
-		break;
 	case Mode_Normals:
-		buffer_to_render = app->normalAttachmentHandle;
-		break;
 	case Mode_Position:
-		buffer_to_render = app->positionAttachmentHandle;
-		break;
 	case Mode_Specular:
-		buffer_to_render = app->specularAttachmentHandle;
+		buffer_to_render = app->gbufferDebugAttachmentHandle;
 		break;
 	case Mode_Deferred:
 		buffer_to_render = app->deferredAttachmentHandle;
@@ -509,22 +1168,62 @@ void Gui(App* app)
 	case Mode_FinalRender:
 		buffer_to_render = app->finalAttachmentHandle;
 		break;
+	case Mode_LightTiles:
+		buffer_to_render = app->lightTiles.heatmapHandle;
+		break;
 	default:
 		break;
 	}
 
+	//the pooled targets are rounded up, only the displaySize corner of them holds the image
+	ImVec2 uvMax = ImVec2(1, 1);
+	if (app->mode != Mode_LightTiles)
+		uvMax = ImVec2((f32)app->displaySize.x / app->renderTargetSize.x, (f32)app->displaySize.y / app->renderTargetSize.y);
+
 	cach = ImVec2(reg_max.x-reg_min.x,reg_max.y-reg_min.y);
 	cach = ImGui::GetWindowSize();
-	ImGui::Image((void*)buffer_to_render,cach,ImVec2(0,1),ImVec2(1,0));
+	ImGui::Image((void*)buffer_to_render,cach,ImVec2(0,uvMax.y),ImVec2(uvMax.x,0));
 
-	app->displaySize.x = cach.x;
-	app->displaySize.y = cach.y;
+	if (ImGui::IsItemClicked(0))
+	{
+		//mouse to NDC inside the image, then back to world with the render camera
+		ImVec2 itemMin = ImGui::GetItemRectMin();
+		ImVec2 itemSize = ImGui::GetItemRectSize();
+		ImVec2 mouse = ImGui::GetMousePos();
+		vec2 ndc = vec2((mouse.x - itemMin.x) / itemSize.x * 2.0f - 1.0f, 1.0f - (mouse.y - itemMin.y) / itemSize.y * 2.0f);
+
+		glm::mat4 invViewProjection = glm::inverse(app->camera.projection * app->camera.view);
+		vec4 nearPoint = invViewProjection * vec4(ndc, -1.0f, 1.0f);
+		vec4 farPoint = invViewProjection * vec4(ndc, 1.0f, 1.0f);
+		vec3 origin = vec3(nearPoint) / nearPoint.w;
+		vec3 direction = glm::normalize(vec3(farPoint) / farPoint.w - origin);
+
+		RayHit hit = RaycastBVH(app, origin, direction, app->camera.zfar);
+		app->pickedModel = hit.hit ? (i32)hit.modelIdx : -1;
+	}
+
+	//a size that falls in the bucket of the current targets is used right away. Any other waits until
+	//the window kept it for a few frames, so dragging the dock doesn't reallocate every frame
+	ivec2 windowSize = glm::max(ivec2(cach.x, cach.y), ivec2(1));
+	if (windowSize != app->pendingDisplaySize)
+	{
+		app->pendingDisplaySize = windowSize;
+		app->resizeStableFrames = 0;
+	}
+	else if (app->resizeStableFrames < RENDER_TARGET_RESIZE_FRAMES)
+	{
+		app->resizeStableFrames++;
+	}
 
-	if (app->prevwinx != app->displaySize.x || app->prevwiny != app->displaySize.y)
+	if (RenderTargetBucketSize(windowSize) != app->renderTargetSize && app->resizeStableFrames >= RENDER_TARGET_RESIZE_FRAMES)
 	{
+		app->displaySize = windowSize;
 		GenerateBuffers(app);
-		app->prevwinx = app->displaySize.x;
-		app->prevwiny = app->displaySize.y;
+	}
+	else
+	{
+		//meanwhile render what fits in the targets we have
+		app->displaySize = glm::min(windowSize, app->renderTargetSize);
 	}
 	ImGui::End();
 
@@ -564,12 +1263,66 @@ void OpenGLWindowData(App* app)
 
 		
 	}
-	ImGui::End();
-}
 
-void ModelWindowGUI(App * app)
-{
-	ImGui::Begin("Model list");
+	if (ImGui::CollapsingHeader("Render graph:"))
+	{
+		const RenderGraph& graph = app->renderGraph;
+		ImGui::Text("%u of %u passes run, transient targets %.1f MB, %.1f MB after aliasing", (u32)graph.order.size(), (u32)graph.passes.size(),
+			graph.transientBytes / (1024.0f * 1024.0f), graph.aliasedBytes / (1024.0f * 1024.0f));
+
+		for (u32 i = 0; i < graph.order.size(); ++i)
+		{
+			const RenderGraphPass& pass = graph.passes[graph.order[i]];
+			auto it = graph.passStates.find(pass.name);
+			if (it == graph.passStates.end())
+				continue;
+
+			const RenderGraphPassState& state = it->second;
+			ImGui::Text("%s: gpu %.3f ms, cpu %.3f ms, %.1f MB transient", pass.name, state.gpuTime, state.cpuTime, state.transientBytes / (1024.0f * 1024.0f));
+		}
+
+		for (u32 i = 0; i < graph.passes.size(); ++i)
+			if (!graph.passes[i].live)
+				ImGui::TextDisabled("%s: culled", graph.passes[i].name);
+	}
+
+	if (ImGui::CollapsingHeader("Render targets:"))
+	{
+		const RenderTargetPool& pool = app->renderTargets;
+		ImGui::Text("%u textures, %.1f MB allocated, %.1f MB in use", (u32)pool.targets.size(),
+			pool.allocatedBytes / (1024.0f * 1024.0f), pool.inUseBytes / (1024.0f * 1024.0f));
+		ImGui::Text("%dx%d rendered in %dx%d targets", app->displaySize.x, app->displaySize.y, app->renderTargetSize.x, app->renderTargetSize.y);
+		ImGui::Text("%u allocated, %u reused, %u deleted", pool.allocationCount, pool.reuseCount, pool.deleteCount);
+
+		for (u32 i = 0; i < pool.targets.size(); ++i)
+		{
+			const RenderTarget& target = pool.targets[i];
+			ImGui::Text("texture %u: 0x%04X %dx%d, %.1f MB%s", target.handle, target.internalFormat, target.size.x, target.size.y,
+				target.bytes / (1024.0f * 1024.0f), target.inUse ? "" : " (unused)");
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Programs:"))
+	{
+		for (u32 i = 0; i < app->programs.size(); ++i)
+		{
+			Program& program = app->programs[i];
+			if (ImGui::TreeNode(program.programName.c_str()))
+			{
+				for (u32 j = 0; j < program.uniforms.size(); ++j)
+					ImGui::Text("uniform %s (location %d)", program.uniforms[j].name.c_str(), program.uniforms[j].location);
+				for (u32 j = 0; j < program.uniformBlocks.size(); ++j)
+					ImGui::Text("block %s (binding %d, %d bytes)", program.uniformBlocks[j].name.c_str(), program.uniformBlocks[j].binding, program.uniformBlocks[j].dataSize);
+				ImGui::TreePop();
+			}
+		}
+	}
+	ImGui::End();
+}
+
+void ModelWindowGUI(App * app)
+{
+	ImGui::Begin("Model list");
 
 	for (u32 i = 0; i < app->models.size(); ++i)
 	{
@@ -579,6 +1332,14 @@ void ModelWindowGUI(App * app)
 
 		std::string s = model.name + " " + std::to_string(i);
 
+		//a model picked in the render view gets unfolded once
+		static i32 unfoldedPick = -1;
+		if (app->pickedModel == (i32)i && unfoldedPick != app->pickedModel)
+		{
+			ImGui::SetNextItemOpen(true);
+			unfoldedPick = app->pickedModel;
+		}
+
 		if (ImGui::CollapsingHeader(s.c_str()))
 		{
 			glm::vec3 pos = model.position;
@@ -631,7 +1392,8 @@ void ModelWindowGUI(App * app)
 							ImGui::PushID("bmp");
 
 							ImGui::Text("Height");
-							ImGui::DragFloat("strength", &submeshMaterial.bumpStrength, 0.005, 0.0, 0.05);
+							if (ImGui::DragFloat("strength", &submeshMaterial.bumpStrength, 0.005, 0.0, 0.05))
+								MarkMaterialDirty(app, submeshMaterialIdx);
 							ImGui::Image((void*)app->textures[submeshMaterial.bumpTextureIdx].handle, cach, ImVec2(0, 1), ImVec2(1, 0));
 							ImGui::PopID();
 
@@ -641,7 +1403,8 @@ void ModelWindowGUI(App * app)
 						{
 							ImGui::PushID("nrm");
 							ImGui::Text("Normals");
-							ImGui::DragFloat("strength", &submeshMaterial.normalsStrength, 0.005, 0.0, 1.0);
+							if (ImGui::DragFloat("strength", &submeshMaterial.normalsStrength, 0.005, 0.0, 1.0))
+								MarkMaterialDirty(app, submeshMaterialIdx);
 							ImGui::Image((void*)app->textures[submeshMaterial.normalsTextureIdx].handle, cach, ImVec2(0, 1), ImVec2(1, 0));
 							ImGui::PopID();
 
@@ -674,6 +1437,19 @@ void LightWindowGUI(App * app)
 {
 	ImGui::Begin("Lights list");
 
+	//stress the light count, short range point lights scattered over the scene
+	if (ImGui::Button("Add 100 point lights"))
+	{
+		for (u32 i = 0; i < 100; ++i)
+		{
+			vec3 color = vec3(rand() % 256, rand() % 256, rand() % 256) / 255.0f;
+			vec3 position = vec3(rand() % 2001 - 1000, rand() % 301, rand() % 2001 - 1000) / 100.0f;
+			AddLight(LightType_Point, color, { 0,1,0 }, position, app);
+			app->lights.back().Klinear = 0.7f;
+			app->lights.back().Kquadratic = 1.8f;
+		}
+	}
+
 	for (u32 i = 0; i < app->lights.size(); ++i)
 	{
 		Light& light = app->lights[i];
@@ -719,85 +1495,26 @@ void Update(App* app)
 {
     // You can handle app->input keyboard/mouse here
 
-	glBindBuffer(GL_UNIFORM_BUFFER, app->LocalAttBuffer.handle);
-	MapBuffer(app->LocalAttBuffer, GL_WRITE_ONLY);
-	app->LocalParamsOffset = app->LocalAttBuffer.head;
+	//before the material table and the bounds, they pick up what an import or a reload changed this same frame
+	FinishModelImports(app);
+	UpdateTextureStreaming(app);
+	ProcessAssetChanges(app);
+	UpdateMaterialTable(app);
+	UpdateWorldBounds(app);
 
-	for (u32 i = 0; i < app->models.size(); ++i)
-	{
-		AlignHead(app->LocalAttBuffer, app->uniformBlockAlignment);
-		
-		Model& model = app->models[i];
-		glm::mat4 world = model.world;
-		glm::mat4 worldViewProjection = app->camera.projection*app->camera.view*world;
-
-		model.localParamsOffset = app->LocalAttBuffer.head;
-		PushMat4(app->LocalAttBuffer, world);
-		PushMat4(app->LocalAttBuffer, worldViewProjection);
-		model.localParamsSize = app->LocalAttBuffer.head - model.localParamsOffset;
-	}
-
-	app->LocalParamsSize = app->LocalAttBuffer.head - app->LocalParamsOffset;
-	UnmapBuffer(app->LocalAttBuffer);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-	glBindBuffer(GL_UNIFORM_BUFFER, app->cbuffer.handle);
-	MapBuffer(app->cbuffer, GL_WRITE_ONLY);
+	BeginRingRegion(app->cbuffer);
 	//handle lights
-	app->globalParamsOffset = app->cbuffer.head;
+	app->globalParamsOffset = app->cbuffer.buffer.head;
 
 	PushVec3(app->cbuffer, app->camera.position);
 
 	PushUInt(app->cbuffer, app->lights.size());
 
-	for (u32 i = 0; i < app->lights.size(); ++i)
-	{
-		AlignHead(app->cbuffer, sizeof(vec4));
+	app->globalParamsSize = app->cbuffer.buffer.head - app->globalParamsOffset;
+	EndRingRegion(app->cbuffer);
 
-		Light& light = app->lights[i];
-		PushUInt(app->cbuffer, light.type);
-		PushVec3(app->cbuffer, light.color);
-		PushVec3(app->cbuffer, light.direction);
-		PushVec3(app->cbuffer, light.position);
-	}
-
-	app->globalParamsSize = app->cbuffer.head - app->globalParamsOffset;
-	UnmapBuffer(app->cbuffer);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-
-	glBindBuffer(GL_UNIFORM_BUFFER, app->LightTransformBuffer.handle);
-	MapBuffer(app->LightTransformBuffer, GL_WRITE_ONLY);
-	
-	//handle lights transforms
-	app->LightTransformParamsOffset = app->LightTransformBuffer.head;
-
-	AlignHead(app->LightTransformBuffer, app->uniformBlockAlignment);
-
-	PushMat4(app->LightTransformBuffer, app->lightworld);
-
-	app->LightTransformParamsSize = app->LightTransformBuffer.head - app->LightTransformParamsOffset;
-	UnmapBuffer(app->LightTransformBuffer);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
-	
-	
-	glBindBuffer(GL_UNIFORM_BUFFER, app->LightParamsBuffer.handle);
-	MapBuffer(app->LightParamsBuffer, GL_WRITE_ONLY);
-	
-	//handle light constants
-	app->LightParamsParamsOffset = app->LightParamsBuffer.head;
-
-	for (u32 i = 0; i < app->lights.size(); ++i)
-	{
-		AlignHead(app->LightParamsBuffer,sizeof(float)*4);
-		glm::vec4 vec;
-		vec.x = app->lights[i].Klinear;
-		vec.y = app->lights[i].Kquadratic;
-		PushVec4(app->LightParamsBuffer, vec);
-	}
-	app->LightParamsParamsSize = app->LightParamsBuffer.head - app->LightParamsParamsOffset;
-	UnmapBuffer(app->LightParamsBuffer);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	//the lights themselves go to their own storage buffer, with no limit on how many
+	UploadGpuLights(app);
 
 	//camera controls
 	if (app->input.keys[K_SPACE] == BUTTON_PRESS)
@@ -894,209 +1611,58 @@ void Update(App* app)
 	app->worldViewProjection = app->camera.projection* app->world*app->camera.view;
 }
 
-void GenerateBuffers(App* app)
+static GLenum FinalTargetFormat(const App* app)
 {
-	//Framebuffer
-	//ALBEDO
-	glGenTextures(1, &app->colorAttachmentHandle);
-	glBindTexture(GL_TEXTURE_2D, app->colorAttachmentHandle);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, app->displaySize.x, app->displaySize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	//NORMALS
-	glGenTextures(1, &app->normalAttachmentHandle);
-	glBindTexture(GL_TEXTURE_2D, app->normalAttachmentHandle);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, app->displaySize.x, app->displaySize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	//POSITION
-	glGenTextures(1, &app->positionAttachmentHandle);
-	glBindTexture(GL_TEXTURE_2D, app->positionAttachmentHandle);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, app->displaySize.x, app->displaySize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	//SPECULAR
-	glGenTextures(1, &app->specularAttachmentHandle);
-	glBindTexture(GL_TEXTURE_2D, app->specularAttachmentHandle);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, app->displaySize.x, app->displaySize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	//FINAL
-	glGenTextures(1, &app->finalAttachmentHandle);
-	glBindTexture(GL_TEXTURE_2D, app->finalAttachmentHandle);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, app->displaySize.x, app->displaySize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	//DEPTH
-	glGenTextures(1, &app->depthAttachmentHandle);
-	glBindTexture(GL_TEXTURE_2D, app->depthAttachmentHandle);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, app->displaySize.x, app->displaySize.y, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-
-	glGenFramebuffers(1, &app->frameBufferHandle);
-	glBindFramebuffer(GL_FRAMEBUFFER, app->frameBufferHandle);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, app->colorAttachmentHandle, 0);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, app->normalAttachmentHandle, 0);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, app->positionAttachmentHandle, 0);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, app->specularAttachmentHandle, 0);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT4, app->finalAttachmentHandle, 0);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, app->depthAttachmentHandle, 0);
-
-	GLenum framebufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-	if (framebufferStatus != GL_FRAMEBUFFER_COMPLETE)
-	{
-		ELOG("FRAMEBUFFER ERROR");
-	}
-
-	glDrawBuffers(1, &app->colorAttachmentHandle);
-	glDrawBuffers(1, &app->normalAttachmentHandle);
-	glDrawBuffers(1, &app->positionAttachmentHandle);
-	glDrawBuffers(1, &app->specularAttachmentHandle);
-	glDrawBuffers(1, &app->finalAttachmentHandle);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-
-	//DEFERRED
-	glGenTextures(1, &app->deferredAttachmentHandle);
-	glBindTexture(GL_TEXTURE_2D, app->deferredAttachmentHandle);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, app->displaySize.x, app->displaySize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	glGenFramebuffers(1, &app->deferredBufferHandle);
-	glBindFramebuffer(GL_FRAMEBUFFER, app->deferredBufferHandle);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, app->deferredAttachmentHandle, 0);
-
-	GLenum defframebufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-	if (defframebufferStatus != GL_FRAMEBUFFER_COMPLETE)
-	{
-		ELOG("FRAMEBUFFER ERROR");
-	}
-
-	glDrawBuffers(1, &app->deferredAttachmentHandle);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-
-	GenerateWaterBuffers(app);
-
+	return app->compactGBuffer ? GL_R11F_G11F_B10F : GL_RGBA16F;
 }
 
-void GenerateWaterBuffers(App * app)
+static GLenum DeferredTargetFormat(const App* app)
 {
-	//REFLECTION
-	
-	//COLOR
-	glGenTextures(1, &app->reflectionAttachmentHandle);
-	glBindTexture(GL_TEXTURE_2D, app->reflectionAttachmentHandle);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, app->displaySize.x, app->displaySize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	//DEPTH
-	glGenTextures(1, &app->reflectiondepthAttachmentHandle);
-	glBindTexture(GL_TEXTURE_2D, app->reflectiondepthAttachmentHandle);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, app->displaySize.x, app->displaySize.y, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-
-	glGenFramebuffers(1, &app->ReflectionframeBuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, app->ReflectionframeBuffer);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, app->reflectionAttachmentHandle, 0);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, app->reflectiondepthAttachmentHandle, 0);
+	return app->compactGBuffer ? GL_R11F_G11F_B10F : GL_RGBA8;
+}
 
-	GLenum defframebufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-	if (defframebufferStatus != GL_FRAMEBUFFER_COMPLETE)
-	{
-		printf("FRAMEBUFFER ERROR");
-	}
+void GenerateBuffers(App* app)
+{
+	//compact layout: RGBA8 albedo with the specular in alpha, RG16 octahedral normals, no position
+	//or specular targets (rebuilt from depth) and R11G11B10F light results
+	const bool compact = app->compactGBuffer;
+	GLenum lightFormat = FinalTargetFormat(app);
+	GLenum deferredFormat = DeferredTargetFormat(app);
 
-	glDrawBuffers(1, &app->reflectionAttachmentHandle);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	//albedo, normals, position, specular, final, depth and the deferred light result
+	app->gbufferBytesPerPixel = compact ? 4 + 4 + 0 + 0 + 4 + 4 + 4 : 8 + 8 + 8 + 8 + 8 + 4 + 4;
 
+	//only what is shown after the frame is kept here, the render graph takes the G buffer and depth
+	//targets from the pool for the passes that use them. The water ones follow the water settings
+	RenderTargetPool& pool = app->renderTargets;
+	ReleaseRenderTarget(pool, app->finalAttachmentHandle);
+	ReleaseRenderTarget(pool, app->deferredAttachmentHandle);
 
-	//REFRACTION
+	//the decoded debug view is only acquired when it is looked at
+	ReleaseRenderTarget(pool, app->gbufferDebugAttachmentHandle);
 
-	//COLOR
-	glGenTextures(1, &app->refractionAttachmentHandle);
-	glBindTexture(GL_TEXTURE_2D, app->refractionAttachmentHandle);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, app->displaySize.x, app->displaySize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	app->renderTargetSize = RenderTargetBucketSize(app->displaySize);
 
-	//DEPTH
-	glGenTextures(1, &app->refractiondepthAttachmentHandle);
-	glBindTexture(GL_TEXTURE_2D, app->refractiondepthAttachmentHandle);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, app->displaySize.x, app->displaySize.y, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-
-	glGenFramebuffers(1, &app->RefractionframeBuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, app->RefractionframeBuffer);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, app->refractionAttachmentHandle, 0);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, app->refractiondepthAttachmentHandle, 0);
+	app->finalAttachmentHandle = AcquireRenderTarget(pool, lightFormat, app->displaySize, RenderTargetUsage_Nearest);
+	app->deferredAttachmentHandle = AcquireRenderTarget(pool, deferredFormat, app->displaySize, RenderTargetUsage_Nearest);
+}
 
-	GLenum refractionframebufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-	if (refractionframebufferStatus != GL_FRAMEBUFFER_COMPLETE)
+void BindGBuffer(App* app, const Program& program, const Camera& camera)
+{
+	//texture units 0 to 4, the compact layout leaves position and specular unbound
+	GLuint gBuffer[] = { app->colorAttachmentHandle, app->normalAttachmentHandle, app->positionAttachmentHandle, app->specularAttachmentHandle, app->depthAttachmentHandle };
+	UniformName gBufferUniforms[] = { Uniform_uAlbedo, Uniform_uNormal, Uniform_uPosition, Uniform_uSpecular, Uniform_uDepth };
+	for (u32 i = 0; i < ARRAY_COUNT(gBuffer); ++i)
 	{
-		printf("FRAMEBUFFER ERROR");
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_2D, gBuffer[i]);
+		glUniform1i(program.uniformLocations[gBufferUniforms[i]], i);
 	}
 
-	glDrawBuffers(1, &app->refractionAttachmentHandle);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
+	glUniform1i(program.uniformLocations[Uniform_uCompactGBuffer], app->compactGBuffer);
+	glUniform2f(program.uniformLocations[Uniform_uScreenSize], app->displaySize.x, app->displaySize.y);
+	glUniformMatrix4fv(program.uniformLocations[Uniform_uInverseProjection], 1, GL_FALSE, glm::value_ptr(glm::inverse(camera.projection)));
+	glUniformMatrix4fv(program.uniformLocations[Uniform_viewMatrixInv], 1, GL_FALSE, glm::value_ptr(glm::inverse(camera.view)));
 }
 
 void ChangeWindowSize(float x, float y, App * app)
@@ -1124,636 +1690,768 @@ glm::mat4 TransformPosition(const vec3 & pos)
 
 
 
-void Render(App* app)
+//FRAME PASSES, see BuildFrameGraph
+
+//reflection and refraction in one traversal of the scene, a geometry shader sends every
+//triangle to both layers of the water targets with the camera and clip plane of the layer
+static void WaterPass(App* app)
 {
- 
 	glCullFace(GL_BACK);
-	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glDepthMask(true);
 
-	if (app->render_water)
-	{
-		//RENDER BOTH WATER REFLECTION AND REFRACTION BUFFERS
-		glCullFace(GL_BACK);
-
-		glEnable(GL_DEPTH_TEST);
-		glEnable(GL_CULL_FACE);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		glDepthMask(true);
-
-		float aspectRatio = (float)app->displaySize.x / (float)app->displaySize.y;
+	float aspectRatio = (float)app->displaySize.x / (float)app->displaySize.y;
 
-		//reflection///////////////////////////////////////////
-		glBindFramebuffer(GL_FRAMEBUFFER, app->ReflectionframeBuffer);
+	Camera reflectionCamera = app->camera;
+	reflectionCamera.position.y = -reflectionCamera.position.y;
+	reflectionCamera.pitch = -reflectionCamera.pitch;
 
-		Camera reflectionCamera = app->camera;
-		reflectionCamera.position.y = -reflectionCamera.position.y;
-		reflectionCamera.pitch = -reflectionCamera.pitch;
+	reflectionCamera.ortho = glm::ortho(glm::radians(60.0f), aspectRatio, reflectionCamera.znear, reflectionCamera.zfar);
+	reflectionCamera.projection = glm::perspective(glm::radians(60.0f), aspectRatio, reflectionCamera.znear, reflectionCamera.zfar);
 
-		reflectionCamera.ortho = glm::ortho(glm::radians(60.0f), aspectRatio, reflectionCamera.znear, reflectionCamera.zfar);
-		reflectionCamera.projection = glm::perspective(glm::radians(60.0f), aspectRatio, reflectionCamera.znear, reflectionCamera.zfar);
 
+	reflectionCamera.direction.x = glm::cos(glm::radians(reflectionCamera.yaw)) * glm::cos(glm::radians(reflectionCamera.pitch));
+	reflectionCamera.direction.y = glm::sin(glm::radians(reflectionCamera.pitch));
+	reflectionCamera.direction.z = glm::sin(glm::radians(reflectionCamera.yaw)) * glm::cos(glm::radians(reflectionCamera.pitch));
 
-		reflectionCamera.direction.x = glm::cos(glm::radians(reflectionCamera.yaw)) * glm::cos(glm::radians(reflectionCamera.pitch));
-		reflectionCamera.direction.y = glm::sin(glm::radians(reflectionCamera.pitch));
-		reflectionCamera.direction.z = glm::sin(glm::radians(reflectionCamera.yaw)) * glm::cos(glm::radians(reflectionCamera.pitch));
+	reflectionCamera.cameraFront = glm::normalize(reflectionCamera.direction);
+	reflectionCamera.target = reflectionCamera.position + reflectionCamera.cameraFront;
 
-		reflectionCamera.cameraFront = glm::normalize(reflectionCamera.direction);
-		reflectionCamera.target = reflectionCamera.position + reflectionCamera.cameraFront;
+	reflectionCamera.view = glm::lookAt(reflectionCamera.position, reflectionCamera.target, app->upVector);
 
-		reflectionCamera.view = glm::lookAt(reflectionCamera.position, reflectionCamera.target, app->upVector);
+	Camera refractionCamera = app->camera;
 
-		glm::mat4 refl = reflectionCamera.projection* app->world*reflectionCamera.view;
+	refractionCamera.ortho = glm::ortho(glm::radians(60.0f), aspectRatio, refractionCamera.znear, refractionCamera.zfar);
+	refractionCamera.projection = glm::perspective(glm::radians(60.0f), app->aspectRatio, refractionCamera.znear, refractionCamera.zfar);
+	refractionCamera.view = glm::lookAt(refractionCamera.position, refractionCamera.target, app->upVector);
 
-		//passwater :D
-		passWaterScene(&reflectionCamera, GL_COLOR_ATTACHMENT0, true, app);
+	//the graph viewport covers the reflection layer, the refraction one can be drawn at another scale
+	const WaterFX& water = app->waterFX;
+	glViewportIndexedf(WaterLayer_Refraction, 0, 0, water.refractionSize.x, water.refractionSize.y);
 
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	//passwater :D
+	Camera cameras[WaterLayer_Count];
+	cameras[WaterLayer_Reflection] = reflectionCamera;
+	cameras[WaterLayer_Refraction] = refractionCamera;
+	passWaterScene(cameras, app);
 
-		//refraction////////////////////////////////////////
-		glBindFramebuffer(GL_FRAMEBUFFER, app->RefractionframeBuffer);
-
-		Camera refractionCamera = app->camera;
-
-		refractionCamera.ortho = glm::ortho(glm::radians(60.0f), aspectRatio, refractionCamera.znear, refractionCamera.zfar);
-		refractionCamera.projection = glm::perspective(glm::radians(60.0f), aspectRatio, refractionCamera.znear, refractionCamera.zfar);
+	app->waterFX.valid = true;
+	app->waterFX.updating = true;
+}
 
-		refractionCamera.view = glm::lookAt(refractionCamera.position, refractionCamera.target, app->upVector);
+//Forward+ culls its tiles against the pre-pass depth, it has one even with the option off
+static bool ForwardDepthPrepass(const App* app)
+{
+	return app->depthPrepass || app->forwardPlus;
+}
 
-		glm::mat4 refr = refractionCamera.projection* app->world*refractionCamera.view;
+//depth only, the main pass shades just the fragments that end up visible. The height mapped
+//materials go through a depth variant of the program that shades them, to get the same depth
+static void SubmitDepthPrepass(App* app, ProgramPermutations& permutations)
+{
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_CULL_FACE);
+	glDisable(GL_BLEND);
 
-		refractionCamera.projection = glm::perspective(glm::radians(60.0f), app->aspectRatio, refractionCamera.znear, refractionCamera.zfar);
-		refractionCamera.view = glm::lookAt(refractionCamera.position, refractionCamera.target, app->upVector);
+	BeginRenderQueue(app->prepassQueue, RenderPass_DepthPrepass, permutations, &app->camera);
+	BuildRenderQueue(app, app->prepassQueue);
+	SortRenderQueue(app->prepassQueue);
+	SubmitRenderQueue(app, app->prepassQueue);
+}
 
-		//passwater :D
-		passWaterScene(&refractionCamera, GL_COLOR_ATTACHMENT0, false, app);
+static void DepthPrepass(App* app)
+{
+	SubmitDepthPrepass(app, app->forwardDepthPrograms);
+}
 
+static void DeferredDepthPrepass(App* app)
+{
+	SubmitDepthPrepass(app, app->gbufferDepthPrograms);
+}
 
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	}
+static void LightTilesPass(App* app)
+{
+	BuildLightTiles(app, app->camera);
+}
 
+//with the pre-pass the depth is final, only the fragments that match it are shaded
+static void BeginEqualDepth()
+{
+	glDepthFunc(GL_EQUAL);
+	glDepthMask(GL_FALSE);
+}
 
+static void EndEqualDepth()
+{
+	glDepthFunc(GL_LESS);
+	glDepthMask(GL_TRUE);
+}
 
+static void ForwardPass(App* app)
+{
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_CULL_FACE);
 
-	GLuint drawBuffersforward[] = { GL_COLOR_ATTACHMENT4 };
-	Program& forwardRenderProgram = app->programs[app->forwardRenderProgramIdx];
+	//opaque geometry, no need for blending
+	glDisable(GL_BLEND);
 
+	const bool prepass = ForwardDepthPrepass(app);
+	if (prepass)
+		BeginEqualDepth();
 
-	GLuint drawBuffersdeferred[] = { GL_COLOR_ATTACHMENT0 };
-	Program& deferredRenderProgramIdx = app->programs[app->deferredRenderProgramIdx];
+	BeginRenderQueue(app->sceneQueue, RenderPass_Forward, app->forwardPlus ? app->forwardPlusPrograms : app->forwardPrograms, &app->camera);
+	BuildRenderQueue(app, app->sceneQueue);
+	SortRenderQueue(app->sceneQueue);
+	SubmitRenderQueue(app, app->sceneQueue);
 
-	switch (app->rendermode)
-	{
-		case RenderMode_Forward:
-		//use normal render
-		glBindFramebuffer(GL_FRAMEBUFFER, app->frameBufferHandle);
+	if (prepass)
+		EndEqualDepth();
+}
 
-		//glClearColor(0.1f, 0.1f, 0.1f, 0.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+static void LightClustersPass(App* app)
+{
+	BuildLightClusters(app, app->camera);
+}
 
-		glDrawBuffers(ARRAY_COUNT(drawBuffersforward), drawBuffersforward);
+static void GBufferPass(App* app)
+{
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_CULL_FACE);
+	glDisable(GL_BLEND);
 
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	if (app->depthPrepass)
+		BeginEqualDepth();
 
-		glUseProgram(forwardRenderProgram.handle);
+	BeginRenderQueue(app->sceneQueue, RenderPass_GBuffer, app->gbufferPrograms, &app->camera);
+	BuildRenderQueue(app, app->sceneQueue);
+	SortRenderQueue(app->sceneQueue);
+	SubmitRenderQueue(app, app->sceneQueue);
 
-		for (int i = 0; i<app->models.size();++i)
-		{
-			Model& model = app->models[i];
-			Mesh& mesh = app->meshes[model.meshIdx];
+	if (app->depthPrepass)
+		EndEqualDepth();
+}
 
-			for (u32 j = 0; j < mesh.submeshes.size(); ++j)
-			{
-				GLuint vao = FindVAO(mesh, j, forwardRenderProgram);
-				glBindVertexArray(vao);
-
-				u32 submeshMaterialIdx = model.materialIdx[j];
-				Material& submeshMaterial = app->materials[submeshMaterialIdx];
-
-				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.albedoTextureIdx].handle);
-				glUniform1i(app->texturedMeshProgram_uTexture, 0);
-				
-				//send normal map if it exists
-				if (submeshMaterial.normalsTextureIdx == 0)
-				{
-					GLint loc = glGetUniformLocation(forwardRenderProgram.handle, "normalMapExists");
-					glUniform1i(loc, 0);
-				}
-				else
-				{
-					GLint loc = glGetUniformLocation(forwardRenderProgram.handle, "normalMapExists");
-					glUniform1i(loc, 1);
-					
-					GLint loc1 = glGetUniformLocation(forwardRenderProgram.handle, "normalStrength");
-					glUniform1f(loc1, submeshMaterial.normalsStrength);
-
-					glActiveTexture(GL_TEXTURE1);
-					GLint locnormals = glGetUniformLocation(forwardRenderProgram.handle, "uNormalMap");
-					glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.normalsTextureIdx].handle);
-					glUniform1i(locnormals, 1);
-				}
+static void DeferredLightingPass(App* app)
+{
+	if (app->clusteredLighting)
+	{
+		ResolveClusteredLighting(app, app->camera);
+		return;
+	}
 
-				//send bump map if it exists
-				if (submeshMaterial.bumpTextureIdx == 0)
-				{
-					GLint loc = glGetUniformLocation(forwardRenderProgram.handle, "depthMapExists");
-					glUniform1i(loc, 0);
-				}
-				else
-				{
-					GLint loc = glGetUniformLocation(forwardRenderProgram.handle, "depthMapExists");
-					glUniform1i(loc, 1);
+	//fallback, one light volume draw per light
+	glEnable(GL_DEPTH_TEST);
 
-					GLint loc1 = glGetUniformLocation(forwardRenderProgram.handle, "depthStrength");
-					glUniform1f(loc1, submeshMaterial.bumpStrength);
+	Program& deferredRenderProgramIdx = app->programs[app->deferredRenderProgramIdx];
+	glUseProgram(deferredRenderProgramIdx.handle);
 
-					glActiveTexture(GL_TEXTURE2);
-					GLint locdepth = glGetUniformLocation(forwardRenderProgram.handle, "uDepthMap");
-					glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.bumpTextureIdx].handle);
-					glUniform1i(locdepth, 2);
-				}
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BUFFER_BINDING, app->gpuLights.buffer.handle);
 
-				//send specular texture if it exists
-				if (submeshMaterial.specularTextureIdx == 0)
-				{
-					GLint loc = glGetUniformLocation(forwardRenderProgram.handle, "specularMapExists");
-					glUniform1i(loc, 0);
-				}
-				else
-				{
-					GLint loc = glGetUniformLocation(forwardRenderProgram.handle, "specularMapExists");
-					glUniform1i(loc, 1);
+	// - bind the program 
+	glEnable(GL_BLEND);
 
-					glActiveTexture(GL_TEXTURE2);
-					GLint locspec = glGetUniformLocation(forwardRenderProgram.handle, "uSpecularMap");
-					glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.specularTextureIdx].handle);
-					glUniform1i(locspec, 2);
-				}
+	BindGBuffer(app, deferredRenderProgramIdx, app->camera);
 
 
-				GLint locproj = glGetUniformLocation(forwardRenderProgram.handle, "cameraProj");
-				glUniformMatrix4fv(locproj,1,GL_FALSE, glm::value_ptr(app->camera.projection));
+	//upload the transforms of all the light volumes at once, each light binds its own range. The
+	//region doubles until every light fits, a few hundred of them outgrow the initial one
+	u32 lightTransformsSize = app->lights.size() * Align(sizeof(glm::mat4), app->uniformBlockAlignment);
+	if (lightTransformsSize > app->LightTransformBuffer.regionSize)
+	{
+		u32 regionSize = app->LightTransformBuffer.regionSize;
+		while (regionSize < lightTransformsSize)
+			regionSize *= 2;
+		ResizeRingBuffer(app->LightTransformBuffer, regionSize);
+	}
+	BeginRingRegion(app->LightTransformBuffer);
+	app->LightTransformParamsOffset = app->LightTransformBuffer.buffer.head;
+	app->lightTransformOffsets.resize(app->lights.size());
 
-				GLint loc = glGetUniformLocation(forwardRenderProgram.handle, "specular");
-				glUniform1f(loc, submeshMaterial.specular);
+	//point lights whose volume doesn't reach any geometry can't light a pixel
+	std::vector<u8> lightReachesScene(app->lights.size(), 1);
+	std::vector<u32> lightOverlaps;
 
-				u32 blockOffset = app->LocalParamsOffset +model.localParamsOffset;
-				u32 blockSize = app->LocalAttBuffer.size;
-				glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->LocalAttBuffer.handle, blockOffset, blockSize);
-						
-				u32 globalblockOffset = app->globalParamsOffset;
-				u32 globalblockSize = app->cbuffer.size;
-				glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, globalblockOffset, globalblockSize);
+	for (int i = 0; i < app->lights.size(); ++i)
+	{
+		Light& light = app->lights[i];
+		app->lightworld = TransformPosition(vec3(0));
 
-				u32 lightparblockOffset = app->LightParamsParamsOffset;
-				u32 lightparblockSize = app->LightParamsBuffer.size;
-				glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(3), app->LightParamsBuffer.handle, lightparblockOffset, lightparblockSize);
+		if (light.type == LightType_Point)
+		{
+			float spheresize = LightVolumeRadius(light);
 
+			OverlapSphereBVH(app->sceneBVH, app->worldBounds, light.position, spheresize, lightOverlaps);
+			lightReachesScene[i] = !lightOverlaps.empty();
 
-				Submesh& submesh = mesh.submeshes[j];
-				glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
-			}
+			//calculate radius
+			glm::mat4 world = TransformPosition(light.position) * TransformScale(vec3(spheresize));
+			app->lightworld = app->camera.projection * app->camera.view *world;
 		}
-		break;
-	case RenderMode_Deferred:
-	{		
-		//use deferred render
-
-		//STEP 1: G BUFFER CREATION//////////////////////
-		glBindFramebuffer(GL_FRAMEBUFFER, app->frameBufferHandle);
 
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		AlignHead(app->LightTransformBuffer, app->uniformBlockAlignment);
+		app->lightTransformOffsets[i] = app->LightTransformBuffer.buffer.head;
+		PushMat4(app->LightTransformBuffer, app->lightworld);
+	}
 
-		glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+	app->LightTransformParamsSize = app->LightTransformBuffer.buffer.head - app->LightTransformParamsOffset;
+	EndRingRegion(app->LightTransformBuffer);
 
-		GLuint drawBuffers[] = { GL_COLOR_ATTACHMENT0,GL_COLOR_ATTACHMENT1,GL_COLOR_ATTACHMENT2 ,GL_COLOR_ATTACHMENT3 };
-		glDrawBuffers(ARRAY_COUNT(drawBuffers), drawBuffers);
+	for (int i = 0; i < app->lights.size(); ++i)
+	{
+		if (!lightReachesScene[i])
+			continue;
 
-		Program& texturedMeshProgram = app->programs[app->mapCalculationProgramIdx];
-		glUseProgram(texturedMeshProgram.handle);
+		int vertextodraw = 6;
 
-		for (int i = 0; i < app->models.size(); ++i)
+		switch (app->lights[i].type)
 		{
-			Model& model = app->models[i];
-			Mesh& mesh = app->meshes[model.meshIdx];
-
-			for (u32 j = 0; j < mesh.submeshes.size(); ++j)
+			case LightType_Directional:
 			{
-				GLuint vao = FindVAO(mesh, j, texturedMeshProgram);
-				glBindVertexArray(vao);
-
-				u32 submeshMaterialIdx = model.materialIdx[j];
-				Material& submeshMaterial = app->materials[submeshMaterialIdx];
-
-				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.albedoTextureIdx].handle);
-				glUniform1i(app->texturedMeshProgram_uTexture, 0);
-				
-				//send normal map if it exists
-				if (submeshMaterial.normalsTextureIdx == 0)
-				{
-					GLint loc = glGetUniformLocation(texturedMeshProgram.handle, "normalMapExists");
-					glUniform1i(loc, 0);
-				}
-				else
-				{
-					GLint loc = glGetUniformLocation(texturedMeshProgram.handle, "normalMapExists");
-					glUniform1i(loc, 1);
-
-					glActiveTexture(GL_TEXTURE1);
-					GLint locnormals = glGetUniformLocation(texturedMeshProgram.handle, "uNormalMap");
-					glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.normalsTextureIdx].handle);
-					glUniform1i(locnormals, 1);
-				}
-
-				//send bump map if it exists
-				if (submeshMaterial.bumpTextureIdx == 0)
-				{
-					GLint loc = glGetUniformLocation(texturedMeshProgram.handle, "depthMapExists");
-					glUniform1i(loc, 0);
-				}
-				else
-				{
-					GLint loc = glGetUniformLocation(texturedMeshProgram.handle, "depthMapExists");
-					glUniform1i(loc, 1);
-
-					GLint loc1 = glGetUniformLocation(texturedMeshProgram.handle, "depthStrength");
-					glUniform1f(loc1, submeshMaterial.bumpStrength);
-
-					glActiveTexture(GL_TEXTURE2);
-					GLint locdepth = glGetUniformLocation(texturedMeshProgram.handle, "uDepthMap");
-					glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.bumpTextureIdx].handle);
-					glUniform1i(locdepth, 2);
-
-				}
-
-				//send specular map if it exists
-				if (submeshMaterial.specularTextureIdx == 0)
-				{
-					GLint loc = glGetUniformLocation(texturedMeshProgram.handle, "specularMapExists");
-					glUniform1i(loc, 0);
-				}
-				else
-				{
-					GLint loc = glGetUniformLocation(texturedMeshProgram.handle, "specularMapExists");
-					glUniform1i(loc, 1);
-
-					glActiveTexture(GL_TEXTURE2);
-					GLint locspec = glGetUniformLocation(texturedMeshProgram.handle, "uSpecularMap");
-					glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.specularTextureIdx].handle);
-					glUniform1i(locspec, 2);
-				}
-
-				GLint loc = glGetUniformLocation(texturedMeshProgram.handle, "specular");
-				glUniform1f(loc, submeshMaterial.specular);
-
-				u32 blockOffset = app->LocalParamsOffset + model.localParamsOffset;
-				u32 blockSize = app->LocalAttBuffer.size;
-				glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->LocalAttBuffer.handle, blockOffset, blockSize);
-
-				u32 globalblockOffset = app->globalParamsOffset;
-				u32 globalblockSize = app->cbuffer.size;
-				glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, globalblockOffset, globalblockSize);
-
-				u32 lightparblockOffset = app->LightParamsParamsOffset;
-				u32 lightparblockSize = app->LightParamsBuffer.size;
-				glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(3), app->LightParamsBuffer.handle, lightparblockOffset, lightparblockSize);
+				//bind square that covers the whole screen
+				glBindVertexArray(app->vao);
+				glBlendFunc(GL_ONE, GL_ONE);
+			}
+			break;
+			case LightType_Point:
+			{
+				vertextodraw = app->spherebuffernumindices;
 
+				glDisable(GL_DEPTH_TEST);
+				glDisable(GL_CULL_FACE);
+				glBlendFunc(GL_ONE, GL_ONE);
 
-				Submesh& submesh = mesh.submeshes[j];
-				glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
+				//bind the sphere geometry
+				glBindVertexArray(app->spherevao);
+			}
+			break;
+			case LightType_Ambient:
+			{
+				//bind square that covers the whole screen
+				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+				glBindVertexArray(app->vao);
 			}
+			break;
+			default:
+				break;
 		}
 
+		//SET ALL UNIFORM VALUES FOR THE LIGHTS RENDERING
 
-		//STEP 2: RENDER THE LIGHTS
-		
-		//DEFERRED :D
-		glBindFramebuffer(GL_FRAMEBUFFER, app->deferredBufferHandle);
-
-		//glClearColor(1.0f, 0.1f, 0.1f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		glViewport(0, 0, app->displaySize.x, app->displaySize.y);
-		glEnable(GL_DEPTH_TEST);
-
-		glDrawBuffers(ARRAY_COUNT(drawBuffersdeferred), drawBuffersdeferred);
-
-		glUseProgram(deferredRenderProgramIdx.handle);
+		u32 lightblockOffset = app->lightTransformOffsets[i];
+		u32 lightblockSize = sizeof(glm::mat4);
+		glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(2), app->LightTransformBuffer.buffer.handle, lightblockOffset, lightblockSize);
 
-		// - bind the program 
-		glEnable(GL_BLEND);
+		u32 globalblockOffset = app->globalParamsOffset;
+		u32 globalblockSize = RingRangeSize(app->cbuffer, globalblockOffset);
+		glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.buffer.handle, globalblockOffset, globalblockSize);
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, app->colorAttachmentHandle);
-		GLint loc0 = glGetUniformLocation(deferredRenderProgramIdx.handle, "uAlbedo");
-		glUniform1i(loc0, 0);
 
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, app->normalAttachmentHandle);
-		GLint loc1 = glGetUniformLocation(deferredRenderProgramIdx.handle, "uNormal");
-		glUniform1i(loc1, 1);
+		GLint loc4 = deferredRenderProgramIdx.uniformLocations[Uniform_current_light];
+		glUniform1i(loc4, app->gpuLights.gpuLightIdx[i]);
 
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, app->positionAttachmentHandle);
-		GLint loc2 = glGetUniformLocation(deferredRenderProgramIdx.handle, "uPosition");
-		glUniform1i(loc2, 2);
+		glDrawElements(GL_TRIANGLES, vertextodraw, GL_UNSIGNED_SHORT, 0);
 
-		glActiveTexture(GL_TEXTURE3);
-		glBindTexture(GL_TEXTURE_2D, app->specularAttachmentHandle);
-		GLint loc3 = glGetUniformLocation(deferredRenderProgramIdx.handle, "uSpecular");
-		glUniform1i(loc3, 3);
-
-
-		for (int i = 0; i < app->lights.size(); ++i)
-		{
-			glm::mat4 world = TransformPosition(vec3(0));
-			app->lightworld = TransformPosition(vec3(0));
-
-			int vertextodraw = 6;
-
-			switch (app->lights[i].type)
-			{
-				case LightType_Directional:
-				{
-					//bind square that covers the whole screen
-					glBindVertexArray(app->vao);
-					glBlendFunc(GL_ONE, GL_ONE);
-				}
-				break;
-				case LightType_Point:
-				{
-					Light& light = app->lights[i];
-					const float maxBrightness = std::fmaxf(std::fmaxf(light.color.r, light.color.g), light.color.b);
-					float spheresize = (-light.Klinear + std::sqrt(light.Klinear * light.Klinear - 4 * light.Kquadratic * (light.Kconstant - (256.0f / 5.0f) * maxBrightness))) / (2.0f * light.Kquadratic);
-
-					//calculate radius
-					world = TransformPosition(app->lights[i].position) * TransformScale(vec3(spheresize));
-					app->lightworld = app->camera.projection * app->camera.view *world;
+	}
+}
 
-					vertextodraw = app->spherebuffernumindices;
+static void RenderWaterPlane(App* app, bool deferred)
+{
+	//forward tests against the scene depth, deferred compares with it in the shader
+	if (deferred)
+		glDisable(GL_DEPTH_TEST);
+	else
+		glEnable(GL_DEPTH_TEST);
 
-					glDisable(GL_DEPTH_TEST);
-					glDisable(GL_CULL_FACE);
-					glBlendFunc(GL_ONE, GL_ONE);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glDisable(GL_CULL_FACE);
+	//glBlendEquation(GL_FUNC_ADD);
 
-					//bind the sphere geometry
-					glBindVertexArray(app->spherevao);
-				}
-				break;
-				case LightType_Ambient:
-				{
-					//bind square that covers the whole screen
-					glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-					glBindVertexArray(app->vao);
-				}
-				break;
-				default:
-					break;
-			}
+	Program& programWaterPlaneRender = app->programs[app->waterPlaneProgramIdx];
+	glUseProgram(programWaterPlaneRender.handle);
 
-			//SET ALL UNIFORM VALUES FOR THE LIGHTS RENDERING
+	GLint locn1 = programWaterPlaneRender.uniformLocations[Uniform_uProjectionMatrix];
+	glUniformMatrix4fv(locn1, 1,GL_FALSE, glm::value_ptr(app->camera.projection));
 
-			glBindBuffer(GL_UNIFORM_BUFFER, app->LightTransformBuffer.handle);
-			MapBuffer(app->LightTransformBuffer, GL_WRITE_ONLY);
+	GLint locn2 = programWaterPlaneRender.uniformLocations[Uniform_uWorldViewMatrix];
+	glUniformMatrix4fv(locn2, 1,GL_FALSE, glm::value_ptr(app->camera.view/*add water transform matrix*/));
 
-			app->LightTransformParamsOffset = app->LightTransformBuffer.head;
+	GLint locn3 = programWaterPlaneRender.uniformLocations[Uniform_viewportSize];
+	glUniform2f(locn3, app->displaySize.x, app->displaySize.y);
 
-			AlignHead(app->LightTransformBuffer, app->uniformBlockAlignment);
+	GLint locn4 = programWaterPlaneRender.uniformLocations[Uniform_modelViewMatrix];
+	glUniformMatrix4fv(locn4, 1, GL_FALSE, glm::value_ptr(app->camera.view/*add water transform matrix*/));
 
-			PushMat4(app->LightTransformBuffer, app->lightworld);
+	GLint locn5 = programWaterPlaneRender.uniformLocations[Uniform_viewMatrixInv];
+	glUniformMatrix4fv(locn5, 1, GL_FALSE, glm::value_ptr(glm::inverse(app->camera.view)));
 
-			app->LightTransformParamsSize = app->LightTransformBuffer.head - app->LightTransformParamsOffset;
-			UnmapBuffer(app->LightTransformBuffer);
-			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	GLint locn6 = programWaterPlaneRender.uniformLocations[Uniform_projectionMatrixInv];
+	glUniformMatrix4fv(locn6, 1, GL_FALSE, glm::value_ptr(glm::inverse(app->camera.projection)));
 
-			u32 lightblockOffset = app->LightTransformParamsOffset;
-			u32 lightblockSize = app->LightTransformBuffer.size;
-			glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(2), app->LightTransformBuffer.handle, lightblockOffset, lightblockSize);
+	//every target is rounded up by the pool, only the corner that was rendered is sampled
+	const WaterFX& water = app->waterFX;
+	vec2 renderTargetScale = vec2(app->displaySize) / vec2(app->renderTargetSize);
+	vec2 reflectionScale = vec2(water.reflectionSize) / vec2(RenderTargetBucketSize(water.targetSize));
+	vec2 refractionScale = vec2(water.refractionSize) / vec2(RenderTargetBucketSize(water.targetSize));
+	glUniform2fv(programWaterPlaneRender.uniformLocations[Uniform_uRenderTargetScale], 1, glm::value_ptr(renderTargetScale));
+	glUniform2fv(programWaterPlaneRender.uniformLocations[Uniform_uReflectionScale], 1, glm::value_ptr(reflectionScale));
+	glUniform2fv(programWaterPlaneRender.uniformLocations[Uniform_uRefractionScale], 1, glm::value_ptr(refractionScale));
 
-			u32 globalblockOffset = app->globalParamsOffset;
-			u32 globalblockSize = app->cbuffer.size;
-			glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, globalblockOffset, globalblockSize);
 
-			u32 lightparblockOffset = app->LightParamsParamsOffset;
-			u32 lightparblockSize = app->LightParamsBuffer.size;
-			glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(3), app->LightParamsBuffer.handle, lightparblockOffset, lightparblockSize);
+	//reflection and refraction are the layers of one array, see WaterLayer
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, app->waterAttachmentHandle);
+	GLint locn7 = programWaterPlaneRender.uniformLocations[Uniform_waterMap];
+	glUniform1i(locn7, 0);
 
+	glActiveTexture(GL_TEXTURE1);
+	GLint locn10 = programWaterPlaneRender.uniformLocations[Uniform_waterDepth];
+	glBindTexture(GL_TEXTURE_2D_ARRAY, app->waterdepthAttachmentHandle);
+	glUniform1i(locn10, 1);
 
-			GLint loc4 = glGetUniformLocation(deferredRenderProgramIdx.handle, "current_light");
-			glUniform1i(loc4, i);
+	glActiveTexture(GL_TEXTURE4);
+	GLint locn11 = programWaterPlaneRender.uniformLocations[Uniform_normalMap];
+	glBindTexture(GL_TEXTURE_2D,app->textures[ app->waternormalMapIdx].handle);
+	glUniform1i(locn11, 4);
 
-			glDrawElements(GL_TRIANGLES, vertextodraw, GL_UNSIGNED_SHORT, 0);
+	glActiveTexture(GL_TEXTURE5);
+	GLint locn12 = programWaterPlaneRender.uniformLocations[Uniform_dudvMap];
+	glBindTexture(GL_TEXTURE_2D, app->textures[app->waterdudvMapIdx].handle);//diceTexIdx
+	glUniform1i(locn12, 5);
 
-		}
-	}
-	break;
-	}
-	glBindFramebuffer(GL_FRAMEBUFFER,0);
+	int isDeferred = 0;
+	bool screenSpaceReflection = false;
 
-	if(app->render_water)
+	if (deferred)
 	{
-		//RENDER THE WATER PLANE
+		glActiveTexture(GL_TEXTURE6);
+		GLint locn13 = programWaterPlaneRender.uniformLocations[Uniform_currdepthMap];
+		glBindTexture(GL_TEXTURE_2D, app->depthAttachmentHandle);//diceTexIdx
+		glUniform1i(locn13, 6);
 
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-		glDisable(GL_CULL_FACE);
-		//glBlendEquation(GL_FUNC_ADD);
+		isDeferred = 1;
 
-		if (app->rendermode == RenderMode_Deferred)
+		screenSpaceReflection = water.reflection == WaterReflection_ScreenSpace;
+		if (screenSpaceReflection)
 		{
+			glActiveTexture(GL_TEXTURE7);
+			glBindTexture(GL_TEXTURE_2D, app->depthPyramid.handle);
+			glUniform1i(programWaterPlaneRender.uniformLocations[Uniform_uDepthPyramid], 7);
+			glUniform1i(programWaterPlaneRender.uniformLocations[Uniform_uDepthPyramidLevels], app->depthPyramid.levels);
 
-			glBindFramebuffer(GL_FRAMEBUFFER, app->deferredBufferHandle);
-
-			glDrawBuffers(ARRAY_COUNT(drawBuffersdeferred), drawBuffersdeferred);
-		}
-		else
-		{
-			glBindFramebuffer(GL_FRAMEBUFFER, app->frameBufferHandle);
-
-			glDrawBuffers(ARRAY_COUNT(drawBuffersforward), drawBuffersforward);
+			glUniform1i(programWaterPlaneRender.uniformLocations[Uniform_uPlanarFallback], water.planarFallback);
+			glUniform3fv(programWaterPlaneRender.uniformLocations[Uniform_uSkyColor], 1, glm::value_ptr(water.skyColor));
 		}
 
+	}			
+	
+	//copies of the main pass, see ForwardSceneCopyPass and DeferredSceneCopyPass
+	if (screenSpaceReflection || water.sceneRefraction)
+	{
+		glActiveTexture(GL_TEXTURE8);
+		glBindTexture(GL_TEXTURE_2D, app->sceneColorAttachmentHandle);
+		glUniform1i(programWaterPlaneRender.uniformLocations[Uniform_uSceneColor], 8);
 
-		Program& programWaterPlaneRender = app->programs[app->waterPlaneProgramIdx];
-		glUseProgram(programWaterPlaneRender.handle);
+		glActiveTexture(GL_TEXTURE9);
+		glBindTexture(GL_TEXTURE_2D, deferred ? app->depthAttachmentHandle : app->sceneDepthAttachmentHandle);
+		glUniform1i(programWaterPlaneRender.uniformLocations[Uniform_uSceneDepth], 9);
+	}
 
-		GLint locn1 = glGetUniformLocation(programWaterPlaneRender.handle, "uProjectionMatrix");
-		glUniformMatrix4fv(locn1, 1,GL_FALSE, glm::value_ptr(app->camera.projection));
+	GLint locb = programWaterPlaneRender.uniformLocations[Uniform_isDeferred];
+	glUniform1i(locb, isDeferred);
+	glUniform1i(programWaterPlaneRender.uniformLocations[Uniform_uScreenSpaceReflection], screenSpaceReflection);
+	glUniform1i(programWaterPlaneRender.uniformLocations[Uniform_uSceneRefraction], water.sceneRefraction);
 
-		GLint locn2 = glGetUniformLocation(programWaterPlaneRender.handle, "uWorldViewMatrix");
-		glUniformMatrix4fv(locn2, 1,GL_FALSE, glm::value_ptr(app->camera.view/*add water transform matrix*/));
+	glBindVertexArray(app->waterplanevao);
 
-		GLint locn3 = glGetUniformLocation(programWaterPlaneRender.handle, "viewportSize");
-		glUniform2f(locn3, app->displaySize.x, app->displaySize.y);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+}
 
-		GLint locn4 = glGetUniformLocation(programWaterPlaneRender.handle, "modelViewMatrix");
-		glUniformMatrix4fv(locn4, 1, GL_FALSE, glm::value_ptr(app->camera.view/*add water transform matrix*/));
+static void ForwardWaterPlanePass(App* app)
+{
+	RenderWaterPlane(app, false);
+}
 
-		GLint locn5 = glGetUniformLocation(programWaterPlaneRender.handle, "viewMatrixInv");
-		glUniformMatrix4fv(locn5, 1, GL_FALSE, glm::value_ptr(glm::inverse(app->camera.view)));
+//the screen space reflections read the depth of the main pass through its Hi-Z pyramid
+static void DepthPyramidPass(App* app)
+{
+	BuildDepthPyramid(app, app->depthAttachmentHandle, app->renderTargetSize);
+}
 
-		GLint locn6 = glGetUniformLocation(programWaterPlaneRender.handle, "projectionMatrixInv");
-		glUniformMatrix4fv(locn6, 1, GL_FALSE, glm::value_ptr(glm::inverse(app->camera.projection)));
+static void CopySceneTarget(App* app, GLuint source, GLuint destination)
+{
+	glCopyImageSubData(source, GL_TEXTURE_2D, 0, 0, 0, 0, destination, GL_TEXTURE_2D, 0, 0, 0, 0,
+		app->displaySize.x, app->displaySize.y, 1);
+}
 
+//the water plane draws over the light result and tests against the depth it would read, its
+//refraction and reflection rays read copies of them
+static void ForwardSceneCopyPass(App* app)
+{
+	CopySceneTarget(app, app->finalAttachmentHandle, app->sceneColorAttachmentHandle);
+	CopySceneTarget(app, app->depthAttachmentHandle, app->sceneDepthAttachmentHandle);
+}
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, app->reflectionAttachmentHandle);
-		GLint locn7 = glGetUniformLocation(programWaterPlaneRender.handle, "reflectionMap");
-		glUniform1i(locn7, 0);
+//the deferred water plane doesn't attach the depth, it reads it as it is
+static void DeferredSceneCopyPass(App* app)
+{
+	CopySceneTarget(app, app->deferredAttachmentHandle, app->sceneColorAttachmentHandle);
+}
 
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, app->refractionAttachmentHandle);
-		GLint locn8 = glGetUniformLocation(programWaterPlaneRender.handle, "refractionMap");
-		glUniform1i(locn8, 1);
+static void DeferredWaterPlanePass(App* app)
+{
+	RenderWaterPlane(app, true);
+}
 
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, app->reflectiondepthAttachmentHandle);
-		GLint locn9 = glGetUniformLocation(programWaterPlaneRender.handle, "reflectionDepth");
-		glUniform1i(locn9, 2);
+//the water targets live across frames so they can be reused. Both layers are as large as the
+//larger of them, the other one only uses a corner
+static void UpdateWaterTargets(App* app)
+{
+	WaterFX& water = app->waterFX;
+	RenderTargetPool& pool = app->renderTargets;
 
-		glActiveTexture(GL_TEXTURE3);
-		GLint locn10 = glGetUniformLocation(programWaterPlaneRender.handle, "refractionDepth");
-		glBindTexture(GL_TEXTURE_2D, app->refractiondepthAttachmentHandle);
-		glUniform1i(locn10, 3);
+	if (!app->render_water)
+	{
+		ReleaseRenderTarget(pool, app->waterAttachmentHandle);
+		ReleaseRenderTarget(pool, app->waterdepthAttachmentHandle);
+		water.valid = false;
+		return;
+	}
 
-		glActiveTexture(GL_TEXTURE4);
-		GLint locn11 = glGetUniformLocation(programWaterPlaneRender.handle, "normalMap");
-		glBindTexture(GL_TEXTURE_2D,app->textures[ app->waternormalMapIdx].handle);
-		glUniform1i(locn11, 4);
+	ivec2 reflectionSize = glm::max(app->displaySize / water.reflectionDivisor, ivec2(1));
+	ivec2 refractionSize = glm::max(app->displaySize / water.refractionDivisor, ivec2(1));
+	if (reflectionSize != water.reflectionSize || refractionSize != water.refractionSize)
+	{
+		water.reflectionSize = reflectionSize;
+		water.refractionSize = refractionSize;
+		water.valid = false;
+	}
 
-		glActiveTexture(GL_TEXTURE5);
-		GLint locn12 = glGetUniformLocation(programWaterPlaneRender.handle, "dudvMap");
-		glBindTexture(GL_TEXTURE_2D, app->textures[app->waterdudvMapIdx].handle);//diceTexIdx
-		glUniform1i(locn12, 5);
+	ivec2 targetSize = glm::max(reflectionSize, refractionSize);
+	if (!app->waterAttachmentHandle || targetSize != water.targetSize)
+	{
+		ReleaseRenderTarget(pool, app->waterAttachmentHandle);
+		ReleaseRenderTarget(pool, app->waterdepthAttachmentHandle);
+		app->waterAttachmentHandle = AcquireRenderTargetArray(pool, GL_RGBA8, targetSize, WaterLayer_Count, RenderTargetUsage_Linear);
+		app->waterdepthAttachmentHandle = AcquireRenderTargetArray(pool, GL_DEPTH_COMPONENT24, targetSize, WaterLayer_Count, RenderTargetUsage_Nearest);
+		water.targetSize = targetSize;
+		water.valid = false;
+	}
+}
 
-		int isDeferred = 0;
+static bool WaterNeedsUpdate(App* app)
+{
+	WaterFX& water = app->waterFX;
+	water.framesSinceUpdate++;
 
-		if (app->rendermode == RenderMode_Deferred)
-		{
-			glActiveTexture(GL_TEXTURE6);
-			GLint locn13 = glGetUniformLocation(programWaterPlaneRender.handle, "currdepthMap");
-			glBindTexture(GL_TEXTURE_2D, app->depthAttachmentHandle);//diceTexIdx
-			glUniform1i(locn13, 6);
+	if (!water.valid || (water.layerMask & ~water.renderedLayers))
+		return true;
 
-			isDeferred = 1;
+	if (water.framesSinceUpdate < (u32)water.updateInterval)
+		return false;
 
-		}			
-		
-		GLint locb = glGetUniformLocation(programWaterPlaneRender.handle, "isDeferred");
-		glUniform1i(locb, isDeferred);
+	if (!water.temporalReuse || water.framesSinceUpdate >= (u32)water.maxReuseFrames)
+		return true;
 
-		glBindVertexArray(app->waterplanevao);
+	//the last reflection is still good enough while the camera stays where it was drawn from
+	const Camera& camera = app->camera;
+	f32 moved = glm::distance(camera.position, water.lastPosition);
+	f32 turned = glm::degrees(glm::acos(glm::clamp(glm::dot(glm::normalize(camera.cameraFront), water.lastFront), -1.0f, 1.0f)));
+	return moved > water.reuseDistance || turned > water.reuseAngle;
+}
 
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+//the water passes only run when a water plane pass that is shown reads them
+static void EndWaterFrame(App* app)
+{
+	WaterFX& water = app->waterFX;
+	RenderGraph& graph = app->renderGraph;
 
+	if (water.updating)
+	{
+		water.framesSinceUpdate = 0;
+		water.lastPosition = app->camera.position;
+		water.lastFront = glm::normalize(app->camera.cameraFront);
+		water.renderedLayers = water.layerMask;
+		water.updateCount++;
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	//what the water costs this frame, to compare the reflection modes and settings
+	const char* waterPasses[] = { "Water", "Scene copy", "Water plane", "Depth pyramid", "Scene copy (deferred)", "Water plane (deferred)" };
+	f32 cost = 0.0f;
+	for (u32 i = 0; i < graph.order.size(); ++i)
+	{
+		const char* name = graph.passes[graph.order[i]].name;
+		for (u32 j = 0; j < ARRAY_COUNT(waterPasses); ++j)
+			if (strcmp(name, waterPasses[j]) == 0)
+				cost += graph.passStates[name].gpuTime;
+	}
 
+	water.frameCost = glm::mix(water.frameCost, cost, 0.05f);
 }
 
+//the G buffer targets don't live past the frame and the compact ones can't be shown as they are,
+//the debug views decode them into a texture of their own
+static void GBufferViewPass(App* app)
+{
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+
+	Program& program = app->programs[app->gbufferDebugProgramIdx];
+	glUseProgram(program.handle);
+	BindGBuffer(app, program, app->camera);
+	glUniform1i(program.uniformLocations[Uniform_uDebugView], app->mode - Mode_AlbedoModel);
 
+	glBindVertexArray(app->vao);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+	glBindVertexArray(0);
+}
 
-void passWaterScene(Camera * cam, GLenum colorAttachment, bool reflection, App* app)
+//Every pass of both render modes is declared, the displayed texture is exported and whatever
+//doesn't lead to it gets culled by the graph
+static void BuildFrameGraph(App* app, RenderGraph& graph)
 {
-	//FUNCTION TO RENDER EITHER REFLECTION OR REFRACTION (is called two times in a frame)
-	glDrawBuffer(colorAttachment);
+	const bool compact = app->compactGBuffer;
+	const bool gbufferView = app->mode >= Mode_AlbedoModel && app->mode <= Mode_Specular;
+
+	//the targets read after the frame are owned by the app, everything else is transient
+	if (gbufferView && !app->gbufferDebugAttachmentHandle)
+		app->gbufferDebugAttachmentHandle = AcquireRenderTarget(app->renderTargets, GL_RGBA16F, app->displaySize, RenderTargetUsage_Nearest);
+	else if (!gbufferView)
+		ReleaseRenderTarget(app->renderTargets, app->gbufferDebugAttachmentHandle);
+
+	u32 finalTarget = ImportRenderGraphResource(graph, "final", &app->finalAttachmentHandle);
+	u32 deferredTarget = ImportRenderGraphResource(graph, "deferred", &app->deferredAttachmentHandle);
+	u32 gbufferViewTarget = ImportRenderGraphResource(graph, "gbuffer view", &app->gbufferDebugAttachmentHandle);
+	u32 tileHeatmap = ImportRenderGraphResource(graph, "light tiles", &app->lightTiles.heatmapHandle);
+	u32 lightClusters = ImportRenderGraphResource(graph, "light clusters", &app->lightClusters.gridBuffer.handle);
+
+	const ivec2 size = app->renderTargetSize;
+	u32 depth = CreateRenderGraphTexture(graph, "depth", GL_DEPTH_COMPONENT24, size, RenderTargetUsage_Nearest, &app->depthAttachmentHandle);
+	u32 albedo = CreateRenderGraphTexture(graph, "albedo", compact ? GL_RGBA8 : GL_RGBA16F, size, RenderTargetUsage_Nearest, &app->colorAttachmentHandle);
+	u32 normals = CreateRenderGraphTexture(graph, "normals", compact ? GL_RG16 : GL_RGBA16F, size, RenderTargetUsage_Nearest, &app->normalAttachmentHandle);
+	u32 position = compact ? RENDER_GRAPH_NONE : CreateRenderGraphTexture(graph, "position", GL_RGBA16F, size, RenderTargetUsage_Nearest, &app->positionAttachmentHandle);
+	u32 specular = compact ? RENDER_GRAPH_NONE : CreateRenderGraphTexture(graph, "specular", GL_RGBA16F, size, RenderTargetUsage_Nearest, &app->specularAttachmentHandle);
+
+	u32 waterTarget = ImportRenderGraphResource(graph, "water", &app->waterAttachmentHandle);
+	u32 waterDepth = ImportRenderGraphResource(graph, "water depth", &app->waterdepthAttachmentHandle);
+
+	//WATER, the frames that reuse the last reflection and refraction don't declare its pass
+	UpdateWaterTargets(app);
+	WaterFX& water = app->waterFX;
+	water.updating = false;
+
+	//the screen space reflections only replace the planar one in the deferred path, the refraction
+	//read from the main pass replaces the refraction layer in both
+	const bool screenSpaceReflection = water.reflection == WaterReflection_ScreenSpace;
+	const bool sceneCopy = screenSpaceReflection || water.sceneRefraction;
+	water.layerMask = 0;
+	if (!(screenSpaceReflection && app->mode == Mode_Deferred) || water.planarFallback)
+		water.layerMask |= 1 << WaterLayer_Reflection;
+	if (!water.sceneRefraction)
+		water.layerMask |= 1 << WaterLayer_Refraction;
+
+	u32 pass;
+	if (app->render_water && water.layerMask && WaterNeedsUpdate(app))
+	{
+		pass = AddRenderGraphPass(graph, "Water", WaterPass);
+		SetRenderGraphPassViewport(graph, pass, water.reflectionSize);
+		UseRenderGraphResource(graph, pass, waterTarget, RenderGraphAccess_ColorClear);
+		UseRenderGraphResource(graph, pass, waterDepth, RenderGraphAccess_DepthClear);
+	}
 
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_CLIP_DISTANCE0);
+	//FORWARD, with the pre-pass the main pass keeps its depth
+	const bool forwardPrepass = ForwardDepthPrepass(app);
+	if (forwardPrepass)
+	{
+		pass = AddRenderGraphPass(graph, "Depth prepass", DepthPrepass);
+		UseRenderGraphResource(graph, pass, depth, RenderGraphAccess_DepthClear);
+	}
 
-	glClearColor(0.0, 0.0, 0.0, 0.0);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	if (app->forwardPlus)
+	{
+		pass = AddRenderGraphPass(graph, "Light tiles", LightTilesPass);
+		UseRenderGraphResource(graph, pass, depth, RenderGraphAccess_Sample);
+		UseRenderGraphResource(graph, pass, tileHeatmap, RenderGraphAccess_Storage);
+	}
 
-	Program& programWaterRender = app->programs[app->waterRenderProgramIdx];
-	glUseProgram(programWaterRender.handle);
+	pass = AddRenderGraphPass(graph, "Forward", ForwardPass);
+	if (app->forwardPlus)
+		UseRenderGraphResource(graph, pass, tileHeatmap, RenderGraphAccess_Sample);
+	UseRenderGraphResource(graph, pass, finalTarget, RenderGraphAccess_ColorClear);
+	UseRenderGraphResource(graph, pass, depth, forwardPrepass ? RenderGraphAccess_Depth : RenderGraphAccess_DepthClear);
 
-	if (reflection)
+	//the forward and deferred copies share their handles, only one of the paths runs
+	u32 sceneColor = RENDER_GRAPH_NONE;
+	u32 sceneDepth = RENDER_GRAPH_NONE;
+	if (app->render_water && water.sceneRefraction)
 	{
-		GLint loc4 = glGetUniformLocation(programWaterRender.handle, "clippingPlane");
-		glm::vec4 ClippingPlane = {0, 1, 0, 0};
-		glUniform4fv(loc4,1, glm::value_ptr(ClippingPlane));
+		sceneColor = CreateRenderGraphTexture(graph, "scene color", FinalTargetFormat(app), size, RenderTargetUsage_Nearest, &app->sceneColorAttachmentHandle);
+		sceneDepth = CreateRenderGraphTexture(graph, "scene depth", GL_DEPTH_COMPONENT24, size, RenderTargetUsage_Nearest, &app->sceneDepthAttachmentHandle);
+
+		pass = AddRenderGraphPass(graph, "Scene copy", ForwardSceneCopyPass);
+		UseRenderGraphResource(graph, pass, finalTarget, RenderGraphAccess_Sample);
+		UseRenderGraphResource(graph, pass, depth, RenderGraphAccess_Sample);
+		UseRenderGraphResource(graph, pass, sceneColor, RenderGraphAccess_Storage);
+		UseRenderGraphResource(graph, pass, sceneDepth, RenderGraphAccess_Storage);
 	}
-	else
+
+	if (app->render_water)
 	{
-		GLint loc4 = glGetUniformLocation(programWaterRender.handle, "clippingPlane");
-		glm::vec4 ClippingPlane = { 0, -1, 0, 0 };
-		glUniform4fv(loc4, 1, glm::value_ptr(ClippingPlane));
+		pass = AddRenderGraphPass(graph, "Water plane", ForwardWaterPlanePass);
+		UseRenderGraphResource(graph, pass, waterTarget, RenderGraphAccess_Sample);
+		UseRenderGraphResource(graph, pass, waterDepth, RenderGraphAccess_Sample);
+		if (water.sceneRefraction)
+		{
+			UseRenderGraphResource(graph, pass, sceneColor, RenderGraphAccess_Sample);
+			UseRenderGraphResource(graph, pass, sceneDepth, RenderGraphAccess_Sample);
+		}
+		UseRenderGraphResource(graph, pass, finalTarget, RenderGraphAccess_Color);
+		UseRenderGraphResource(graph, pass, depth, RenderGraphAccess_Depth);
 	}
 
-	GLint locworld = glGetUniformLocation(programWaterRender.handle, "uWorldMatrix");
-	GLint locworldprojview = glGetUniformLocation(programWaterRender.handle, "uWorldViewProjectionMatrix");
+	//DEFERRED
+	if (app->clusteredLighting)
+	{
+		pass = AddRenderGraphPass(graph, "Light clusters", LightClustersPass);
+		UseRenderGraphResource(graph, pass, lightClusters, RenderGraphAccess_Storage);
+	}
 
-	for (int i = 0; i<app->models.size(); ++i)
+	if (app->depthPrepass)
 	{
-		Model& model = app->models[i];
-		Mesh& mesh = app->meshes[model.meshIdx];
+		pass = AddRenderGraphPass(graph, "Depth prepass (deferred)", DeferredDepthPrepass);
+		UseRenderGraphResource(graph, pass, depth, RenderGraphAccess_DepthClear);
+	}
 
-		for (u32 j = 0; j < mesh.submeshes.size(); ++j)
-		{
-			GLuint vao = FindVAO(mesh, j, programWaterRender);
-			glBindVertexArray(vao);
+	//the compact layout only writes albedo and normals, position comes back from the depth
+	pass = AddRenderGraphPass(graph, "G-buffer", GBufferPass);
+	UseRenderGraphResource(graph, pass, albedo, RenderGraphAccess_ColorClear);
+	UseRenderGraphResource(graph, pass, normals, RenderGraphAccess_ColorClear);
+	if (!compact)
+	{
+		UseRenderGraphResource(graph, pass, position, RenderGraphAccess_ColorClear);
+		UseRenderGraphResource(graph, pass, specular, RenderGraphAccess_ColorClear);
+	}
+	UseRenderGraphResource(graph, pass, depth, app->depthPrepass ? RenderGraphAccess_Depth : RenderGraphAccess_DepthClear);
 
-			u32 submeshMaterialIdx = model.materialIdx[j];
-			Material& submeshMaterial = app->materials[submeshMaterialIdx];
+	u32 gbuffer[] = { albedo, normals, position, specular, depth };
 
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.albedoTextureIdx].handle);
-			glUniform1i(app->texturedMeshProgram_uTexture, 0);
+	pass = AddRenderGraphPass(graph, "Deferred lighting", DeferredLightingPass);
+	for (u32 i = 0; i < ARRAY_COUNT(gbuffer); ++i)
+		if (gbuffer[i] != RENDER_GRAPH_NONE)
+			UseRenderGraphResource(graph, pass, gbuffer[i], RenderGraphAccess_Sample);
+	if (app->clusteredLighting)
+		UseRenderGraphResource(graph, pass, lightClusters, RenderGraphAccess_Sample);
+	UseRenderGraphResource(graph, pass, deferredTarget, RenderGraphAccess_ColorClear);
 
-			glm::mat4 world = model.world;
-			glm::mat4 worldViewProjection = cam->projection*cam->view* world;
+	u32 depthPyramid = ImportRenderGraphResource(graph, "depth pyramid", &app->depthPyramid.handle);
+	if (app->render_water && screenSpaceReflection)
+	{
+		pass = AddRenderGraphPass(graph, "Depth pyramid", DepthPyramidPass);
+		UseRenderGraphResource(graph, pass, depth, RenderGraphAccess_Sample);
+		UseRenderGraphResource(graph, pass, depthPyramid, RenderGraphAccess_Storage);
+	}
 
-			glUniformMatrix4fv(locworld,1,GL_FALSE,glm::value_ptr(world));
-			glUniformMatrix4fv(locworldprojview, 1, GL_FALSE, glm::value_ptr(worldViewProjection));
+	if (app->render_water && sceneCopy)
+	{
+		sceneColor = CreateRenderGraphTexture(graph, "scene color (deferred)", DeferredTargetFormat(app), size, RenderTargetUsage_Nearest, &app->sceneColorAttachmentHandle);
+		pass = AddRenderGraphPass(graph, "Scene copy (deferred)", DeferredSceneCopyPass);
+		UseRenderGraphResource(graph, pass, deferredTarget, RenderGraphAccess_Sample);
+		UseRenderGraphResource(graph, pass, sceneColor, RenderGraphAccess_Storage);
+	}
 
-			Submesh& submesh = mesh.submeshes[j];
-			glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
-		}
+	if (app->render_water)
+	{
+		pass = AddRenderGraphPass(graph, "Water plane (deferred)", DeferredWaterPlanePass);
+		UseRenderGraphResource(graph, pass, waterTarget, RenderGraphAccess_Sample);
+		UseRenderGraphResource(graph, pass, waterDepth, RenderGraphAccess_Sample);
+		UseRenderGraphResource(graph, pass, depth, RenderGraphAccess_Sample);
+		if (screenSpaceReflection)
+			UseRenderGraphResource(graph, pass, depthPyramid, RenderGraphAccess_Sample);
+		if (sceneCopy)
+			UseRenderGraphResource(graph, pass, sceneColor, RenderGraphAccess_Sample);
+		UseRenderGraphResource(graph, pass, deferredTarget, RenderGraphAccess_Color);
 	}
 
+	pass = AddRenderGraphPass(graph, "G-buffer view", GBufferViewPass);
+	for (u32 i = 0; i < ARRAY_COUNT(gbuffer); ++i)
+		if (gbuffer[i] != RENDER_GRAPH_NONE)
+			UseRenderGraphResource(graph, pass, gbuffer[i], RenderGraphAccess_Sample);
+	UseRenderGraphResource(graph, pass, gbufferViewTarget, RenderGraphAccess_ColorClear);
 
+	switch (app->mode)
+	{
+	case Mode_AlbedoModel:
+	case Mode_Normals:
+	case Mode_Position:
+	case Mode_Specular:
+		ExportRenderGraphResource(graph, gbufferViewTarget);
+		break;
+	case Mode_Deferred:
+		ExportRenderGraphResource(graph, deferredTarget);
+		break;
+	case Mode_LightTiles:
+		ExportRenderGraphResource(graph, tileHeatmap);
+		break;
+	default:
+		ExportRenderGraphResource(graph, finalTarget);
+		break;
+	}
+}
 
+void Render(App* app)
+{
+	RenderGraph& graph = app->renderGraph;
+	BeginRenderGraph(graph, app->renderTargets, app->displaySize);
+	BuildFrameGraph(app, graph);
+	CompileRenderGraph(graph);
+	ExecuteRenderGraph(app, graph);
+	EndWaterFrame(app);
+
+	//the regions written this frame can't be reused until the gpu is done with them
+	FenceRingRegion(app->cbuffer);
+	FenceRingRegion(app->LightTransformBuffer);
+
+	CollectRenderTargets(app->renderTargets);
 }
 
-GLuint FindVAO(Mesh & mesh, u32 submeshIndex, const Program & program)
+
+
+void passWaterScene(const Camera* cameras, App* app)
 {
-	Submesh& submesh = mesh.submeshes[submeshIndex];
+	//FUNCTION TO RENDER REFLECTION AND REFRACTION, one layer each (is called once in a frame)
+	//the render graph binds and clears the targets
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_CLIP_DISTANCE0);
 
-	for (u32 i = 0; i < (u32)submesh.vao_list.size(); i++)
-	{
-		if (submesh.vao_list[i].programHandle == program.handle)
-			return submesh.vao_list[i].handle;
-	}
+	glDisable(GL_BLEND);
 
-	GLuint vaoHandle = 0;
+	RenderQueue& queue = app->waterQueue;
+	BeginRenderQueue(queue, RenderPass_Water, app->waterRenderProgramIdx, &app->camera);
+	for (u32 layer = 0; layer < WaterLayer_Count; ++layer)
+		queue.layerCameras[layer] = &cameras[layer];
+	queue.layerMask = app->waterFX.layerMask;
+	BuildRenderQueue(app, queue);
+	SortRenderQueue(queue);
+	SubmitRenderQueue(app, queue);
 
-	glGenVertexArrays(1, &vaoHandle);
-	glBindVertexArray(vaoHandle);
+	glDisable(GL_CLIP_DISTANCE0);
+}
 
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
+GLuint FindVAO(App* app, Mesh & mesh, u32 submeshIndex, const Program & program)
+{
+	Submesh& submesh = mesh.submeshes[submeshIndex];
+	GeometryArena& arena = app->geometryArenas[submesh.arenaIdx];
 
+	//the arena VAO enables every attribute of the format, the program just has to find the ones it reads
 	for (u32 i = 0; i < program.vertexInputLayout.attributes.size(); ++i)
 	{
 		bool attributeWasLinked = false;
 
-		for (u32 j = 0; j < submesh.vertexBufferLayout.attributes.size(); ++j)
+		for (u32 j = 0; j < arena.layout.attributes.size(); ++j)
 		{
-			if (program.vertexInputLayout.attributes[i].location == submesh.vertexBufferLayout.attributes[j].location)
+			if (program.vertexInputLayout.attributes[i].location == arena.layout.attributes[j].location)
 			{
-				const u32 index = submesh.vertexBufferLayout.attributes[j].location;
-				const u32 ncomp = submesh.vertexBufferLayout.attributes[j].componentCount;
-				const u32 offset = submesh.vertexBufferLayout.attributes[j].offset + submesh.vertexOffset;
-				const u32 stride = submesh.vertexBufferLayout.stride;
-
-				glVertexAttribPointer(index, ncomp, GL_FLOAT, GL_FALSE, stride, (void*)(u64)offset);
-				glEnableVertexAttribArray(index);
-
 				attributeWasLinked = true;
 				break;
 			}
@@ -1762,12 +2460,7 @@ GLuint FindVAO(Mesh & mesh, u32 submeshIndex, const Program & program)
 		assert(attributeWasLinked);
 	}
 
-	glBindVertexArray(0);
-
-	Vao vao = { vaoHandle, program.handle };
-	submesh.vao_list.push_back(vao);
-
-	return vaoHandle;
+	return arena.vao;
 }
 
 GLuint AddSphere(App * app)
@@ -1882,6 +2575,7 @@ void RecalculateMatrix(Model * model)
 	glm::mat4 rotm = glm::mat4(q);
 	
 	model->world = TransformPosition(model->position)* rotm * TransformScale(model->scale);
+	model->boundsDirty = true;
 }
 
 void ChangePos(Model * model, float x, float y, float z)
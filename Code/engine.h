@@ -7,6 +7,33 @@
 
 #define MAXTEXTURES 1000
 
+#define INITIAL_SCENE_DRAWS 4096 // draws the draw data ring and the draw ids are first sized for, both grow past it
+#define DRAW_ID_LOCATION 5 // instanced vertex attribute carrying the index of the draw
+
+#define MAX_FRUSTUM_PLANES 7 // the 6 camera planes plus an optional clipping plane
+
+#define MAX_TEXTURE_BUCKETS 8
+#define MATERIAL_TEXTURE_UNIT 8 // first texture unit used by the texture buckets
+
+// Froxel grid of the clustered deferred lighting, tiles across the screen and exponential depth slices
+#define LIGHT_CLUSTER_X 16
+#define LIGHT_CLUSTER_Y 9
+#define LIGHT_CLUSTER_Z 24
+#define LIGHT_CLUSTER_COUNT (LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y * LIGHT_CLUSTER_Z)
+
+#define LIGHT_TILE_SIZE 16 // Forward+ screen tiles, in pixels
+
+#define RENDER_TARGET_BUCKET 128         // render targets are allocated in steps of this many pixels
+#define RENDER_TARGET_RESIZE_FRAMES 10   // frames a new size has to hold before the targets are reallocated
+#define RENDER_TARGET_RELEASE_FRAMES 60  // frames an unused target is kept before it is deleted
+
+#define MAX_RENDER_GRAPH_ATTACHMENTS 5
+#define RENDER_GRAPH_TIMER_FRAMES 4      // frames a pass timer query gets before its result is read
+
+#define TEXTURE_UPLOAD_BUFFERS 3 // pixel unpack buffers the streamed textures go through, one in use per frame in flight
+
+#define DEPTH_PYRAMID_LEVELS 8 // RENDER_TARGET_BUCKET is 2^7, the depth target halves exactly that many times
+
 #include "platform.h"
 #include <glad/glad.h>
 #include <glm/glm.hpp>
@@ -14,6 +41,15 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <list>
 #include <vector>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+
+struct aiScene;
 
 typedef glm::vec2  vec2;
 typedef glm::vec3  vec3;
@@ -41,6 +77,27 @@ struct Buffer
 
 };
 
+// Persistently mapped buffer split in frame regions, each one guarded by a fence
+// so the CPU never writes on a region the GPU may still be reading.
+struct RingBuffer
+{
+	Buffer buffer;
+
+	u32 regionCount;
+	u32 regionSize;
+	u32 regionIdx;
+	u32 regionStart;
+	u8* regionData;
+	std::vector<GLsync> fences; // one per region
+
+	bool persistent;
+
+	//fence stats
+	u32 waitCount;
+	f64 lastWaitTime;
+	f64 totalWaitTime;
+};
+
 struct Image
 {
     void* pixels;
@@ -49,10 +106,113 @@ struct Image
     i32   stride;
 };
 
+//what a texture holds, it picks the block compression it is cooked to (see texture_cooking.h)
+enum TextureCompression
+{
+	TextureCompression_None,
+	TextureCompression_Color,  // BC1, BC3 when it has alpha
+	TextureCompression_Normal, // BC5, x and y only
+	TextureCompression_Single, // BC4, the red channel
+};
+
+//a block compressed texture with its whole mip chain, as read from or written to its cache file
+struct CookedTexture
+{
+	GLenum internalFormat;
+	ivec2 size;
+	u64 contentHash;              // of the decoded source pixels and the format they are cooked to
+	std::vector<u8> data;         // every level, the largest first
+	std::vector<u32> levelOffsets; // into data, one per level and a last one at its end
+};
+
 struct Texture
 {
     GLuint      handle;
     std::string filepath;
+    ivec2       size;
+    GLenum      internalFormat;
+    u64         lastWriteTimestamp;
+    bool        resident; // uploaded, a streamed one is replaced by a placeholder until then
+    u64         contentHash;  // of the decoded pixels and their format, see texture_registry.h
+    u32         contentOwner; // itself, or the texture with the same pixels whose handle and layer it shares
+    TextureCompression compression;
+};
+
+//open addressing with linear probing, 0 marks an empty key
+struct HashIndex
+{
+	std::vector<u64> keys;
+	std::vector<u32> values;
+	u32 count;
+};
+
+//see texture_registry.h
+struct TextureRegistry
+{
+	HashIndex paths;    // hash of the path -> texture index, the path itself lives in the texture
+	HashIndex contents; // content hash -> the texture owning those pixels
+
+	u32 lookups;
+	u32 probes;         // slots looked at over all lookups
+	u32 duplicates;     // textures sharing another's pixels
+	u64 savedBytes;     // GPU memory those didn't take, mips included
+};
+
+//a texture decoded on the worker pool, waiting for its upload
+struct TextureDecode
+{
+	u32 textureIdx;
+	std::string filepath;
+	TextureCompression compression;
+	Image image;          // no pixels when the file couldn't be read, or when it was cooked
+	CookedTexture cooked; // no data unless compressed
+	u64 contentHash;      // hashed on the worker too
+	bool cacheHit;        // the cooked texture came from its cache file
+	f64 cookTime;         // seconds the worker spent encoding it
+};
+
+//block compression of the streamed textures, see texture_cooking.h
+struct TextureCooking
+{
+	bool s3tc;           // EXT_texture_compression_s3tc, BC1 and BC3 need it while BC4 and BC5 are core
+	u32 encoded;
+	u32 cacheHits;
+	f64 encodeTime;      // seconds, added over every worker
+	u64 cookedBytes;     // GPU size of the cooked textures, mips included
+	u64 uncompressedBytes; // the same textures as RGBA8
+};
+
+//see texture_streaming.h
+struct TextureStreaming
+{
+	GLuint uploadBuffers[TEXTURE_UPLOAD_BUFFERS];
+	u32 uploadBufferSizes[TEXTURE_UPLOAD_BUFFERS];
+	GLsync uploadFences[TEXTURE_UPLOAD_BUFFERS]; // the buffer is reused once the texture read from it is done
+	u32 nextUploadBuffer;
+
+	std::mutex mutex;
+	std::vector<TextureDecode*> decoded;  // guarded by the mutex, the workers add and the main thread takes
+	std::deque<TextureDecode*> uploads;   // main thread, in the order they were decoded
+
+	u32 frameBudget;      // bytes uploaded per frame, a texture bigger than that goes alone
+	u32 pending;          // requested and not resident yet
+	u32 residentCount;
+	u32 failedCount;
+	u32 frameBytes;       // uploaded this frame
+	u32 bufferWaits;      // frames cut short because the next buffer was still being read
+	u32 newlyResident;    // since the material table was last laid out
+	u32 framesSinceLayout;
+	u64 totalBytes;
+};
+
+// Textures with the same size and format end up as layers of one GL_TEXTURE_2D_ARRAY
+struct TextureBucket
+{
+	GLuint handle;
+	ivec2 size;
+	GLenum internalFormat;
+	u32 mipCount;
+	u32 layerCount;
 };
 
 struct VertexShaderAttribute
@@ -66,13 +226,160 @@ struct VertexShaderLayout
 	std::vector<VertexShaderAttribute>attributes;
 };
 
+// Every uniform the engine sets by hand, used as a precomputed handle
+// into Program::uniformLocations instead of looking it up by name
+enum UniformName
+{
+	Uniform_uTextureBuckets,
+	Uniform_cameraProj,
+
+	Uniform_uAlbedo,
+	Uniform_uNormal,
+	Uniform_uPosition,
+	Uniform_uSpecular,
+	Uniform_current_light,
+
+	Uniform_clippingPlane,
+
+	Uniform_uProjectionMatrix,
+	Uniform_uWorldViewMatrix,
+	Uniform_viewportSize,
+	Uniform_modelViewMatrix,
+	Uniform_viewMatrixInv,
+	Uniform_projectionMatrixInv,
+	Uniform_waterMap,
+	Uniform_waterDepth,
+	Uniform_normalMap,
+	Uniform_dudvMap,
+	Uniform_currdepthMap,
+	Uniform_isDeferred,
+
+	Uniform_uViewMatrix,
+	Uniform_uInverseProjection,
+	Uniform_uScreenSize,
+	Uniform_uClusterDepthRange,
+	Uniform_uLightCount,
+	Uniform_uDepth,
+	Uniform_uCompactGBuffer,
+	Uniform_uDebugView,
+	Uniform_uRenderTargetScale,
+	Uniform_uReflectionScale,
+	Uniform_uRefractionScale,
+	Uniform_uLayerViewProjection,
+	Uniform_uLayerMask,
+	Uniform_uSceneRefraction,
+	Uniform_uSceneDepth,
+	Uniform_uDepthPyramid,
+	Uniform_uDepthPyramidLevels,
+	Uniform_uSceneColor,
+	Uniform_uScreenSpaceReflection,
+	Uniform_uPlanarFallback,
+	Uniform_uSkyColor,
+
+	Uniform_Count
+};
+
+struct ProgramUniform
+{
+	std::string name;
+	GLint location;
+	GLenum type;
+	GLint size;
+};
+
+struct ProgramUniformBlock
+{
+	std::string name;
+	GLuint index;
+	GLint binding;
+	GLint dataSize;
+};
+
 struct Program
 {
     GLuint             handle;
     std::string        filepath;
     std::string        programName;
-    u64                lastWriteTimestamp; // What is this for?
+    u64                lastWriteTimestamp; // of the file when it was last (re)linked, a change at the same time is ignored
+	VertexShaderLayout vertexInputLayout;
+	bool               compute; // single compute stage instead of vertex + fragment
+	bool               geometry; // geometry stage between the vertex and fragment ones
+	std::string        defines;  // extra #defines of a permutation, see ProgramPermutations
+	bool               pending;  // linked without waiting, FinishProgram reads the status
+	u64                cacheKey; // entry of its binary in the program cache
+
+	//reflection, rebuilt every time the program is (re)linked
+	std::vector<ProgramUniform> uniforms;
+	std::vector<ProgramUniformBlock> uniformBlocks;
+	GLint uniformLocations[Uniform_Count];
+};
+
+//linked program binaries kept on disk between runs, see program_cache.h
+struct ProgramCache
+{
+	bool enabled;       // the driver has at least one binary format
+	u64 driverHash;     // vendor, renderer and version strings
+	std::vector<GLint> binaryFormats;
+
+	u32 hits;
+	u32 misses;
+	u32 staleEntries;   // found but unusable, deleted and recompiled
+	f64 programTime;    // seconds spent creating programs and waiting for their links
+	f64 startupTime;    // programTime when Init finished
+};
+
+//threads running std::function jobs, first in first out
+struct WorkerPool
+{
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<std::function<void()>> jobs; // guarded by the mutex
+	bool stopping;
+};
+
+//a file the watcher thread saw change, see asset_watcher.h
+struct AssetChange
+{
+	std::string filepath;
+	f64 detectTime; // GetPlatformTime() when the watcher saw it
+};
+
+struct AssetWatcher
+{
+	std::thread thread;
+	std::atomic<bool> running;
+	const char* backend;                    // "inotify" or "polling"
+
+	//shared with the thread, guarded by the mutex
+	std::mutex mutex;
+	std::vector<std::string> watchedFiles;
+	u32 watchedVersion;                     // bumped when watchedFiles changes
+	std::vector<AssetChange> changes;
+
+	//main thread only
+	u32 watchedPrograms;                    // sizes of the asset arrays when watchedFiles was built
+	u32 watchedTextures;
+	u32 watchedMeshes;
+	u32 reloadCount;
+	u32 failedCount;
+	std::string lastAsset;
+	f64 lastReloadTime;                     // seconds the reload itself took
+	f64 lastLatency;                        // seconds from the watcher seeing the change to the reload being done
+	f64 maxLatency;
+};
+
+//variants of one shader, one per combination of the MaterialFeature bits it cares about. Every
+//variant is a program of app->programs, compiled the first time a material asks for it
+struct ProgramPermutations
+{
+	std::string filepath;
+	std::string programName;
+	u32 featureMask;        // MaterialFeature bits that select a variant, the rest are ignored
+	u32 fallbackProgramIdx; // for the materials with none of them, UINT32_MAX compiles a variant too
 	VertexShaderLayout vertexInputLayout;
+
+	std::unordered_map<u32, u32> variants; // masked features -> program index
 };
 
 struct Material
@@ -98,14 +405,49 @@ struct Material
 	f32 specular;
 };
 
+enum MaterialFeature
+{
+	MaterialFeature_NormalMap   = 1 << 0,
+	MaterialFeature_HeightMap   = 1 << 1,
+	MaterialFeature_SpecularMap = 1 << 2,
+};
+
+// Entry of the material table SSBO, laid out as std430 (see MaterialData in the shaders)
+struct GpuMaterial
+{
+	vec4 albedoSpecular;
+	f32 bumpStrength;
+	f32 normalsStrength;
+	u32 features;
+	u32 padding;
+
+	// bucket and layer of each texture
+	ivec2 albedoTexture;
+	ivec2 normalsTexture;
+	ivec2 bumpTexture;
+	ivec2 specularTexture;
+};
+
+struct MaterialTable
+{
+	Buffer buffer;
+	std::vector<TextureBucket> buckets;
+	std::vector<ivec2> textureLocations; // bucket and layer of every app->textures entry
+	std::vector<u32> dirtyMaterials;
+
+	u32 builtMaterialCount;
+	u32 builtTextureCount;
+	u32 uploadCount;
+	bool layoutDirty; // streamed textures became resident and need their layers
+};
+
 struct Model
 {
 	u32 meshIdx;
 	std::vector<u32> materialIdx;
 
-	u32 localParamsOffset;
-	u32 localParamsSize;
 	glm::mat4 world = {};
+	bool boundsDirty = true; // set by RecalculateMatrix, the world bounds and BVH are refit from it
 
 	glm::vec3 position;
 	glm::vec3 scale;
@@ -130,10 +472,13 @@ struct VertexBufferLayout
 	u8 stride;
 };
 
-struct Vao
+//every mesh with the same vertex format is suballocated from one arena, drawn through one VAO
+struct GeometryArena
 {
-	GLuint handle;
-	GLuint programHandle;
+	VertexBufferLayout layout;
+	Buffer vertexBuffer;
+	u32 vertexCount;
+	GLuint vao;
 };
 
 
@@ -144,9 +489,13 @@ struct Submesh
 	VertexBufferLayout vertexBufferLayout;
 	std::vector<float> vertices;
 	std::vector<u32> indices;
-	u32 vertexOffset;
-	u32 indexOffset;
-	std::vector<Vao>vao_list;
+	u32 arenaIdx;
+	u32 baseVertex;  // in vertices, from the start of the arena
+	u32 firstIndex;  // in indices, from the start of the index arena
+
+	//object space bounds
+	vec3 aabbMin;
+	vec3 aabbMax;
 
 	std::string name;
 };
@@ -154,10 +503,38 @@ struct Submesh
 struct Mesh
 {
 	std::vector<Submesh> submeshes;
-	GLuint vertexBufferHandle;
-	GLuint indexBufferHandle;
+	std::vector<u32> materialIdx; // materials of the submeshes as imported, copied into every model of the mesh
+	u32 firstMaterialIdx;         // the file's materials are app->materials[firstMaterialIdx, +materialCount)
+	u32 materialCount;
 
 	std::string name;
+	std::string filepath;
+	u64 lastWriteTimestamp;
+	bool loading; // imported on the worker pool, no submeshes until it is done
+};
+
+//a model file being imported, see LoadModelAsync
+struct ModelImport
+{
+	u32 meshIdx;
+	std::string filepath;
+	const aiScene* scene;  // released once its materials are made, null when the import failed
+	Mesh imported;         // submeshes with the material indices of the file
+	f64 importTime;        // seconds the worker spent on it
+};
+
+struct ModelImports
+{
+	std::mutex mutex;
+	std::vector<ModelImport*> finished; // guarded by the mutex, the workers add and the main thread takes
+
+	//main thread only
+	u32 pending;
+	u32 completed;
+	u32 failed;
+	f64 workerTime;        // seconds spent importing, added over every worker
+	f64 requestTime;       // when the first import of the current batch was requested
+	f64 readyTime;         // seconds from that request to the whole batch being ready
 };
 
 
@@ -177,6 +554,8 @@ enum Mode//WHAT IS SHOWN
 	Mode_ReflectionWater,
 	Mode_RefractionWater,
 
+	Mode_LightTiles,
+
     Mode_Count
 };
 
@@ -211,6 +590,155 @@ struct Camera
 	glm::vec3 cameraFront;
 };
 
+enum RenderPass
+{
+	RenderPass_DepthPrepass,
+	RenderPass_Forward,
+	RenderPass_GBuffer,
+	RenderPass_Water,        // reflection and refraction at once, one layer each
+
+	RenderPass_Count
+};
+
+//layers of the water targets, a geometry shader sends every triangle to both
+enum WaterLayer
+{
+	WaterLayer_Reflection,
+	WaterLayer_Refraction,
+
+	WaterLayer_Count
+};
+
+// One submesh draw of a RenderQueue, see render_queue.h
+struct DrawCommand
+{
+	u64 key;
+	u32 modelIdx;
+	u32 meshIdx;
+	u32 submeshIdx;
+	u32 materialIdx;
+	u32 programIdx;
+	GLuint vao;
+	u32 indexCount;
+	u32 firstIndex;
+	u32 baseVertex;
+};
+
+struct InstanceGroup
+{
+	u32 commandIdx; // first command of the group, the one the indirect command is built from
+	u32 firstInstance;
+	u32 instanceCount;
+};
+
+//planes point inside, a point p is inside when dot(plane.xyz, p) + plane.w >= 0
+struct Frustum
+{
+	vec4 planes[MAX_FRUSTUM_PLANES];
+	u32 planeCount;
+};
+
+//world space AABBs of every submesh of every model, as center/extents SoA so the
+//culling kernel loads 4 boxes per register. Padded to a multiple of 4
+struct WorldBounds
+{
+	std::vector<f32> centerX, centerY, centerZ;
+	std::vector<f32> extentX, extentY, extentZ;
+	std::vector<u32> firstBound; // first bound of every model, submeshes follow in order
+	std::vector<u32> boundModel; // model of every bound
+	std::vector<u8> visible;     // result of the last CullWorldBounds
+	u32 count;
+};
+
+//leaves own items[leftFirst, leftFirst + count), inner nodes have count 0 and
+//their children at leftFirst and leftFirst + 1, always after the parent
+struct BVHNode
+{
+	vec3 aabbMin;
+	u32 leftFirst;
+	vec3 aabbMax;
+	u32 count;
+};
+
+//hierarchy over the WorldBounds entries, refit in place when models move
+struct BVH
+{
+	std::vector<BVHNode> nodes;
+	std::vector<u32> items;     // WorldBounds indices, leaves reference ranges of it
+	std::vector<u32> parents;   // parent of every node, the root has UINT32_MAX
+	std::vector<u32> itemLeaf;  // leaf holding every WorldBounds index
+	std::vector<u32> dirtyItems;
+	u32 nodeCount;
+
+	f64 lastBuildTime;
+	f64 lastRefitTime;
+};
+
+struct BVHBenchmark
+{
+	u32 itemCount;
+	u32 nodeCount;
+	f64 buildTime;
+	f64 fullRefitTime;
+	f64 partialRefitTime; // 1% of the items moved
+};
+
+struct RayHit
+{
+	bool hit;
+	u32 modelIdx;
+	u32 submeshIdx;
+	f32 t;
+};
+
+//layout defined by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+	u32 count;
+	u32 instanceCount;
+	u32 firstIndex;
+	u32 baseVertex;
+	u32 baseInstance;
+};
+
+//per draw data, indexed in the shaders by the draw id attribute (std430)
+struct GpuDrawData
+{
+	glm::mat4 world;
+	glm::mat4 worldViewProjection;
+	u32 materialIdx;
+	u32 padding[3];
+};
+
+struct RenderQueue
+{
+	RenderPass pass;
+	u32 programIdx;
+	ProgramPermutations* permutations; // when set, every draw uses the variant for its material
+	const Camera* camera;
+	const Camera* layerCameras[WaterLayer_Count]; // RenderPass_Water, culled against every drawn layer
+	u32 layerMask;                                // bit per WaterLayer, the ones nothing reads are skipped
+	std::vector<u8> layerVisible;
+
+	std::vector<DrawCommand> commands;
+	std::vector<DrawCommand> sortScratch;
+
+	//draws of the same submesh and material, submitted as instances of one indirect command
+	std::vector<InstanceGroup> instanceGroups;
+	std::vector<u32> instanceCommands; // command indices, grouped
+	std::unordered_map<u64, u32> instanceGroupLookup;
+
+	//submission stats of the last Submit
+	u32 visibleCount;
+	u32 culledCount;
+	u32 drawCount;
+	u32 instanceCount;
+	u32 vaoBinds;
+	u32 textureBinds;
+	u32 programBinds;
+	u32 multiDrawCount;
+};
+
 glm::mat4 TransformScale(const vec3& scaleFactors);
 glm::mat4 TransformPosition(const vec3& pos);
 
@@ -233,6 +761,236 @@ struct Light
 	float Kquadratic = 0.032;
 };
 
+// Entry of the light SSBO, laid out as std430 (see LightData in the shaders)
+struct GpuLight
+{
+	vec3 position;
+	f32 radius;
+	vec3 color;
+	u32 type;
+	vec3 direction;
+	f32 Klinear;
+	f32 Kquadratic;
+	f32 padding[3];
+};
+
+// All the scene lights in a shader storage buffer, the non point lights go first
+struct GpuLightBuffer
+{
+	Buffer buffer;
+	u32 capacity;
+
+	std::vector<u32> gpuLightIdx; // app->lights index -> buffer index
+	u32 lightCount;
+	u32 globalLightCount;        // directional and ambient lights, they reach every pixel
+};
+
+// Light indices of every cluster or tile one after the other, each one reserves its range with
+// an atomic counter. The count is read back without stalling once the GPU is done with it
+struct LightIndexList
+{
+	Buffer indexBuffer;
+	Buffer counterBuffer;
+	Buffer readbackBuffer;
+	u32 capacity;
+
+	GLsync counterFence;
+	u32 lastCount;
+	u32 overflowCount;
+	u32 lastTruncated;         // tiles that touched more lights than a tile keeps, the cluster list has no such limit
+	u32 truncatedFrames;
+};
+
+// Clustered deferred lighting: every frame a compute pass bins the point lights into the froxels
+// they touch, the resolve then only evaluates the lights of the fragment's cluster
+struct LightClusters
+{
+	u32 boundsProgramIdx;
+	u32 cullProgramIdx;
+	u32 resolveProgramIdx;
+
+	Buffer boundsBuffer;       // view space AABB of every cluster
+	Buffer gridBuffer;         // offset and count of every cluster into the index list
+	LightIndexList indices;
+
+	//the bounds only change with the projection
+	glm::mat4 boundsProjection;
+	bool boundsDirty;
+};
+
+// Forward+: the depth pre-pass gives every screen tile its depth range, a compute pass keeps
+// the point lights touching it and the forward shader only loops over those
+struct LightTiles
+{
+	u32 cullProgramIdx;
+
+	Buffer gridBuffer;         // offset and count of every tile into the index list
+	LightIndexList indices;
+	ivec2 tileCount;
+
+	GLuint heatmapHandle;      // one texel per tile, shown by Mode_LightTiles
+};
+
+// Hi-Z: every level keeps the closest depth of the 2x2 texels under it, see depth_pyramid.h
+struct DepthPyramid
+{
+	u32 copyProgramIdx;
+	u32 reduceProgramIdx;
+
+	GLuint handle;             // R32F, a mip per level
+	ivec2 size;
+	u32 levels;
+};
+
+enum RenderTargetUsage
+{
+	RenderTargetUsage_Nearest, // read texel for texel, G buffer, depth and light results
+	RenderTargetUsage_Linear,  // filtered when sampled
+};
+
+// Screen sized textures, see render_target_pool.h. Sizes are rounded up to RENDER_TARGET_BUCKET,
+// so a target can be larger than what is rendered into it
+struct RenderTarget
+{
+	GLuint handle;
+	GLenum internalFormat;
+	ivec2 size;
+	u32 layers;                  // 1 is a plain 2D texture, more an array
+	RenderTargetUsage usage;
+	u32 bytes;
+
+	bool inUse;
+	u32 releasedFrame;
+};
+
+struct RenderTargetPool
+{
+	std::vector<RenderTarget> targets;
+	u32 frame;
+
+	u64 allocatedBytes;
+	u64 inUseBytes;
+
+	u32 allocationCount;
+	u32 reuseCount;
+	u32 deleteCount;
+};
+
+// How a render graph pass touches a resource. Cleared attachments don't depend on what was in
+// them before, every other write keeps the previous contents and so reads them too
+enum RenderGraphAccess
+{
+	RenderGraphAccess_Sample,     // read in a shader
+	RenderGraphAccess_Color,      // color attachment, blended over what it had
+	RenderGraphAccess_ColorClear, // color attachment, cleared when the pass starts
+	RenderGraphAccess_Depth,      // depth attachment, tested against and written
+	RenderGraphAccess_DepthClear, // depth attachment, cleared when the pass starts
+	RenderGraphAccess_Storage,    // written by compute or image stores, never attached
+};
+
+struct App;
+typedef void (*RenderGraphExecute)(App* app);
+
+struct RenderGraphResource
+{
+	const char* name;
+	GLuint* handle;            // where the texture or buffer is published, null for pure dependencies
+	bool transient;            // taken from the render target pool for the passes that use it only
+	GLenum internalFormat;
+	ivec2 size;
+	RenderTargetUsage usage;
+	u32 bytes;
+
+	bool exported;             // read after the graph runs, keeps its writers alive
+	u32 lastWriter;
+	u32 firstUse;              // positions in the execution order
+	u32 lastUse;
+};
+
+struct RenderGraphUse
+{
+	u32 resourceIdx;
+	RenderGraphAccess access;
+};
+
+struct RenderGraphPass
+{
+	const char* name;
+	RenderGraphExecute execute;
+	std::vector<RenderGraphUse> uses;
+	ivec2 viewportSize;
+
+	std::vector<u32> producers;  // passes whose output this one reads
+	std::vector<u32> runsAfter;  // every pass that has to go first, producers included
+	bool live;
+};
+
+// What the graph keeps of a pass between frames, looked up by name
+struct RenderGraphPassState
+{
+	GLuint framebuffer;
+	GLuint attachments[MAX_RENDER_GRAPH_ATTACHMENTS + 1]; // colors, then depth
+
+	GLuint timerQueries[RENDER_GRAPH_TIMER_FRAMES];
+	u32 pendingQueries;          // bit per query slot
+	f32 gpuTime;                 // ms
+	f32 cpuTime;                 // ms
+	u32 transientBytes;          // transient targets the pass touches
+};
+
+struct RenderGraph
+{
+	std::vector<RenderGraphResource> resources;
+	std::vector<RenderGraphPass> passes;
+	std::vector<u32> order;      // live passes, in execution order
+	ivec2 viewportSize;          // of every pass that doesn't set its own
+	u32 frame;
+
+	std::unordered_map<std::string, RenderGraphPassState> passStates;
+
+	u64 transientBytes;          // every transient target on its own
+	u64 aliasedBytes;            // what they took from the pool, sharing textures when their lifetimes don't overlap
+};
+
+enum WaterReflection
+{
+	WaterReflection_Planar,      // reflection layer of the water targets
+	WaterReflection_ScreenSpace, // deferred only, marched through the depth pyramid of the main pass
+};
+
+//reflection and refraction are rendered at a fraction of the screen and kept between frames,
+//they are redrawn every updateInterval frames and only when the camera moved enough. Both are
+//layers of the same array targets, each drawn into its own viewport of it
+struct WaterFX
+{
+	i32 reflectionDivisor = 2;   // 1, 2 or 4
+	i32 refractionDivisor = 2;
+	i32 updateInterval = 1;      // frames
+	bool temporalReuse = true;
+	f32 reuseDistance = 0.02f;   // world units
+	f32 reuseAngle = 0.25f;      // degrees
+	i32 maxReuseFrames = 30;
+
+	WaterReflection reflection = WaterReflection_Planar;
+	bool planarFallback;         // where the screen space rays miss, instead of the sky color
+	bool sceneRefraction;        // refraction read from a copy of the main pass instead of drawn again
+	vec3 skyColor = vec3(0.45f, 0.6f, 0.8f);
+
+	ivec2 reflectionSize;        // rendered, the targets are rounded up
+	ivec2 refractionSize;
+	ivec2 targetSize;            // both layers fit in it
+	bool valid;
+	u32 layerMask;               // bit per WaterLayer read this frame
+	u32 renderedLayers;          // by the last update
+	u32 framesSinceUpdate;
+	vec3 lastPosition;
+	vec3 lastFront;
+	bool updating;               // this frame
+
+	u32 updateCount;
+	f32 frameCost;               // ms of every water pass that ran, averaged over the frames that reuse and the ones that update
+};
+
 struct App
 {
     // Loop
@@ -252,10 +1010,28 @@ struct App
     //std::vector<Program>  programs;
 
     // program indices
-	u32 forwardRenderProgramIdx;
-
-    u32 mapCalculationProgramIdx;
+	u32 depthPrepassProgramIdx;
 	u32 deferredRenderProgramIdx;
+	u32 gbufferDebugProgramIdx;
+
+	//scene shaders, the draws pick the variant for the features of their material
+	ProgramPermutations forwardPrograms;
+	ProgramPermutations forwardPlusPrograms;
+	ProgramPermutations forwardDepthPrograms; // pre-pass of the height mapped materials
+	ProgramPermutations gbufferPrograms;
+	ProgramPermutations gbufferDepthPrograms;
+	std::unordered_map<u64, u32> programSourceHashes; // variants with the same source share a program
+	ProgramCache programCache;
+	bool parallelShaderCompile;                        // KHR_parallel_shader_compile
+	u32 permutationCount;
+	u32 sharedPermutationCount;
+
+	AssetWatcher assetWatcher;
+	WorkerPool workers;
+	ModelImports modelImports;
+	TextureStreaming textureStreaming;
+	TextureRegistry textureRegistry;
+	TextureCooking textureCooking;
 
 	u32 waterRenderProgramIdx;
 	u32 waterPlaneProgramIdx;
@@ -265,9 +1041,15 @@ struct App
 
 	GLuint bufferHandle;
 
-	u32 LocalParamsOffset;
-	u32 LocalParamsSize;
-	Buffer LocalAttBuffer;
+	GLint storageBlockAlignment;
+
+	//scene geometry
+	std::vector<GeometryArena> geometryArenas;
+	Buffer indexArena;
+	u32 indexArenaCount;
+	Buffer drawIdBuffer;
+	RingBuffer DrawParamsBuffer;
+	u32 sceneDrawCapacity; // draws both of them hold
     
     // texture indices
     u32 diceTexIdx;
@@ -284,7 +1066,6 @@ struct App
 
 	int model = 0;
 	int mesh = 0;
-	u32 texturedMeshProgram_uTexture;
     // Mode
     Mode mode = Mode_FinalRender;
 	RenderMode rendermode;
@@ -302,11 +1083,12 @@ struct App
 
 	u32 globalParamsOffset;
 	u32 globalParamsSize;
-	Buffer cbuffer;
+	RingBuffer cbuffer;
 
 	u32 LightTransformParamsOffset;
 	u32 LightTransformParamsSize;
-	Buffer LightTransformBuffer;
+	RingBuffer LightTransformBuffer;
+	std::vector<u32> lightTransformOffsets;
 
 	glm::mat4 lightworld;
 
@@ -323,8 +1105,9 @@ struct App
 	glm::mat4 world = TransformPosition(vec3(0, 0, -6.0))*TransformScale(vec3(0.45));
 	glm::mat4 worldViewProjection;
 	
-	//framebuffer;
-	GLuint frameBufferHandle;//FRAME BUFFER INITIAL
+	//frame targets, the render graph binds them to the framebuffers of its passes. final, deferred
+	//and the G buffer view are kept between frames, the others only exist while their passes run
+	RenderGraph renderGraph;
 
 	GLuint colorAttachmentHandle;
 	GLuint depthAttachmentHandle;
@@ -333,21 +1116,20 @@ struct App
 	GLuint specularAttachmentHandle;
 	GLuint finalAttachmentHandle;
 
-	//
-	GLuint deferredBufferHandle;
-
 	GLuint deferredAttachmentHandle;
 
-	//water
-	GLuint ReflectionframeBuffer;
-	GLuint reflectionAttachmentHandle;
-	GLuint reflectiondepthAttachmentHandle;
+	//compact G buffer: albedo + specular in RGBA8, octahedral normals in RG16 and the position
+	//rebuilt from depth. Its debug views are decoded into their own target
+	bool compactGBuffer = true;
+	u32 gbufferBytesPerPixel;
+	GLuint gbufferDebugAttachmentHandle;
 
-	GLuint RefractionframeBuffer;
-	GLuint refractionAttachmentHandle;
-	GLuint refractiondepthAttachmentHandle;
+	//water, reflection and refraction layers
+	GLuint waterAttachmentHandle;
+	GLuint waterdepthAttachmentHandle;
 
 	bool render_water = true;
+	WaterFX waterFX;
 
 	GLuint waterviewmatloc;
 	GLuint waterprojmatloc;
@@ -360,8 +1142,10 @@ struct App
 
 
 	//CHECK WINDOW SIZE
-	float prevwinx;
-	float prevwiny;
+	RenderTargetPool renderTargets;
+	ivec2 renderTargetSize;    // size the screen targets were allocated with, displaySize fits in it
+	ivec2 pendingDisplaySize;
+	u32 resizeStableFrames;
 
 	GLint screen[2];
 
@@ -377,18 +1161,51 @@ struct App
 
 	bool isrenderonfocus = false;
 
-	u32 LightParamsParamsOffset;
-	u32 LightParamsParamsSize;
-	Buffer LightParamsBuffer;
+	RenderQueue sceneQueue;
+	RenderQueue prepassQueue;
+	RenderQueue waterQueue;
+	WorldBounds worldBounds;
+	BVH sceneBVH;
+	BVHBenchmark bvhBenchmark;
+	bool bvhCulling = true;
+	i32 pickedModel = -1;
+
+	MaterialTable materialTable;
+
+	GpuLightBuffer gpuLights;
+	LightClusters lightClusters;
+	bool clusteredLighting = true;
+	LightTiles lightTiles;
+	bool forwardPlus = true;
+
+	//opaque geometry is drawn depth only first, the main pass then shades with GL_EQUAL.
+	//Forward+ has one regardless, its tiles are culled against that depth
+	bool depthPrepass = true;
+
+	DepthPyramid depthPyramid;
+	GLuint sceneColorAttachmentHandle; // copy of the forward or deferred light result, read by the water plane
+	GLuint sceneDepthAttachmentHandle; // copy of the forward depth, the water plane tests against the original
 
 	GLuint KlLocdeferred;
 	GLuint KqLocdeferred;
 };
 
 void Init(App* app);
+void Shutdown(App* app);
 
 u32 LoadTexture2D(App* app, const char* filepath);
+bool ReloadTexture2D(App* app, u32 texIdx);
+void BuildProgramReflection(Program& program);
+bool ReloadProgram(App* app, u32 programIdx);
+u32 LoadProgram(App* app, const char* filepath, const char* programName, bool geometry = false);
+GLuint CreateProgramFromSource(String programSource, const char* shaderName, bool geometry, const char* defines = "", bool deferStatus = false);
+GLuint CompileProgram(App* app, Program& program, String programSource, bool deferStatus = false);
+void FinishProgram(App* app, u32 programIdx);
+u32 LoadComputeProgram(App* app, const char* filepath, const char* programName);
 Image LoadImage(const char* filename);
+void FreeImage(Image image);
+GLenum TextureInternalFormat(const Image& image);
+GLuint CreateTexture2DFromImage(Image image);
 void AddLight(LightType type, vec3 color, vec3 direction, vec3 position, App* app);
 
 void Gui(App* app);
@@ -398,15 +1215,15 @@ void LightWindowGUI(App* app);
 
 void Update(App* app);
 void GenerateBuffers(App* app);
-void GenerateWaterBuffers(App* app);
 
 void ChangeWindowSize(float x, float y, App* app);
 //glm::mat4 TransformRotation(const vec3& rotation);
 
 void Render(App* app);
-GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program);
+void BindGBuffer(App* app, const Program& program, const Camera& camera);
+GLuint FindVAO(App* app, Mesh& mesh, u32 submeshIndex, const Program& program);
 
-void passWaterScene(Camera* cam, GLenum colorAttachment, bool reflection, App* app);
+void passWaterScene(const Camera* cameras, App* app);
 
 GLuint AddSphere(App* app);
 
@@ -0,0 +1,181 @@
+#include "frustum_culling.h"
+#include "bvh.h"
+#include <xmmintrin.h>
+#include <cfloat>
+
+static vec4 NormalizePlane(vec4 plane)
+{
+	f32 length = glm::length(vec3(plane));
+	return plane / length;
+}
+
+Frustum MakeFrustum(const glm::mat4& viewProjection)
+{
+	//Gribb/Hartmann, rows of the clip matrix. glm is column major so row i is m[.][i]
+	glm::mat4 m = glm::transpose(viewProjection);
+
+	Frustum frustum = {};
+	frustum.planes[0] = NormalizePlane(m[3] + m[0]); // left
+	frustum.planes[1] = NormalizePlane(m[3] - m[0]); // right
+	frustum.planes[2] = NormalizePlane(m[3] + m[1]); // bottom
+	frustum.planes[3] = NormalizePlane(m[3] - m[1]); // top
+	frustum.planes[4] = NormalizePlane(m[3] + m[2]); // near
+	frustum.planes[5] = NormalizePlane(m[3] - m[2]); // far
+	frustum.planeCount = 6;
+	return frustum;
+}
+
+void AddFrustumPlane(Frustum& frustum, vec4 plane)
+{
+	ASSERT(frustum.planeCount < MAX_FRUSTUM_PLANES, "Too many frustum planes");
+	frustum.planes[frustum.planeCount++] = NormalizePlane(plane);
+}
+
+void ComputeSubmeshBounds(Submesh& submesh)
+{
+	//positions are always the first attribute of the vertex
+	const u32 floatStride = submesh.vertexBufferLayout.stride / sizeof(float);
+	const u32 vertexCount = floatStride ? submesh.vertices.size() / floatStride : 0;
+
+	if (vertexCount == 0)
+	{
+		submesh.aabbMin = submesh.aabbMax = vec3(0.0f);
+		return;
+	}
+
+	vec3 aabbMin(FLT_MAX);
+	vec3 aabbMax(-FLT_MAX);
+	for (u32 i = 0; i < vertexCount; ++i)
+	{
+		vec3 position = glm::make_vec3(&submesh.vertices[i * floatStride]);
+		aabbMin = glm::min(aabbMin, position);
+		aabbMax = glm::max(aabbMax, position);
+	}
+
+	submesh.aabbMin = aabbMin;
+	submesh.aabbMax = aabbMax;
+}
+
+static void ComputeModelBounds(App* app, u32 modelIdx)
+{
+	WorldBounds& bounds = app->worldBounds;
+	const Model& model = app->models[modelIdx];
+	const Mesh& mesh = app->meshes[model.meshIdx];
+	const glm::mat4& world = model.world;
+
+	//Arvo: the extents of the transformed box are the extents multiplied by |world|
+	glm::mat3 absWorld = glm::mat3(world);
+	for (u32 c = 0; c < 3; ++c)
+		absWorld[c] = glm::abs(absWorld[c]);
+
+	for (u32 j = 0; j < mesh.submeshes.size(); ++j)
+	{
+		const Submesh& submesh = mesh.submeshes[j];
+		vec3 center = vec3(world * vec4((submesh.aabbMin + submesh.aabbMax) * 0.5f, 1.0f));
+		vec3 extent = absWorld * ((submesh.aabbMax - submesh.aabbMin) * 0.5f);
+
+		u32 b = bounds.firstBound[modelIdx] + j;
+		bounds.centerX[b] = center.x;
+		bounds.centerY[b] = center.y;
+		bounds.centerZ[b] = center.z;
+		bounds.extentX[b] = extent.x;
+		bounds.extentY[b] = extent.y;
+		bounds.extentZ[b] = extent.z;
+	}
+}
+
+void UpdateWorldBounds(App* app)
+{
+	WorldBounds& bounds = app->worldBounds;
+	BVH& bvh = app->sceneBVH;
+
+	//models were added, lay the arrays out again and rebuild the hierarchy from scratch
+	const bool rebuild = bounds.firstBound.size() != app->models.size();
+	if (rebuild)
+	{
+		u32 count = 0;
+		bounds.firstBound.resize(app->models.size());
+		bounds.boundModel.clear();
+		for (u32 i = 0; i < app->models.size(); ++i)
+		{
+			bounds.firstBound[i] = count;
+			u32 submeshCount = app->meshes[app->models[i].meshIdx].submeshes.size();
+			bounds.boundModel.insert(bounds.boundModel.end(), submeshCount, i);
+			count += submeshCount;
+			app->models[i].boundsDirty = true;
+		}
+
+		const u32 paddedCount = (count + 3) & ~3u;
+		bounds.centerX.assign(paddedCount, 0.0f);
+		bounds.centerY.assign(paddedCount, 0.0f);
+		bounds.centerZ.assign(paddedCount, 0.0f);
+		bounds.extentX.assign(paddedCount, 0.0f);
+		bounds.extentY.assign(paddedCount, 0.0f);
+		bounds.extentZ.assign(paddedCount, 0.0f);
+		bounds.visible.assign(paddedCount, 0);
+		bounds.count = count;
+	}
+
+	for (u32 i = 0; i < app->models.size(); ++i)
+	{
+		Model& model = app->models[i];
+		if (!model.boundsDirty)
+			continue;
+
+		ComputeModelBounds(app, i);
+		model.boundsDirty = false;
+
+		if (!rebuild)
+		{
+			u32 submeshCount = app->meshes[model.meshIdx].submeshes.size();
+			for (u32 j = 0; j < submeshCount; ++j)
+				bvh.dirtyItems.push_back(bounds.firstBound[i] + j);
+		}
+	}
+
+	if (rebuild)
+		BuildBVH(bvh, bounds);
+	else if (!bvh.dirtyItems.empty())
+		RefitBVH(bvh, bounds);
+}
+
+u32 CullWorldBounds(WorldBounds& bounds, const Frustum& frustum)
+{
+	const __m128 zero = _mm_setzero_ps();
+	u32 visibleCount = 0;
+
+	for (u32 i = 0; i < bounds.count; i += 4)
+	{
+		__m128 cx = _mm_loadu_ps(&bounds.centerX[i]);
+		__m128 cy = _mm_loadu_ps(&bounds.centerY[i]);
+		__m128 cz = _mm_loadu_ps(&bounds.centerZ[i]);
+		__m128 ex = _mm_loadu_ps(&bounds.extentX[i]);
+		__m128 ey = _mm_loadu_ps(&bounds.extentY[i]);
+		__m128 ez = _mm_loadu_ps(&bounds.extentZ[i]);
+
+		//a box is out when it is fully behind any plane: dot(n, c) + d + dot(|n|, e) < 0
+		__m128 outside = zero;
+		for (u32 p = 0; p < frustum.planeCount; ++p)
+		{
+			const vec4& plane = frustum.planes[p];
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)),
+			                                        _mm_mul_ps(cy, _mm_set1_ps(plane.y))),
+			                             _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane.z)),
+			                                        _mm_set1_ps(plane.w)));
+			__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(glm::abs(plane.x))),
+			                                      _mm_mul_ps(ey, _mm_set1_ps(glm::abs(plane.y)))),
+			                           _mm_mul_ps(ez, _mm_set1_ps(glm::abs(plane.z))));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+		}
+
+		int outsideMask = _mm_movemask_ps(outside);
+		for (u32 k = 0; k < 4 && i + k < bounds.count; ++k)
+		{
+			u8 visible = (outsideMask >> k) & 1 ? 0 : 1;
+			bounds.visible[i + k] = visible;
+			visibleCount += visible;
+		}
+	}
+
+	return visibleCount;
+}
@@ -0,0 +1,14 @@
+//
+// frustum_culling.h: Per submesh bounding volumes in world space and a SSE kernel that
+// tests them against the frustum of a pass 4 boxes at a time.
+//
+#pragma once
+
+#include "engine.h"
+
+Frustum MakeFrustum(const glm::mat4& viewProjection);
+void AddFrustumPlane(Frustum& frustum, vec4 plane);
+
+void ComputeSubmeshBounds(Submesh& submesh);
+void UpdateWorldBounds(App* app);
+u32 CullWorldBounds(WorldBounds& bounds, const Frustum& frustum);
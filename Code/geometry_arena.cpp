@@ -0,0 +1,157 @@
+#include "geometry_arena.h"
+#include "buffer_management.h"
+
+static bool SameLayout(const VertexBufferLayout& a, const VertexBufferLayout& b)
+{
+	if (a.stride != b.stride || a.attributes.size() != b.attributes.size())
+		return false;
+
+	for (u32 i = 0; i < a.attributes.size(); ++i)
+	{
+		if (a.attributes[i].location != b.attributes[i].location ||
+		    a.attributes[i].componentCount != b.attributes[i].componentCount ||
+		    a.attributes[i].offset != b.attributes[i].offset)
+			return false;
+	}
+	return true;
+}
+
+static void SetupArenaVAO(App* app, GeometryArena& arena)
+{
+	glBindVertexArray(arena.vao);
+
+	glBindBuffer(GL_ARRAY_BUFFER, arena.vertexBuffer.handle);
+	for (u32 i = 0; i < arena.layout.attributes.size(); ++i)
+	{
+		const VertexBufferAttribute& attribute = arena.layout.attributes[i];
+		glVertexAttribPointer(attribute.location, attribute.componentCount, GL_FLOAT, GL_FALSE, arena.layout.stride, (void*)(u64)attribute.offset);
+		glEnableVertexAttribArray(attribute.location);
+	}
+
+	//one value per instance, the base instance of every indirect command selects its draw data
+	glBindBuffer(GL_ARRAY_BUFFER, app->drawIdBuffer.handle);
+	glVertexAttribIPointer(DRAW_ID_LOCATION, 1, GL_UNSIGNED_INT, sizeof(u32), (void*)0);
+	glVertexAttribDivisor(DRAW_ID_LOCATION, 1);
+	glEnableVertexAttribArray(DRAW_ID_LOCATION);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->indexArena.handle);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+//grows the buffer keeping its contents, the caller must rebind it where it's referenced
+static void GrowBuffer(Buffer& buffer, u32 requiredSize)
+{
+	u32 newSize = buffer.size;
+	while (newSize < requiredSize)
+		newSize *= 2;
+
+	//allocated through the copy target, binding the index arena as an element buffer
+	//would overwrite the element binding of whatever VAO happens to be bound
+	Buffer newBuffer = {};
+	newBuffer.size = newSize;
+	newBuffer.type = buffer.type;
+	glGenBuffers(1, &newBuffer.handle);
+
+	glBindBuffer(GL_COPY_READ_BUFFER, buffer.handle);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer.handle);
+	glBufferData(GL_COPY_WRITE_BUFFER, newBuffer.size, NULL, GL_STATIC_DRAW);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, buffer.size);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	glDeleteBuffers(1, &buffer.handle);
+	buffer = newBuffer;
+}
+
+//draw ids are just 0..count-1, read through the base instance
+static Buffer CreateDrawIdBuffer(u32 count)
+{
+	std::vector<u32> drawIds(count);
+	for (u32 i = 0; i < count; ++i)
+		drawIds[i] = i;
+
+	Buffer buffer = CreateStaticVertexBuffer(count * sizeof(u32));
+	glBindBuffer(GL_ARRAY_BUFFER, buffer.handle);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, drawIds.size() * sizeof(u32), drawIds.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return buffer;
+}
+
+void InitGeometryArenas(App* app)
+{
+	app->geometryArenas.clear();
+	app->indexArena = CreateStaticIndexBuffer(GEOMETRY_ARENA_INITIAL_SIZE);
+	app->indexArenaCount = 0;
+	app->drawIdBuffer = CreateDrawIdBuffer(INITIAL_SCENE_DRAWS);
+}
+
+void ReserveDrawIds(App* app, u32 count)
+{
+	glDeleteBuffers(1, &app->drawIdBuffer.handle);
+	app->drawIdBuffer = CreateDrawIdBuffer(count);
+
+	for (u32 i = 0; i < app->geometryArenas.size(); ++i)
+		SetupArenaVAO(app, app->geometryArenas[i]);
+}
+
+u32 FindOrCreateGeometryArena(App* app, const VertexBufferLayout& layout)
+{
+	for (u32 i = 0; i < app->geometryArenas.size(); ++i)
+	{
+		if (SameLayout(app->geometryArenas[i].layout, layout))
+			return i;
+	}
+
+	GeometryArena arena = {};
+	arena.layout = layout;
+	arena.vertexBuffer = CreateStaticVertexBuffer(GEOMETRY_ARENA_INITIAL_SIZE);
+	glGenVertexArrays(1, &arena.vao);
+	SetupArenaVAO(app, arena);
+
+	app->geometryArenas.push_back(arena);
+	return app->geometryArenas.size() - 1;
+}
+
+void UploadSubmeshGeometry(App* app, Submesh& submesh)
+{
+	ASSERT(app->indexArena.handle != 0, "InitGeometryArenas() must be called before loading meshes");
+
+	submesh.arenaIdx = FindOrCreateGeometryArena(app, submesh.vertexBufferLayout);
+	GeometryArena& arena = app->geometryArenas[submesh.arenaIdx];
+
+	const u32 stride = submesh.vertexBufferLayout.stride;
+	const u32 verticesSize = submesh.vertices.size() * sizeof(float);
+	const u32 indicesSize = submesh.indices.size() * sizeof(u32);
+	const u32 verticesOffset = arena.vertexCount * stride;
+	const u32 indicesOffset = app->indexArenaCount * sizeof(u32);
+
+	if (verticesOffset + verticesSize > arena.vertexBuffer.size)
+	{
+		GrowBuffer(arena.vertexBuffer, verticesOffset + verticesSize);
+		SetupArenaVAO(app, arena);
+	}
+
+	if (indicesOffset + indicesSize > app->indexArena.size)
+	{
+		GrowBuffer(app->indexArena, indicesOffset + indicesSize);
+		for (u32 i = 0; i < app->geometryArenas.size(); ++i)
+			SetupArenaVAO(app, app->geometryArenas[i]);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, arena.vertexBuffer.handle);
+	glBufferSubData(GL_ARRAY_BUFFER, verticesOffset, verticesSize, submesh.vertices.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	//the element buffer binding is VAO state, upload through the copy target instead
+	glBindBuffer(GL_COPY_WRITE_BUFFER, app->indexArena.handle);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, indicesOffset, indicesSize, submesh.indices.data());
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	submesh.baseVertex = arena.vertexCount;
+	submesh.firstIndex = app->indexArenaCount;
+
+	arena.vertexCount += verticesSize / stride;
+	app->indexArenaCount += submesh.indices.size();
+}
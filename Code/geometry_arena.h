@@ -0,0 +1,16 @@
+//
+// geometry_arena.h: Global vertex/index storage for the scene meshes. Submeshes are suballocated
+// from one vertex arena per vertex format and a single index arena, so every submesh with the
+// same format shares a VAO and can go in the same glMultiDrawElementsIndirect call.
+//
+#pragma once
+
+#include "engine.h"
+
+#define GEOMETRY_ARENA_INITIAL_SIZE (16 * 1024 * 1024)
+
+void InitGeometryArenas(App* app);
+// the draw ids go up to count-1, every arena VAO is pointed at the new buffer
+void ReserveDrawIds(App* app, u32 count);
+u32 FindOrCreateGeometryArena(App* app, const VertexBufferLayout& layout);
+void UploadSubmeshGeometry(App* app, Submesh& submesh);
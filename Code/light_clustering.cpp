@@ -0,0 +1,302 @@
+#include "light_clustering.h"
+#include "buffer_management.h"
+
+f32 LightVolumeRadius(const Light& light)
+{
+	//distance at which the attenuated light drops below 5/256 of its brightest channel
+	const f32 maxBrightness = std::fmaxf(std::fmaxf(light.color.r, light.color.g), light.color.b);
+	return (-light.Klinear + std::sqrt(light.Klinear * light.Klinear - 4 * light.Kquadratic * (light.Kconstant - (256.0f / 5.0f) * maxBrightness))) / (2.0f * light.Kquadratic);
+}
+
+static void ResizeStorage(Buffer& buffer, u32 size)
+{
+	if (buffer.handle)
+		glDeleteBuffers(1, &buffer.handle);
+	buffer = CreateBuffer(size, GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_DRAW);
+}
+
+static void InitIndexList(LightIndexList& list, u32 capacity)
+{
+	list.capacity = capacity;
+	ResizeStorage(list.indexBuffer, list.capacity * sizeof(u32));
+	//the index count, then the tiles that had to drop lights
+	ResizeStorage(list.counterBuffer, sizeof(u32) * 2);
+	list.readbackBuffer = CreateBuffer(sizeof(u32) * 2, GL_COPY_WRITE_BUFFER, GL_STREAM_READ);
+}
+
+static void ReadBackIndexCount(LightIndexList& list, const char* name)
+{
+	if (!list.counterFence)
+		return;
+
+	GLenum status = glClientWaitSync(list.counterFence, 0, 0);
+	if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		return;
+
+	glDeleteSync(list.counterFence);
+	list.counterFence = 0;
+
+	u32 counters[2];
+	glBindBuffer(GL_COPY_WRITE_BUFFER, list.readbackBuffer.handle);
+	glGetBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizeof(counters), counters);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	//logged when it starts, the UI keeps the count while it lasts
+	if (counters[1] > 0 && list.lastTruncated == 0)
+		ELOG("%s light culling: %u tiles touched more lights than they can keep, the rest are not shaded\n", name, counters[1]);
+	list.truncatedFrames += counters[1] > 0 ? 1 : 0;
+	list.lastCount = counters[0];
+	list.lastTruncated = counters[1];
+
+	//some lists lost lights that frame, make room for all of them from now on
+	if (list.lastCount > list.capacity)
+	{
+		list.overflowCount++;
+		list.capacity = list.lastCount + list.lastCount / 2;
+		ResizeStorage(list.indexBuffer, list.capacity * sizeof(u32));
+		ILOG("%s light index list grown to %u entries\n", name, list.capacity);
+	}
+}
+
+static void BeginIndexList(LightIndexList& list)
+{
+	u32 zero[2] = {};
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, list.counterBuffer.handle);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), zero);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_LIGHT_INDEX_BINDING, list.indexBuffer.handle);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_COUNTER_BINDING, list.counterBuffer.handle);
+}
+
+//keep a copy of how many indices were needed, it is read once the GPU gets there
+static void EndIndexList(LightIndexList& list)
+{
+	if (list.counterFence)
+		return;
+
+	glBindBuffer(GL_COPY_READ_BUFFER, list.counterBuffer.handle);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, list.readbackBuffer.handle);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(u32) * 2);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	list.counterFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void InitLightCulling(App* app)
+{
+	GpuLightBuffer& lights = app->gpuLights;
+	lights.capacity = 64;
+	ResizeStorage(lights.buffer, lights.capacity * sizeof(GpuLight));
+
+	LightClusters& clusters = app->lightClusters;
+	clusters.boundsProgramIdx = LoadComputeProgram(app, "light_clustering.glsl", "LIGHT_CLUSTER_BOUNDS");
+	clusters.cullProgramIdx = LoadComputeProgram(app, "light_clustering.glsl", "LIGHT_CLUSTER_CULL");
+	clusters.resolveProgramIdx = LoadProgram(app, "deferred.glsl", "DEFERRED_CLUSTERED_RESOLVE");
+
+	ResizeStorage(clusters.boundsBuffer, LIGHT_CLUSTER_COUNT * sizeof(vec4) * 2);
+	ResizeStorage(clusters.gridBuffer, LIGHT_CLUSTER_COUNT * sizeof(u32) * 2);
+	InitIndexList(clusters.indices, LIGHT_CLUSTER_COUNT * CLUSTER_AVERAGE_LIGHTS);
+	clusters.boundsDirty = true;
+
+	//the tile grid follows the screen size, it is created by the first BuildLightTiles
+	LightTiles& tiles = app->lightTiles;
+	tiles.cullProgramIdx = LoadComputeProgram(app, "light_clustering.glsl", "LIGHT_TILE_CULL");
+}
+
+void UploadGpuLights(App* app)
+{
+	GpuLightBuffer& lights = app->gpuLights;
+
+	//directional and ambient lights first, the cull passes only look at the point lights after them
+	std::vector<GpuLight> gpuLights;
+	gpuLights.reserve(app->lights.size());
+	lights.gpuLightIdx.resize(app->lights.size());
+
+	for (u32 pointLights = 0; pointLights < 2; ++pointLights)
+	{
+		for (u32 i = 0; i < app->lights.size(); ++i)
+		{
+			const Light& light = app->lights[i];
+			if ((light.type == LightType_Point) != (pointLights == 1))
+				continue;
+
+			GpuLight gpuLight = {};
+			gpuLight.position = light.position;
+			gpuLight.radius = light.type == LightType_Point ? LightVolumeRadius(light) : 0.0f;
+			gpuLight.color = light.color;
+			gpuLight.type = light.type;
+			gpuLight.direction = light.direction;
+			gpuLight.Klinear = light.Klinear;
+			gpuLight.Kquadratic = light.Kquadratic;
+
+			lights.gpuLightIdx[i] = gpuLights.size();
+			gpuLights.push_back(gpuLight);
+		}
+
+		if (pointLights == 0)
+			lights.globalLightCount = gpuLights.size();
+	}
+	lights.lightCount = gpuLights.size();
+
+	if (lights.lightCount > lights.capacity)
+	{
+		while (lights.capacity < lights.lightCount)
+			lights.capacity *= 2;
+		ResizeStorage(lights.buffer, lights.capacity * sizeof(GpuLight));
+	}
+
+	//orphan the previous storage so the upload doesn't wait for last frame's lighting
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, lights.buffer.handle);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, lights.buffer.size, NULL, GL_DYNAMIC_DRAW);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, gpuLights.size() * sizeof(GpuLight), gpuLights.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void BuildLightClusters(App* app, const Camera& camera)
+{
+	LightClusters& clusters = app->lightClusters;
+	const GpuLightBuffer& lights = app->gpuLights;
+
+	ReadBackIndexCount(clusters.indices, "Cluster");
+
+	//the froxels are fixed in NDC, their view space bounds only change with the projection
+	if (clusters.boundsDirty || clusters.boundsProjection != camera.projection)
+	{
+		Program& boundsProgram = app->programs[clusters.boundsProgramIdx];
+		glUseProgram(boundsProgram.handle);
+		glUniformMatrix4fv(boundsProgram.uniformLocations[Uniform_uInverseProjection], 1, GL_FALSE, glm::value_ptr(glm::inverse(camera.projection)));
+		glUniform2f(boundsProgram.uniformLocations[Uniform_uClusterDepthRange], camera.znear, camera.zfar);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_BOUNDS_BINDING, clusters.boundsBuffer.handle);
+
+		//one invocation per tile, one work group per depth slice
+		glDispatchCompute(1, 1, LIGHT_CLUSTER_Z);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		clusters.boundsProjection = camera.projection;
+		clusters.boundsDirty = false;
+	}
+
+	Program& cullProgram = app->programs[clusters.cullProgramIdx];
+	glUseProgram(cullProgram.handle);
+	glUniformMatrix4fv(cullProgram.uniformLocations[Uniform_uViewMatrix], 1, GL_FALSE, glm::value_ptr(camera.view));
+	glUniform2ui(cullProgram.uniformLocations[Uniform_uLightCount], lights.globalLightCount, lights.lightCount);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BUFFER_BINDING, lights.buffer.handle);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_BOUNDS_BINDING, clusters.boundsBuffer.handle);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_GRID_BINDING, clusters.gridBuffer.handle);
+	BeginIndexList(clusters.indices);
+
+	glDispatchCompute((LIGHT_CLUSTER_COUNT + CLUSTER_CULL_GROUP_SIZE - 1) / CLUSTER_CULL_GROUP_SIZE, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	EndIndexList(clusters.indices);
+}
+
+void ResolveClusteredLighting(App* app, const Camera& camera)
+{
+	LightClusters& clusters = app->lightClusters;
+	const GpuLightBuffer& lights = app->gpuLights;
+	Program& resolveProgram = app->programs[clusters.resolveProgramIdx];
+
+	glUseProgram(resolveProgram.handle);
+
+	BindGBuffer(app, resolveProgram, camera);
+
+	glUniformMatrix4fv(resolveProgram.uniformLocations[Uniform_uViewMatrix], 1, GL_FALSE, glm::value_ptr(camera.view));
+	glUniform2f(resolveProgram.uniformLocations[Uniform_uScreenSize], app->displaySize.x, app->displaySize.y);
+	glUniform2f(resolveProgram.uniformLocations[Uniform_uClusterDepthRange], camera.znear, camera.zfar);
+	glUniform2ui(resolveProgram.uniformLocations[Uniform_uLightCount], lights.globalLightCount, lights.lightCount);
+
+	u32 globalblockOffset = app->globalParamsOffset;
+	u32 globalblockSize = RingRangeSize(app->cbuffer, globalblockOffset);
+	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.buffer.handle, globalblockOffset, globalblockSize);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BUFFER_BINDING, lights.buffer.handle);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_GRID_BINDING, clusters.gridBuffer.handle);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_LIGHT_INDEX_BINDING, clusters.indices.indexBuffer.handle);
+
+	//every light is summed in the shader, a single full screen pass with no blending
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+
+	glBindVertexArray(app->vao);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+	glBindVertexArray(0);
+}
+
+static void ResizeLightTiles(LightTiles& tiles, ivec2 tileCount)
+{
+	tiles.tileCount = tileCount;
+	u32 count = tileCount.x * tileCount.y;
+
+	ResizeStorage(tiles.gridBuffer, count * sizeof(u32) * 2);
+
+	//the list only grows, a smaller screen keeps the room it had
+	if (!tiles.indices.indexBuffer.handle)
+		InitIndexList(tiles.indices, count * TILE_AVERAGE_LIGHTS);
+
+	if (tiles.heatmapHandle)
+		glDeleteTextures(1, &tiles.heatmapHandle);
+
+	glGenTextures(1, &tiles.heatmapHandle);
+	glBindTexture(GL_TEXTURE_2D, tiles.heatmapHandle);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, tileCount.x, tileCount.y);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void BuildLightTiles(App* app, const Camera& camera)
+{
+	LightTiles& tiles = app->lightTiles;
+	const GpuLightBuffer& lights = app->gpuLights;
+
+	ivec2 tileCount = (app->displaySize + ivec2(LIGHT_TILE_SIZE - 1)) / LIGHT_TILE_SIZE;
+	tileCount = glm::max(tileCount, ivec2(1));
+	if (tileCount != tiles.tileCount)
+		ResizeLightTiles(tiles, tileCount);
+
+	ReadBackIndexCount(tiles.indices, "Tile");
+
+	Program& cullProgram = app->programs[tiles.cullProgramIdx];
+	glUseProgram(cullProgram.handle);
+	glUniformMatrix4fv(cullProgram.uniformLocations[Uniform_uViewMatrix], 1, GL_FALSE, glm::value_ptr(camera.view));
+	glUniformMatrix4fv(cullProgram.uniformLocations[Uniform_uInverseProjection], 1, GL_FALSE, glm::value_ptr(glm::inverse(camera.projection)));
+	glUniform2f(cullProgram.uniformLocations[Uniform_uScreenSize], app->displaySize.x, app->displaySize.y);
+	glUniform2ui(cullProgram.uniformLocations[Uniform_uLightCount], lights.globalLightCount, lights.lightCount);
+
+	//depth of the pre-pass
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, app->depthAttachmentHandle);
+	glUniform1i(cullProgram.uniformLocations[Uniform_uDepth], 0);
+
+	glBindImageTexture(LIGHT_TILE_HEATMAP_IMAGE, tiles.heatmapHandle, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BUFFER_BINDING, lights.buffer.handle);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_GRID_BINDING, tiles.gridBuffer.handle);
+	BeginIndexList(tiles.indices);
+
+	//one work group per tile, one invocation per pixel
+	glDispatchCompute(tileCount.x, tileCount.y, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	EndIndexList(tiles.indices);
+}
+
+void BindForwardLights(App* app, const Program& program)
+{
+	const GpuLightBuffer& lights = app->gpuLights;
+
+	glUniform2ui(program.uniformLocations[Uniform_uLightCount], lights.globalLightCount, lights.lightCount);
+	glUniform2f(program.uniformLocations[Uniform_uScreenSize], app->displaySize.x, app->displaySize.y);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BUFFER_BINDING, lights.buffer.handle);
+	if (app->lightTiles.gridBuffer.handle)
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_GRID_BINDING, app->lightTiles.gridBuffer.handle);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_LIGHT_INDEX_BINDING, app->lightTiles.indices.indexBuffer.handle);
+	}
+}
@@ -0,0 +1,32 @@
+//
+// light_clustering.h: Light culling on the GPU. The lights live in a shader storage buffer with
+// no upper bound and compute passes bin the point lights, either into a froxel grid for the
+// clustered deferred resolve or into screen tiles for the Forward+ shading.
+//
+#pragma once
+
+#include "engine.h"
+
+// shader storage bindings, see deferred.glsl, forward_shading.glsl and light_clustering.glsl
+#define LIGHT_BUFFER_BINDING         2
+#define CLUSTER_BOUNDS_BINDING       3
+#define CLUSTER_GRID_BINDING         4 // also the tile grid
+#define CLUSTER_LIGHT_INDEX_BINDING  5
+#define CLUSTER_COUNTER_BINDING      6
+
+#define LIGHT_TILE_HEATMAP_IMAGE     0 // image unit
+
+#define CLUSTER_CULL_GROUP_SIZE      128
+#define CLUSTER_AVERAGE_LIGHTS       32 // initial index list size, per cluster
+#define TILE_AVERAGE_LIGHTS          32 // initial index list size, per tile
+
+f32 LightVolumeRadius(const Light& light);
+
+void InitLightCulling(App* app);
+void UploadGpuLights(App* app);
+
+void BuildLightClusters(App* app, const Camera& camera);
+void ResolveClusteredLighting(App* app, const Camera& camera);
+
+void BuildLightTiles(App* app, const Camera& camera);
+void BindForwardLights(App* app, const Program& program);
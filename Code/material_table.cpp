@@ -0,0 +1,281 @@
+#include "material_table.h"
+#include "buffer_management.h"
+
+static u32 MipCount(ivec2 size)
+{
+	u32 largest = glm::max(size.x, size.y);
+	u32 count = 1;
+	while (largest > 1)
+	{
+		largest >>= 1;
+		count++;
+	}
+	return count;
+}
+
+//LoadTexture2D returns UINT32_MAX when the image couldn't be read
+static bool UsesTexture(App* app, bool hasTexture, u32 textureIdx)
+{
+	return hasTexture && textureIdx < app->textures.size();
+}
+
+static u32 FindOrAddBucket(App* app, const Texture& texture)
+{
+	MaterialTable& table = app->materialTable;
+
+	for (u32 i = 0; i < table.buckets.size(); ++i)
+	{
+		if (table.buckets[i].size == texture.size && table.buckets[i].internalFormat == texture.internalFormat)
+			return i;
+	}
+
+	if (table.buckets.size() == MAX_TEXTURE_BUCKETS)
+		return UINT32_MAX;
+
+	TextureBucket bucket = {};
+	bucket.size = texture.size;
+	bucket.internalFormat = texture.internalFormat;
+	bucket.mipCount = MipCount(texture.size);
+	table.buckets.push_back(bucket);
+	return table.buckets.size() - 1;
+}
+
+//the 2D textures already have their mip chain, copy it level by level into their layer
+static void CopyTextureToLayer(App* app, u32 textureIdx)
+{
+	const MaterialTable& table = app->materialTable;
+	const Texture& texture = app->textures[textureIdx];
+	ivec2 location = table.textureLocations[textureIdx];
+	const TextureBucket& bucket = table.buckets[location.x];
+
+	for (u32 level = 0; level < bucket.mipCount; ++level)
+	{
+		i32 width = glm::max(texture.size.x >> level, 1);
+		i32 height = glm::max(texture.size.y >> level, 1);
+		glCopyImageSubData(texture.handle, GL_TEXTURE_2D, level, 0, 0, 0,
+		                   bucket.handle, GL_TEXTURE_2D_ARRAY, level, 0, 0, location.y,
+		                   width, height, 1);
+	}
+}
+
+u32 MaterialFeatures(App* app, const Material& material)
+{
+	return (UsesTexture(app, material.hasnormals, material.normalsTextureIdx) ? MaterialFeature_NormalMap : 0) |
+	       (UsesTexture(app, material.hasbump, material.bumpTextureIdx) ? MaterialFeature_HeightMap : 0) |
+	       (UsesTexture(app, material.hasspecular, material.specularTextureIdx) ? MaterialFeature_SpecularMap : 0);
+}
+
+//a streamed texture samples the placeholder until it is resident and has its layer
+static u32 LayerOr(const MaterialTable& table, u32 textureIdx, u32 placeholderIdx)
+{
+	bool placed = textureIdx < table.textureLocations.size() && table.textureLocations[textureIdx].x >= 0;
+	return placed ? textureIdx : placeholderIdx;
+}
+
+GpuMaterial MakeGpuMaterial(App* app, const Material& material)
+{
+	const MaterialTable& table = app->materialTable;
+
+	u32 features = MaterialFeatures(app, material);
+	bool albedoMap = UsesTexture(app, material.hasalbedo, material.albedoTextureIdx);
+	bool normalMap = (features & MaterialFeature_NormalMap) != 0;
+	bool heightMap = (features & MaterialFeature_HeightMap) != 0;
+	bool specularMap = (features & MaterialFeature_SpecularMap) != 0;
+
+	//materials without a texture sample a neutral one instead
+	u32 albedoIdx = albedoMap ? LayerOr(table, material.albedoTextureIdx, app->whiteTexIdx) : app->whiteTexIdx;
+	u32 normalsIdx = normalMap ? LayerOr(table, material.normalsTextureIdx, app->normalTexIdx) : app->normalTexIdx;
+	u32 bumpIdx = heightMap ? LayerOr(table, material.bumpTextureIdx, app->blackTexIdx) : app->blackTexIdx;
+	u32 specularIdx = specularMap ? LayerOr(table, material.specularTextureIdx, app->whiteTexIdx) : app->whiteTexIdx;
+
+	GpuMaterial gpuMaterial = {};
+	gpuMaterial.albedoSpecular = vec4(material.albedo, material.specular);
+	gpuMaterial.bumpStrength = material.bumpStrength;
+	gpuMaterial.normalsStrength = material.normalsStrength;
+	gpuMaterial.features = features;
+	gpuMaterial.albedoTexture = table.textureLocations[albedoIdx];
+	gpuMaterial.normalsTexture = table.textureLocations[normalsIdx];
+	gpuMaterial.bumpTexture = table.textureLocations[bumpIdx];
+	gpuMaterial.specularTexture = table.textureLocations[specularIdx];
+	return gpuMaterial;
+}
+
+void BuildMaterialTable(App* app)
+{
+	MaterialTable& table = app->materialTable;
+
+	for (u32 i = 0; i < table.buckets.size(); ++i)
+		glDeleteTextures(1, &table.buckets[i].handle);
+	table.buckets.clear();
+	table.dirtyMaterials.clear();
+
+	//only the textures a material (or a material fallback) can reference go into the buckets
+	std::vector<bool> referenced(app->textures.size(), false);
+	referenced[app->whiteTexIdx] = true;
+	referenced[app->blackTexIdx] = true;
+	referenced[app->normalTexIdx] = true;
+	for (u32 i = 0; i < app->materials.size(); ++i)
+	{
+		const Material& material = app->materials[i];
+		if (UsesTexture(app, material.hasalbedo, material.albedoTextureIdx)) referenced[material.albedoTextureIdx] = true;
+		if (UsesTexture(app, material.hasnormals, material.normalsTextureIdx)) referenced[material.normalsTextureIdx] = true;
+		if (UsesTexture(app, material.hasbump, material.bumpTextureIdx)) referenced[material.bumpTextureIdx] = true;
+		if (UsesTexture(app, material.hasspecular, material.specularTextureIdx)) referenced[material.specularTextureIdx] = true;
+	}
+	//the ones still streaming have no size yet, the ones sharing pixels use the layer of their owner
+	for (u32 i = 0; i < app->textures.size(); ++i)
+	{
+		u32 ownerIdx = app->textures[i].contentOwner;
+		if (referenced[i] && ownerIdx != i)
+			referenced[ownerIdx] = true;
+	}
+	for (u32 i = 0; i < app->textures.size(); ++i)
+		referenced[i] = referenced[i] && app->textures[i].resident && app->textures[i].contentOwner == i;
+
+	//the fallback textures go first so they always get a bucket
+	std::vector<u32> order;
+	order.push_back(app->whiteTexIdx);
+	order.push_back(app->blackTexIdx);
+	order.push_back(app->normalTexIdx);
+	for (u32 i = 0; i < app->textures.size(); ++i)
+		if (referenced[i] && i != app->whiteTexIdx && i != app->blackTexIdx && i != app->normalTexIdx)
+			order.push_back(i);
+
+	table.textureLocations.assign(app->textures.size(), ivec2(-1, -1));
+	std::vector<bool> placed(app->textures.size(), false);
+	for (u32 i = 0; i < order.size(); ++i)
+	{
+		u32 textureIdx = order[i];
+		u32 bucketIdx = FindOrAddBucket(app, app->textures[textureIdx]);
+		if (bucketIdx == UINT32_MAX)
+		{
+			ELOG("BuildMaterialTable() - out of texture buckets, %s falls back to the white texture\n", app->textures[textureIdx].filepath.c_str());
+			table.textureLocations[textureIdx] = table.textureLocations[app->whiteTexIdx];
+			continue;
+		}
+		table.textureLocations[textureIdx] = ivec2(bucketIdx, table.buckets[bucketIdx].layerCount++);
+		placed[textureIdx] = true;
+	}
+	for (u32 i = 0; i < app->textures.size(); ++i)
+		if (app->textures[i].resident && app->textures[i].contentOwner != i)
+			table.textureLocations[i] = table.textureLocations[app->textures[i].contentOwner];
+
+	for (u32 i = 0; i < table.buckets.size(); ++i)
+	{
+		TextureBucket& bucket = table.buckets[i];
+		glGenTextures(1, &bucket.handle);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, bucket.handle);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, bucket.mipCount, bucket.internalFormat, bucket.size.x, bucket.size.y, bucket.layerCount);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	for (u32 i = 0; i < app->textures.size(); ++i)
+	{
+		if (!placed[i])
+			continue;
+
+		CopyTextureToLayer(app, i);
+	}
+
+	std::vector<GpuMaterial> gpuMaterials(app->materials.size());
+	for (u32 i = 0; i < app->materials.size(); ++i)
+		gpuMaterials[i] = MakeGpuMaterial(app, app->materials[i]);
+
+	if (table.buffer.handle)
+		glDeleteBuffers(1, &table.buffer.handle);
+
+	u32 tableSize = glm::max<u32>(gpuMaterials.size(), 1) * sizeof(GpuMaterial);
+	table.buffer = CreateBuffer(tableSize, GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, table.buffer.handle);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, gpuMaterials.size() * sizeof(GpuMaterial), gpuMaterials.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	table.builtMaterialCount = app->materials.size();
+	table.builtTextureCount = app->textures.size();
+	table.layoutDirty = false;
+	table.uploadCount++;
+}
+
+void UpdateMaterialTable(App* app)
+{
+	MaterialTable& table = app->materialTable;
+
+	//new materials or textures were loaded or became resident, the buckets have to be laid out again
+	if (table.builtMaterialCount != app->materials.size() || table.builtTextureCount != app->textures.size() || table.layoutDirty)
+	{
+		BuildMaterialTable(app);
+		return;
+	}
+
+	if (table.dirtyMaterials.empty())
+		return;
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, table.buffer.handle);
+	for (u32 i = 0; i < table.dirtyMaterials.size(); ++i)
+	{
+		u32 materialIdx = table.dirtyMaterials[i];
+		GpuMaterial gpuMaterial = MakeGpuMaterial(app, app->materials[materialIdx]);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, materialIdx * sizeof(GpuMaterial), sizeof(GpuMaterial), &gpuMaterial);
+		table.uploadCount++;
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	table.dirtyMaterials.clear();
+}
+
+void UpdateMaterialTexture(App* app, u32 textureIdx)
+{
+	MaterialTable& table = app->materialTable;
+
+	//not in the table yet, the next build copies it
+	if (textureIdx >= table.textureLocations.size())
+		return;
+
+	//no material samples it, or it ran out of buckets and borrows the white layer
+	ivec2 location = table.textureLocations[textureIdx];
+	if (location.x < 0 || (textureIdx != app->whiteTexIdx && location == table.textureLocations[app->whiteTexIdx]))
+		return;
+
+	//a new size or format doesn't fit its layer anymore, the buckets have to be laid out again
+	const Texture& texture = app->textures[textureIdx];
+	const TextureBucket& bucket = table.buckets[location.x];
+	if (bucket.size != texture.size || bucket.internalFormat != texture.internalFormat)
+	{
+		BuildMaterialTable(app);
+		return;
+	}
+
+	CopyTextureToLayer(app, textureIdx);
+	table.uploadCount++;
+}
+
+void MarkMaterialDirty(App* app, u32 materialIdx)
+{
+	std::vector<u32>& dirty = app->materialTable.dirtyMaterials;
+	for (u32 i = 0; i < dirty.size(); ++i)
+		if (dirty[i] == materialIdx)
+			return;
+	dirty.push_back(materialIdx);
+}
+
+void BindMaterialTable(App* app, const Program& program)
+{
+	MaterialTable& table = app->materialTable;
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_TABLE_BINDING, table.buffer.handle);
+
+	GLint units[MAX_TEXTURE_BUCKETS];
+	for (u32 i = 0; i < MAX_TEXTURE_BUCKETS; ++i)
+	{
+		units[i] = MATERIAL_TEXTURE_UNIT + i;
+		glActiveTexture(GL_TEXTURE0 + MATERIAL_TEXTURE_UNIT + i);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, i < table.buckets.size() ? table.buckets[i].handle : 0);
+	}
+	glActiveTexture(GL_TEXTURE0);
+
+	glUniform1iv(program.uniformLocations[Uniform_uTextureBuckets], MAX_TEXTURE_BUCKETS, units);
+}
@@ -0,0 +1,18 @@
+//
+// material_table.h: GPU resident copy of app->materials. Every material is one std430 entry of
+// a shader storage buffer and all its textures live as layers of a few GL_TEXTURE_2D_ARRAY buckets,
+// so the shaders only need the material index of the draw.
+//
+#pragma once
+
+#include "engine.h"
+
+#define MATERIAL_TABLE_BINDING 0
+
+void BuildMaterialTable(App* app);
+void UpdateMaterialTable(App* app);
+void MarkMaterialDirty(App* app, u32 materialIdx);
+void UpdateMaterialTexture(App* app, u32 textureIdx); // copies a reloaded texture into its layer
+void BindMaterialTable(App* app, const Program& program);
+u32 MaterialFeatures(App* app, const Material& material); // MaterialFeature bits
+GpuMaterial MakeGpuMaterial(App* app, const Material& material);
@@ -19,6 +19,7 @@
 
 #include <GLFW/glfw3.h>
 #include <stdio.h>
+#include <string.h>
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
@@ -270,6 +271,8 @@ int main()
         GlobalFrameArenaHead = 0;
     }
 
+    Shutdown(&app);
+
     free(GlobalFrameArenaMemory);
 
     ImGui_ImplOpenGL3_Shutdown();
@@ -397,16 +400,108 @@ u64 GetFileLastWriteTimestamp(const char* filepath)
         return(conversor.u64time);
     }
 #else
-    // NOTE: This has not been tested in unix-like systems
     struct stat attrib;
     if (stat(filepath, &attrib) == 0) {
+#ifdef __linux__
+        // st_mtime only has seconds, two saves within one would look like the same file
+        return (u64)attrib.st_mtim.tv_sec * 1000000000ull + (u64)attrib.st_mtim.tv_nsec;
+#else
         return attrib.st_mtime;
+#endif
     }
 #endif
 
     return 0;
 }
 
+void MakeDirectory(const char* path)
+{
+#ifdef _WIN32
+    CreateDirectoryA(path, NULL);
+#else
+    mkdir(path, 0755);
+#endif
+}
+
+u64 HashData(u64 hash, const void* data, u64 size)
+{
+    const u64 prime = 0x100000001b3ull;
+    const u8* bytes = (const u8*)data;
+    u64 i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        u64 word;
+        memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * prime;
+    }
+    for (; i < size; ++i)
+        hash = (hash ^ bytes[i]) * prime;
+    return hash;
+}
+
+bool WriteFileAtomic(const char* path, const void* header, u32 headerSize, const void* data, u64 dataSize)
+{
+    std::string tempPath = std::string(path) + ".tmp";
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (!file)
+    {
+        ELOG("WriteFileAtomic() - could not write %s\n", tempPath.c_str());
+        return false;
+    }
+    bool complete = fwrite(header, headerSize, 1, file) == 1 &&
+                    (dataSize == 0 || fwrite(data, 1, dataSize, file) == dataSize);
+    complete = fclose(file) == 0 && complete;
+
+    // Replaced in one step, there is no moment without a file at path
+#ifdef _WIN32
+    complete = complete && MoveFileExA(tempPath.c_str(), path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    complete = complete && rename(tempPath.c_str(), path) == 0;
+#endif
+    if (!complete)
+        remove(tempPath.c_str());
+    return complete;
+}
+
+CacheFileStatus ReadCacheFile(const char* path, u32 magic, u32 version, void* header, u32 headerSize, std::vector<u8>& data)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return CacheFile_Missing;
+
+    CacheFileHeader& fileHeader = *(CacheFileHeader*)header;
+    bool valid = fread(header, headerSize, 1, file) == 1 &&
+                 fileHeader.magic == magic && fileHeader.version == version;
+    if (valid)
+    {
+        data.resize(fileHeader.dataSize);
+        valid = fread(data.data(), 1, data.size(), file) == data.size() &&
+                HashData(HASH_SEED, data.data(), data.size()) == fileHeader.checksum;
+    }
+    fclose(file);
+    return valid ? CacheFile_Valid : CacheFile_Invalid;
+}
+
+bool WriteCacheFile(const char* path, u32 magic, u32 version, void* header, u32 headerSize, const void* data, u64 dataSize)
+{
+    CacheFileHeader& fileHeader = *(CacheFileHeader*)header;
+    fileHeader.magic = magic;
+    fileHeader.version = version;
+    fileHeader.dataSize = dataSize;
+    fileHeader.checksum = HashData(HASH_SEED, data, dataSize);
+    return WriteFileAtomic(path, header, headerSize, data, dataSize);
+}
+
+f64 GetPlatformTime()
+{
+    return glfwGetTime();
+}
+
+void* GetOpenGLProcAddress(const char* name)
+{
+    return (void*)glfwGetProcAddress(name);
+}
+
 void LogString(const char* str)
 {
 #ifdef _WIN32
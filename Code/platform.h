@@ -81,6 +81,68 @@ String ReadTextFile(const char *filepath);
  */
 u64 GetFileLastWriteTimestamp(const char *filepath);
 
+/**
+ * Creates a directory in the working directory, nothing happens if it already exists.
+ * Useful for caches the engine writes between runs.
+ */
+void MakeDirectory(const char *path);
+
+/**
+ * Hashes a block of memory, chained through hash (start from HASH_SEED). It multiplies and
+ * xors a 64-bit word at a time with the FNV-1a constants, so it isn't FNV-1a itself, but it
+ * keeps up with the megabytes of texture data and program binaries it is used on.
+ */
+u64 HashData(u64 hash, const void *data, u64 size);
+
+/**
+ * Writes header and data to a file next to path and renames it over path, so a crash
+ * halfway never leaves a partial file behind. Returns false when it couldn't be written.
+ */
+bool WriteFileAtomic(const char *path, const void *header, u32 headerSize, const void *data, u64 dataSize);
+
+/**
+ * First member of the header of every cache file the engine keeps between runs, the file
+ * is that header followed by dataSize bytes. The fields of each cache go after it.
+ */
+struct CacheFileHeader
+{
+    u32 magic;
+    u32 version;  // bumped whenever the layout of that cache changes
+    u64 dataSize;
+    u64 checksum; // of the data, a truncated or damaged file is never used
+};
+
+enum CacheFileStatus
+{
+    CacheFile_Missing,
+    CacheFile_Invalid, // wrong magic or version, truncated or damaged
+    CacheFile_Valid,
+};
+
+/**
+ * Reads a cache file into header (headerSize bytes, starting with a CacheFileHeader) and
+ * data, checking its magic, version and checksum. The fields of the cache are left to
+ * the caller.
+ */
+CacheFileStatus ReadCacheFile(const char *path, u32 magic, u32 version, void *header, u32 headerSize, std::vector<u8> &data);
+
+/**
+ * Fills in the CacheFileHeader at the start of header and writes the file with WriteFileAtomic.
+ */
+bool WriteCacheFile(const char *path, u32 magic, u32 version, void *header, u32 headerSize, const void *data, u64 dataSize);
+
+/**
+ * Returns the time in seconds since the platform layer was initialized.
+ * Useful to measure how long some engine operations take.
+ */
+f64 GetPlatformTime();
+
+/**
+ * Retrieves the address of an OpenGL function that the glad loader does not
+ * expose (e.g. functions from extensions newer than the loaded GL version).
+ */
+void* GetOpenGLProcAddress(const char* name);
+
 /**
  * It logs a string to whichever outputs are configured in the platform layer.
  * By default, the string is printed in the output console of VisualStudio.
@@ -101,6 +163,8 @@ LogString(logBuffer);             \
 
 #define ASSERT(condition, message) assert((condition) && message)
 
+#define HASH_SEED 0xcbf29ce484222325ull
+
 #define KB(count) (1024*(count))
 #define MB(count) (1024*KB(count))
 #define GB(count) (1024*MB(count))
@@ -0,0 +1,141 @@
+#include "program_cache.h"
+#include <stdio.h>
+
+//a cache file is this header followed by the program binary
+struct ProgramCacheHeader
+{
+	CacheFileHeader file;
+	u64 key;
+	u32 binaryFormat;
+};
+
+static void CacheEntryPath(char* path, u64 key)
+{
+	sprintf(path, "%s/%016llx.bin", PROGRAM_CACHE_DIRECTORY, (unsigned long long)key);
+}
+
+void InitProgramCache(App* app)
+{
+	ProgramCache& cache = app->programCache;
+
+	GLint formatCount = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+	cache.binaryFormats.resize(formatCount);
+	if (formatCount)
+		glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, cache.binaryFormats.data());
+	cache.enabled = formatCount > 0;
+
+	//a binary only loads on the driver that produced it
+	const info& gl = *app->OpenGLinfo;
+	std::string driver = gl.OpenGLvendor + "\n" + gl.OpenGLrenderer + "\n" + gl.OpenGLversion + "\n" + gl.OpenGLSLverion;
+	cache.driverHash = HashData(HASH_SEED, driver.c_str(), driver.size());
+
+	if (cache.enabled)
+		MakeDirectory(PROGRAM_CACHE_DIRECTORY);
+}
+
+u64 ProgramCacheKey(App* app, const Program& program, String programSource)
+{
+	u32 stages = (program.compute ? 1 : 0) | (program.geometry ? 2 : 0);
+	u32 version = PROGRAM_CACHE_VERSION;
+
+	u64 key = app->programCache.driverHash;
+	key = HashData(key, &version, sizeof(version));
+	key = HashData(key, &stages, sizeof(stages));
+	key = HashData(key, program.programName.c_str(), program.programName.size() + 1);
+	key = HashData(key, program.defines.c_str(), program.defines.size() + 1);
+	key = HashData(key, programSource.str, programSource.len);
+	return key;
+}
+
+GLuint LoadCachedProgram(App* app, u64 key)
+{
+	ProgramCache& cache = app->programCache;
+	if (!cache.enabled)
+	{
+		cache.misses++;
+		return 0;
+	}
+
+	char path[256];
+	CacheEntryPath(path, key);
+
+	ProgramCacheHeader header = {};
+	std::vector<u8> binary;
+	CacheFileStatus status = ReadCacheFile(path, PROGRAM_CACHE_MAGIC, PROGRAM_CACHE_VERSION, &header, sizeof(header), binary);
+	if (status == CacheFile_Missing)
+	{
+		cache.misses++;
+		return 0;
+	}
+
+	//the formats a driver accepts can change without its strings changing
+	bool knownFormat = false;
+	for (u32 i = 0; i < cache.binaryFormats.size(); ++i)
+		knownFormat |= (GLenum)cache.binaryFormats[i] == header.binaryFormat;
+	bool valid = status == CacheFile_Valid && header.key == key && knownFormat && !binary.empty();
+
+	GLuint programHandle = 0;
+	if (valid)
+	{
+		programHandle = glCreateProgram();
+		glProgramBinary(programHandle, header.binaryFormat, binary.data(), binary.size());
+
+		GLint success;
+		glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			glDeleteProgram(programHandle);
+			programHandle = 0;
+			valid = false;
+		}
+	}
+
+	if (!valid)
+	{
+		ELOG("LoadCachedProgram() - the cache entry %s can't be used, the program is compiled again\n", path);
+		remove(path);
+		cache.staleEntries++;
+		cache.misses++;
+		return 0;
+	}
+
+	cache.hits++;
+	return programHandle;
+}
+
+void StoreCachedProgram(App* app, u64 key, GLuint programHandle)
+{
+	ProgramCache& cache = app->programCache;
+	if (!cache.enabled)
+		return;
+
+	GLint success;
+	glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
+	GLint binarySize = 0;
+	glGetProgramiv(programHandle, GL_PROGRAM_BINARY_LENGTH, &binarySize);
+	if (!success || binarySize <= 0)
+		return;
+
+	std::vector<u8> binary(binarySize);
+	GLenum binaryFormat = 0;
+	GLsizei written = 0;
+	glGetProgramBinary(programHandle, binarySize, &written, &binaryFormat, binary.data());
+	if (written <= 0)
+		return;
+
+	ProgramCacheHeader header = {};
+	header.key = key;
+	header.binaryFormat = binaryFormat;
+
+	char path[256];
+	CacheEntryPath(path, key);
+	WriteCacheFile(path, PROGRAM_CACHE_MAGIC, PROGRAM_CACHE_VERSION, &header, sizeof(header), binary.data(), written);
+}
+
+void DeleteCachedProgram(u64 key)
+{
+	char path[256];
+	CacheEntryPath(path, key);
+	remove(path);
+}
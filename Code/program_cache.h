@@ -0,0 +1,22 @@
+//
+// program_cache.h: On-disk cache of linked program binaries (glGetProgramBinary/glProgramBinary).
+// An entry is keyed by a hash of the source, the program name and defines and the driver strings,
+// so a shader edit or a driver update only misses. Entries the driver refuses, with a binary format
+// it no longer lists or a bad checksum are deleted and the program is compiled again.
+//
+#pragma once
+
+#include "engine.h"
+
+#define PROGRAM_CACHE_DIRECTORY "program_cache"
+#define PROGRAM_CACHE_MAGIC     0x48434750 // "PGCH"
+#define PROGRAM_CACHE_VERSION   3          // bump when the entry layout or the hashing changes
+
+void InitProgramCache(App* app);
+u64 ProgramCacheKey(App* app, const Program& program, String programSource);
+
+// 0 when there is no usable entry
+GLuint LoadCachedProgram(App* app, u64 key);
+// only linked programs are stored
+void StoreCachedProgram(App* app, u64 key, GLuint programHandle);
+void DeleteCachedProgram(u64 key);
@@ -0,0 +1,137 @@
+#include "program_permutations.h"
+#include "material_table.h"
+
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+//indexed by the bit of the MaterialFeature
+static const char* FeatureDefines[] =
+{
+	"FEATURE_NORMAL_MAP",
+	"FEATURE_HEIGHT_MAP",
+	"FEATURE_SPECULAR_MAP",
+};
+
+void InitParallelShaderCompile(App* app)
+{
+	app->parallelShaderCompile = false;
+
+	std::list<std::string>& extensions = app->OpenGLinfo->OpenGLextensions;
+	for (std::list<std::string>::iterator it = extensions.begin(); it != extensions.end(); it++)
+	{
+		if (*it == "GL_KHR_parallel_shader_compile" || *it == "GL_ARB_parallel_shader_compile")
+			app->parallelShaderCompile = true;
+	}
+
+	if (!app->parallelShaderCompile)
+		return;
+
+	//as many compiler threads as the driver wants to use
+	PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)GetOpenGLProcAddress("glMaxShaderCompilerThreadsKHR");
+	if (!maxShaderCompilerThreads)
+		maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)GetOpenGLProcAddress("glMaxShaderCompilerThreadsARB");
+	if (maxShaderCompilerThreads)
+		maxShaderCompilerThreads(0xFFFFFFFF);
+}
+
+void InitProgramPermutations(ProgramPermutations& permutations, const char* filepath, const char* programName, u32 featureMask,
+                             const VertexShaderLayout& vertexInputLayout, u32 fallbackProgramIdx)
+{
+	permutations.filepath = filepath;
+	permutations.programName = programName;
+	permutations.featureMask = featureMask;
+	permutations.fallbackProgramIdx = fallbackProgramIdx;
+	permutations.vertexInputLayout = vertexInputLayout;
+	permutations.variants.clear();
+}
+
+u32 RequestProgramPermutation(App* app, ProgramPermutations& permutations, u32 features)
+{
+	features &= permutations.featureMask;
+	if (!features && permutations.fallbackProgramIdx != UINT32_MAX)
+		return permutations.fallbackProgramIdx;
+
+	auto it = permutations.variants.find(features);
+	if (it != permutations.variants.end())
+		return it->second;
+
+	//ReadTextFile already logged it. Those features keep the fallback from now on, without one the
+	//variant is built from the empty source like LoadProgram does, and a hot reload of the file fixes it
+	String programSource = ReadTextFile(permutations.filepath.c_str());
+	if (!programSource.str && permutations.fallbackProgramIdx != UINT32_MAX)
+	{
+		permutations.variants[features] = permutations.fallbackProgramIdx;
+		return permutations.fallbackProgramIdx;
+	}
+
+	//the defines the shader never mentions change nothing, leaving them out of the preamble lets
+	//the masks that only differ in those share a program
+	std::string defines;
+	for (u32 bit = 0; bit < ARRAY_COUNT(FeatureDefines); ++bit)
+	{
+		if ((features & (1u << bit)) && programSource.str && strstr(programSource.str, FeatureDefines[bit]))
+			defines += std::string("#define ") + FeatureDefines[bit] + "\n";
+	}
+
+	u64 hash = HASH_SEED;
+	hash = HashData(hash, permutations.programName.c_str(), permutations.programName.size() + 1);
+	hash = HashData(hash, defines.c_str(), defines.size() + 1);
+	hash = HashData(hash, programSource.str, programSource.len);
+
+	auto shared = app->programSourceHashes.find(hash);
+	if (shared != app->programSourceHashes.end())
+	{
+		permutations.variants[features] = shared->second;
+		app->sharedPermutationCount++;
+		return shared->second;
+	}
+
+	Program program = {};
+	program.filepath = permutations.filepath;
+	program.programName = permutations.programName;
+	program.defines = defines;
+	program.lastWriteTimestamp = GetFileLastWriteTimestamp(permutations.filepath.c_str());
+	program.vertexInputLayout = permutations.vertexInputLayout;
+	program.handle = CompileProgram(app, program, programSource, true);
+	if (!program.pending)
+		BuildProgramReflection(program);
+	app->programs.push_back(program);
+
+	u32 programIdx = app->programs.size() - 1;
+	permutations.variants[features] = programIdx;
+	app->programSourceHashes[hash] = programIdx;
+	app->permutationCount++;
+	return programIdx;
+}
+
+void PrewarmProgramPermutations(App* app, ProgramPermutations& permutations)
+{
+	for (u32 i = 0; i < app->materials.size(); ++i)
+		RequestProgramPermutation(app, permutations, MaterialFeatures(app, app->materials[i]));
+}
+
+void PrewarmScenePermutations(App* app, u32 firstMaterialIdx)
+{
+	ProgramPermutations* sceneSets[] = { &app->forwardPrograms, &app->forwardPlusPrograms, &app->forwardDepthPrograms, &app->gbufferPrograms, &app->gbufferDepthPrograms };
+	for (u32 set = 0; set < ARRAY_COUNT(sceneSets); ++set)
+		for (u32 i = firstMaterialIdx; i < app->materials.size(); ++i)
+			RequestProgramPermutation(app, *sceneSets[set], MaterialFeatures(app, app->materials[i]));
+}
+
+u32 PendingProgramPermutations(App* app)
+{
+	//without the extension asking would wait for the link, those are counted as pending until used
+	u32 count = 0;
+	for (u32 i = 0; i < app->programs.size(); ++i)
+	{
+		const Program& program = app->programs[i];
+		if (!program.pending)
+			continue;
+
+		GLint completed = GL_FALSE;
+		if (app->parallelShaderCompile)
+			glGetProgramiv(program.handle, GL_COMPLETION_STATUS_KHR, &completed);
+		if (!completed)
+			count++;
+	}
+	return count;
+}
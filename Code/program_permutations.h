@@ -0,0 +1,29 @@
+//
+// program_permutations.h: Shader variants selected by the MaterialFeature bits of a material. A
+// variant compiles the first time a draw asks for it, with a #define per feature, so the shaders
+// have no runtime branches on the maps a material has. Variants are linked without waiting for the
+// driver and finished on first use, which lets KHR_parallel_shader_compile build them side by side.
+//
+#pragma once
+
+#include "engine.h"
+
+// KHR_parallel_shader_compile, the glad loader is generated without it
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR           0x91B1
+
+void InitParallelShaderCompile(App* app);
+
+void InitProgramPermutations(ProgramPermutations& permutations, const char* filepath, const char* programName, u32 featureMask,
+                             const VertexShaderLayout& vertexInputLayout, u32 fallbackProgramIdx = UINT32_MAX);
+
+// program index of the variant for the features, it may still be compiling
+u32 RequestProgramPermutation(App* app, ProgramPermutations& permutations, u32 features);
+
+// starts the variants of every loaded material, they are finished as the passes use them
+void PrewarmProgramPermutations(App* app, ProgramPermutations& permutations);
+// the same for every scene set, for the materials from firstMaterialIdx on
+void PrewarmScenePermutations(App* app, u32 firstMaterialIdx);
+
+// variants whose compile hasn't completed, without waiting for any
+u32 PendingProgramPermutations(App* app);
@@ -0,0 +1,377 @@
+#include "render_graph.h"
+#include "render_target_pool.h"
+
+static bool ReadsResource(RenderGraphAccess access)
+{
+	return access == RenderGraphAccess_Sample || access == RenderGraphAccess_Color || access == RenderGraphAccess_Depth;
+}
+
+static bool WritesResource(RenderGraphAccess access)
+{
+	return access != RenderGraphAccess_Sample;
+}
+
+static void AddUnique(std::vector<u32>& list, u32 value)
+{
+	for (u32 i = 0; i < list.size(); ++i)
+		if (list[i] == value)
+			return;
+	list.push_back(value);
+}
+
+void BeginRenderGraph(RenderGraph& graph, RenderTargetPool& pool, ivec2 viewportSize)
+{
+	//exported transient targets were kept past the end of the last frame
+	for (u32 i = 0; i < graph.resources.size(); ++i)
+	{
+		RenderGraphResource& resource = graph.resources[i];
+		if (resource.transient && resource.handle)
+			ReleaseRenderTarget(pool, *resource.handle);
+	}
+
+	graph.resources.clear();
+	graph.passes.clear();
+	graph.order.clear();
+	graph.viewportSize = viewportSize;
+	graph.frame++;
+}
+
+u32 ImportRenderGraphResource(RenderGraph& graph, const char* name, GLuint* handle)
+{
+	RenderGraphResource resource = {};
+	resource.name = name;
+	resource.handle = handle;
+	graph.resources.push_back(resource);
+	return graph.resources.size() - 1;
+}
+
+u32 CreateRenderGraphTexture(RenderGraph& graph, const char* name, GLenum internalFormat, ivec2 size, RenderTargetUsage usage, GLuint* handle)
+{
+	ivec2 bucketSize = RenderTargetBucketSize(size);
+
+	RenderGraphResource resource = {};
+	resource.name = name;
+	resource.handle = handle;
+	resource.transient = true;
+	resource.internalFormat = internalFormat;
+	resource.size = size;
+	resource.usage = usage;
+	resource.bytes = bucketSize.x * bucketSize.y * RenderTargetBytesPerPixel(internalFormat);
+	graph.resources.push_back(resource);
+	return graph.resources.size() - 1;
+}
+
+void ExportRenderGraphResource(RenderGraph& graph, u32 resourceIdx)
+{
+	graph.resources[resourceIdx].exported = true;
+}
+
+u32 AddRenderGraphPass(RenderGraph& graph, const char* name, RenderGraphExecute execute)
+{
+	RenderGraphPass pass = {};
+	pass.name = name;
+	pass.execute = execute;
+	pass.viewportSize = graph.viewportSize;
+	graph.passes.push_back(pass);
+	return graph.passes.size() - 1;
+}
+
+void UseRenderGraphResource(RenderGraph& graph, u32 passIdx, u32 resourceIdx, RenderGraphAccess access)
+{
+	RenderGraphUse use = {};
+	use.resourceIdx = resourceIdx;
+	use.access = access;
+	graph.passes[passIdx].uses.push_back(use);
+}
+
+//passes drawing into reduced resolution targets
+void SetRenderGraphPassViewport(RenderGraph& graph, u32 passIdx, ivec2 viewportSize)
+{
+	graph.passes[passIdx].viewportSize = viewportSize;
+}
+
+void CompileRenderGraph(RenderGraph& graph)
+{
+	const u32 passCount = graph.passes.size();
+	const u32 resourceCount = graph.resources.size();
+
+	//dependencies follow the declaration order, a read sees the last write declared before it
+	std::vector<std::vector<u32>> readers(resourceCount);
+	for (u32 r = 0; r < resourceCount; ++r)
+		graph.resources[r].lastWriter = RENDER_GRAPH_NONE;
+
+	for (u32 p = 0; p < passCount; ++p)
+	{
+		RenderGraphPass& pass = graph.passes[p];
+
+		for (u32 i = 0; i < pass.uses.size(); ++i)
+		{
+			const RenderGraphUse& use = pass.uses[i];
+			RenderGraphResource& resource = graph.resources[use.resourceIdx];
+			if (!ReadsResource(use.access))
+				continue;
+
+			if (resource.lastWriter != RENDER_GRAPH_NONE && resource.lastWriter != p)
+				AddUnique(pass.producers, resource.lastWriter);
+			AddUnique(readers[use.resourceIdx], p);
+		}
+
+		for (u32 i = 0; i < pass.uses.size(); ++i)
+		{
+			const RenderGraphUse& use = pass.uses[i];
+			RenderGraphResource& resource = graph.resources[use.resourceIdx];
+			if (!WritesResource(use.access))
+				continue;
+
+			//a write waits for everyone still reading or writing the previous contents
+			if (resource.lastWriter != RENDER_GRAPH_NONE && resource.lastWriter != p)
+				AddUnique(pass.runsAfter, resource.lastWriter);
+			for (u32 j = 0; j < readers[use.resourceIdx].size(); ++j)
+				if (readers[use.resourceIdx][j] != p)
+					AddUnique(pass.runsAfter, readers[use.resourceIdx][j]);
+
+			readers[use.resourceIdx].clear();
+			resource.lastWriter = p;
+		}
+
+		for (u32 i = 0; i < pass.producers.size(); ++i)
+			AddUnique(pass.runsAfter, pass.producers[i]);
+	}
+
+	//a pass lives if what it writes reaches an exported resource
+	std::vector<u32> stack;
+	for (u32 r = 0; r < resourceCount; ++r)
+		if (graph.resources[r].exported && graph.resources[r].lastWriter != RENDER_GRAPH_NONE)
+			stack.push_back(graph.resources[r].lastWriter);
+
+	u32 liveCount = 0;
+	while (!stack.empty())
+	{
+		RenderGraphPass& pass = graph.passes[stack.back()];
+		stack.pop_back();
+		if (pass.live)
+			continue;
+
+		pass.live = true;
+		liveCount++;
+		for (u32 i = 0; i < pass.producers.size(); ++i)
+			stack.push_back(pass.producers[i]);
+	}
+
+	//topological order of the live passes, ties go to the one declared first
+	std::vector<u8> placed(passCount, 0);
+	while (graph.order.size() < liveCount)
+	{
+		u32 next = RENDER_GRAPH_NONE;
+		for (u32 p = 0; p < passCount && next == RENDER_GRAPH_NONE; ++p)
+		{
+			const RenderGraphPass& pass = graph.passes[p];
+			if (!pass.live || placed[p])
+				continue;
+
+			bool ready = true;
+			for (u32 i = 0; i < pass.runsAfter.size() && ready; ++i)
+				ready = !graph.passes[pass.runsAfter[i]].live || placed[pass.runsAfter[i]];
+			if (ready)
+				next = p;
+		}
+
+		if (next == RENDER_GRAPH_NONE)
+		{
+			ELOG("CompileRenderGraph() - the passes depend on each other in a cycle, %u of %u are left out\n", liveCount - (u32)graph.order.size(), liveCount);
+			break;
+		}
+
+		placed[next] = 1;
+		graph.order.push_back(next);
+	}
+
+	//lifetimes of the resources, as positions in the execution order
+	for (u32 r = 0; r < resourceCount; ++r)
+	{
+		graph.resources[r].firstUse = RENDER_GRAPH_NONE;
+		graph.resources[r].lastUse = 0;
+	}
+
+	for (u32 i = 0; i < graph.order.size(); ++i)
+	{
+		const RenderGraphPass& pass = graph.passes[graph.order[i]];
+		for (u32 j = 0; j < pass.uses.size(); ++j)
+		{
+			RenderGraphResource& resource = graph.resources[pass.uses[j].resourceIdx];
+			if (resource.firstUse == RENDER_GRAPH_NONE)
+				resource.firstUse = i;
+			resource.lastUse = i;
+		}
+	}
+
+	graph.transientBytes = 0;
+	for (u32 r = 0; r < resourceCount; ++r)
+	{
+		RenderGraphResource& resource = graph.resources[r];
+		if (resource.exported)
+			resource.lastUse = graph.order.size();
+		if (resource.transient && resource.firstUse != RENDER_GRAPH_NONE)
+			graph.transientBytes += resource.bytes;
+	}
+}
+
+static void BindPassAttachments(RenderGraph& graph, const RenderGraphPass& pass, RenderGraphPassState& state)
+{
+	GLuint attachments[MAX_RENDER_GRAPH_ATTACHMENTS + 1] = {};
+	GLenum drawBuffers[MAX_RENDER_GRAPH_ATTACHMENTS];
+	u32 colorCount = 0;
+	bool depth = false;
+
+	for (u32 i = 0; i < pass.uses.size(); ++i)
+	{
+		const RenderGraphUse& use = pass.uses[i];
+		const RenderGraphResource& resource = graph.resources[use.resourceIdx];
+		GLuint handle = resource.handle ? *resource.handle : 0;
+
+		if (use.access == RenderGraphAccess_Color || use.access == RenderGraphAccess_ColorClear)
+		{
+			if (colorCount == MAX_RENDER_GRAPH_ATTACHMENTS)
+			{
+				ELOG("ExecuteRenderGraph() - pass %s writes more than %u color attachments\n", pass.name, MAX_RENDER_GRAPH_ATTACHMENTS);
+				continue;
+			}
+			drawBuffers[colorCount] = GL_COLOR_ATTACHMENT0 + colorCount;
+			attachments[colorCount++] = handle;
+		}
+		else if (use.access == RenderGraphAccess_Depth || use.access == RenderGraphAccess_DepthClear)
+		{
+			attachments[MAX_RENDER_GRAPH_ATTACHMENTS] = handle;
+			depth = true;
+		}
+	}
+
+	//compute passes don't draw
+	if (!colorCount && !depth)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		return;
+	}
+
+	if (!state.framebuffer)
+		glGenFramebuffers(1, &state.framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, state.framebuffer);
+
+	//the attachments only change when targets are reallocated or aliased differently
+	if (memcmp(attachments, state.attachments, sizeof(attachments)) != 0)
+	{
+		for (u32 i = 0; i < MAX_RENDER_GRAPH_ATTACHMENTS; ++i)
+			glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, attachments[i], 0);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, attachments[MAX_RENDER_GRAPH_ATTACHMENTS], 0);
+		memcpy(state.attachments, attachments, sizeof(attachments));
+
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			ELOG("ExecuteRenderGraph() - the framebuffer of pass %s is incomplete\n", pass.name);
+		}
+	}
+
+	if (colorCount)
+		glDrawBuffers(colorCount, drawBuffers);
+	else
+		glDrawBuffer(GL_NONE);
+	glViewport(0, 0, pass.viewportSize.x, pass.viewportSize.y);
+
+	const GLfloat black[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	const GLfloat farDepth = 1.0f;
+	u32 drawBuffer = 0;
+	for (u32 i = 0; i < pass.uses.size(); ++i)
+	{
+		RenderGraphAccess access = pass.uses[i].access;
+		if (access == RenderGraphAccess_ColorClear && drawBuffer < colorCount)
+			glClearBufferfv(GL_COLOR, drawBuffer, black);
+		if (access == RenderGraphAccess_Color || access == RenderGraphAccess_ColorClear)
+			drawBuffer++;
+
+		if (access == RenderGraphAccess_DepthClear)
+		{
+			glDepthMask(GL_TRUE);
+			glClearBufferfv(GL_DEPTH, 0, &farDepth);
+		}
+	}
+}
+
+//the query of a slot is read RENDER_GRAPH_TIMER_FRAMES frames later, it doesn't wait for the gpu
+static bool BeginPassTimer(RenderGraphPassState& state, u32 slot)
+{
+	if (!state.timerQueries[0])
+		glGenQueries(RENDER_GRAPH_TIMER_FRAMES, state.timerQueries);
+
+	u32 bit = 1u << slot;
+	if (state.pendingQueries & bit)
+	{
+		GLint available = 0;
+		glGetQueryObjectiv(state.timerQueries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			return false;
+
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(state.timerQueries[slot], GL_QUERY_RESULT, &elapsed);
+		state.gpuTime = elapsed / 1000000.0f;
+		state.pendingQueries &= ~bit;
+	}
+
+	glBeginQuery(GL_TIME_ELAPSED, state.timerQueries[slot]);
+	state.pendingQueries |= bit;
+	return true;
+}
+
+void ExecuteRenderGraph(App* app, RenderGraph& graph)
+{
+	RenderTargetPool& pool = app->renderTargets;
+	const u32 timerSlot = graph.frame % RENDER_GRAPH_TIMER_FRAMES;
+
+	//distinct textures handed out this frame, aliased targets share one
+	std::vector<u32> frameTargets;
+	graph.aliasedBytes = 0;
+
+	for (u32 i = 0; i < graph.order.size(); ++i)
+	{
+		const RenderGraphPass& pass = graph.passes[graph.order[i]];
+		RenderGraphPassState& state = graph.passStates[pass.name];
+
+		state.transientBytes = 0;
+		for (u32 j = 0; j < pass.uses.size(); ++j)
+		{
+			RenderGraphResource& resource = graph.resources[pass.uses[j].resourceIdx];
+			if (!resource.transient)
+				continue;
+
+			state.transientBytes += resource.bytes;
+			if (resource.firstUse != i || *resource.handle)
+				continue;
+
+			*resource.handle = AcquireRenderTarget(pool, resource.internalFormat, resource.size, resource.usage);
+
+			u32 targetCount = frameTargets.size();
+			AddUnique(frameTargets, *resource.handle);
+			if (frameTargets.size() != targetCount)
+				graph.aliasedBytes += resource.bytes;
+		}
+
+		bool timed = BeginPassTimer(state, timerSlot);
+		f64 cpuStart = GetPlatformTime();
+
+		BindPassAttachments(graph, pass, state);
+		pass.execute(app);
+
+		state.cpuTime = (f32)((GetPlatformTime() - cpuStart) * 1000.0);
+		if (timed)
+			glEndQuery(GL_TIME_ELAPSED);
+
+		//whatever isn't read anymore goes back to the pool for the next passes
+		for (u32 j = 0; j < pass.uses.size(); ++j)
+		{
+			RenderGraphResource& resource = graph.resources[pass.uses[j].resourceIdx];
+			if (resource.transient && resource.lastUse == i)
+				ReleaseRenderTarget(pool, *resource.handle);
+		}
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
@@ -0,0 +1,24 @@
+//
+// render_graph.h: Frame passes declared with the resources they read and write. The graph orders
+// them, culls the ones whose output nobody reads, binds the attachments of each pass and takes
+// the transient targets from the render target pool only for the span of passes that use them,
+// so targets whose lifetimes don't overlap end up sharing a texture.
+//
+#pragma once
+
+#include "engine.h"
+
+#define RENDER_GRAPH_NONE 0xFFFFFFFF
+
+void BeginRenderGraph(RenderGraph& graph, RenderTargetPool& pool, ivec2 viewportSize);
+
+u32 ImportRenderGraphResource(RenderGraph& graph, const char* name, GLuint* handle);
+u32 CreateRenderGraphTexture(RenderGraph& graph, const char* name, GLenum internalFormat, ivec2 size, RenderTargetUsage usage, GLuint* handle);
+void ExportRenderGraphResource(RenderGraph& graph, u32 resourceIdx);
+
+u32 AddRenderGraphPass(RenderGraph& graph, const char* name, RenderGraphExecute execute);
+void UseRenderGraphResource(RenderGraph& graph, u32 passIdx, u32 resourceIdx, RenderGraphAccess access);
+void SetRenderGraphPassViewport(RenderGraph& graph, u32 passIdx, ivec2 viewportSize);
+
+void CompileRenderGraph(RenderGraph& graph);
+void ExecuteRenderGraph(App* app, RenderGraph& graph);
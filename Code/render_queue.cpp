@@ -0,0 +1,370 @@
+#include "render_queue.h"
+#include "buffer_management.h"
+#include "material_table.h"
+#include "frustum_culling.h"
+#include "bvh.h"
+#include "light_clustering.h"
+#include "program_permutations.h"
+#include "geometry_arena.h"
+
+#define SORTKEY_MASK(bits) ((1ull << (bits)) - 1ull)
+
+vec4 WaterClippingPlane(WaterLayer layer)
+{
+	//the water plane sits at y = 0, reflection keeps what is above it and refraction what is below
+	return layer == WaterLayer_Reflection ? vec4(0, 1, 0, 0) : vec4(0, -1, 0, 0);
+}
+
+u64 MakeSortKey(RenderPass pass, u32 programIdx, u32 materialIdx, GLuint vao, f32 depth, f32 zfar)
+{
+	//opaque geometry goes front to back, so closer draws get the smaller key
+	f32 normalizedDepth = glm::clamp(depth / zfar, 0.0f, 1.0f);
+	u64 quantizedDepth = (u64)(normalizedDepth * (f32)SORTKEY_MASK(SORTKEY_DEPTH_BITS));
+
+	u64 key = 0;
+	key |= ((u64)pass        & SORTKEY_MASK(SORTKEY_PASS_BITS))     << SORTKEY_PASS_SHIFT;
+	key |= ((u64)programIdx  & SORTKEY_MASK(SORTKEY_PROGRAM_BITS))  << SORTKEY_PROGRAM_SHIFT;
+	key |= ((u64)materialIdx & SORTKEY_MASK(SORTKEY_MATERIAL_BITS)) << SORTKEY_MATERIAL_SHIFT;
+	key |= ((u64)vao         & SORTKEY_MASK(SORTKEY_VAO_BITS))      << SORTKEY_VAO_SHIFT;
+	key |= quantizedDepth << SORTKEY_DEPTH_SHIFT;
+	return key;
+}
+
+void BeginRenderQueue(RenderQueue& queue, RenderPass pass, u32 programIdx, const Camera* camera)
+{
+	queue.pass = pass;
+	queue.programIdx = programIdx;
+	queue.permutations = NULL;
+	queue.camera = camera;
+	queue.layerMask = 0;
+	queue.commands.clear();
+}
+
+//the program of every draw is the variant of the set for the features of its material
+void BeginRenderQueue(RenderQueue& queue, RenderPass pass, ProgramPermutations& permutations, const Camera* camera)
+{
+	BeginRenderQueue(queue, pass, UINT32_MAX, camera);
+	queue.permutations = &permutations;
+}
+
+void BuildRenderQueue(App* app, RenderQueue& queue)
+{
+	const Camera& camera = *queue.camera;
+	WorldBounds& bounds = app->worldBounds;
+
+	if (queue.pass == RenderPass_Water)
+	{
+		//every draw goes to all the drawn layers, it is kept when any of their frustums sees it.
+		//The layers clip at the water plane, whatever is fully on the other side is culled too
+		bool firstLayer = true;
+		for (u32 layer = 0; layer < WaterLayer_Count; ++layer)
+		{
+			if (!(queue.layerMask & (1u << layer)))
+				continue;
+
+			const Camera& layerCamera = *queue.layerCameras[layer];
+			Frustum frustum = MakeFrustum(layerCamera.projection * layerCamera.view);
+			AddFrustumPlane(frustum, WaterClippingPlane((WaterLayer)layer));
+
+			if (app->bvhCulling)
+				CullBVH(app->sceneBVH, bounds, frustum);
+			else
+				CullWorldBounds(bounds, frustum);
+
+			if (firstLayer)
+				queue.layerVisible = bounds.visible;
+			else
+				for (u32 b = 0; b < bounds.count; ++b)
+					queue.layerVisible[b] |= bounds.visible[b];
+			firstLayer = false;
+		}
+		bounds.visible.swap(queue.layerVisible);
+
+		queue.visibleCount = 0;
+		for (u32 b = 0; b < bounds.count; ++b)
+			queue.visibleCount += bounds.visible[b];
+	}
+	else
+	{
+		Frustum frustum = MakeFrustum(camera.projection * camera.view);
+		queue.visibleCount = app->bvhCulling ? CullBVH(app->sceneBVH, bounds, frustum) : CullWorldBounds(bounds, frustum);
+	}
+	queue.culledCount = bounds.count - queue.visibleCount;
+
+	for (u32 i = 0; i < app->models.size(); ++i)
+	{
+		Model& model = app->models[i];
+		Mesh& mesh = app->meshes[model.meshIdx];
+
+		for (u32 j = 0; j < mesh.submeshes.size(); ++j)
+		{
+			u32 b = bounds.firstBound[i] + j;
+			if (!bounds.visible[b])
+				continue;
+
+			Submesh& submesh = mesh.submeshes[j];
+
+			glm::vec4 viewPosition = camera.view * glm::vec4(bounds.centerX[b], bounds.centerY[b], bounds.centerZ[b], 1.0f);
+			f32 depth = -viewPosition.z;
+
+			DrawCommand command = {};
+			command.modelIdx = i;
+			command.meshIdx = model.meshIdx;
+			command.submeshIdx = j;
+			command.materialIdx = model.materialIdx[j];
+			command.programIdx = queue.permutations ? RequestProgramPermutation(app, *queue.permutations, MaterialFeatures(app, app->materials[command.materialIdx]))
+			                                        : queue.programIdx;
+			command.vao = FindVAO(app, mesh, j, app->programs[command.programIdx]);
+			command.indexCount = submesh.indices.size();
+			command.firstIndex = submesh.firstIndex;
+			command.baseVertex = submesh.baseVertex;
+			command.key = MakeSortKey(queue.pass, command.programIdx, command.materialIdx, command.vao, depth, camera.zfar);
+
+			queue.commands.push_back(command);
+		}
+	}
+}
+
+void SortRenderQueue(RenderQueue& queue)
+{
+	//LSD radix sort, one byte of the key per pass
+	std::vector<DrawCommand>& src = queue.commands;
+	std::vector<DrawCommand>& dst = queue.sortScratch;
+	const u32 count = src.size();
+	if (count < 2)
+		return;
+
+	dst.resize(count);
+
+	for (u32 shift = 0; shift < 64; shift += 8)
+	{
+		u32 histogram[256] = {};
+		for (u32 i = 0; i < count; ++i)
+			histogram[(src[i].key >> shift) & 0xFF]++;
+
+		//every key has the same byte here, nothing to reorder
+		if (histogram[(src[0].key >> shift) & 0xFF] == count)
+			continue;
+
+		u32 offset = 0;
+		for (u32 b = 0; b < 256; ++b)
+		{
+			u32 bucketCount = histogram[b];
+			histogram[b] = offset;
+			offset += bucketCount;
+		}
+
+		for (u32 i = 0; i < count; ++i)
+			dst[histogram[(src[i].key >> shift) & 0xFF]++] = src[i];
+
+		src.swap(dst);
+	}
+}
+
+//models sharing a mesh end up as instances of the same indirect command. Groups keep the
+//order in which the sorted queue first reaches them, so they stay grouped by VAO
+static void GroupInstances(RenderQueue& queue, u32 count)
+{
+	queue.instanceGroups.clear();
+	queue.instanceCommands.clear();
+	queue.instanceGroupLookup.clear();
+
+	std::vector<u32> groupOf(count);
+	for (u32 i = 0; i < count; ++i)
+	{
+		const DrawCommand& command = queue.commands[i];
+		u64 instanceKey = ((u64)command.meshIdx << 48) | ((u64)(command.submeshIdx & 0xFFFF) << 32) | command.materialIdx;
+
+		auto it = queue.instanceGroupLookup.find(instanceKey);
+		if (it == queue.instanceGroupLookup.end())
+		{
+			InstanceGroup group = {};
+			group.commandIdx = i;
+			it = queue.instanceGroupLookup.insert({ instanceKey, (u32)queue.instanceGroups.size() }).first;
+			queue.instanceGroups.push_back(group);
+		}
+
+		groupOf[i] = it->second;
+		queue.instanceGroups[it->second].instanceCount++;
+	}
+
+	u32 firstInstance = 0;
+	for (u32 g = 0; g < queue.instanceGroups.size(); ++g)
+	{
+		queue.instanceGroups[g].firstInstance = firstInstance;
+		firstInstance += queue.instanceGroups[g].instanceCount;
+		queue.instanceGroups[g].instanceCount = 0;
+	}
+
+	queue.instanceCommands.resize(count);
+	for (u32 i = 0; i < count; ++i)
+	{
+		InstanceGroup& group = queue.instanceGroups[groupOf[i]];
+		queue.instanceCommands[group.firstInstance + group.instanceCount++] = i;
+	}
+}
+
+//per program state of the pass, set whenever the queue switches program
+static void BindQueueProgram(App* app, RenderQueue& queue, u32 programIdx)
+{
+	const Camera& camera = *queue.camera;
+
+	//a variant still compiling is waited for here, after every other one of the frame was started
+	FinishProgram(app, programIdx);
+	const Program& program = app->programs[programIdx];
+
+	glUseProgram(program.handle);
+	queue.programBinds++;
+
+	//all material textures live in the buckets of the material table
+	BindMaterialTable(app, program);
+	queue.textureBinds += app->materialTable.buckets.size();
+
+	if (queue.pass == RenderPass_Water)
+	{
+		glm::mat4 layerViewProjection[WaterLayer_Count];
+		glm::vec4 clippingPlanes[WaterLayer_Count];
+		for (u32 layer = 0; layer < WaterLayer_Count; ++layer)
+		{
+			layerViewProjection[layer] = queue.layerCameras[layer]->projection * queue.layerCameras[layer]->view;
+			clippingPlanes[layer] = WaterClippingPlane((WaterLayer)layer);
+		}
+		glUniformMatrix4fv(program.uniformLocations[Uniform_uLayerViewProjection], WaterLayer_Count, GL_FALSE, glm::value_ptr(layerViewProjection[0]));
+		glUniform4fv(program.uniformLocations[Uniform_clippingPlane], WaterLayer_Count, glm::value_ptr(clippingPlanes[0]));
+		glUniform1ui(program.uniformLocations[Uniform_uLayerMask], queue.layerMask);
+	}
+	else
+	{
+		glUniformMatrix4fv(program.uniformLocations[Uniform_cameraProj], 1, GL_FALSE, glm::value_ptr(camera.projection));
+
+		u32 globalblockOffset = app->globalParamsOffset;
+		u32 globalblockSize = RingRangeSize(app->cbuffer, globalblockOffset);
+		glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.buffer.handle, globalblockOffset, globalblockSize);
+
+		BindForwardLights(app, program);
+
+		if (queue.pass == RenderPass_GBuffer)
+			glUniform1i(program.uniformLocations[Uniform_uCompactGBuffer], app->compactGBuffer);
+	}
+}
+
+u32 DrawParamsRegionSize(App* app, u32 drawCount)
+{
+	return drawCount * (sizeof(GpuDrawData) + sizeof(DrawElementsIndirectCommand)) + app->storageBlockAlignment;
+}
+
+//doubles until the queue fits, a scene that keeps growing only reallocates a few times
+static void ReserveSceneDraws(App* app, u32 count)
+{
+	if (count <= app->sceneDrawCapacity)
+		return;
+
+	u32 capacity = app->sceneDrawCapacity;
+	while (capacity < count)
+		capacity *= 2;
+
+	ResizeRingBuffer(app->DrawParamsBuffer, DrawParamsRegionSize(app, capacity));
+	ReserveDrawIds(app, capacity);
+	app->sceneDrawCapacity = capacity;
+
+	ILOG("SubmitRenderQueue() - %u draws queued, the draw data now holds %u\n", count, capacity);
+}
+
+void SubmitRenderQueue(App* app, RenderQueue& queue)
+{
+	const Camera& camera = *queue.camera;
+	RingBuffer& ring = app->DrawParamsBuffer;
+
+	queue.drawCount = 0;
+	queue.instanceCount = 0;
+	queue.vaoBinds = 0;
+	queue.textureBinds = 0;
+	queue.programBinds = 0;
+	queue.multiDrawCount = 0;
+
+	if (queue.commands.empty())
+		return;
+
+	u32 count = queue.commands.size();
+	ReserveSceneDraws(app, count);
+
+	GroupInstances(queue, count);
+	const u32 groupCount = queue.instanceGroups.size();
+
+	//per instance data and indirect commands, instance j of a group reads uDraws[baseInstance + j]
+	BeginRingRegion(ring);
+
+	AlignHead(ring, app->storageBlockAlignment);
+	u32 drawDataOffset = ring.buffer.head;
+	for (u32 i = 0; i < count; ++i)
+	{
+		const DrawCommand& command = queue.commands[queue.instanceCommands[i]];
+		const Model& model = app->models[command.modelIdx];
+
+		GpuDrawData drawData = {};
+		drawData.world = model.world;
+		drawData.worldViewProjection = camera.projection * camera.view * model.world;
+		drawData.materialIdx = command.materialIdx;
+		PushData(ring, &drawData, sizeof(drawData));
+	}
+	u32 drawDataSize = ring.buffer.head - drawDataOffset;
+
+	AlignHead(ring, sizeof(u32));
+	u32 indirectOffset = ring.buffer.head;
+	for (u32 g = 0; g < groupCount; ++g)
+	{
+		const InstanceGroup& group = queue.instanceGroups[g];
+		const DrawCommand& command = queue.commands[group.commandIdx];
+
+		DrawElementsIndirectCommand indirect = {};
+		indirect.count = command.indexCount;
+		indirect.instanceCount = group.instanceCount;
+		indirect.firstIndex = command.firstIndex;
+		indirect.baseVertex = command.baseVertex;
+		indirect.baseInstance = group.firstInstance;
+		PushData(ring, &indirect, sizeof(indirect));
+	}
+
+	EndRingRegion(ring);
+
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BINDING, ring.buffer.handle, drawDataOffset, drawDataSize);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, ring.buffer.handle);
+
+	//the queue is sorted by program and VAO, every run of groups sharing both is a single multi-draw
+	u32 boundProgramIdx = UINT32_MAX;
+	u32 batchStart = 0;
+	while (batchStart < groupCount)
+	{
+		const DrawCommand& first = queue.commands[queue.instanceGroups[batchStart].commandIdx];
+		u32 batchEnd = batchStart + 1;
+		while (batchEnd < groupCount)
+		{
+			const DrawCommand& command = queue.commands[queue.instanceGroups[batchEnd].commandIdx];
+			if (command.programIdx != first.programIdx || command.vao != first.vao)
+				break;
+			batchEnd++;
+		}
+
+		if (first.programIdx != boundProgramIdx)
+		{
+			BindQueueProgram(app, queue, first.programIdx);
+			boundProgramIdx = first.programIdx;
+		}
+
+		glBindVertexArray(first.vao);
+		queue.vaoBinds++;
+
+		u64 commandOffset = indirectOffset + batchStart * sizeof(DrawElementsIndirectCommand);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)commandOffset, batchEnd - batchStart, 0);
+		queue.multiDrawCount++;
+
+		batchStart = batchEnd;
+	}
+	queue.drawCount = groupCount;
+	queue.instanceCount = count;
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	FenceRingRegion(ring);
+}
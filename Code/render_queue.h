@@ -0,0 +1,35 @@
+//
+// render_queue.h: Sort-key based draw queue used by the scene passes. Every draw gets a 64 bit
+// key (pass | program | vao | material | depth) so sorting it groups the draws that share a program
+// and VAO, and submission turns each run of them into a single glMultiDrawElementsIndirect call.
+//
+#pragma once
+
+#include "engine.h"
+
+#define DRAW_DATA_BINDING 1 // shader storage binding of the per draw data
+
+// Key layout, from the most significant bit
+#define SORTKEY_PASS_BITS     4
+#define SORTKEY_PROGRAM_BITS  8
+#define SORTKEY_VAO_BITS      16
+#define SORTKEY_MATERIAL_BITS 16
+#define SORTKEY_DEPTH_BITS    20
+
+#define SORTKEY_DEPTH_SHIFT    0
+#define SORTKEY_MATERIAL_SHIFT (SORTKEY_DEPTH_SHIFT + SORTKEY_DEPTH_BITS)
+#define SORTKEY_VAO_SHIFT      (SORTKEY_MATERIAL_SHIFT + SORTKEY_MATERIAL_BITS)
+#define SORTKEY_PROGRAM_SHIFT  (SORTKEY_VAO_SHIFT + SORTKEY_VAO_BITS)
+#define SORTKEY_PASS_SHIFT     (SORTKEY_PROGRAM_SHIFT + SORTKEY_PROGRAM_BITS)
+
+vec4 WaterClippingPlane(WaterLayer layer);
+u64 MakeSortKey(RenderPass pass, u32 programIdx, u32 materialIdx, GLuint vao, f32 depth, f32 zfar);
+
+void BeginRenderQueue(RenderQueue& queue, RenderPass pass, u32 programIdx, const Camera* camera);
+void BeginRenderQueue(RenderQueue& queue, RenderPass pass, ProgramPermutations& permutations, const Camera* camera);
+void BuildRenderQueue(App* app, RenderQueue& queue);
+void SortRenderQueue(RenderQueue& queue);
+void SubmitRenderQueue(App* app, RenderQueue& queue);
+
+// a region of the draw data ring, the draw data of that many draws and at most as many indirect commands
+u32 DrawParamsRegionSize(App* app, u32 drawCount);
@@ -0,0 +1,119 @@
+#include "render_target_pool.h"
+
+u32 RenderTargetBytesPerPixel(GLenum internalFormat)
+{
+	switch (internalFormat)
+	{
+	case GL_RGBA32F:
+		return 16;
+	case GL_RGBA16F:
+		return 8;
+	case GL_RG8:
+		return 2;
+	case GL_R8:
+		return 1;
+	default:
+		//RGBA8, RG16, R11G11B10F, R32F and the depth formats, 24 bit depth is padded to 32
+		return 4;
+	}
+}
+
+ivec2 RenderTargetBucketSize(ivec2 size)
+{
+	ivec2 bucket = (glm::max(size, ivec2(1)) + ivec2(RENDER_TARGET_BUCKET - 1)) / RENDER_TARGET_BUCKET;
+	return bucket * RENDER_TARGET_BUCKET;
+}
+
+GLuint AcquireRenderTarget(RenderTargetPool& pool, GLenum internalFormat, ivec2 size, RenderTargetUsage usage)
+{
+	return AcquireRenderTargetArray(pool, internalFormat, size, 1, usage);
+}
+
+//a single layer is a GL_TEXTURE_2D, more are a GL_TEXTURE_2D_ARRAY
+GLuint AcquireRenderTargetArray(RenderTargetPool& pool, GLenum internalFormat, ivec2 size, u32 layers, RenderTargetUsage usage)
+{
+	size = RenderTargetBucketSize(size);
+
+	for (u32 i = 0; i < pool.targets.size(); ++i)
+	{
+		RenderTarget& target = pool.targets[i];
+		if (!target.inUse && target.internalFormat == internalFormat && target.size == size && target.layers == layers && target.usage == usage)
+		{
+			target.inUse = true;
+			pool.inUseBytes += target.bytes;
+			pool.reuseCount++;
+			return target.handle;
+		}
+	}
+
+	RenderTarget target = {};
+	target.internalFormat = internalFormat;
+	target.size = size;
+	target.layers = layers;
+	target.usage = usage;
+	target.bytes = size.x * size.y * layers * RenderTargetBytesPerPixel(internalFormat);
+	target.inUse = true;
+
+	//immutable storage, the size of a target never changes
+	GLenum textureTarget = layers > 1 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+	GLint filter = usage == RenderTargetUsage_Linear ? GL_LINEAR : GL_NEAREST;
+	glGenTextures(1, &target.handle);
+	glBindTexture(textureTarget, target.handle);
+	if (layers > 1)
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, internalFormat, size.x, size.y, layers);
+	else
+		glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, size.x, size.y);
+	glTexParameteri(textureTarget, GL_TEXTURE_MIN_FILTER, filter);
+	glTexParameteri(textureTarget, GL_TEXTURE_MAG_FILTER, filter);
+	glTexParameteri(textureTarget, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(textureTarget, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(textureTarget, 0);
+
+	pool.targets.push_back(target);
+	pool.allocatedBytes += target.bytes;
+	pool.inUseBytes += target.bytes;
+	pool.allocationCount++;
+	return target.handle;
+}
+
+void ReleaseRenderTarget(RenderTargetPool& pool, GLuint& handle)
+{
+	if (!handle)
+		return;
+
+	for (u32 i = 0; i < pool.targets.size(); ++i)
+	{
+		RenderTarget& target = pool.targets[i];
+		if (target.handle == handle && target.inUse)
+		{
+			target.inUse = false;
+			target.releasedFrame = pool.frame;
+			pool.inUseBytes -= target.bytes;
+			handle = 0;
+			return;
+		}
+	}
+
+	ELOG("ReleaseRenderTarget() - texture %u doesn't belong to the pool\n", handle);
+	handle = 0;
+}
+
+void CollectRenderTargets(RenderTargetPool& pool)
+{
+	pool.frame++;
+
+	u32 kept = 0;
+	for (u32 i = 0; i < pool.targets.size(); ++i)
+	{
+		RenderTarget& target = pool.targets[i];
+		if (!target.inUse && pool.frame - target.releasedFrame > RENDER_TARGET_RELEASE_FRAMES)
+		{
+			glDeleteTextures(1, &target.handle);
+			pool.allocatedBytes -= target.bytes;
+			pool.deleteCount++;
+			continue;
+		}
+		pool.targets[kept++] = target;
+	}
+	pool.targets.resize(kept);
+}
@@ -0,0 +1,19 @@
+//
+// render_target_pool.h: Pool of the screen sized textures. Targets are looked up by format, size
+// and usage, released ones are handed out again and only deleted once they went unused for
+// RENDER_TARGET_RELEASE_FRAMES frames. Sizes are rounded up to buckets, so resizing the render
+// window by a few pixels doesn't reallocate anything.
+//
+#pragma once
+
+#include "engine.h"
+
+ivec2 RenderTargetBucketSize(ivec2 size);
+u32 RenderTargetBytesPerPixel(GLenum internalFormat);
+
+GLuint AcquireRenderTarget(RenderTargetPool& pool, GLenum internalFormat, ivec2 size, RenderTargetUsage usage);
+GLuint AcquireRenderTargetArray(RenderTargetPool& pool, GLenum internalFormat, ivec2 size, u32 layers, RenderTargetUsage usage);
+void ReleaseRenderTarget(RenderTargetPool& pool, GLuint& handle);
+
+// once per frame, deletes the targets nobody acquired for a while
+void CollectRenderTargets(RenderTargetPool& pool);
@@ -0,0 +1,434 @@
+#include "texture_cooking.h"
+#include "texture_registry.h"
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+
+//a cache file is this header followed by every level, the largest first
+struct CookedTextureHeader
+{
+	CacheFileHeader file;
+	u64 sourceTimestamp; // the file is stale once the source is written again
+	u32 compression;
+	u32 internalFormat;
+	i32 width;
+	i32 height;
+	u32 levelCount;
+	u64 contentHash;     // of the decoded source and its format, the texture registry dedups without decoding
+};
+
+void InitTextureCooking(App* app)
+{
+	app->textureCooking.s3tc = false;
+
+	std::list<std::string>& extensions = app->OpenGLinfo->OpenGLextensions;
+	for (std::list<std::string>::iterator it = extensions.begin(); it != extensions.end(); it++)
+	{
+		if (*it == "GL_EXT_texture_compression_s3tc")
+			app->textureCooking.s3tc = true;
+	}
+}
+
+static u32 BlockBytes(GLenum internalFormat)
+{
+	return internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || internalFormat == GL_COMPRESSED_RED_RGTC1 ? 8 : 16;
+}
+
+//down to 1x1, the same chain the material table buckets allocate
+static u32 LevelCount(ivec2 size)
+{
+	u32 largest = glm::max(size.x, size.y);
+	u32 count = 1;
+	while (largest > 1)
+	{
+		largest >>= 1;
+		count++;
+	}
+	return count;
+}
+
+static void LayOutLevels(CookedTexture& cooked, u32 levelCount)
+{
+	u32 blockBytes = BlockBytes(cooked.internalFormat);
+	u32 offset = 0;
+
+	cooked.levelOffsets.clear();
+	for (u32 level = 0; level < levelCount; ++level)
+	{
+		i32 width = glm::max(cooked.size.x >> level, 1);
+		i32 height = glm::max(cooked.size.y >> level, 1);
+		cooked.levelOffsets.push_back(offset);
+		offset += ((width + 3) / 4) * ((height + 3) / 4) * blockBytes;
+	}
+	cooked.levelOffsets.push_back(offset);
+}
+
+//grey and grey-alpha images too, the encoders only see RGBA8
+static void ExpandToRGBA(const Image& image, std::vector<u8>& rgba)
+{
+	rgba.resize(image.size.x * image.size.y * 4);
+	for (i32 y = 0; y < image.size.y; ++y)
+	{
+		for (i32 x = 0; x < image.size.x; ++x)
+		{
+			const u8* src = (const u8*)image.pixels + y * image.stride + x * image.nchannels;
+			u8* dst = &rgba[(y * image.size.x + x) * 4];
+			switch (image.nchannels)
+			{
+				case 1: dst[0] = dst[1] = dst[2] = src[0]; dst[3] = 255; break;
+				case 2: dst[0] = dst[1] = dst[2] = src[0]; dst[3] = src[1]; break;
+				case 3: dst[0] = src[0]; dst[1] = src[1]; dst[2] = src[2]; dst[3] = 255; break;
+				default: memcpy(dst, src, 4); break;
+			}
+		}
+	}
+}
+
+//2x2 box filter, the odd last row or column is repeated
+static void Downsample(const std::vector<u8>& src, ivec2 size, std::vector<u8>& dst, ivec2 dstSize)
+{
+	dst.resize(dstSize.x * dstSize.y * 4);
+	for (i32 y = 0; y < dstSize.y; ++y)
+	{
+		i32 y0 = glm::min(2 * y, size.y - 1);
+		i32 y1 = glm::min(2 * y + 1, size.y - 1);
+		for (i32 x = 0; x < dstSize.x; ++x)
+		{
+			i32 x0 = glm::min(2 * x, size.x - 1);
+			i32 x1 = glm::min(2 * x + 1, size.x - 1);
+			for (i32 c = 0; c < 4; ++c)
+			{
+				u32 sum = src[(y0 * size.x + x0) * 4 + c] + src[(y0 * size.x + x1) * 4 + c] +
+				          src[(y1 * size.x + x0) * 4 + c] + src[(y1 * size.x + x1) * 4 + c];
+				dst[(y * dstSize.x + x) * 4 + c] = (u8)((sum + 2) / 4);
+			}
+		}
+	}
+}
+
+//texels past the edge repeat the last row or column
+static void FetchBlock(const std::vector<u8>& rgba, ivec2 size, i32 blockX, i32 blockY, u8 block[16][4])
+{
+	for (i32 y = 0; y < 4; ++y)
+	{
+		for (i32 x = 0; x < 4; ++x)
+		{
+			i32 px = glm::min(blockX * 4 + x, size.x - 1);
+			i32 py = glm::min(blockY * 4 + y, size.y - 1);
+			memcpy(block[y * 4 + x], &rgba[(py * size.x + px) * 4], 4);
+		}
+	}
+}
+
+static u16 PackRGB565(vec3 color)
+{
+	color = glm::clamp(color, vec3(0.0f), vec3(255.0f));
+	u16 r = (u16)(color.r * 31.0f / 255.0f + 0.5f);
+	u16 g = (u16)(color.g * 63.0f / 255.0f + 0.5f);
+	u16 b = (u16)(color.b * 31.0f / 255.0f + 0.5f);
+	return (r << 11) | (g << 5) | b;
+}
+
+static ivec3 UnpackRGB565(u16 packed)
+{
+	i32 r = (packed >> 11) & 31;
+	i32 g = (packed >> 5) & 63;
+	i32 b = packed & 31;
+	return ivec3((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+}
+
+//endpoints at the extremes of the colors along their principal axis, then the closest of the 4 colors per texel
+static void EncodeBC1Block(const u8 block[16][4], u8* out)
+{
+	vec3 mean(0.0f);
+	for (u32 i = 0; i < 16; ++i)
+		mean += vec3(block[i][0], block[i][1], block[i][2]);
+	mean /= 16.0f;
+
+	f32 xx = 0.0f, xy = 0.0f, xz = 0.0f, yy = 0.0f, yz = 0.0f, zz = 0.0f;
+	for (u32 i = 0; i < 16; ++i)
+	{
+		vec3 d = vec3(block[i][0], block[i][1], block[i][2]) - mean;
+		xx += d.x * d.x; xy += d.x * d.y; xz += d.x * d.z;
+		yy += d.y * d.y; yz += d.y * d.z; zz += d.z * d.z;
+	}
+
+	//power iteration on the covariance, a flat block keeps the grey axis
+	vec3 axis = glm::normalize(vec3(1.0f));
+	for (u32 iteration = 0; iteration < 8; ++iteration)
+	{
+		vec3 next(xx * axis.x + xy * axis.y + xz * axis.z,
+		          xy * axis.x + yy * axis.y + yz * axis.z,
+		          xz * axis.x + yz * axis.y + zz * axis.z);
+		f32 length = glm::length(next);
+		if (length < 1e-6f)
+			break;
+		axis = next / length;
+	}
+
+	f32 minT = FLT_MAX;
+	f32 maxT = -FLT_MAX;
+	for (u32 i = 0; i < 16; ++i)
+	{
+		f32 t = glm::dot(vec3(block[i][0], block[i][1], block[i][2]) - mean, axis);
+		minT = glm::min(minT, t);
+		maxT = glm::max(maxT, t);
+	}
+
+	//color0 > color1 selects the 4 color mode, the only one BC3 has
+	u16 color0 = PackRGB565(mean + axis * maxT);
+	u16 color1 = PackRGB565(mean + axis * minT);
+	if (color0 < color1)
+	{
+		u16 swap = color0;
+		color0 = color1;
+		color1 = swap;
+	}
+
+	u32 indices = 0;
+	if (color0 != color1)
+	{
+		ivec3 palette[4];
+		palette[0] = UnpackRGB565(color0);
+		palette[1] = UnpackRGB565(color1);
+		palette[2] = (2 * palette[0] + palette[1]) / 3;
+		palette[3] = (palette[0] + 2 * palette[1]) / 3;
+
+		for (u32 i = 0; i < 16; ++i)
+		{
+			u32 best = 0;
+			i32 bestDistance = INT32_MAX;
+			for (u32 p = 0; p < 4; ++p)
+			{
+				ivec3 d = ivec3(block[i][0], block[i][1], block[i][2]) - palette[p];
+				i32 distance = d.x * d.x + d.y * d.y + d.z * d.z;
+				if (distance < bestDistance)
+				{
+					bestDistance = distance;
+					best = p;
+				}
+			}
+			indices |= best << (2 * i);
+		}
+	}
+
+	out[0] = color0 & 0xFF;
+	out[1] = color0 >> 8;
+	out[2] = color1 & 0xFF;
+	out[3] = color1 >> 8;
+	for (u32 b = 0; b < 4; ++b)
+		out[4 + b] = (indices >> (8 * b)) & 0xFF;
+}
+
+//the 8 value mode between the block's min and max, also the alpha of BC3 and each channel of BC5
+static void EncodeBC4Block(const u8 values[16], u8* out)
+{
+	u8 low = 255;
+	u8 high = 0;
+	for (u32 i = 0; i < 16; ++i)
+	{
+		low = glm::min(low, values[i]);
+		high = glm::max(high, values[i]);
+	}
+
+	out[0] = high;
+	out[1] = low;
+	memset(out + 2, 0, 6);
+	if (high == low)
+		return;
+
+	i32 palette[8];
+	palette[0] = high;
+	palette[1] = low;
+	for (i32 i = 1; i < 7; ++i)
+		palette[i + 1] = ((7 - i) * high + i * low) / 7;
+
+	u64 indices = 0;
+	for (u32 i = 0; i < 16; ++i)
+	{
+		u64 best = 0;
+		i32 bestDistance = INT32_MAX;
+		for (u32 p = 0; p < 8; ++p)
+		{
+			i32 distance = glm::abs(values[i] - palette[p]);
+			if (distance < bestDistance)
+			{
+				bestDistance = distance;
+				best = p;
+			}
+		}
+		indices |= best << (3 * i);
+	}
+
+	for (u32 b = 0; b < 6; ++b)
+		out[2 + b] = (indices >> (8 * b)) & 0xFF;
+}
+
+static void EncodeLevel(const std::vector<u8>& rgba, ivec2 size, GLenum internalFormat, u8* out)
+{
+	i32 blocksX = (size.x + 3) / 4;
+	i32 blocksY = (size.y + 3) / 4;
+	u32 blockBytes = BlockBytes(internalFormat);
+
+	u8 block[16][4];
+	u8 channel[16];
+	for (i32 by = 0; by < blocksY; ++by)
+	{
+		for (i32 bx = 0; bx < blocksX; ++bx)
+		{
+			FetchBlock(rgba, size, bx, by, block);
+			u8* dst = out + (by * blocksX + bx) * blockBytes;
+
+			switch (internalFormat)
+			{
+				case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+					EncodeBC1Block(block, dst);
+					break;
+				case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+					for (u32 i = 0; i < 16; ++i) channel[i] = block[i][3];
+					EncodeBC4Block(channel, dst);
+					EncodeBC1Block(block, dst + 8);
+					break;
+				case GL_COMPRESSED_RED_RGTC1:
+					for (u32 i = 0; i < 16; ++i) channel[i] = block[i][0];
+					EncodeBC4Block(channel, dst);
+					break;
+				case GL_COMPRESSED_RG_RGTC2:
+					for (u32 i = 0; i < 16; ++i) channel[i] = block[i][0];
+					EncodeBC4Block(channel, dst);
+					for (u32 i = 0; i < 16; ++i) channel[i] = block[i][1];
+					EncodeBC4Block(channel, dst + 8);
+					break;
+			}
+		}
+	}
+}
+
+static GLenum CookedFormat(TextureCompression compression, const std::vector<u8>& rgba)
+{
+	switch (compression)
+	{
+		case TextureCompression_Normal: return GL_COMPRESSED_RG_RGTC2;
+		case TextureCompression_Single: return GL_COMPRESSED_RED_RGTC1;
+		default: break;
+	}
+
+	for (u32 i = 3; i < rgba.size(); i += 4)
+		if (rgba[i] != 255)
+			return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+}
+
+static bool ReadCookedTexture(const char* path, u64 sourceTimestamp, TextureCompression compression, CookedTexture& cooked)
+{
+	CookedTextureHeader header = {};
+	if (ReadCacheFile(path, COOKED_TEXTURE_MAGIC, COOKED_TEXTURE_VERSION, &header, sizeof(header), cooked.data) != CacheFile_Valid)
+		return false;
+
+	bool valid = header.sourceTimestamp == sourceTimestamp && header.compression == (u32)compression &&
+	             header.width > 0 && header.height > 0 && header.levelCount == LevelCount(ivec2(header.width, header.height));
+	if (valid)
+	{
+		cooked.internalFormat = header.internalFormat;
+		cooked.size = ivec2(header.width, header.height);
+		cooked.contentHash = header.contentHash;
+		LayOutLevels(cooked, header.levelCount);
+		valid = cooked.levelOffsets.back() == cooked.data.size();
+	}
+	return valid;
+}
+
+static void WriteCookedTexture(const char* path, u64 sourceTimestamp, TextureCompression compression, const CookedTexture& cooked)
+{
+	CookedTextureHeader header = {};
+	header.sourceTimestamp = sourceTimestamp;
+	header.compression = compression;
+	header.internalFormat = cooked.internalFormat;
+	header.width = cooked.size.x;
+	header.height = cooked.size.y;
+	header.levelCount = cooked.levelOffsets.size() - 1;
+	header.contentHash = cooked.contentHash;
+	WriteCacheFile(path, COOKED_TEXTURE_MAGIC, COOKED_TEXTURE_VERSION, &header, sizeof(header), cooked.data.data(), cooked.data.size());
+}
+
+bool CookTexture(const char* filepath, TextureCompression compression, CookedTexture& cooked, bool& cacheHit)
+{
+	std::string cachePath = std::string(filepath) + COOKED_TEXTURE_EXTENSION;
+	u64 sourceTimestamp = GetFileLastWriteTimestamp(filepath);
+
+	cacheHit = sourceTimestamp != 0 && ReadCookedTexture(cachePath.c_str(), sourceTimestamp, compression, cooked);
+	if (cacheHit)
+		return true;
+
+	Image image = LoadImage(filepath);
+	if (!image.pixels)
+		return false;
+
+	std::vector<u8> level;
+	ExpandToRGBA(image, level);
+	cooked.internalFormat = CookedFormat(compression, level);
+	cooked.contentHash = HashTextureContent(image, compression, cooked.internalFormat);
+	cooked.size = image.size;
+	FreeImage(image);
+
+	u32 levelCount = LevelCount(cooked.size);
+	LayOutLevels(cooked, levelCount);
+	cooked.data.resize(cooked.levelOffsets.back());
+
+	ivec2 levelSize = cooked.size;
+	std::vector<u8> nextLevel;
+	for (u32 l = 0; l < levelCount; ++l)
+	{
+		EncodeLevel(level, levelSize, cooked.internalFormat, cooked.data.data() + cooked.levelOffsets[l]);
+		if (l + 1 == levelCount)
+			break;
+
+		ivec2 nextSize = glm::max(levelSize / 2, ivec2(1));
+		Downsample(level, levelSize, nextLevel, nextSize);
+		level.swap(nextLevel);
+		levelSize = nextSize;
+	}
+
+	WriteCookedTexture(cachePath.c_str(), sourceTimestamp, compression, cooked);
+	return true;
+}
+
+void UploadCookedTexture2D(GLuint texHandle, const CookedTexture& cooked, const u8* data)
+{
+	u32 levelCount = cooked.levelOffsets.size() - 1;
+
+	glBindTexture(GL_TEXTURE_2D, texHandle);
+	for (u32 level = 0; level < levelCount; ++level)
+	{
+		i32 width = glm::max(cooked.size.x >> level, 1);
+		i32 height = glm::max(cooked.size.y >> level, 1);
+		u32 levelSize = cooked.levelOffsets[level + 1] - cooked.levelOffsets[level];
+		glCompressedTexImage2D(GL_TEXTURE_2D, level, cooked.internalFormat, width, height, 0, levelSize,
+		                       (const void*)((size_t)data + cooked.levelOffsets[level]));
+	}
+	//a reload at a smaller size leaves no stale levels past its chain
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+GLuint CreateTexture2DFromCooked(const CookedTexture& cooked, const u8* data)
+{
+	GLuint texHandle;
+	glGenTextures(1, &texHandle);
+	glBindTexture(GL_TEXTURE_2D, texHandle);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+	//BC4 only has red, the previews show it as grey
+	if (cooked.internalFormat == GL_COMPRESSED_RED_RGTC1)
+	{
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, GL_RED);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_RED);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	UploadCookedTexture2D(texHandle, cooked, data);
+	return texHandle;
+}
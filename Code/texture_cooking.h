@@ -0,0 +1,26 @@
+//
+// texture_cooking.h: CPU BC1/BC3/BC4/BC5 encoding of the streamed textures. The whole mip chain is
+// built and encoded once on a worker and kept in a cache file next to the source, later loads read
+// that file while it is newer than the source and skip both the PNG decode and the encode.
+//
+#pragma once
+
+#include "engine.h"
+
+// EXT_texture_compression_s3tc, the glad loader is generated without it
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT  0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+
+#define COOKED_TEXTURE_EXTENSION ".btex"    // appended to the source path
+#define COOKED_TEXTURE_MAGIC     0x58455442 // "BTEX"
+#define COOKED_TEXTURE_VERSION   3          // bump when the layout or the encoder output changes
+
+void InitTextureCooking(App* app);
+
+// the cache file when it is up to date, otherwise the source decoded, encoded and the cache written.
+// Safe on a worker thread, false when the source can't be read
+bool CookTexture(const char* filepath, TextureCompression compression, CookedTexture& cooked, bool& cacheHit);
+
+// every level of the texture; data is cooked.data, or NULL with a pixel unpack buffer holding it bound
+void UploadCookedTexture2D(GLuint texHandle, const CookedTexture& cooked, const u8* data);
+GLuint CreateTexture2DFromCooked(const CookedTexture& cooked, const u8* data);
@@ -0,0 +1,193 @@
+#include "texture_registry.h"
+#include "texture_cooking.h"
+#include <string.h>
+
+//0 is the empty slot
+static u64 NonZeroHash(u64 hash)
+{
+	return hash ? hash : 1;
+}
+
+static u64 HashTexturePath(const char* filepath, TextureCompression compression)
+{
+	u64 hash = HashData(HASH_SEED, &compression, sizeof(compression));
+	return NonZeroHash(HashData(hash, filepath, strlen(filepath)));
+}
+
+u64 HashTextureContent(const Image& image, TextureCompression compression, GLenum internalFormat)
+{
+	u64 header[5] = { (u64)image.size.x, (u64)image.size.y, (u64)image.nchannels, (u64)compression, (u64)internalFormat };
+	u64 hash = HashData(HASH_SEED, header, sizeof(header));
+	hash = HashData(hash, image.pixels, (u64)image.stride * image.size.y);
+	return NonZeroHash(hash);
+}
+
+static u64 TextureBytes(const Texture& tex)
+{
+	u64 bitsPerPixel = 24;
+	switch (tex.internalFormat)
+	{
+		case GL_RGBA8: bitsPerPixel = 32; break;
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+		case GL_COMPRESSED_RED_RGTC1: bitsPerPixel = 4; break;
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+		case GL_COMPRESSED_RG_RGTC2: bitsPerPixel = 8; break;
+	}
+	u64 baseLevel = (u64)tex.size.x * tex.size.y * bitsPerPixel / 8;
+	return baseLevel + baseLevel / 3;
+}
+
+static void AddHashEntry(HashIndex& index, u64 key, u32 value);
+
+static void GrowHashIndex(HashIndex& index)
+{
+	std::vector<u64> keys;
+	std::vector<u32> values;
+	keys.swap(index.keys);
+	values.swap(index.values);
+
+	u32 capacity = keys.empty() ? TEXTURE_REGISTRY_CAPACITY : keys.size() * 2;
+	index.keys.assign(capacity, 0);
+	index.values.assign(capacity, UINT32_MAX);
+	index.count = 0;
+
+	for (u32 i = 0; i < keys.size(); ++i)
+		if (keys[i])
+			AddHashEntry(index, keys[i], values[i]);
+}
+
+//kept at most half full, the probe sequences stay short
+static void AddHashEntry(HashIndex& index, u64 key, u32 value)
+{
+	if ((index.count + 1) * 2 > index.keys.size())
+		GrowHashIndex(index);
+
+	u32 mask = index.keys.size() - 1;
+	u32 slot = key & mask;
+	while (index.keys[slot])
+		slot = (slot + 1) & mask;
+
+	index.keys[slot] = key;
+	index.values[slot] = value;
+	index.count++;
+}
+
+u32 FindTexturePath(App* app, const char* filepath, TextureCompression compression)
+{
+	TextureRegistry& registry = app->textureRegistry;
+	const HashIndex& index = registry.paths;
+	registry.lookups++;
+	if (index.keys.empty())
+		return UINT32_MAX;
+
+	//the hash only narrows it down, the path and compression of the texture are compared too
+	u64 key = HashTexturePath(filepath, compression);
+	u32 mask = index.keys.size() - 1;
+	for (u32 slot = key & mask; index.keys[slot]; slot = (slot + 1) & mask)
+	{
+		registry.probes++;
+		const Texture& tex = app->textures[index.values[slot]];
+		if (index.keys[slot] == key && tex.compression == compression && tex.filepath == filepath)
+			return index.values[slot];
+	}
+	return UINT32_MAX;
+}
+
+void RegisterTexturePath(App* app, u32 texIdx)
+{
+	const Texture& tex = app->textures[texIdx];
+	AddHashEntry(app->textureRegistry.paths, HashTexturePath(tex.filepath.c_str(), tex.compression), texIdx);
+}
+
+u32 FindTextureContent(App* app, u64 contentHash)
+{
+	const HashIndex& index = app->textureRegistry.contents;
+	if (index.keys.empty())
+		return UINT32_MAX;
+
+	//an entry whose texture was reloaded since no longer has those pixels
+	u32 mask = index.keys.size() - 1;
+	for (u32 slot = contentHash & mask; index.keys[slot]; slot = (slot + 1) & mask)
+	{
+		if (index.keys[slot] != contentHash)
+			continue;
+
+		u32 ownerIdx = index.values[slot];
+		const Texture& owner = app->textures[ownerIdx];
+		return owner.contentHash == contentHash && owner.contentOwner == ownerIdx ? ownerIdx : UINT32_MAX;
+	}
+	return UINT32_MAX;
+}
+
+void RegisterTextureContent(App* app, u32 texIdx)
+{
+	HashIndex& index = app->textureRegistry.contents;
+	u64 contentHash = app->textures[texIdx].contentHash;
+
+	if (!index.keys.empty())
+	{
+		u32 mask = index.keys.size() - 1;
+		for (u32 slot = contentHash & mask; index.keys[slot]; slot = (slot + 1) & mask)
+		{
+			if (index.keys[slot] == contentHash)
+			{
+				index.values[slot] = texIdx;
+				return;
+			}
+		}
+	}
+	AddHashEntry(index, contentHash, texIdx);
+}
+
+void ShareTextureContent(App* app, u32 texIdx, u32 ownerIdx)
+{
+	const Texture& owner = app->textures[ownerIdx];
+	Texture& tex = app->textures[texIdx];
+	tex.handle = owner.handle;
+	tex.size = owner.size;
+	tex.internalFormat = owner.internalFormat;
+	tex.contentHash = owner.contentHash;
+	tex.contentOwner = ownerIdx;
+	tex.resident = true;
+
+	TextureRegistry& registry = app->textureRegistry;
+	registry.duplicates++;
+	registry.savedBytes += TextureBytes(tex);
+}
+
+bool DetachTextureContent(App* app, u32 texIdx)
+{
+	TextureRegistry& registry = app->textureRegistry;
+	Texture& tex = app->textures[texIdx];
+
+	if (tex.contentOwner != texIdx)
+	{
+		registry.duplicates--;
+		registry.savedBytes -= TextureBytes(tex);
+		tex.contentOwner = texIdx;
+		tex.handle = 0;
+		return true;
+	}
+
+	//the first alias becomes the owner of the handle and the pixels
+	u32 heirIdx = UINT32_MAX;
+	for (u32 i = 0; i < app->textures.size(); ++i)
+	{
+		if (i == texIdx || app->textures[i].contentOwner != texIdx)
+			continue;
+		if (heirIdx == UINT32_MAX)
+		{
+			heirIdx = i;
+			registry.duplicates--;
+			registry.savedBytes -= TextureBytes(app->textures[i]);
+		}
+		app->textures[i].contentOwner = heirIdx;
+	}
+
+	if (heirIdx == UINT32_MAX)
+		return false;
+
+	RegisterTextureContent(app, heirIdx);
+	tex.handle = 0;
+	return true;
+}
@@ -0,0 +1,26 @@
+//
+// texture_registry.h: Lookup of the loaded textures by path, and by the hash of their decoded
+// pixels. Two files with the same pixels end up as one GL texture and one material table layer, the
+// later one keeps its own index and shares the handle of the first (its content owner).
+//
+#pragma once
+
+#include "engine.h"
+
+#define TEXTURE_REGISTRY_CAPACITY 2048 // initial slots of each index, a power of two over 2 * MAXTEXTURES
+
+// the compression and internal format are part of it, the same pixels in another format are another texture
+u64 HashTextureContent(const Image& image, TextureCompression compression, GLenum internalFormat);
+
+// UINT32_MAX when the path isn't loaded with that compression
+u32 FindTexturePath(App* app, const char* filepath, TextureCompression compression);
+void RegisterTexturePath(App* app, u32 texIdx);
+
+// the texture owning those pixels, UINT32_MAX when none does
+u32 FindTextureContent(App* app, u64 contentHash);
+void RegisterTextureContent(App* app, u32 texIdx);
+// texIdx takes the handle, size and layer of ownerIdx instead of its own
+void ShareTextureContent(App* app, u32 texIdx, u32 ownerIdx);
+// before its pixels change: an alias gets handle 0 to create its own, an owner leaves its handle to
+// its first alias and gets 0. false when the texture shared nothing
+bool DetachTextureContent(App* app, u32 texIdx);
@@ -0,0 +1,244 @@
+#include "texture_streaming.h"
+#include "worker_pool.h"
+#include "texture_registry.h"
+#include "texture_cooking.h"
+#include <string.h>
+
+void InitTextureStreaming(App* app)
+{
+	TextureStreaming& streaming = app->textureStreaming;
+
+	glGenBuffers(TEXTURE_UPLOAD_BUFFERS, streaming.uploadBuffers);
+	for (u32 i = 0; i < TEXTURE_UPLOAD_BUFFERS; ++i)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, streaming.uploadBuffers[i]);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, TEXTURE_UPLOAD_BUFFER_SIZE, NULL, GL_STREAM_DRAW);
+		streaming.uploadBufferSizes[i] = TEXTURE_UPLOAD_BUFFER_SIZE;
+		streaming.uploadFences[i] = 0;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	streaming.nextUploadBuffer = 0;
+	streaming.frameBudget = TEXTURE_UPLOAD_BUDGET;
+}
+
+void ReleaseTextureStreaming(App* app)
+{
+	TextureStreaming& streaming = app->textureStreaming;
+
+	streaming.uploads.insert(streaming.uploads.end(), streaming.decoded.begin(), streaming.decoded.end());
+	streaming.decoded.clear();
+	for (u32 i = 0; i < streaming.uploads.size(); ++i)
+	{
+		if (streaming.uploads[i]->image.pixels)
+			FreeImage(streaming.uploads[i]->image);
+		delete streaming.uploads[i];
+	}
+	streaming.uploads.clear();
+
+	for (u32 i = 0; i < TEXTURE_UPLOAD_BUFFERS; ++i)
+		if (streaming.uploadFences[i])
+			glDeleteSync(streaming.uploadFences[i]);
+	glDeleteBuffers(TEXTURE_UPLOAD_BUFFERS, streaming.uploadBuffers);
+}
+
+u32 LoadTexture2DAsync(App* app, const char* filepath, TextureCompression compression)
+{
+	//without s3tc the colour maps stay RGBA8, the BC4 and BC5 ones are core
+	if (compression == TextureCompression_Color && !app->textureCooking.s3tc)
+		compression = TextureCompression_None;
+
+	u32 loadedIdx = FindTexturePath(app, filepath, compression);
+	if (loadedIdx != UINT32_MAX)
+		return loadedIdx;
+
+	u32 texIdx = app->textures.size();
+	Texture tex = {};
+	tex.filepath = filepath;
+	tex.resident = false;
+	tex.compression = compression;
+	tex.contentOwner = texIdx;
+	app->textures.push_back(tex);
+	RegisterTexturePath(app, texIdx);
+
+	TextureStreaming& streaming = app->textureStreaming;
+	streaming.pending++;
+
+	TextureDecode* decode = new TextureDecode();
+	decode->textureIdx = texIdx;
+	decode->filepath = filepath;
+	decode->compression = compression;
+
+	PushWorkerJob(app->workers, [decode, &streaming]()
+	{
+		//a source that can't be cooked is still tried as a plain image, which logs why
+		bool cooked = false;
+		if (decode->compression != TextureCompression_None)
+		{
+			f64 start = GetPlatformTime();
+			cooked = CookTexture(decode->filepath.c_str(), decode->compression, decode->cooked, decode->cacheHit);
+			decode->cookTime = decode->cacheHit ? 0.0 : GetPlatformTime() - start;
+			decode->contentHash = decode->cooked.contentHash;
+		}
+		if (!cooked)
+		{
+			decode->cooked.data.clear();
+			decode->image = LoadImage(decode->filepath.c_str());
+			if (decode->image.pixels)
+				decode->contentHash = HashTextureContent(decode->image, decode->compression, TextureInternalFormat(decode->image));
+		}
+
+		std::lock_guard<std::mutex> lock(streaming.mutex);
+		streaming.decoded.push_back(decode);
+	});
+
+	return texIdx;
+}
+
+//false while the buffer is still being read by an earlier upload, the frame doesn't wait for it
+static bool UploadBufferReady(TextureStreaming& streaming, u32 bufferIdx)
+{
+	GLsync& fence = streaming.uploadFences[bufferIdx];
+	if (!fence)
+		return true;
+
+	GLenum status = glClientWaitSync(fence, 0, 0);
+	if (status == GL_TIMEOUT_EXPIRED)
+		return false;
+
+	glDeleteSync(fence);
+	fence = 0;
+	return true;
+}
+
+static void UploadTexture(App* app, TextureDecode* decode, u32 bufferIdx)
+{
+	TextureStreaming& streaming = app->textureStreaming;
+	const Image& image = decode->image;
+	const CookedTexture& cooked = decode->cooked;
+	u32 byteCount = cooked.data.empty() ? image.stride * image.size.y : cooked.data.size();
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, streaming.uploadBuffers[bufferIdx]);
+	if (streaming.uploadBufferSizes[bufferIdx] < byteCount)
+	{
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, byteCount, NULL, GL_STREAM_DRAW);
+		streaming.uploadBufferSizes[bufferIdx] = byteCount;
+	}
+
+	void* staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, byteCount, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	memcpy(staging, cooked.data.empty() ? image.pixels : cooked.data.data(), byteCount);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	//with the unpack buffer bound the pixels are an offset into it, the copy happens on the GPU timeline
+	Texture& tex = app->textures[decode->textureIdx];
+	if (cooked.data.empty())
+	{
+		Image staged = image;
+		staged.pixels = NULL;
+		tex.handle = CreateTexture2DFromImage(staged);
+		tex.size = image.size;
+		tex.internalFormat = TextureInternalFormat(image);
+	}
+	else
+	{
+		tex.handle = CreateTexture2DFromCooked(cooked, NULL);
+		tex.size = cooked.size;
+		tex.internalFormat = cooked.internalFormat;
+	}
+	tex.lastWriteTimestamp = GetFileLastWriteTimestamp(tex.filepath.c_str());
+	tex.resident = true;
+	tex.contentHash = decode->contentHash;
+	RegisterTextureContent(app, decode->textureIdx);
+
+	streaming.uploadFences[bufferIdx] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	streaming.frameBytes += byteCount;
+	streaming.totalBytes += byteCount;
+}
+
+void UpdateTextureStreaming(App* app)
+{
+	TextureStreaming& streaming = app->textureStreaming;
+
+	{
+		std::lock_guard<std::mutex> lock(streaming.mutex);
+		streaming.uploads.insert(streaming.uploads.end(), streaming.decoded.begin(), streaming.decoded.end());
+		streaming.decoded.clear();
+	}
+
+	streaming.frameBytes = 0;
+	u32 uploaded = 0;
+	while (!streaming.uploads.empty())
+	{
+		TextureDecode* decode = streaming.uploads.front();
+
+		//LoadImage already logged it, the materials keep the placeholder
+		if (!decode->image.pixels && decode->cooked.data.empty())
+		{
+			streaming.uploads.pop_front();
+			streaming.pending--;
+			streaming.failedCount++;
+			delete decode;
+			continue;
+		}
+
+		//the same pixels as a resident texture take nothing from the budget
+		u32 ownerIdx = FindTextureContent(app, decode->contentHash);
+		if (ownerIdx != UINT32_MAX)
+		{
+			ShareTextureContent(app, decode->textureIdx, ownerIdx);
+			app->textures[decode->textureIdx].lastWriteTimestamp = GetFileLastWriteTimestamp(decode->filepath.c_str());
+			if (decode->image.pixels)
+				FreeImage(decode->image);
+			streaming.uploads.pop_front();
+			streaming.pending--;
+			streaming.residentCount++;
+			streaming.newlyResident++;
+			delete decode;
+			continue;
+		}
+
+		u32 byteCount = decode->cooked.data.empty() ? decode->image.stride * decode->image.size.y : decode->cooked.data.size();
+		if (uploaded > 0 && streaming.frameBytes + byteCount > streaming.frameBudget)
+			break;
+
+		u32 bufferIdx = streaming.nextUploadBuffer;
+		if (!UploadBufferReady(streaming, bufferIdx))
+		{
+			streaming.bufferWaits++;
+			break;
+		}
+
+		UploadTexture(app, decode, bufferIdx);
+		streaming.nextUploadBuffer = (bufferIdx + 1) % TEXTURE_UPLOAD_BUFFERS;
+
+		if (!decode->cooked.data.empty())
+		{
+			TextureCooking& cooking = app->textureCooking;
+			cooking.encoded += decode->cacheHit ? 0 : 1;
+			cooking.cacheHits += decode->cacheHit ? 1 : 0;
+			cooking.encodeTime += decode->cookTime;
+			cooking.cookedBytes += decode->cooked.data.size();
+			cooking.uncompressedBytes += (u64)decode->cooked.size.x * decode->cooked.size.y * 4 * 4 / 3;
+		}
+
+		if (decode->image.pixels)
+			FreeImage(decode->image);
+		streaming.uploads.pop_front();
+		streaming.pending--;
+		streaming.residentCount++;
+		delete decode;
+		uploaded++;
+	}
+
+	//laying the table out copies every layer again, a stream of textures is taken in a few at a time
+	streaming.newlyResident += uploaded;
+	streaming.framesSinceLayout++;
+	if (streaming.newlyResident > 0 && (streaming.pending == 0 || streaming.framesSinceLayout >= TEXTURE_LAYOUT_FRAMES))
+	{
+		app->materialTable.layoutDirty = true;
+		streaming.newlyResident = 0;
+		streaming.framesSinceLayout = 0;
+	}
+}
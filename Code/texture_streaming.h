@@ -0,0 +1,23 @@
+//
+// texture_streaming.h: Textures decoded on the worker pool and uploaded through a ring of pixel
+// unpack buffers, a frame budget of bytes at a time. Until a texture is resident and has its layer in
+// the material table, the materials sample the neutral placeholder of that map instead.
+//
+#pragma once
+
+#include "engine.h"
+
+#define TEXTURE_UPLOAD_BUFFER_SIZE (4 * 1024 * 1024) // initial size of each upload buffer, grown for bigger images
+#define TEXTURE_UPLOAD_BUDGET (8 * 1024 * 1024)      // default bytes uploaded per frame
+#define TEXTURE_LAYOUT_FRAMES 30                     // frames the material table waits to take in more resident textures
+
+void InitTextureStreaming(App* app);
+// the textures the workers decoded or are decoding are dropped, after the worker pool stopped
+void ReleaseTextureStreaming(App* app);
+
+// the index right away, the texture is resident some frames later. A compressed one is cooked on the
+// worker, or read from its cache file, see texture_cooking.h
+u32 LoadTexture2DAsync(App* app, const char* filepath, TextureCompression compression = TextureCompression_None);
+
+// once per frame on the GL thread, uploads what fits in the budget
+void UpdateTextureStreaming(App* app);
@@ -0,0 +1,52 @@
+#include "worker_pool.h"
+
+static void WorkerLoop(WorkerPool* pool)
+{
+	for (;;)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(pool->mutex);
+			pool->wake.wait(lock, [pool] { return pool->stopping || !pool->jobs.empty(); });
+			if (pool->jobs.empty())
+				return;
+
+			job = std::move(pool->jobs.front());
+			pool->jobs.pop_front();
+		}
+		job();
+	}
+}
+
+void StartWorkerPool(WorkerPool& pool)
+{
+	//hardware_concurrency() is 0 when it can't tell
+	u32 cores = std::thread::hardware_concurrency();
+	u32 threadCount = cores > 1 ? cores - 1 : 1;
+
+	pool.stopping = false;
+	for (u32 i = 0; i < threadCount; ++i)
+		pool.threads.push_back(std::thread(WorkerLoop, &pool));
+}
+
+void StopWorkerPool(WorkerPool& pool)
+{
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		pool.stopping = true;
+	}
+	pool.wake.notify_all();
+
+	for (u32 i = 0; i < pool.threads.size(); ++i)
+		pool.threads[i].join();
+	pool.threads.clear();
+}
+
+void PushWorkerJob(WorkerPool& pool, std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		pool.jobs.push_back(std::move(job));
+	}
+	pool.wake.notify_one();
+}
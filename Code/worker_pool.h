@@ -0,0 +1,13 @@
+//
+// worker_pool.h: A few threads taking jobs off one queue, for the CPU side of asset loading. The
+// jobs never touch GL, what they produce is handed back to the main thread to upload.
+//
+#pragma once
+
+#include "engine.h"
+
+// one thread per core, leaving one for the main thread
+void StartWorkerPool(WorkerPool& pool);
+// the jobs already queued still run
+void StopWorkerPool(WorkerPool& pool);
+void PushWorkerJob(WorkerPool& pool, std::function<void()> job);
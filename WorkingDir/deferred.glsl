@@ -1,34 +1,133 @@
 /////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////
-#ifdef DEFERRED_SHADING_RENDER
+#if defined(DEFERRED_SHADING_RENDER) || defined(DEFERRED_CLUSTERED_RESOLVE) || defined(GBUFFER_DEBUG_VIEW)
 
-struct Light
+struct LightData
 {
-unsigned int type;
-vec3 color;
-vec3 direction;
-vec3 position;
+	vec3 position;
+	float radius;
+	vec3 color;
+	uint type;
+	vec3 direction;
+	float Klinear;
+	float Kquadratic;
+	float padding0;
+	float padding1;
+	float padding2;
 };
 
-struct LightConstants
+layout(binding = 2, std430) readonly buffer Lights
+{
+	LightData uLights[];
+};
+
+#if defined(FRAGMENT)
+
+uniform sampler2D uAlbedo;
+uniform sampler2D uNormal;
+uniform sampler2D uPosition;
+uniform sampler2D uSpecular;
+uniform sampler2D uDepth;
+
+//compact layout: RGBA8 albedo with the specular in alpha, octahedral RG16 normals and the
+//position rebuilt from depth, there are no position or specular targets
+uniform bool uCompactGBuffer;
+uniform mat4 uInverseProjection;
+uniform mat4 viewMatrixInv;
+uniform vec2 uScreenSize; // the targets can be larger, see render_target_pool.h
+
+struct GBufferSample
 {
-float Klinear;
-float Kquadratic;
-float useless;
-float uselesss;
+	bool geometry;
+	vec3 position;
+	vec3 normal;
+	vec3 albedo;
+	float specular;
 };
 
+//must match OctEncode in map_calculation.glsl
+vec3 OctDecode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if(n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
+
+GBufferSample ReadGBuffer(vec2 uv)
+{
+	GBufferSample g;
+	vec4 albedo = texture(uAlbedo, uv);
+	g.albedo = albedo.rgb;
+
+	if(uCompactGBuffer)
+	{
+		float depth = texture(uDepth, uv).r;
+		vec4 viewPosition = uInverseProjection * vec4(vec3(gl_FragCoord.xy / uScreenSize, depth) * 2.0 - 1.0, 1.0);
+		g.geometry = depth < 1.0;
+		g.position = (viewMatrixInv * vec4(viewPosition.xyz / viewPosition.w, 1.0)).xyz;
+		g.normal = OctDecode(texture(uNormal, uv).rg * 2.0 - 1.0);
+		g.specular = albedo.a;
+	}
+	else
+	{
+		g.geometry = albedo.a != 0;
+		g.position = texture(uPosition, uv).rgb;
+		g.normal = texture(uNormal, uv).rgb;
+		g.specular = texture(uSpecular, uv).r;
+	}
+	return g;
+}
+
+vec3 ShadeLight(LightData light, vec3 FragPos, vec3 Normal, vec3 Albedo, float Specular, vec3 viewDir)
+{
+	if(light.type == 2)
+		return Albedo*0.1*light.color;
+
+	float Kconstant = 1.0;
+	float Klinear = light.Klinear;// 0.7; (default values)
+	float Kquadratic = light.Kquadratic;// 1.8;
+	float distance = length(light.position - FragPos);
+
+	vec3 lightDir = vec3(0.0);
+
+	if(light.type == 0)
+	{
+		lightDir = normalize(light.direction);
+	}
+	else
+	{
+		lightDir = normalize(light.position - FragPos);
+	}
+
+    // diffuse
+    vec3 diffuse = max(dot(Normal, lightDir), 0.0) * Albedo * light.color;
+    // specular
+    vec3 halfwayDir = normalize(lightDir + viewDir);  
+    float spec = pow(max(dot(Normal, halfwayDir), 0.0), 16.0);
+    vec3 specular = light.color * spec * Specular;
+    // attenuation
+	float attenuation = 1.0;
+
+	if(light.type != 0)
+	    attenuation = 1.0 / (Kconstant + Klinear * distance + Kquadratic * distance * distance);
+
+    diffuse *= attenuation;
+    specular *= attenuation;
+    return diffuse + specular;
+}
+
+#endif
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef DEFERRED_SHADING_RENDER
+
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
 layout(location=0) in vec3 aPosition;
 layout(location=1) in vec2 aTexCoord;
 
-layout(binding = 0, std140) uniform GlobalParams
-{
-	vec3 uCameraPosition;
-	unsigned int uLightCount;
-	Light uLight[16];
-};
 layout(binding = 2, std140) uniform LightParams
 {
 	mat4 model;
@@ -41,97 +140,180 @@ void main()
 {
 	vTexCoord = aTexCoord;
 
-	if(uLight[current_light].type ==0)
+	if(uLights[current_light].type ==0)
 		gl_Position = vec4(aPosition, 1.0);
-	else if(uLight[current_light].type ==1)
+	else if(uLights[current_light].type ==1)
 		gl_Position =  model * vec4(aPosition,1.0);
-	else if( uLight[current_light].type ==2)
+	else if( uLights[current_light].type ==2)
 		gl_Position = vec4(aPosition, 1.0);
 
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
 
-uniform sampler2D uAlbedo;
-uniform sampler2D uNormal;
-uniform sampler2D uPosition;
-uniform sampler2D uSpecular;
+layout(binding = 0, std140) uniform GlobalParams
+{
+	vec3 uCameraPosition;
+};
+
+layout(location = 0) out vec4 oColor;
+
+in vec2 vTexCoord;
+
+uniform int current_light;
+
+void main()
+{
+	
+	vec2 uv = gl_FragCoord.xy/vec2(textureSize(uAlbedo,0));
+
+	GBufferSample g = ReadGBuffer(uv);
+
+	vec3 viewDir = normalize(uCameraPosition-g.position);
+
+	vec3 lighting = ShadeLight(uLights[current_light], g.position, g.normal, g.albedo, g.specular, viewDir);
+
+	if(g.geometry)
+	{
+		oColor = vec4(lighting,1.0);
+	}
+
+}
+
+#endif
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef DEFERRED_CLUSTERED_RESOLVE
+
+// must match LIGHT_CLUSTER_X/Y/Z in engine.h
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location=0) in vec3 aPosition;
+layout(location=1) in vec2 aTexCoord;
+
+out vec2 vTexCoord;
+
+void main()
+{
+	vTexCoord = aTexCoord;
+	gl_Position = vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
 
 layout(binding = 0, std140) uniform GlobalParams
 {
 	vec3 uCameraPosition;
-	unsigned int uLightCount;
-	Light uLight[16];
 };
 
-layout(binding = 3, std140) uniform LightParamsSecond
+layout(binding = 4, std430) readonly buffer ClusterGrid
 {
-	LightConstants uConstants[16];
+	uvec2 uClusterGrid[]; // offset and count into uClusterLightIndices
 };
 
+layout(binding = 5, std430) readonly buffer ClusterLightIndices
+{
+	uint uClusterLightIndices[];
+};
+
+uniform mat4 uViewMatrix;
+uniform vec2 uClusterDepthRange;
+uniform uvec2 uLightCount; // first point light, total lights
+
 layout(location = 0) out vec4 oColor;
 
 in vec2 vTexCoord;
 
-uniform int current_light;
+uint ClusterIndex(vec3 FragPos)
+{
+	float viewDepth = -(uViewMatrix * vec4(FragPos, 1.0)).z;
+	float zNear = uClusterDepthRange.x;
+	float zFar = uClusterDepthRange.y;
+
+	uint slice = uint(clamp(log(viewDepth / zNear) / log(zFar / zNear) * CLUSTER_Z, 0.0, CLUSTER_Z - 1.0));
+	uvec2 tile = min(uvec2(gl_FragCoord.xy / uScreenSize * vec2(CLUSTER_X, CLUSTER_Y)), uvec2(CLUSTER_X - 1, CLUSTER_Y - 1));
+	return tile.x + tile.y * CLUSTER_X + slice * CLUSTER_X * CLUSTER_Y;
+}
 
 void main()
 {
-	
 	vec2 uv = gl_FragCoord.xy/vec2(textureSize(uAlbedo,0));
 
-	vec3 FragPos = texture(uPosition, uv).rgb;
-	vec3 Normal = texture(uNormal, uv).rgb;
-	vec3 Albedo = texture(uAlbedo, uv).rgb;
-	float Specular = texture(uSpecular, uv).r;
+	GBufferSample g = ReadGBuffer(uv);
+	if(!g.geometry)
+		discard;
+
+	vec3 FragPos = g.position;
+	vec3 Normal = g.normal;
+	vec3 Albedo = g.albedo;
+	float Specular = g.specular;
 
-	vec3 lighting = vec3(0.0);
 	vec3 viewDir = normalize(uCameraPosition-FragPos);
 
-	int i = current_light;
+	//directional and ambient lights reach every pixel
+	vec3 lighting = vec3(0.0);
+	for(uint i = 0u; i < uLightCount.x; ++i)
+		lighting += ShadeLight(uLights[i], FragPos, Normal, Albedo, Specular, viewDir);
 
-	float Kconstant = 1.0;
-	float Klinear = uConstants[i].Klinear;// 0.7; (default values)
-	float Kquadratic = uConstants[i].Kquadratic;// 1.8;
-	float distance = length(uLight[i].position - FragPos);
+	uvec2 cluster = uClusterGrid[ClusterIndex(FragPos)];
+	for(uint i = 0u; i < cluster.y; ++i)
+		lighting += ShadeLight(uLights[uClusterLightIndices[cluster.x + i]], FragPos, Normal, Albedo, Specular, viewDir);
 
-	vec3 lightDir = vec3(0.0);
+	oColor = vec4(lighting, 1.0);
+}
 
-	if(uLight[i].type == 0)
-	{
-		lightDir = normalize(uLight[i].direction);
-	}
-	else
-	{
-		lightDir = normalize(uLight[i].position - FragPos);
-	}
+#endif
+#endif
 
-    // diffuse
-    vec3 diffuse = max(dot(Normal, lightDir), 0.0) * Albedo * uLight[i].color;
-    // specular
-    vec3 halfwayDir = normalize(lightDir + viewDir);  
-    float spec = pow(max(dot(Normal, halfwayDir), 0.0), 16.0);
-    vec3 specular = uLight[i].color * spec * Specular;
-    // attenuation
-	float attenuation = 1.0;
+/////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef GBUFFER_DEBUG_VIEW
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
 
-	if(uLight[i].type != 0)
-	    attenuation = 1.0 / (1.0 + Klinear * distance + Kquadratic * distance * distance);
+layout(location=0) in vec3 aPosition;
+layout(location=1) in vec2 aTexCoord;
 
-    diffuse *= attenuation;
-    specular *= attenuation;
-    lighting += diffuse + specular;
+out vec2 vTexCoord;
+
+void main()
+{
+	vTexCoord = aTexCoord;
+	gl_Position = vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+uniform int uDebugView; // albedo, normals, position, specular
+
+layout(location = 0) out vec4 oColor;
+
+in vec2 vTexCoord;
+
+void main()
+{
+	vec2 uv = gl_FragCoord.xy/vec2(textureSize(uAlbedo,0));
 
-	if(texture(uAlbedo, uv).a != 0)
+	GBufferSample g = ReadGBuffer(uv);
+	if(!g.geometry)
 	{
-		oColor = vec4(lighting,1.0);
-		if(uLight[i].type == 2)
-		{
-			oColor = vec4(Albedo*0.1*uLight[i].color, 1.0);
-		}
+		oColor = vec4(0.0);
+		return;
 	}
 
+	if(uDebugView == 0)
+		oColor = vec4(g.albedo, 1.0);
+	else if(uDebugView == 1)
+		oColor = vec4(g.normal, 1.0);
+	else if(uDebugView == 2)
+		oColor = vec4(g.position, 1.0);
+	else
+		oColor = vec4(vec3(g.specular), 1.0);
 }
 
 #endif
-#endif
\ No newline at end of file
+#endif
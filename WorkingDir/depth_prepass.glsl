@@ -0,0 +1,37 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef DEPTH_PREPASS
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location=0) in vec3 aPosition;
+layout(location=5) in uint aDrawIdx;
+
+struct DrawData
+{
+	mat4 world;
+	mat4 worldViewProjection;
+	uint materialIdx;
+};
+
+layout(binding = 1, std430) readonly buffer Draws
+{
+	DrawData uDraws[];
+};
+
+//GL_EQUAL in the main pass needs the same depth the shading programs rasterize
+invariant gl_Position;
+
+void main()
+{
+	gl_Position = uDraws[aDrawIdx].worldViewProjection * vec4(aPosition,1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+void main()
+{
+}
+
+#endif
+#endif
@@ -0,0 +1,56 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Hi-Z depth pyramid compute passes, see depth_pyramid.cpp
+
+// must match DEPTH_PYRAMID_GROUP_SIZE and the image units in depth_pyramid.h
+
+#define GROUP_SIZE 8
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef DEPTH_PYRAMID_COPY
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = GROUP_SIZE, local_size_y = GROUP_SIZE) in;
+
+uniform sampler2D uDepth;
+layout(binding = 1, r32f) writeonly uniform image2D uDestination;
+
+void main()
+{
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	if (any(greaterThanEqual(texel, imageSize(uDestination))))
+		return;
+
+	imageStore(uDestination, texel, vec4(texelFetch(uDepth, texel, 0).r));
+}
+
+#endif
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef DEPTH_PYRAMID_REDUCE
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = GROUP_SIZE, local_size_y = GROUP_SIZE) in;
+
+layout(binding = 0, r32f) readonly uniform image2D uSource;
+layout(binding = 1, r32f) writeonly uniform image2D uDestination;
+
+//the closest of the 2x2 texels of the level above
+void main()
+{
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	if (any(greaterThanEqual(texel, imageSize(uDestination))))
+		return;
+
+	ivec2 source = texel * 2;
+	float closest = min(min(imageLoad(uSource, source).r, imageLoad(uSource, source + ivec2(1, 0)).r),
+	                    min(imageLoad(uSource, source + ivec2(0, 1)).r, imageLoad(uSource, source + ivec2(1, 1)).r));
+
+	imageStore(uDestination, texel, vec4(closest));
+}
+
+#endif
+#endif
@@ -1,20 +1,19 @@
-#ifdef FORWARD_SHADING_RENDER
+//Forward+ permutation, same shader with the lights culled per screen tile
+#ifdef FORWARD_PLUS_RENDER
+#define FORWARD_SHADING_RENDER
+#define TILED_LIGHTS
+#endif
 
-struct Light
-{
-unsigned int type;
-vec3 color;
-vec3 direction;
-vec3 position;
-};
+//pre-pass of the height mapped materials, the same depth the shading permutations test GL_EQUAL against
+#ifdef FORWARD_SHADING_DEPTH
+#define FORWARD_SHADING_RENDER
+#define DEPTH_ONLY
+#endif
 
-struct LightConstants
-{
-float Klinear;
-float Kquadratic;
-float useless;
-float uselesss;
-};
+//the engine adds FEATURE_NORMAL_MAP, FEATURE_HEIGHT_MAP and FEATURE_SPECULAR_MAP for the material of
+//the draw (see program_permutations.h), the maps a material lacks cost no branches or samples
+
+#ifdef FORWARD_SHADING_RENDER
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
@@ -24,20 +23,27 @@ layout(location=2) in vec2 aTexCoord;
 
 layout(location=3) in vec3 tangent;
 layout(location=4) in vec3 bitangent;
+layout(location=5) in uint aDrawIdx;
 
 layout(binding = 0, std140) uniform GlobalParams
 {
 	vec3 uCameraPosition;
-	unsigned int uLightCount;
-	Light uLight[16];
 };
 
-layout(binding = 1, std140) uniform LocalParams
+struct DrawData
+{
+	mat4 world;
+	mat4 worldViewProjection;
+	uint materialIdx;
+};
+
+layout(binding = 1, std430) readonly buffer Draws
 {
-	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectionMatrix;
+	DrawData uDraws[];
 };
 
+flat out uint vDrawIdx;
+
 out vec2 vTexCoord;
 out vec3 vPosition;
 out vec3 vNormal;
@@ -51,8 +57,14 @@ out Data
 } VSOut;
 out vec3 aPos;
 
+//the pre-pass is drawn with other programs, the depth must come out bit for bit the same
+invariant gl_Position;
+
 void main()
 {
+	mat4 uWorldMatrix = uDraws[aDrawIdx].world;
+	mat4 uWorldViewProjectionMatrix = uDraws[aDrawIdx].worldViewProjection;
+	vDrawIdx = aDrawIdx;
 	
 	VSOut.tangentLocalspace = tangent;
 	VSOut.bitangentLocalspace = bitangent;
@@ -76,35 +88,120 @@ in vec3 vPosition;
 in vec3 vNormal;
 in vec3 vViewDir;
 
-uniform sampler2D uTexture;
-uniform sampler2D uNormalMap;
-uniform sampler2D uDepthMap;
-uniform sampler2D uSpecularMap;
+struct MaterialData
+{
+	vec4 albedoSpecular;
+	float bumpStrength;
+	float normalsStrength;
+	uint features;
+	uint padding;
+	ivec2 albedoTexture;
+	ivec2 normalsTexture;
+	ivec2 bumpTexture;
+	ivec2 specularTexture;
+};
 
-uniform float specular;
+layout(binding = 0, std430) readonly buffer Materials
+{
+	MaterialData uMaterials[];
+};
+
+uniform sampler2DArray uTextureBuckets[8];
+
+//x is the bucket, y the layer inside it
+//the bucket comes from the draw id of a multi-draw, so it isn't dynamically uniform:
+//every case indexes the sampler array with a constant, and the gradients are taken
+//before branching since the cases aren't in uniform control flow either
+vec4 SampleMaterialTexture(ivec2 location, vec2 uv)
+{
+	vec3 coords = vec3(uv, location.y);
+	vec2 dx = dFdx(uv);
+	vec2 dy = dFdy(uv);
+	switch (location.x)
+	{
+	case 0: return textureGrad(uTextureBuckets[0], coords, dx, dy);
+	case 1: return textureGrad(uTextureBuckets[1], coords, dx, dy);
+	case 2: return textureGrad(uTextureBuckets[2], coords, dx, dy);
+	case 3: return textureGrad(uTextureBuckets[3], coords, dx, dy);
+	case 4: return textureGrad(uTextureBuckets[4], coords, dx, dy);
+	case 5: return textureGrad(uTextureBuckets[5], coords, dx, dy);
+	case 6: return textureGrad(uTextureBuckets[6], coords, dx, dy);
+	default: return textureGrad(uTextureBuckets[7], coords, dx, dy);
+	}
+}
+
+//the normal maps keep x and y only (BC5), z is rebuilt from them
+vec3 SampleMaterialNormal(ivec2 location, vec2 uv)
+{
+	vec2 xy = SampleMaterialTexture(location, uv).xy * 2.0 - 1.0;
+	return vec3(xy, sqrt(max(1.0 - dot(xy, xy), 0.0)));
+}
 
 layout(binding = 0, std140) uniform GlobalParams
 {
 	vec3 uCameraPosition;
-	unsigned int uLightCount;
-	Light uLight[16];
 };
 
-layout(binding = 1, std140) uniform LocalParams
+struct DrawData
+{
+	mat4 world;
+	mat4 worldViewProjection;
+	uint materialIdx;
+};
+
+layout(binding = 1, std430) readonly buffer Draws
+{
+	DrawData uDraws[];
+};
+
+flat in uint vDrawIdx;
+
+mat4 uWorldMatrix;
+mat4 uWorldViewProjectionMatrix;
+
+struct LightData
+{
+	vec3 position;
+	float radius;
+	vec3 color;
+	uint type;
+	vec3 direction;
+	float Klinear;
+	float Kquadratic;
+	float padding0;
+	float padding1;
+	float padding2;
+};
+
+layout(binding = 2, std430) readonly buffer Lights
 {
-	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectionMatrix;
+	LightData uLights[];
 };
 
-layout(binding = 3, std140) uniform LightParamsSecond
+uniform uvec2 uLightCount; // first point light, total lights
+
+#ifdef TILED_LIGHTS
+
+#define TILE_SIZE 16u // LIGHT_TILE_SIZE
+
+layout(binding = 4, std430) readonly buffer TileGrid
 {
-	LightConstants uConstants[16];
+	uvec2 uTileGrid[]; // offset and count into uTileLightIndices
 };
 
+layout(binding = 5, std430) readonly buffer TileLightIndices
+{
+	uint uTileLightIndices[];
+};
+
+uniform vec2 uScreenSize;
+
+#endif
+
 float depthmodifier = 0.0;
-uniform float depthStrength;
-uniform float normalStrength;
-vec3 newpos;
+float depthStrength;
+vec3 newpos = vec3(0.0);
+ivec2 depthMap;
 
 //function based on the learnopengl tutorial: https://learnopengl.com/Advanced-Lighting/Parallax-Mapping
 vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
@@ -121,14 +218,14 @@ vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
     vec2 deltaTexCoords = P / numLayers;
 
 	vec2  currentTexCoords     = texCoords;
-	float currentDepthMapValue = texture(uDepthMap, currentTexCoords).r;
+	float currentDepthMapValue = SampleMaterialTexture(depthMap, currentTexCoords).r;
   
 	while(currentLayerDepth < currentDepthMapValue)
 	{
 		// shift texture coordinates along direction of P
 		currentTexCoords -= deltaTexCoords;
 		// get depthmap value at current texture coordinates
-		currentDepthMapValue = texture(uDepthMap, currentTexCoords).r;  
+		currentDepthMapValue = SampleMaterialTexture(depthMap, currentTexCoords).r;  
 		// get depth of next layer
 		currentLayerDepth += layerDepth;  
 	}
@@ -139,7 +236,7 @@ vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
 
 	// get depth after and before collision for linear interpolation
 	float afterDepth  = currentDepthMapValue - currentLayerDepth;
-	float beforeDepth = texture(uDepthMap, prevTexCoords).r - currentLayerDepth + layerDepth;
+	float beforeDepth = SampleMaterialTexture(depthMap, prevTexCoords).r - currentLayerDepth + layerDepth;
  
 	// interpolation of texture coordinates
 	float weight = afterDepth / (afterDepth - beforeDepth);
@@ -148,13 +245,51 @@ vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
 	//calculating the vector that will be added to the depth
 	vec3 normview = normalize(uCameraPosition - vPosition);
 
-	float d = (texture(uDepthMap, finalTexCoords).r) / (normview.y);
+	float d = (SampleMaterialTexture(depthMap, finalTexCoords).r) / (normview.y);
 
 	newpos = normview*d*depthStrength*40;
 
 	return finalTexCoords;
 } 
 
+vec3 ShadeLight(LightData light, vec3 albedo, vec3 norm, vec3 viewDir, float realspecular)
+{
+	if(light.type == 2)
+		return albedo*0.1*light.color;
+
+	vec3 lightDir = vec3(0.0);
+
+	if(light.type == 0)
+	{
+		lightDir = normalize(light.direction);
+	}
+	else
+	{
+		lightDir = normalize(light.position - vPosition);
+	}
+
+	float Kconstant = 1.0;
+	float Klinear = light.Klinear;// 0.7;
+	float Kquadratic = light.Kquadratic;// 1.8;
+	float distance = length(light.position - vPosition);
+
+	// diffuse
+	vec3 diffuse = max(dot(norm, lightDir), 0.0) * albedo * light.color;
+	// specular
+	vec3 halfwayDir = normalize(lightDir + viewDir);  
+	float spec = pow(max(dot(norm, halfwayDir), 0.0), 16.0);
+	vec3 specular = light.color * spec * realspecular;
+	// attenuation
+	float attenuation = 1.0;
+
+	if(light.type != 0)
+		attenuation = 1.0 / (Kconstant + Klinear * distance + Kquadratic * distance * distance);
+
+	diffuse *= attenuation;
+	specular *= attenuation;
+	return diffuse + specular;
+}
+
 layout(location = 0) out vec4 oColor;
 layout(location = 1) out vec4 oNormals;
 layout(location = 2) out vec4 oPosition;
@@ -168,18 +303,25 @@ in Data{
 } FSIn;
 
 
-uniform int normalMapExists;
-uniform int depthMapExists;
-uniform int specularMapExists;
-
 uniform mat4 cameraProj;
 
 in vec3 aPos;
 
-layout (depth_any) out float gl_FragDepth;
+#ifdef FEATURE_HEIGHT_MAP
+//parallax only pushes the surface away, fragments behind the depth buffer are still rejected early
+layout (depth_greater) out float gl_FragDepth;
+#endif
 
 void main()
 {
+	DrawData draw = uDraws[vDrawIdx];
+	uWorldMatrix = draw.world;
+	uWorldViewProjectionMatrix = draw.worldViewProjection;
+
+	MaterialData material = uMaterials[draw.materialIdx];
+	depthStrength = material.bumpStrength;
+	depthMap = material.bumpTexture;
+
 	vec3 T = normalize(vec3(uWorldMatrix*vec4(FSIn.tangentLocalspace,0.0)));
 	vec3 B = normalize(vec3(uWorldMatrix*vec4(FSIn.bitangentLocalspace,0.0)));
 	vec3 N = normalize(vec3(uWorldMatrix*vec4(FSIn.normalLocalspace,0.0)));
@@ -191,91 +333,60 @@ void main()
 	vec3 tanviewposition = uCameraPosition*TBN;
 
 	vec3 depthViewDir = normalize(tanviewposition-tanvposition);
-	vec2 newtexCoords = vec2(0.0);
-	if(depthMapExists == 1)
-	{
-		newtexCoords = ParallaxMapping(vTexCoord,depthViewDir);
-	}
-	else
-	{
-		newtexCoords = vTexCoord;
-	}	
+	vec2 newtexCoords = vTexCoord;
+#ifdef FEATURE_HEIGHT_MAP
+	newtexCoords = ParallaxMapping(vTexCoord,depthViewDir);
+
+	vec4 v_clip_coord = uWorldViewProjectionMatrix * vec4(aPos-newpos, 1.0);
+	float f_ndc_depth = v_clip_coord.z / v_clip_coord.w;
+	//never in front of the rasterized depth, depth_greater relies on it
+	gl_FragDepth = max((1.0 - 0.0) * 0.5 * f_ndc_depth + (1.0 + 0.0) * 0.5, gl_FragCoord.z);
+#endif
 
-	vec3 tangentSpaceNormal = texture(uNormalMap,newtexCoords).xyz;
-	tangentSpaceNormal = tangentSpaceNormal * 2.0 - 1.0;
-	tangentSpaceNormal.xy *= normalStrength;
+#ifdef DEPTH_ONLY
+	return;
+#endif
+
+#ifdef FEATURE_NORMAL_MAP
+	vec3 tangentSpaceNormal = SampleMaterialNormal(material.normalsTexture,newtexCoords);
+	tangentSpaceNormal.xy *= material.normalsStrength;
 
 	vec3 localSpaceNormal = TBN*tangentSpaceNormal;
 	vec3 viewSpaceNormal = normalize(uWorldViewProjectionMatrix* vec4(localSpaceNormal,0.0)).xyz;
-	
-	vec3 norm = vec3(0.0);
-	if(normalMapExists == 1)
-		norm = normalize(viewSpaceNormal);
-	else
-		norm = normalize(vNormal);
+	vec3 norm = normalize(viewSpaceNormal);
+#else
+	vec3 norm = normalize(vNormal);
+#endif
 
 	oPosition = vec4(vPosition,1.0f);
 	oNormals = vec4(norm,1.0f);
-	oSpecular = vec4(vec3(specular),1.0f);
+	oSpecular = vec4(vec3(material.albedoSpecular.w),1.0f);
 
-	float realspecular =0.0;
-	if(specularMapExists == 1)
-	{
-		realspecular = texture(uSpecularMap,newtexCoords).r;
-	}
-	else
-	{
-		realspecular = specular;
-	}
+#ifdef FEATURE_SPECULAR_MAP
+	float realspecular = SampleMaterialTexture(material.specularTexture,newtexCoords).r;
+#else
+	float realspecular = material.albedoSpecular.w;
+#endif
+
+	vec3 albedo = SampleMaterialTexture(material.albedoTexture, newtexCoords).xyz;
 
 	vec3 color = vec3(0.0);
-	
-	for ( int i = 0; i< uLightCount; ++i)
-	{
 
-		vec3 lightDir = vec3(0.0);
-	
-		if(uLight[i].type == 0)
-		{
-			lightDir = normalize(uLight[i].direction);
-		}
-		else if(uLight[i].type == 1)
-		{
-			lightDir = normalize(uLight[i].position - vPosition);
-		}
-		else if(uLight[i].type == 2)
-		{
-			color+= texture(uTexture, newtexCoords).xyz*0.1*uLight[i].color;
-		}
-
-		float Kconstant = 1.0;
-		float Klinear = uConstants[i].Klinear;// 0.7;
-		float Kquadratic = uConstants[i].Kquadratic;// 1.8;
-		float distance = length(uLight[i].position - vPosition);
-
-		// diffuse
-		vec3 diffuse = max(dot(norm, lightDir), 0.0) * texture(uTexture, newtexCoords).xyz * uLight[i].color;
-		// specular
-		vec3 halfwayDir = normalize(lightDir + viewDir);  
-		float spec = pow(max(dot(norm, halfwayDir), 0.0), 16.0);
-		vec3 specular = uLight[i].color * spec * realspecular;
-		// attenuation
-		float attenuation = 1.0;
-
-		if(uLight[i].type != 0)
-			attenuation = 1.0 / (1.0 + Klinear * distance + Kquadratic * distance * distance);
-
-		diffuse *= attenuation;
-		specular *= attenuation;
-		
-		if(uLight[i].type != 2)
-			color += diffuse + specular;
-
-	};
+	//directional and ambient lights reach every pixel
+	for(uint i = 0u; i < uLightCount.x; ++i)
+		color += ShadeLight(uLights[i], albedo, norm, viewDir, realspecular);
 
-	vec4 v_clip_coord = uWorldViewProjectionMatrix * vec4(aPos-newpos, 1.0);
-	float f_ndc_depth = v_clip_coord.z / v_clip_coord.w;
-	gl_FragDepth = (1.0 - 0.0) * 0.5 * f_ndc_depth + (1.0 + 0.0) * 0.5;
+#ifdef TILED_LIGHTS
+	uvec2 tile = uvec2(gl_FragCoord.xy) / TILE_SIZE;
+	uint tilesX = (uint(uScreenSize.x) + TILE_SIZE - 1u) / TILE_SIZE;
+	uvec2 tileLights = uTileGrid[tile.x + tile.y * tilesX];
+
+	for(uint i = 0u; i < tileLights.y; ++i)
+		color += ShadeLight(uLights[uTileLightIndices[tileLights.x + i]], albedo, norm, viewDir, realspecular);
+#else
+	for(uint i = uLightCount.x; i < uLightCount.y; ++i)
+		color += ShadeLight(uLights[i], albedo, norm, viewDir, realspecular);
+#endif
 
 	oColor =vec4(color,1.0f);
 }
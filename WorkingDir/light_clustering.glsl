@@ -0,0 +1,351 @@
+/////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Light culling compute passes, see light_clustering.cpp
+
+// Froxel grid of the clustered deferred lighting, must match LIGHT_CLUSTER_X/Y/Z in engine.h
+
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+
+struct ClusterBounds
+{
+	vec4 minPoint;
+	vec4 maxPoint;
+};
+
+struct LightData
+{
+	vec3 position;
+	float radius;
+	vec3 color;
+	uint type;
+	vec3 direction;
+	float Klinear;
+	float Kquadratic;
+	float padding0;
+	float padding1;
+	float padding2;
+};
+
+#if defined(LIGHT_CLUSTER_CULL) || defined(LIGHT_TILE_CULL)
+layout(binding = 2, std430) readonly buffer Lights
+{
+	LightData uLights[];
+};
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef LIGHT_CLUSTER_BOUNDS
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = CLUSTER_X, local_size_y = CLUSTER_Y, local_size_z = 1) in;
+
+layout(binding = 3, std430) writeonly buffer ClusterBoundsBuffer
+{
+	ClusterBounds uClusterBounds[];
+};
+
+uniform mat4 uInverseProjection;
+uniform vec2 uClusterDepthRange;
+
+//point of the near plane behind an NDC position, the camera sits at the view space origin
+vec3 NearPlanePoint(vec2 ndc)
+{
+	vec4 point = uInverseProjection * vec4(ndc, -1.0, 1.0);
+	return point.xyz / point.w;
+}
+
+vec3 AtDepth(vec3 rayPoint, float z)
+{
+	return rayPoint * (z / rayPoint.z);
+}
+
+void main()
+{
+	uvec3 cluster = uvec3(gl_LocalInvocationID.xy, gl_WorkGroupID.z);
+	uint clusterIdx = cluster.x + cluster.y * CLUSTER_X + cluster.z * CLUSTER_X * CLUSTER_Y;
+
+	vec2 minNdc = vec2(cluster.xy) / vec2(CLUSTER_X, CLUSTER_Y) * 2.0 - 1.0;
+	vec2 maxNdc = vec2(cluster.xy + 1u) / vec2(CLUSTER_X, CLUSTER_Y) * 2.0 - 1.0;
+
+	//exponential slices, each one covers the same depth ratio
+	float zNear = uClusterDepthRange.x;
+	float zFar = uClusterDepthRange.y;
+	float sliceNear = -zNear * pow(zFar / zNear, float(cluster.z) / CLUSTER_Z);
+	float sliceFar = -zNear * pow(zFar / zNear, float(cluster.z + 1u) / CLUSTER_Z);
+
+	vec3 minPoint = NearPlanePoint(minNdc);
+	vec3 maxPoint = NearPlanePoint(maxNdc);
+
+	vec3 minNear = AtDepth(minPoint, sliceNear);
+	vec3 minFar = AtDepth(minPoint, sliceFar);
+	vec3 maxNear = AtDepth(maxPoint, sliceNear);
+	vec3 maxFar = AtDepth(maxPoint, sliceFar);
+
+	uClusterBounds[clusterIdx].minPoint = vec4(min(min(minNear, minFar), min(maxNear, maxFar)), 0.0);
+	uClusterBounds[clusterIdx].maxPoint = vec4(max(max(minNear, minFar), max(maxNear, maxFar)), 0.0);
+}
+
+#endif
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef LIGHT_CLUSTER_CULL
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+#define GROUP_SIZE 128 // CLUSTER_CULL_GROUP_SIZE
+
+layout(local_size_x = GROUP_SIZE) in;
+
+layout(binding = 3, std430) readonly buffer ClusterBoundsBuffer
+{
+	ClusterBounds uClusterBounds[];
+};
+
+layout(binding = 4, std430) writeonly buffer ClusterGrid
+{
+	uvec2 uClusterGrid[]; // offset and count into uClusterLightIndices
+};
+
+layout(binding = 5, std430) writeonly buffer ClusterLightIndices
+{
+	uint uClusterLightIndices[];
+};
+
+layout(binding = 6, std430) buffer ClusterCounter
+{
+	uint uIndexCount;
+};
+
+uniform mat4 uViewMatrix;
+uniform uvec2 uLightCount; // first point light, total lights
+
+//view space position and radius of a batch of point lights, shared by the whole group
+shared vec4 sharedLights[GROUP_SIZE];
+
+bool SphereTouchesBox(vec4 sphere, vec3 boxMin, vec3 boxMax)
+{
+	vec3 closest = clamp(sphere.xyz, boxMin, boxMax);
+	vec3 d = closest - sphere.xyz;
+	return dot(d, d) <= sphere.w * sphere.w;
+}
+
+void main()
+{
+	uint clusterIdx = gl_GlobalInvocationID.x;
+	bool active = clusterIdx < CLUSTER_X * CLUSTER_Y * CLUSTER_Z;
+
+	vec3 boxMin = vec3(0.0);
+	vec3 boxMax = vec3(0.0);
+	if (active)
+	{
+		boxMin = uClusterBounds[clusterIdx].minPoint.xyz;
+		boxMax = uClusterBounds[clusterIdx].maxPoint.xyz;
+	}
+
+	//first walk counts the lights to reserve room in the list, the second one writes them
+	uint count = 0u;
+	uint offset = 0u;
+	uint writable = 0u;
+
+	for (int walk = 0; walk < 2; ++walk)
+	{
+		uint written = 0u;
+
+		for (uint batch = uLightCount.x; batch < uLightCount.y; batch += GROUP_SIZE)
+		{
+			uint lightIdx = batch + gl_LocalInvocationIndex;
+			if (lightIdx < uLightCount.y)
+			{
+				vec4 viewPosition = uViewMatrix * vec4(uLights[lightIdx].position, 1.0);
+				sharedLights[gl_LocalInvocationIndex] = vec4(viewPosition.xyz, uLights[lightIdx].radius);
+			}
+			barrier();
+
+			uint batchCount = min(uint(GROUP_SIZE), uLightCount.y - batch);
+			for (uint j = 0u; active && j < batchCount; ++j)
+			{
+				if (!SphereTouchesBox(sharedLights[j], boxMin, boxMax))
+					continue;
+
+				if (walk == 0)
+					count++;
+				else if (written < writable)
+					uClusterLightIndices[offset + written++] = batch + j;
+			}
+			barrier();
+		}
+
+		if (walk == 0 && active)
+		{
+			//the CPU grows the list when the total doesn't fit, until then this cluster gets what is left
+			offset = atomicAdd(uIndexCount, count);
+			uint capacity = uint(uClusterLightIndices.length());
+			writable = offset < capacity ? min(count, capacity - offset) : 0u;
+		}
+	}
+
+	if (active)
+		uClusterGrid[clusterIdx] = uvec2(offset, writable);
+}
+
+#endif
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef LIGHT_TILE_CULL
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+#define TILE_SIZE 16         // LIGHT_TILE_SIZE
+#define TILE_MAX_LIGHTS 512  // lights one tile can keep
+#define HEATMAP_MAX_LIGHTS 32.0
+
+layout(local_size_x = TILE_SIZE, local_size_y = TILE_SIZE) in;
+
+layout(binding = 4, std430) writeonly buffer TileGrid
+{
+	uvec2 uTileGrid[]; // offset and count into uTileLightIndices
+};
+
+layout(binding = 5, std430) writeonly buffer TileLightIndices
+{
+	uint uTileLightIndices[];
+};
+
+layout(binding = 6, std430) buffer TileCounter
+{
+	uint uIndexCount;
+	uint uTruncatedTiles; // tiles that touched more than TILE_MAX_LIGHTS, read back for the debug UI
+};
+
+layout(binding = 0, rgba8) writeonly uniform image2D uHeatmap;
+
+uniform sampler2D uDepth;
+uniform mat4 uViewMatrix;
+uniform mat4 uInverseProjection;
+uniform vec2 uScreenSize;
+uniform uvec2 uLightCount; // first point light, total lights
+
+shared uint minDepthBits;
+shared uint maxDepthBits;
+shared uint tileLightCount;
+shared uint tileOffset;
+shared uint tileWritable;
+shared uint tileLights[TILE_MAX_LIGHTS];
+
+vec3 NearPlanePoint(vec2 pixel)
+{
+	vec4 point = uInverseProjection * vec4(pixel / uScreenSize * 2.0 - 1.0, -1.0, 1.0);
+	return point.xyz / point.w;
+}
+
+float ViewDepth(float depth)
+{
+	vec4 point = uInverseProjection * vec4(0.0, 0.0, depth * 2.0 - 1.0, 1.0);
+	return -point.z / point.w;
+}
+
+vec3 HeatmapColor(uint count)
+{
+	if (count == 0u)
+		return vec3(0.0);
+
+	float heat = clamp(float(count) / HEATMAP_MAX_LIGHTS, 0.0, 1.0);
+	return heat < 0.5 ? mix(vec3(0.0, 0.0, 1.0), vec3(0.0, 1.0, 0.0), heat * 2.0)
+	                  : mix(vec3(0.0, 1.0, 0.0), vec3(1.0, 0.0, 0.0), heat * 2.0 - 1.0);
+}
+
+void main()
+{
+	uint threadIdx = gl_LocalInvocationIndex;
+	uvec2 tile = gl_WorkGroupID.xy;
+	uint tileIdx = tile.x + tile.y * gl_NumWorkGroups.x;
+
+	if (threadIdx == 0u)
+	{
+		minDepthBits = 0xFFFFFFFFu;
+		maxDepthBits = 0u;
+		tileLightCount = 0u;
+	}
+	barrier();
+
+	//depth range of the tile, positive floats keep their order as uints. The cleared depth is skipped
+	ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+	if (pixel.x < int(uScreenSize.x) && pixel.y < int(uScreenSize.y))
+	{
+		float depth = texelFetch(uDepth, pixel, 0).r;
+		if (depth < 1.0)
+		{
+			atomicMin(minDepthBits, floatBitsToUint(depth));
+			atomicMax(maxDepthBits, floatBitsToUint(depth));
+		}
+	}
+	barrier();
+
+	bool hasGeometry = minDepthBits <= maxDepthBits;
+	float nearDepth = hasGeometry ? ViewDepth(uintBitsToFloat(minDepthBits)) : 0.0;
+	float farDepth = hasGeometry ? ViewDepth(uintBitsToFloat(maxDepthBits)) : 0.0;
+
+	//side planes of the tile go through the camera, their normals point inside
+	vec2 tileMin = vec2(tile * TILE_SIZE);
+	vec2 tileMax = vec2((tile + 1u) * TILE_SIZE);
+	vec3 corner00 = NearPlanePoint(tileMin);
+	vec3 corner10 = NearPlanePoint(vec2(tileMax.x, tileMin.y));
+	vec3 corner01 = NearPlanePoint(vec2(tileMin.x, tileMax.y));
+	vec3 corner11 = NearPlanePoint(tileMax);
+
+	vec3 planes[4];
+	planes[0] = normalize(cross(corner00, corner01)); // left
+	planes[1] = normalize(cross(corner11, corner10)); // right
+	planes[2] = normalize(cross(corner10, corner00)); // bottom
+	planes[3] = normalize(cross(corner01, corner11)); // top
+
+	for (uint lightIdx = uLightCount.x + threadIdx; hasGeometry && lightIdx < uLightCount.y; lightIdx += TILE_SIZE * TILE_SIZE)
+	{
+		vec3 center = (uViewMatrix * vec4(uLights[lightIdx].position, 1.0)).xyz;
+		float radius = uLights[lightIdx].radius;
+
+		if (-center.z + radius < nearDepth || -center.z - radius > farDepth)
+			continue;
+
+		bool inside = true;
+		for (int p = 0; p < 4; ++p)
+			inside = inside && dot(planes[p], center) >= -radius;
+
+		if (inside)
+		{
+			uint slot = atomicAdd(tileLightCount, 1u);
+			if (slot < TILE_MAX_LIGHTS)
+				tileLights[slot] = lightIdx;
+		}
+	}
+	barrier();
+
+	//the CPU grows the list when the total doesn't fit, until then this tile gets what is left
+	if (threadIdx == 0u)
+	{
+		uint count = min(tileLightCount, uint(TILE_MAX_LIGHTS));
+		tileOffset = atomicAdd(uIndexCount, count);
+		uint capacity = uint(uTileLightIndices.length());
+		tileWritable = tileOffset < capacity ? min(count, capacity - tileOffset) : 0u;
+
+		//the lights past TILE_MAX_LIGHTS are lost, the tile is counted and shows magenta in the heatmap
+		bool truncated = tileLightCount > uint(TILE_MAX_LIGHTS);
+		if (truncated)
+			atomicAdd(uTruncatedTiles, 1u);
+
+		uTileGrid[tileIdx] = uvec2(tileOffset, tileWritable);
+		imageStore(uHeatmap, ivec2(tile), vec4(truncated ? vec3(1.0, 0.0, 1.0) : HeatmapColor(tileLightCount), 1.0));
+	}
+	barrier();
+
+	for (uint i = threadIdx; i < tileWritable; i += TILE_SIZE * TILE_SIZE)
+		uTileLightIndices[tileOffset + i] = tileLights[i];
+}
+
+#endif
+#endif
@@ -1,3 +1,12 @@
+//pre-pass of the height mapped materials, the same depth the G-buffer pass tests GL_EQUAL against
+#ifdef MAP_CALCULATION_DEPTH
+#define MAP_CALCULATION_SHADER
+#define DEPTH_ONLY
+#endif
+
+//the engine adds FEATURE_NORMAL_MAP, FEATURE_HEIGHT_MAP and FEATURE_SPECULAR_MAP for the material of
+//the draw, see program_permutations.h
+
 #ifdef MAP_CALCULATION_SHADER
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
@@ -8,13 +17,22 @@ layout(location=2) in vec2 aTexCoord;
 
 layout(location=3) in vec3 tangent;
 layout(location=4) in vec3 bitangent;
+layout(location=5) in uint aDrawIdx;
+
+struct DrawData
+{
+	mat4 world;
+	mat4 worldViewProjection;
+	uint materialIdx;
+};
 
-layout(binding = 1, std140) uniform LocalParams
+layout(binding = 1, std430) readonly buffer Draws
 {
-	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectionMatrix;
+	DrawData uDraws[];
 };
 
+flat out uint vDrawIdx;
+
 out vec2 vTexCoord;
 out vec3 vPosition;
 out vec3 vNormal;
@@ -27,8 +45,14 @@ out Data
 	vec3 normalLocalspace;
 } VSOut;
 
+//the pre-pass is drawn with other programs, the depth must come out bit for bit the same
+invariant gl_Position;
+
 void main()
 {
+	mat4 uWorldMatrix = uDraws[aDrawIdx].world;
+	mat4 uWorldViewProjectionMatrix = uDraws[aDrawIdx].worldViewProjection;
+	vDrawIdx = aDrawIdx;
 	vTexCoord = aTexCoord;
 
 	vPosition = vec3( uWorldMatrix * vec4(aPosition,1.0));
@@ -45,29 +69,61 @@ void main()
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
 
-struct Light
-{
-unsigned int type;
-vec3 color;
-vec3 direction;
-vec3 position;
-};
-
 in vec2 vTexCoord;
 in vec3 vPosition;
 in vec3 vNormal;
 
-uniform sampler2D uTexture;
-uniform sampler2D uNormalMap;
-uniform sampler2D uDepthMap;
-uniform sampler2D uSpecularMap;
+struct MaterialData
+{
+	vec4 albedoSpecular;
+	float bumpStrength;
+	float normalsStrength;
+	uint features;
+	uint padding;
+	ivec2 albedoTexture;
+	ivec2 normalsTexture;
+	ivec2 bumpTexture;
+	ivec2 specularTexture;
+};
+
+layout(binding = 0, std430) readonly buffer Materials
+{
+	MaterialData uMaterials[];
+};
+
+uniform sampler2DArray uTextureBuckets[8];
 
-uniform float specular;
-uniform int normalMapExists;
-uniform int depthMapExists;
-uniform int specularMapExists;
+//x is the bucket, y the layer inside it
+//the bucket comes from the draw id of a multi-draw, so it isn't dynamically uniform:
+//every case indexes the sampler array with a constant, and the gradients are taken
+//before branching since the cases aren't in uniform control flow either
+vec4 SampleMaterialTexture(ivec2 location, vec2 uv)
+{
+	vec3 coords = vec3(uv, location.y);
+	vec2 dx = dFdx(uv);
+	vec2 dy = dFdy(uv);
+	switch (location.x)
+	{
+	case 0: return textureGrad(uTextureBuckets[0], coords, dx, dy);
+	case 1: return textureGrad(uTextureBuckets[1], coords, dx, dy);
+	case 2: return textureGrad(uTextureBuckets[2], coords, dx, dy);
+	case 3: return textureGrad(uTextureBuckets[3], coords, dx, dy);
+	case 4: return textureGrad(uTextureBuckets[4], coords, dx, dy);
+	case 5: return textureGrad(uTextureBuckets[5], coords, dx, dy);
+	case 6: return textureGrad(uTextureBuckets[6], coords, dx, dy);
+	default: return textureGrad(uTextureBuckets[7], coords, dx, dy);
+	}
+}
 
-uniform float depthStrength;
+//the normal maps keep x and y only (BC5), z is rebuilt from them
+vec3 SampleMaterialNormal(ivec2 location, vec2 uv)
+{
+	vec2 xy = SampleMaterialTexture(location, uv).xy * 2.0 - 1.0;
+	return vec3(xy, sqrt(max(1.0 - dot(xy, xy), 0.0)));
+}
+
+float depthStrength;
+ivec2 depthMap;
 
 in Data{
 	vec3 tangentLocalspace;
@@ -84,22 +140,48 @@ layout(binding = 0, std140) uniform GlobalParams
 {
 	vec3 uCameraPosition;
 	unsigned int uLightCount;
-	Light uLight[16];
 };
 
-layout(binding = 1, std140) uniform LocalParams
+struct DrawData
+{
+	mat4 world;
+	mat4 worldViewProjection;
+	uint materialIdx;
+};
+
+layout(binding = 1, std430) readonly buffer Draws
 {
-	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectionMatrix;
+	DrawData uDraws[];
 };
 
+flat in uint vDrawIdx;
+
+//compact layout: specular in the albedo alpha, octahedral normals and no position or specular targets
+uniform bool uCompactGBuffer;
+
+mat4 uWorldMatrix;
+mat4 uWorldViewProjectionMatrix;
+
 vec3 newpos = vec3(0.0);
 
 in vec3 aPos;
 
+#ifdef FEATURE_HEIGHT_MAP
+//parallax only pushes the surface away, fragments behind the depth buffer are still rejected early
+layout (depth_greater) out float gl_FragDepth;
+#endif
+
+//unit vector to the [-1,1] square, must match OctDecode in deferred.glsl
+vec2 OctEncode(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 wrapped = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return n.z >= 0.0 ? n.xy : wrapped;
+}
+
 vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
 { 
-    /*float height =  texture(uDepthMap, texCoords).r;
+    /*float height =  SampleMaterialTexture(depthMap, texCoords).r;
     vec2 p = viewDir.xy/viewDir.z * (height*0.1);
 	//return vec2(height);
     return texCoords - p;    */
@@ -115,14 +197,14 @@ vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
     vec2 deltaTexCoords = P / numLayers;
 
 	vec2  currentTexCoords     = texCoords;
-	float currentDepthMapValue = texture(uDepthMap, currentTexCoords).r;
+	float currentDepthMapValue = SampleMaterialTexture(depthMap, currentTexCoords).r;
   
 	while(currentLayerDepth < currentDepthMapValue)
 	{
 		// shift texture coordinates along direction of P
 		currentTexCoords -= deltaTexCoords;
 		// get depthmap value at current texture coordinates
-		currentDepthMapValue = texture(uDepthMap, currentTexCoords).r;  
+		currentDepthMapValue = SampleMaterialTexture(depthMap, currentTexCoords).r;  
 		// get depth of next layer
 		currentLayerDepth += layerDepth;  
 	}
@@ -133,7 +215,7 @@ vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
 
 	// get depth after and before collision for linear interpolation
 	float afterDepth  = currentDepthMapValue - currentLayerDepth;
-	float beforeDepth = texture(uDepthMap, prevTexCoords).r - currentLayerDepth + layerDepth;
+	float beforeDepth = SampleMaterialTexture(depthMap, prevTexCoords).r - currentLayerDepth + layerDepth;
  
 	// interpolation of texture coordinates
 	float weight = afterDepth / (afterDepth - beforeDepth);
@@ -142,7 +224,7 @@ vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
 	//calculating the vector that will be added to the depth
 	vec3 normview = normalize(uCameraPosition - vPosition);
 
-	float d = (texture(uDepthMap, finalTexCoords).r) / (normview.y);
+	float d = (SampleMaterialTexture(depthMap, finalTexCoords).r) / (normview.y);
 
 	newpos = normview*d*depthStrength*40;
 
@@ -152,6 +234,13 @@ vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
 
 void main()
 {
+	DrawData draw = uDraws[vDrawIdx];
+	uWorldMatrix = draw.world;
+	uWorldViewProjectionMatrix = draw.worldViewProjection;
+
+	MaterialData material = uMaterials[draw.materialIdx];
+	depthStrength = material.bumpStrength;
+	depthMap = material.bumpTexture;
 
 	vec3 T = normalize(vec3(uWorldMatrix*vec4(FSIn.tangentLocalspace,0.0)));
 	vec3 B = normalize(vec3(uWorldMatrix*vec4(FSIn.bitangentLocalspace,0.0)));
@@ -161,46 +250,48 @@ void main()
 	vec3 tanvposition = vPosition*TBN;
 	vec3 tanviewposition = uCameraPosition*TBN;
 	vec3 depthViewDir = normalize(tanviewposition-tanvposition);
-	vec2 newtexCoords = vec2(0.0);
-	if(depthMapExists == 1)
-	{
-		newtexCoords = ParallaxMapping(vTexCoord,depthViewDir);
-	}
-	else
-	{
-		newtexCoords = vTexCoord;
-	}	
-
-	vec3 tangentSpaceNormal = texture(uNormalMap, newtexCoords).xyz * 2.0 - vec3(1.0);
-	vec3 localSpaceNormal = TBN*tangentSpaceNormal;
-	vec3 viewSpaceNormal = normalize(uWorldViewProjectionMatrix* vec4(localSpaceNormal,0.0)).xyz;
-	
-	oColor = texture(uTexture, newtexCoords);
-
-	vec3 norm = vec3(0.0);
-	if(normalMapExists == 1)
-		norm = normalize(viewSpaceNormal);
-	else
-		norm = normalize(vNormal);
+	vec2 newtexCoords = vTexCoord;
+#ifdef FEATURE_HEIGHT_MAP
+	newtexCoords = ParallaxMapping(vTexCoord,depthViewDir);
 
 	vec4 v_clip_coord = uWorldViewProjectionMatrix * vec4(aPos-newpos, 1.0);
 	float f_ndc_depth = v_clip_coord.z / v_clip_coord.w;
-	gl_FragDepth = (1.0 - 0.0) * 0.5 * f_ndc_depth + (1.0 + 0.0) * 0.5;
+	//never in front of the rasterized depth, depth_greater relies on it
+	gl_FragDepth = max((1.0 - 0.0) * 0.5 * f_ndc_depth + (1.0 + 0.0) * 0.5, gl_FragCoord.z);
+#endif
+
+#ifdef DEPTH_ONLY
+	return;
+#endif
+
+	oColor = SampleMaterialTexture(material.albedoTexture, newtexCoords);
+
+#ifdef FEATURE_NORMAL_MAP
+	vec3 tangentSpaceNormal = SampleMaterialNormal(material.normalsTexture, newtexCoords);
+	vec3 localSpaceNormal = TBN*tangentSpaceNormal;
+	vec3 viewSpaceNormal = normalize(uWorldViewProjectionMatrix* vec4(localSpaceNormal,0.0)).xyz;
+	vec3 norm = normalize(viewSpaceNormal);
+#else
+	vec3 norm = normalize(vNormal);
+#endif
 
 	oPosition = vec4(vPosition+newpos,1.0f);
 	oNormals = vec4(norm,1.0f);
 
-	float realspecular = 0.0;
-	if(specularMapExists == 1)
-	{
-		realspecular = texture(uSpecularMap,newtexCoords).r;
-	}
-	else
-	{
-		realspecular = specular;
-	}
+#ifdef FEATURE_SPECULAR_MAP
+	float realspecular = SampleMaterialTexture(material.specularTexture,newtexCoords).r;
+#else
+	float realspecular = material.albedoSpecular.w;
+#endif
 
 	oSpecular = vec4(vec3(realspecular),1.0f);
+
+	if(uCompactGBuffer)
+	{
+		//geometry is told apart from the background by its depth
+		oColor = vec4(oColor.rgb, realspecular);
+		oNormals = vec4(OctEncode(norm) * 0.5 + 0.5, 0.0, 0.0);
+	}
 }
 
 #endif
@@ -28,19 +28,37 @@ void main()
 
 
 uniform vec2 viewportSize;
+uniform vec2 uRenderTargetScale; // the screen targets are rounded up, only this corner of them is used
+uniform vec2 uReflectionScale;   // same for the reflection and refraction layers, drawn at a fraction of the screen
+uniform vec2 uRefractionScale;
 uniform mat4 modelViewMatrix;
 uniform mat4 viewMatrixInv;
 uniform mat4 projectionMatrixInv;
-uniform sampler2D reflectionMap;
-uniform sampler2D refractionMap;
-uniform sampler2D reflectionDepth;
-uniform sampler2D refractionDepth;
+uniform sampler2DArray waterMap;   // layer 0 reflection, 1 refraction
+uniform sampler2DArray waterDepth;
 uniform sampler2D normalMap;
 uniform sampler2D dudvMap;
 
 uniform sampler2D currdepthMap;
 uniform int isDeferred;
 
+//screen space reflections, deferred only
+uniform int uScreenSpaceReflection;
+uniform mat4 uProjectionMatrix;
+uniform sampler2D uDepthPyramid; // closest depth, a texel of level n covers 2^n pixels
+uniform int uDepthPyramidLevels;
+uniform sampler2D uSceneColor;  // copy of the main pass light result
+uniform int uPlanarFallback;
+uniform vec3 uSkyColor;
+
+//refraction read from the main pass instead of the refraction layer
+uniform int uSceneRefraction;
+uniform sampler2D uSceneDepth;
+
+#define SSR_MAX_STEPS 64
+#define SSR_MAX_DISTANCE 100.0
+#define SSR_THICKNESS 0.5
+
 in Data{
 	vec3 positionViewspace;
 	vec3 normalViewspace;
@@ -48,6 +66,23 @@ in Data{
 
 layout(location = 0) out vec4 oColor;
 
+//screen uv to the uv of a pooled target, clamped to the texels that were rendered
+vec2 TargetUV(vec2 screenUV, vec2 targetSize, vec2 scale)
+{
+	vec2 halfTexel = 0.5 / (targetSize * scale);
+	return clamp(screenUV, halfTexel, 1.0 - halfTexel) * scale;
+}
+
+vec3 ReflectionUV(vec2 screenUV)
+{
+	return vec3(TargetUV(screenUV, vec2(textureSize(waterMap, 0).xy), uReflectionScale), 0.0);
+}
+
+vec3 RefractionUV(vec2 screenUV)
+{
+	return vec3(TargetUV(screenUV, vec2(textureSize(waterMap, 0).xy), uRefractionScale), 1.0);
+}
+
 vec3 fresnelSchlick(float cosTheta, vec3 FO){
 	return FO + (1.0 - FO) * pow(1.0 - cosTheta, 5.0);
 }
@@ -60,6 +95,114 @@ vec3 reconstructPixelPosition(float depth){
 	return positionEyespace.xyz;
 }
 
+float ViewDepth(float depth)
+{
+	vec4 positionEyespace = projectionMatrixInv * vec4(0.0, 0.0, depth * 2.0 - 1.0, 1.0);
+	return positionEyespace.z / positionEyespace.w;
+}
+
+//pixels and depth, both change linearly along a ray there
+vec3 ViewToScreen(vec3 positionViewspace)
+{
+	vec4 positionClip = uProjectionMatrix * vec4(positionViewspace, 1.0);
+	vec3 positionNDC = positionClip.xyz / positionClip.w;
+	return vec3((positionNDC.xy * 0.5 + 0.5) * viewportSize, positionNDC.z * 0.5 + 0.5);
+}
+
+//marches the ray through the depth pyramid: it climbs a level every time it crosses a cell in
+//front of everything in it and goes back down where it reaches the closest depth of the cell
+bool TraceScreenSpaceRay(vec3 origin, vec3 direction, out vec2 hitPixel)
+{
+	//the end of the ray has to stay in front of the near plane to be projected
+	float rayLength = SSR_MAX_DISTANCE;
+	float nearPlane = uProjectionMatrix[3][2] / (uProjectionMatrix[2][2] - 1.0);
+	if (origin.z + direction.z * rayLength > -nearPlane)
+		rayLength = 0.99 * (-nearPlane - origin.z) / direction.z;
+
+	vec3 start = ViewToScreen(origin);
+	vec3 delta = ViewToScreen(origin + direction * rayLength) - start;
+
+	float pixelStep = 1.0 / max(max(abs(delta.x), abs(delta.y)), 1.0);
+	vec2 crossing = step(0.0, delta.xy);
+	vec2 safeDelta = vec2(abs(delta.x) < 1e-5 ? 1e-5 : delta.x, abs(delta.y) < 1e-5 ? 1e-5 : delta.y);
+
+	int level = 0;
+	float t = pixelStep; // one pixel off the water itself
+	for (int i = 0; i < SSR_MAX_STEPS && t <= 1.0; ++i)
+	{
+		vec3 p = start + delta * t;
+		if (any(lessThan(p.xy, vec2(0.0))) || any(greaterThanEqual(p.xy, viewportSize)) || p.z >= 1.0)
+			return false;
+
+		float cellSize = float(1 << level);
+		vec2 cell = floor(p.xy / cellSize);
+		float closest = texelFetch(uDepthPyramid, ivec2(cell), level).r;
+
+		vec2 tBoundary = ((cell + crossing) * cellSize - start.xy) / safeDelta;
+		float tExit = min(tBoundary.x, tBoundary.y) + pixelStep * 0.01;
+
+		float tSurface = p.z >= closest ? t : (delta.z > 0.0 ? t + (closest - p.z) / delta.z : 2.0);
+		if (tSurface < tExit)
+		{
+			if (level == 0)
+			{
+				//a hit, unless the ray passes far behind a thin surface
+				vec3 hit = start + delta * tSurface;
+				if (ViewDepth(closest) - ViewDepth(hit.z) < SSR_THICKNESS)
+				{
+					hitPixel = hit.xy;
+					return true;
+				}
+				t = tExit;
+				continue;
+			}
+			t = tSurface;
+			level--;
+		}
+		else
+		{
+			t = tExit;
+			level = min(level + 1, uDepthPyramidLevels - 1);
+		}
+	}
+	return false;
+}
+
+vec2 SceneUV(vec2 screenUV)
+{
+	return TargetUV(screenUV, vec2(textureSize(uSceneColor, 0)), uRenderTargetScale);
+}
+
+//the distorted lookup can land on something in front of the water, only what is below it is
+//refracted. Everything seen through the water plane is under it
+vec3 SceneRefraction(vec2 refractionTexCoord, vec2 texCoord, out float groundDepth)
+{
+	vec2 uv = refractionTexCoord;
+	groundDepth = texture(uSceneDepth, SceneUV(uv)).r;
+	if (groundDepth < gl_FragCoord.z)
+	{
+		uv = texCoord;
+		groundDepth = texture(uSceneDepth, SceneUV(uv)).r;
+	}
+	return texture(uSceneColor, SceneUV(uv)).rgb;
+}
+
+vec3 ScreenSpaceReflection(vec3 N, vec2 distorsion, vec2 reflectionTexCoord)
+{
+	vec3 fallback = uPlanarFallback == 1 ? texture(waterMap, ReflectionUV(reflectionTexCoord)).rgb : uSkyColor;
+
+	vec2 hitPixel;
+	vec3 R = reflect(normalize(FSIn.positionViewspace), N);
+	if (!TraceScreenSpaceRay(FSIn.positionViewspace, R, hitPixel))
+		return fallback;
+
+	//same waves as the planar reflection, faded out towards the borders where the rays start to miss
+	vec2 hitUV = hitPixel / viewportSize + distorsion;
+	vec2 border = smoothstep(0.0, 0.1, hitUV) * smoothstep(0.0, 0.1, 1.0 - hitUV);
+	ivec2 hitTexel = ivec2(clamp(hitUV, vec2(0.0), vec2(1.0)) * (viewportSize - 1.0));
+	return mix(fallback, texelFetch(uSceneColor, hitTexel, 0).rgb, border.x * border.y);
+}
+
 void main()
 {
 	vec3 N = normalize(FSIn.normalViewspace);
@@ -75,13 +218,24 @@ void main()
 
 	vec2 reflectionTexCoord = vec2(texCoord.s, 1.0 - texCoord.t) + distorsion;
 	vec2 refractionTexCoord = texCoord + distorsion;
-	vec3 reflectionColor = texture(reflectionMap,reflectionTexCoord).rgb;
-	vec3 refractionColor = texture(refractionMap,refractionTexCoord).rgb;
+	vec3 reflectionColor = uScreenSpaceReflection == 1 ? ScreenSpaceReflection(N, distorsion, reflectionTexCoord)
+	                                                   : texture(waterMap,ReflectionUV(reflectionTexCoord)).rgb;
+
+	vec3 refractionColor;
+	float distortedGroundDepth;
+	if (uSceneRefraction == 1)
+	{
+		refractionColor = SceneRefraction(refractionTexCoord, texCoord, distortedGroundDepth);
+	}
+	else
+	{
+		refractionColor = texture(waterMap,RefractionUV(refractionTexCoord)).rgb;
+		distortedGroundDepth = texture(waterDepth, RefractionUV(refractionTexCoord)).x;
+	}
 	
 	vec2 inverseRefrTexCoord = texCoord + distorsion*0.1;
-	vec3 inverserefractionColor = texture(reflectionMap,inverseRefrTexCoord).rgb;
+	vec3 inverserefractionColor = texture(waterMap,ReflectionUV(inverseRefrTexCoord)).rgb;
 
-	float distortedGroundDepth = texture(refractionDepth, refractionTexCoord).x;
 	vec3 distortedGroundPosViewspace = reconstructPixelPosition(distortedGroundDepth);
 	float distortedWaterDepth = FSIn.positionViewspace.z - distortedGroundPosViewspace.z;
 	float tintFactor = clamp(distortedWaterDepth / turbidityDistance, 0.0, 1.0);
@@ -96,7 +250,7 @@ void main()
 	if(isDeferred == 1)
 	{
 	vec2 UV = gl_FragCoord.xy/viewportSize;
-	float texDepth = texture(currdepthMap,UV).r;
+	float texDepth = texture(currdepthMap,TargetUV(UV, vec2(textureSize(currdepthMap, 0)), uRenderTargetScale)).r;
 
 	if(texDepth < gl_FragCoord.z)
 		oColor.a = 0.0;
@@ -4,41 +4,153 @@
 
 layout(location=0) in vec3 aPosition;
 layout(location=2) in vec2 aTexCoord;
+layout(location=5) in uint aDrawIdx;
 
+struct DrawData
+{
+	mat4 world;
+	mat4 worldViewProjection;
+	uint materialIdx;
+};
 
-uniform mat4 uWorldMatrix;
-uniform mat4 uWorldViewProjectionMatrix;
+layout(binding = 1, std430) readonly buffer Draws
+{
+	DrawData uDraws[];
+};
 
+out Data
+{
+	vec2 texCoord;
+	vec3 position;
+	flat uint drawIdx;
+} VSOut;
 
-out vec2 vTexCoord;
-out vec3 vPosition;
+//world space only, the geometry shader projects every triangle once per layer
+void main()
+{
+	mat4 uWorldMatrix = uDraws[aDrawIdx].world;
+	VSOut.drawIdx = aDrawIdx;
 
-uniform vec4 clippingPlane;
+	VSOut.texCoord = aTexCoord;
 
-void main()
+	VSOut.position = vec3( uWorldMatrix * vec4(aPosition,1.0));
+
+	gl_Position = vec4(VSOut.position, 1.0);
+}
+
+#elif defined(GEOMETRY) ///////////////////////////////////////////////
+
+//one invocation per layer: 0 reflection, 1 refraction
+layout(triangles, invocations = 2) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+in Data
 {
-	vTexCoord = aTexCoord;
+	vec2 texCoord;
+	vec3 position;
+	flat uint drawIdx;
+} GSIn[];
 
-	vPosition = vec3( uWorldMatrix * vec4(aPosition,1.0));
+out Data
+{
+	vec2 texCoord;
+	vec3 position;
+	flat uint drawIdx;
+} GSOut;
 
-	gl_ClipDistance[0] = dot(vec4(vPosition,1.0),clippingPlane);
+uniform mat4 uLayerViewProjection[2];
+uniform vec4 clippingPlane[2];
+uniform uint uLayerMask; // bit per layer, the ones nothing reads this frame are skipped
 
-	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition,1.0);
+void main()
+{
+	if ((uLayerMask & (1u << gl_InvocationID)) == 0u)
+		return;
+
+	for (int i = 0; i < 3; ++i)
+	{
+		GSOut.texCoord = GSIn[i].texCoord;
+		GSOut.position = GSIn[i].position;
+		GSOut.drawIdx = GSIn[i].drawIdx;
+
+		gl_Layer = gl_InvocationID;
+		gl_ViewportIndex = gl_InvocationID;
+		gl_ClipDistance[0] = dot(vec4(GSIn[i].position, 1.0), clippingPlane[gl_InvocationID]);
+		gl_Position = uLayerViewProjection[gl_InvocationID] * vec4(GSIn[i].position, 1.0);
+		EmitVertex();
+	}
+	EndPrimitive();
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
 
-in vec2 vTexCoord;
-in vec3 vPosition;
+in Data
+{
+	vec2 texCoord;
+	vec3 position;
+	flat uint drawIdx;
+} FSIn;
+
+struct MaterialData
+{
+	vec4 albedoSpecular;
+	float bumpStrength;
+	float normalsStrength;
+	uint features;
+	uint padding;
+	ivec2 albedoTexture;
+	ivec2 normalsTexture;
+	ivec2 bumpTexture;
+	ivec2 specularTexture;
+};
+
+struct DrawData
+{
+	mat4 world;
+	mat4 worldViewProjection;
+	uint materialIdx;
+};
+
+layout(binding = 1, std430) readonly buffer Draws
+{
+	DrawData uDraws[];
+};
+
+layout(binding = 0, std430) readonly buffer Materials
+{
+	MaterialData uMaterials[];
+};
 
-uniform sampler2D uTexture;
+uniform sampler2DArray uTextureBuckets[8];
+
+//x is the bucket, y the layer inside it
+//the bucket comes from the draw id of a multi-draw, so it isn't dynamically uniform:
+//every case indexes the sampler array with a constant, and the gradients are taken
+//before branching since the cases aren't in uniform control flow either
+vec4 SampleMaterialTexture(ivec2 location, vec2 uv)
+{
+	vec3 coords = vec3(uv, location.y);
+	vec2 dx = dFdx(uv);
+	vec2 dy = dFdy(uv);
+	switch (location.x)
+	{
+	case 0: return textureGrad(uTextureBuckets[0], coords, dx, dy);
+	case 1: return textureGrad(uTextureBuckets[1], coords, dx, dy);
+	case 2: return textureGrad(uTextureBuckets[2], coords, dx, dy);
+	case 3: return textureGrad(uTextureBuckets[3], coords, dx, dy);
+	case 4: return textureGrad(uTextureBuckets[4], coords, dx, dy);
+	case 5: return textureGrad(uTextureBuckets[5], coords, dx, dy);
+	case 6: return textureGrad(uTextureBuckets[6], coords, dx, dy);
+	default: return textureGrad(uTextureBuckets[7], coords, dx, dy);
+	}
+}
 
 layout(location = 0) out vec4 oColor;
 
 void main()
 {
 	oColor = vec4(0.0f);
-	oColor = texture(uTexture, vTexCoord);
+	oColor = SampleMaterialTexture(uMaterials[uDraws[FSIn.drawIdx].materialIdx].albedoTexture, FSIn.texCoord);
 }
 
 #endif